@@ -0,0 +1,418 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+
+/**
+ * @brief Parse a size such as `4096`, `16k` or `1m`.
+ *
+ * @param str Size as string
+ * @return word_t Size in bytes, 0 if malformed
+ */
+static word_t parse_size(const char *str)
+{
+    char *end;
+    unsigned long value = strtoul(str, &end, 10);
+    if (*end == 'k' || *end == 'K')
+        value <<= 10, end++;
+    else if (*end == 'm' || *end == 'M')
+        value <<= 20, end++;
+
+    return (end == str || *end != '\0') ? 0 : value;
+}
+
+static bool is_power_of_two(word_t n)
+{
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+/**
+ * @brief Configure one level from `SIZE:WAYS:LINE[:REPLACE[:WRITE]]` or `off`.
+ *
+ * @param c Level to configure
+ * @param fields Description of the level, modified while parsing
+ */
+static void parse_level(CACHE *c, char *fields)
+{
+    if (strcmp(fields, "off") == 0)
+    {
+        c->enabled = false;
+        return;
+    }
+
+    char *save;
+    char *size = strtok_r(fields, ":", &save);
+    char *ways = strtok_r(NULL, ":", &save);
+    char *line = strtok_r(NULL, ":", &save);
+    char *replace = strtok_r(NULL, ":", &save);
+    char *write = strtok_r(NULL, ":", &save);
+
+    if (size == NULL || ways == NULL || line == NULL)
+    {
+        fprintf(stderr, "ERROR: Cache %s needs SIZE:WAYS:LINE\n", c->name);
+        exit(EXIT_FAILURE);
+    }
+
+    c->enabled = true;
+    c->size = parse_size(size);
+    c->ways = parse_size(ways);
+    c->line_size = parse_size(line);
+
+    if (!is_power_of_two(c->size) || !is_power_of_two(c->ways) ||
+        !is_power_of_two(c->line_size) || c->line_size < 4 ||
+        c->ways * c->line_size > c->size)
+    {
+        fprintf(stderr, "ERROR: Invalid geometry for cache %s\n", c->name);
+        exit(EXIT_FAILURE);
+    }
+
+    if (replace == NULL || strcmp(replace, "lru") == 0)
+        c->replace = REPLACE_LRU;
+    else if (strcmp(replace, "fifo") == 0)
+        c->replace = REPLACE_FIFO;
+    else if (strcmp(replace, "random") == 0)
+        c->replace = REPLACE_RANDOM;
+    else
+    {
+        fprintf(stderr, "ERROR: Unknown replacement policy %s\n", replace);
+        exit(EXIT_FAILURE);
+    }
+
+    if (write == NULL || strcmp(write, "wb") == 0)
+        c->write = WRITE_BACK;
+    else if (strcmp(write, "wt") == 0)
+        c->write = WRITE_THROUGH;
+    else
+    {
+        fprintf(stderr, "ERROR: Unknown write policy %s\n", write);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Apply a comma-separated list of `LEVEL=...` settings, where LEVEL is
+ * `l1i`, `l1d` or `l2`.
+ *
+ * @param sim Cache simulator
+ * @param spec Settings
+ */
+static void parse_spec(CACHE_SIM *sim, const char *spec)
+{
+    char *copy = strdup(spec);
+    if (copy == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Cache\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char *save;
+    for (char *item = strtok_r(copy, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
+    {
+        char *fields = strchr(item, '=');
+        if (fields == NULL)
+        {
+            fprintf(stderr, "ERROR: Expected LEVEL=SIZE:WAYS:LINE, got %s\n", item);
+            exit(EXIT_FAILURE);
+        }
+        *fields++ = '\0';
+
+        if (strcmp(item, "l1i") == 0)
+            parse_level(&sim->l1i, fields);
+        else if (strcmp(item, "l1d") == 0)
+            parse_level(&sim->l1d, fields);
+        else if (strcmp(item, "l2") == 0)
+            parse_level(&sim->l2, fields);
+        else
+        {
+            fprintf(stderr, "ERROR: Unknown cache level %s\n", item);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    free(copy);
+}
+
+/**
+ * @brief Allocate the lines of a configured level.
+ *
+ * @param c Level
+ */
+static void init_lines(CACHE *c)
+{
+    if (!c->enabled)
+        return;
+
+    word_t n_lines = c->size / c->line_size;
+    c->set_mask = n_lines / c->ways - 1;
+    c->line_bits = __builtin_ctz(c->line_size);
+    c->lines = calloc(n_lines, sizeof(CACHE_LINE));
+    if (c->lines == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Cache %s\n", c->name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Initialise the cache hierarchy from the defaults, then `spec`.
+ *
+ * @param spec Settings as for `--cache=`, or NULL for the defaults
+ * @return CACHE_SIM*
+ */
+CACHE_SIM *init_CACHE_SIM(const char *spec)
+{
+    CACHE_SIM *sim = calloc(1, sizeof(CACHE_SIM));
+    if (sim == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Cache\n");
+        exit(EXIT_FAILURE);
+    }
+
+    sim->l1i.name = "L1I";
+    sim->l1d.name = "L1D";
+    sim->l2.name = "L2";
+    sim->l1i.latency = L1_LATENCY;
+    sim->l1d.latency = L1_LATENCY;
+    sim->l2.latency = L2_LATENCY;
+    sim->seed = 0x9e3779b97f4a7c15ULL;
+
+    parse_spec(sim, CACHE_DEFAULT_SPEC);
+    if (spec != NULL)
+        parse_spec(sim, spec);
+
+    init_lines(&sim->l1i);
+    init_lines(&sim->l1d);
+    init_lines(&sim->l2);
+
+    CACHE *l2 = sim->l2.enabled ? &sim->l2 : NULL;
+    sim->l1i.next = l2;
+    sim->l1d.next = l2;
+
+    return sim;
+}
+
+/**
+ * @brief Destroy the cache hierarchy.
+ *
+ * @param sim Cache simulator to be destroyed
+ */
+void free_CACHE_SIM(CACHE_SIM *sim)
+{
+    free(sim->l1i.lines);
+    free(sim->l1d.lines);
+    free(sim->l2.lines);
+    free(sim->pcs);
+    free(sim);
+    sim = NULL;
+}
+
+/**
+ * @brief Give every instruction of a program of `n` counters, keeping those
+ * already counted.
+ *
+ * @param sim Cache simulator
+ * @param n Number of instructions
+ */
+void cache_resize(CACHE_SIM *sim, int n)
+{
+    if (n <= sim->n_pcs)
+        return;
+
+    sim->pcs = realloc(sim->pcs, n * sizeof(CACHE_PC));
+    if (sim->pcs == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Cache\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(&sim->pcs[sim->n_pcs], 0, (n - sim->n_pcs) * sizeof(CACHE_PC));
+    sim->n_pcs = n;
+}
+
+/**
+ * @brief Pick the line of a full set to evict.
+ */
+static CACHE_LINE *victim(CACHE_SIM *sim, CACHE *c, CACHE_LINE *set)
+{
+    if (c->replace == REPLACE_RANDOM)
+    {
+        sim->seed ^= sim->seed << 13;
+        sim->seed ^= sim->seed >> 7;
+        sim->seed ^= sim->seed << 17;
+        return &set[sim->seed & (c->ways - 1)];
+    }
+
+    CACHE_LINE *oldest = &set[0];
+    for (word_t w = 1; w < c->ways; w++)
+        if (set[w].stamp < oldest->stamp)
+            oldest = &set[w];
+    return oldest;
+}
+
+/**
+ * @brief Simulate one access at a level and, on a miss, the levels below it.
+ * Write-backs and write-through stores are counted at the next level but are
+ * assumed to drain through a write buffer, so they add no latency.
+ *
+ * @param sim Cache simulator
+ * @param c Level, or NULL for main memory
+ * @param addr Guest address
+ * @param write Access is a store
+ * @return unsigned long long Cycles to complete the access
+ */
+static unsigned long long access_level(CACHE_SIM *sim, CACHE *c, word_t addr, bool write)
+{
+    if (c == NULL)
+        return MEMORY_LATENCY;
+
+    word_t block = addr >> c->line_bits;
+    CACHE_LINE *set = &c->lines[(block & c->set_mask) * c->ways];
+    c->accesses++;
+
+    CACHE_LINE *line = NULL;
+    for (word_t w = 0; w < c->ways && line == NULL; w++)
+        if (set[w].valid && set[w].block == block)
+            line = &set[w];
+
+    if (line != NULL)
+    {
+        c->mru = line;
+        c->hits++;
+        if (c->replace == REPLACE_LRU)
+            line->stamp = ++sim->tick;
+        if (write && c->write == WRITE_BACK)
+            line->dirty = true;
+        else if (write)
+            access_level(sim, c->next, addr, true);
+        return c->latency;
+    }
+
+    c->misses++;
+    if (write && c->write == WRITE_THROUGH)
+        return c->latency + access_level(sim, c->next, addr, true);
+
+    for (word_t w = 0; w < c->ways && line == NULL; w++)
+        if (!set[w].valid)
+            line = &set[w];
+    if (line == NULL)
+        line = victim(sim, c, set);
+
+    if (line->valid && line->dirty)
+    {
+        c->writebacks++;
+        access_level(sim, c->next, line->block << c->line_bits, true);
+    }
+
+    unsigned long long cycles = c->latency + access_level(sim, c->next, addr, false);
+    *line = (CACHE_LINE){ block, true, write, ++sim->tick };
+    c->mru = line;
+    return cycles;
+}
+
+/**
+ * @brief Simulate every queued access and empty the queue.
+ *
+ * @param sim Cache simulator
+ */
+void cache_flush(CACHE_SIM *sim)
+{
+    for (int i = 0; i < sim->n_trace; i++)
+    {
+        ACCESS *a = &sim->trace[i];
+        CACHE *c = a->kind == ACCESS_FETCH ? &sim->l1i : &sim->l1d;
+        if (!c->enabled)
+            c = c->next;
+
+        bool store = a->kind == ACCESS_STORE;
+        bool miss = false;
+        unsigned long long cycles;
+        CACHE_LINE *mru = c == NULL ? NULL : c->mru;
+
+        if (mru != NULL && mru->block == a->addr >> c->line_bits &&
+            !(store && c->write == WRITE_THROUGH))
+        {
+            // Hit in the line used last, the common case, without a set lookup
+            c->accesses++;
+            c->hits++;
+            if (c->replace == REPLACE_LRU)
+                mru->stamp = ++sim->tick;
+            mru->dirty |= store;
+            cycles = c->latency;
+        }
+        else
+        {
+            unsigned long long misses = c == NULL ? 0 : c->misses;
+            cycles = access_level(sim, c, a->addr, store);
+            miss = c == NULL || c->misses != misses;
+        }
+
+        sim->cycles += cycles;
+        if (a->pc < (word_t)sim->n_pcs)
+        {
+            CACHE_PC *p = &sim->pcs[a->pc];
+            p->accesses++;
+            p->misses += miss;
+            p->cycles += cycles;
+        }
+
+        // The rest of a fetch run hits the line just used
+        if (a->count > 1)
+        {
+            word_t more = a->count - 1;
+            c->accesses += more;
+            c->hits += more;
+            if (c->replace == REPLACE_LRU)
+                c->mru->stamp = ++sim->tick;
+            sim->cycles += (unsigned long long)more * c->latency;
+
+            for (word_t pc = a->pc + 1; pc < a->pc + a->count && pc < (word_t)sim->n_pcs; pc++)
+            {
+                sim->pcs[pc].accesses++;
+                sim->pcs[pc].cycles += c->latency;
+            }
+        }
+    }
+
+    sim->n_trace = 0;
+    sim->fetch_run = NULL;
+}
+
+static void print_level(CACHE *c)
+{
+    if (!c->enabled)
+        return;
+
+    printf("%-4s %10llu %10llu %10llu %7.2f%% %10llu\n",
+        c->name,
+        c->accesses,
+        c->hits,
+        c->misses,
+        c->accesses > 0 ? 100.0 * c->hits / c->accesses : 0.0,
+        c->writebacks);
+}
+
+/**
+ * @brief Print hit rates per level, the estimated memory cycles, and the
+ * instructions that missed in L1.
+ *
+ * @param sim Cache simulator
+ */
+void print_cache_stats(CACHE_SIM *sim)
+{
+    cache_flush(sim);
+
+    printf("Cache\n");
+    printf("%-4s %10s %10s %10s %8s %10s\n", "", "Accesses", "Hits", "Misses", "Hit rate", "Writebacks");
+    print_level(&sim->l1i);
+    print_level(&sim->l1d);
+    print_level(&sim->l2);
+    printf("Estimated cycles = %llu\n", sim->cycles);
+
+    printf("%4s %10s %10s %10s\n", "PC", "Accesses", "L1 misses", "Cycles");
+    for (int i = 0; i < sim->n_pcs; i++)
+    {
+        CACHE_PC *p = &sim->pcs[i];
+        if (p->misses > 0)
+            printf("%4d %10llu %10llu %10llu\n", i, p->accesses, p->misses, p->cycles);
+    }
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "hardware.h"
+
+/**
+ * Accesses are queued and simulated in batches of this many.
+ */
+#define CACHE_BATCH 4096
+
+/**
+ * Latency in cycles of a hit at each level, and of main memory.
+ */
+#define L1_LATENCY 1
+#define L2_LATENCY 10
+#define MEMORY_LATENCY 100
+
+/**
+ * Default geometry, overridden by `--cache=SPEC`.
+ */
+#define CACHE_DEFAULT_SPEC "l1i=16k:2:32:lru,l1d=16k:4:32:lru:wb,l2=256k:8:64:lru:wb"
+
+typedef enum replace_t
+{
+    REPLACE_LRU,
+    REPLACE_FIFO,
+    REPLACE_RANDOM,
+} replace_t;
+
+typedef enum write_policy_t
+{
+    WRITE_BACK,    // Write-allocate, dirty lines written back on eviction
+    WRITE_THROUGH, // No write-allocate, every store goes to the next level
+} write_policy_t;
+
+typedef enum access_t
+{
+    ACCESS_FETCH,
+    ACCESS_LOAD,
+    ACCESS_STORE,
+} access_t;
+
+/**
+ * @struct CACHE_LINE
+ * @brief One line of a set. `stamp` orders lines for LRU and FIFO.
+ */
+typedef struct CACHE_LINE
+{
+    word_t block;             // Address divided by the line size
+    bool valid;               // Holds a block
+    bool dirty;               // Modified since it was filled
+    unsigned long long stamp; // Last use (LRU) or fill (FIFO)
+} CACHE_LINE;
+
+/**
+ * @struct CACHE
+ * @brief One level of the hierarchy and its counters.
+ */
+typedef struct CACHE
+{
+    const char *name;     // Name in the report
+    bool enabled;         // False when the level is switched off
+    word_t size;          // Capacity in bytes
+    word_t ways;          // Associativity
+    word_t line_size;     // Bytes per line
+    replace_t replace;    // Replacement policy
+    write_policy_t write; // Write policy
+    int latency;          // Cycles for a hit
+    int line_bits;        // log2 of `line_size`
+    word_t set_mask;      // Number of sets - 1
+    CACHE_LINE *lines;    // `ways` lines per set
+    CACHE_LINE *mru;      // Line of the last hit or fill
+    struct CACHE *next;   // Next level, NULL for main memory
+    unsigned long long accesses;
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long writebacks;
+} CACHE;
+
+/**
+ * @struct ACCESS
+ * @brief One queued memory access.
+ */
+typedef struct ACCESS
+{
+    word_t addr;   // Guest address
+    word_t pc;     // Instruction making the access
+    access_t kind; // Fetch, load or store
+    word_t count;  // Fetches of `pc` onwards in the same line, 1 otherwise
+} ACCESS;
+
+/**
+ * @struct CACHE_PC
+ * @brief Counters for one instruction.
+ */
+typedef struct CACHE_PC
+{
+    unsigned long long accesses;
+    unsigned long long misses; // L1 misses
+    unsigned long long cycles;
+} CACHE_PC;
+
+/**
+ * @struct CACHE_SIM
+ * @brief The cache hierarchy with its queue of pending accesses.
+ */
+typedef struct CACHE_SIM
+{
+    CACHE l1i;                   // L1 instruction cache
+    CACHE l1d;                   // L1 data cache
+    CACHE l2;                    // Unified L2
+    ACCESS trace[CACHE_BATCH];   // Accesses not simulated yet
+    int n_trace;                 // Number of entries in `trace`
+    ACCESS *fetch_run;           // Last fetch in `trace`, NULL if it cannot grow
+    unsigned long long tick;     // Clock for replacement stamps
+    unsigned long long seed;     // State for random replacement
+    unsigned long long cycles;   // Estimated cycles spent on memory accesses
+    CACHE_PC *pcs;               // Counters per instruction
+    int n_pcs;                   // Length of `pcs`
+} CACHE_SIM;
+
+CACHE_SIM *init_CACHE_SIM(const char *spec);
+void free_CACHE_SIM(CACHE_SIM *sim);
+void cache_resize(CACHE_SIM *sim, int n);
+void cache_flush(CACHE_SIM *sim);
+void print_cache_stats(CACHE_SIM *sim);
+
+/**
+ * @brief Queue an access, simulating the queue first if it is full.
+ *
+ * @param sim Cache simulator
+ * @param pc Instruction making the access
+ * @param addr Guest address
+ * @param kind Fetch, load or store
+ */
+static inline void cache_record(CACHE_SIM *sim, word_t pc, word_t addr, access_t kind)
+{
+    if (sim->n_trace == CACHE_BATCH)
+        cache_flush(sim);
+    sim->trace[sim->n_trace++] = (ACCESS){ addr, pc, kind, 1 };
+}
+
+/**
+ * @brief Queue an instruction fetch. A fetch that follows the previous one in
+ * the same L1I line is certain to hit, so it only extends that fetch's run.
+ *
+ * @param sim Cache simulator
+ * @param pc Instruction being fetched
+ */
+static inline void cache_fetch(CACHE_SIM *sim, word_t pc)
+{
+    ACCESS *run = sim->fetch_run;
+    if (run != NULL && run->pc + run->count == pc &&
+        (pc * 4) >> sim->l1i.line_bits == run->addr >> sim->l1i.line_bits)
+    {
+        run->count++;
+        return;
+    }
+
+    cache_record(sim, pc, pc * 4, ACCESS_FETCH);
+    if (sim->l1i.enabled)
+        sim->fetch_run = &sim->trace[sim->n_trace - 1];
+}
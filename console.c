@@ -0,0 +1,123 @@
+#include <stdio.h>
+
+#include "console.h"
+#include "io.h"
+#include "memory.h"
+
+/**
+ * @brief Write the transmit ring out from the host's tail up to the guest's
+ * head, a page span per `fwrite`. A guest that has lapped the host has
+ * overwritten all but the last ring's worth, which is what gets written.
+ *
+ * @param mem Guest memory
+ * @param io Guest I/O
+ * @param head Guest's head of the transmit ring
+ */
+static void drain(MEMORY *mem, IO *io, word_t head)
+{
+    CONSOLE *con = &io->console;
+    if (head - con->tx_tail > CONSOLE_RING_SIZE)
+        con->tx_tail = head - CONSOLE_RING_SIZE;
+
+    while (con->tx_tail != head)
+    {
+        byte_t *span;
+        word_t at = con->tx_tail & (CONSOLE_RING_SIZE - 1);
+        size_t len = mem_span(mem, CONSOLE_TX_RING + at, head - con->tx_tail, false, &span);
+        fwrite(span, 1, len, io->out);
+        con->tx_tail += len;
+    }
+}
+
+/**
+ * @brief Refill the receive ring once the guest has emptied it, with as much
+ * guest stdin as is buffered, up to the end of the ring. Waits for input only
+ * when none is buffered.
+ *
+ * @param mem Guest memory
+ * @param io Guest I/O
+ */
+static void fill(MEMORY *mem, IO *io)
+{
+    CONSOLE *con = &io->console;
+    if (con->rx_head != con->rx_tail || con->rx_eof)
+        return;
+
+    const char *data;
+    word_t at = con->rx_head & (CONSOLE_RING_SIZE - 1);
+    size_t n = io_take(io, CONSOLE_RING_SIZE - at, &data);
+    if (n == 0)
+    {
+        con->rx_eof = true;
+        return;
+    }
+
+    mem_write(mem, CONSOLE_RX_RING + at, data, n);
+    con->rx_head += n;
+}
+
+/**
+ * @brief Load a console register. Registers are meant to be loaded as words;
+ * offsets that are not a register read as 0.
+ */
+static word_t console_read(MEMORY *mem, void *ctx, word_t offset, int size)
+{
+    IO *io = ctx;
+    CONSOLE *con = &io->console;
+
+    switch (offset)
+    {
+    case CONSOLE_TX_HEAD:
+        return con->tx_tail;
+    case CONSOLE_RX_HEAD:
+        fill(mem, io);
+        return con->rx_head;
+    case CONSOLE_RX_TAIL:
+        return con->rx_tail;
+    case CONSOLE_STATUS:
+        return con->rx_eof ? CONSOLE_RX_EOF : 0;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Store to a console register. Stores to anything but the transmit
+ * doorbell and the receive tail are ignored.
+ */
+static void console_write(MEMORY *mem, void *ctx, word_t offset, word_t value, int size)
+{
+    IO *io = ctx;
+
+    switch (offset)
+    {
+    case CONSOLE_TX_HEAD:
+        drain(mem, io, value);
+        break;
+    case CONSOLE_RX_TAIL:
+        io->console.rx_tail = value;
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Map the console into guest memory, on guest I/O's streams. The guest
+ * writes a whole string into the transmit ring with ordinary stores and rings
+ * the doorbell once, and the host writes it out in bulk; input arrives in the
+ * receive ring the same way. Harts on host threads sharing the console must
+ * take turns at it, as with any ring.
+ *
+ * @param mem Guest memory
+ * @param io Guest I/O
+ * @return true if mapped, false if guest memory already uses its pages
+ */
+bool console_attach(MEMORY *mem, IO *io)
+{
+    if (!mem_add_handler(mem, CONSOLE_BASE, PAGE_SIZE, console_read, console_write, io))
+        return false;
+
+    io->console.attached = true;
+    return true;
+}
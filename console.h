@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "hardware.h"
+#include "io.h"
+
+/**
+ * The memory-mapped console, in the MMIO area SPIM uses. Its register page is
+ * handled by the device; the two rings after it are ordinary guest RAM that
+ * the guest fills or empties with plain stores and loads.
+ */
+#define CONSOLE_BASE 0xFFFF0000
+#define CONSOLE_TX_RING (CONSOLE_BASE + PAGE_SIZE)
+#define CONSOLE_RX_RING (CONSOLE_BASE + 2 * PAGE_SIZE)
+#define CONSOLE_RING_SIZE PAGE_SIZE
+
+/**
+ * Console registers, as offsets into its register page. Ring positions are
+ * free-running byte counts, taken modulo `CONSOLE_RING_SIZE` to index a ring.
+ *
+ * TX_HEAD is the transmit doorbell: storing the guest's head there writes
+ * the ring out up to it, and loading it gives how far the host has written.
+ * Loading RX_HEAD gives how far the host has filled the receive ring,
+ * refilling it from guest stdin first when the guest has emptied it. The
+ * guest stores how far it has read to RX_TAIL.
+ */
+#define CONSOLE_TX_HEAD 0x0
+#define CONSOLE_RX_HEAD 0x4
+#define CONSOLE_RX_TAIL 0x8
+#define CONSOLE_STATUS 0xC
+
+/**
+ * Bits of the STATUS register.
+ */
+#define CONSOLE_RX_EOF 0x1
+
+bool console_attach(MEMORY *mem, IO *io);
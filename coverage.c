@@ -0,0 +1,304 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "coverage.h"
+#include "decode.h"
+#include "disasm.h"
+#include "opcode.h"
+
+/**
+ * @brief Initialise coverage with no instruction executed.
+ *
+ * @return COVERAGE*
+ */
+COVERAGE *init_COVERAGE(void)
+{
+    COVERAGE *cov = calloc(1, sizeof(COVERAGE));
+    if (cov == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Coverage\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return cov;
+}
+
+/**
+ * @brief Destroy coverage.
+ *
+ * @param cov Coverage to be destroyed
+ */
+void free_COVERAGE(COVERAGE *cov)
+{
+    free(cov->executed);
+    free(cov);
+    cov = NULL;
+}
+
+/**
+ * @brief Give every instruction of a program of `n` its bits, keeping those
+ * already set.
+ *
+ * @param cov Coverage
+ * @param n Number of instructions
+ */
+void coverage_resize(COVERAGE *cov, int n)
+{
+    uint32_t words = COVERAGE_WORDS_FOR(n);
+    if (words <= cov->words)
+        return;
+
+    uint64_t *bits = calloc(3 * (size_t)words, sizeof(uint64_t));
+    if (bits == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Coverage\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (cov->words > 0)
+    {
+        memcpy(bits, cov->executed, cov->words * sizeof(uint64_t));
+        memcpy(bits + words, cov->taken, cov->words * sizeof(uint64_t));
+        memcpy(bits + 2 * words, cov->fallthrough, cov->words * sizeof(uint64_t));
+    }
+    free(cov->executed);
+
+    cov->executed = bits;
+    cov->taken = bits + words;
+    cov->fallthrough = bits + 2 * words;
+    cov->words = words;
+}
+
+/**
+ * @brief Size of the coverage file of a program of `n` instructions.
+ */
+static size_t file_size(uint32_t n)
+{
+    return sizeof(COVERAGE_HEADER) + 3 * COVERAGE_WORDS_FOR(n) * sizeof(uint64_t) +
+           ((n * sizeof(uint32_t) + 7) & ~(size_t)7);
+}
+
+/**
+ * @brief Write coverage to a file, with the loaded program.
+ *
+ * @param cov Coverage
+ * @param cpu CPU the program is loaded in
+ * @param file Name of the file, replaced if it exists
+ * @return true if written
+ */
+bool coverage_save(COVERAGE *cov, CPU *cpu, const char *file)
+{
+    FILE *f = fopen(file, "wb");
+    if (f == NULL)
+        return false;
+
+    uint32_t n = cpu->n_instr;
+    COVERAGE_HEADER h = {
+        .n = n,
+        .words = COVERAGE_WORDS_FOR(n),
+        .text_base = cpu->text_base,
+        .runs = 1,
+    };
+    memcpy(h.magic, COVERAGE_MAGIC, COVERAGE_MAGIC_LEN);
+
+    uint64_t pad = 0;
+    size_t text = n * sizeof(uint32_t);
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+              fwrite(cov->executed, sizeof(uint64_t), h.words, f) == h.words &&
+              fwrite(cov->taken, sizeof(uint64_t), h.words, f) == h.words &&
+              fwrite(cov->fallthrough, sizeof(uint64_t), h.words, f) == h.words &&
+              fwrite(cpu->text, 1, text, f) == text &&
+              fwrite(&pad, 1, -text & 7, f) == (-text & 7);
+    return fclose(f) == 0 && ok;
+}
+
+/**
+ * @brief Map a coverage file read-only and check its layout.
+ *
+ * @param file Name of the file
+ * @param size Set to the length of the file
+ * @return const COVERAGE_HEADER*
+ */
+static const COVERAGE_HEADER *map_file(const char *file, size_t *size)
+{
+    int fd = open(file, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        fprintf(stderr, "ERROR: Failed to open %s\n", file);
+        exit(EXIT_FAILURE);
+    }
+
+    const COVERAGE_HEADER *h = MAP_FAILED;
+    if ((size_t)st.st_size >= sizeof(COVERAGE_HEADER))
+        h = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (h == MAP_FAILED || memcmp(h->magic, COVERAGE_MAGIC, COVERAGE_MAGIC_LEN) != 0 ||
+        h->n > MAX_INSTR || h->words != COVERAGE_WORDS_FOR(h->n) || file_size(h->n) != (size_t)st.st_size)
+    {
+        fprintf(stderr, "ERROR: %s is not a coverage file\n", file);
+        exit(EXIT_FAILURE);
+    }
+
+    *size = st.st_size;
+    return h;
+}
+
+/**
+ * @brief Check whether an instruction is a conditional branch, the only kind
+ * with two ways to go.
+ */
+static bool is_branch(int code)
+{
+    if (is_I_FORMAT(code))
+    {
+        int op = extract_I_FORMAT(code).op;
+        return op == BEQ || op == BNE || op == BGEZ || op == BGTZ || op == BLEZ;
+    }
+    return is_F_FORMAT(code) && extract_F_FORMAT(code).fmt == BC;
+}
+
+static bool test_bit(const uint64_t *map, unsigned int i)
+{
+    return (map[i >> 6] >> (i & 63)) & 1;
+}
+
+static double rate(unsigned int part, unsigned int whole)
+{
+    return whole == 0 ? 0.0 : 100.0 * part / whole;
+}
+
+/**
+ * @brief Print how much of a program was covered, then each instruction never
+ * executed and each branch that only ever went one way, as Assembly.
+ *
+ * @param cpu CPU to decode the program with
+ * @param h Header of the coverage
+ * @param bits The three bitmaps, `h->words` words each
+ * @param text Encoded instructions
+ */
+static void report(CPU *cpu, const COVERAGE_HEADER *h, const uint64_t *bits, const uint32_t *text)
+{
+    const uint64_t *executed = bits;
+    const uint64_t *taken = bits + h->words;
+    const uint64_t *fallthrough = bits + 2 * h->words;
+
+    unsigned int covered = 0;
+    unsigned int branches = 0;
+    unsigned int directions = 0;
+    for (unsigned int i = 0; i < h->n; i++)
+    {
+        covered += test_bit(executed, i);
+        if (is_branch(text[i]))
+        {
+            branches++;
+            directions += test_bit(taken, i) + test_bit(fallthrough, i);
+        }
+    }
+
+    printf("Coverage (%u run%s)\n", h->runs, h->runs == 1 ? "" : "s");
+    printf("Instructions = %u/%u (%.2f%%)\n", covered, h->n, rate(covered, h->n));
+    printf("Branches     = %u/%u directions (%.2f%%)\n", directions, 2 * branches, rate(directions, 2 * branches));
+
+    for (unsigned int i = 0; i < h->n; i++)
+    {
+        const char *note;
+        if (!test_bit(executed, i))
+            note = "not executed";
+        else if (!is_branch(text[i]))
+            continue;
+        else if (!test_bit(taken, i))
+            note = "never taken";
+        else if (!test_bit(fallthrough, i))
+            note = "always taken";
+        else
+            continue;
+
+        DECODED d;
+        char line[DISASM_LINE + 1];
+        decode_instruction(cpu, &d, text[i]);
+        line[disasm_instruction(line, &d)] = '\0';
+        printf("%4u: %-28s %s\n", i, line, note);
+    }
+}
+
+/**
+ * @brief Print the coverage of the program loaded in a CPU.
+ *
+ * @param cov Coverage
+ * @param cpu CPU the program is loaded in
+ */
+void print_coverage_stats(COVERAGE *cov, CPU *cpu)
+{
+    COVERAGE_HEADER h = {
+        .n = cpu->n_instr,
+        .words = cov->words,
+        .runs = 1,
+    };
+
+    // The bitmaps of `COVERAGE` follow one another, as in a file
+    report(cpu, &h, cov->executed, (const uint32_t *)cpu->text);
+}
+
+/**
+ * @brief Merge coverage files of one program, from any number of runs, by
+ * OR-ing their bitmaps, then write the result out and report on it. Inputs
+ * are mapped rather than read, and the merge is a single pass of 64-bit ORs
+ * the compiler can vectorise. The output may also be one of the inputs.
+ *
+ * @param cpu CPU to decode the program with
+ * @param out Name of the merged file
+ * @param files Names of the files to merge
+ * @param n Number of files, at least 1
+ */
+void coverage_merge(CPU *cpu, const char *out, char **files, int n)
+{
+    size_t size;
+    const COVERAGE_HEADER *first = map_file(files[0], &size);
+    COVERAGE_HEADER *merged = malloc(size);
+    if (merged == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Coverage\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(merged, first, size);
+    munmap((void *)first, size);
+
+    size_t words = 3 * (size_t)merged->words;
+    uint64_t *bits = (uint64_t *)(merged + 1);
+    const uint32_t *text = (const uint32_t *)(bits + words);
+
+    for (int k = 1; k < n; k++)
+    {
+        size_t len;
+        const COVERAGE_HEADER *h = map_file(files[k], &len);
+        const uint64_t *in = (const uint64_t *)(h + 1);
+        if (len != size || h->text_base != merged->text_base ||
+            memcmp(in + words, text, merged->n * sizeof(uint32_t)) != 0)
+        {
+            fprintf(stderr, "ERROR: %s covers a different program than %s\n", files[k], files[0]);
+            exit(EXIT_FAILURE);
+        }
+
+        for (size_t i = 0; i < words; i++)
+            bits[i] |= in[i];
+        merged->runs += h->runs;
+        munmap((void *)h, len);
+    }
+
+    FILE *f = fopen(out, "wb");
+    if (f == NULL || fwrite(merged, 1, size, f) != size || fclose(f) != 0)
+    {
+        fprintf(stderr, "ERROR: Failed to write %s\n", out);
+        exit(EXIT_FAILURE);
+    }
+
+    report(cpu, merged, bits, text);
+    free(merged);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hardware.h"
+
+/**
+ * Coverage files start with these bytes, without a NUL.
+ */
+#define COVERAGE_MAGIC "SMIPSCOV"
+#define COVERAGE_MAGIC_LEN 8
+
+/**
+ * 64-bit words in a bitmap of one bit per instruction of a text segment of
+ * `n` instructions.
+ */
+#define COVERAGE_WORDS_FOR(n) (((n) + 63) / 64)
+
+/**
+ * @struct COVERAGE_HEADER
+ * @brief Start of a coverage file. Three bitmaps of `words` 64-bit words
+ * follow, in the order of `COVERAGE`, then the program's encoded instructions
+ * padded to 8 bytes, so a file can be reported on without the program and is
+ * only merged with files of the same program. The bitmaps are contiguous and
+ * 8-byte aligned, so merging mapped files is one OR over their words.
+ */
+typedef struct COVERAGE_HEADER
+{
+    char magic[COVERAGE_MAGIC_LEN]; // `COVERAGE_MAGIC`
+    uint32_t n;                     // Instructions in the text segment
+    uint32_t words;                 // 64-bit words per bitmap
+    uint32_t text_base;             // Guest address of the first instruction
+    uint32_t runs;                  // Runs merged into the file
+} COVERAGE_HEADER;
+
+/**
+ * @struct COVERAGE
+ * @brief One bit per instruction for each of: executed, went anywhere but the
+ * next instruction (a branch taken), and went on to the next instruction (a
+ * branch not taken). The bitmaps follow one another in one allocation sized
+ * to the loaded program. Harts share one, so bits are set atomically.
+ */
+typedef struct COVERAGE
+{
+    uint64_t *executed;    // Instructions executed
+    uint64_t *taken;       // Instructions followed by a jump
+    uint64_t *fallthrough; // Instructions followed by the next
+    uint32_t words;        // 64-bit words per bitmap
+} COVERAGE;
+
+COVERAGE *init_COVERAGE(void);
+void free_COVERAGE(COVERAGE *cov);
+void coverage_resize(COVERAGE *cov, int n);
+bool coverage_save(COVERAGE *cov, CPU *cpu, const char *file);
+void coverage_merge(CPU *cpu, const char *out, char **files, int n);
+void print_coverage_stats(COVERAGE *cov, CPU *cpu);
+
+/**
+ * @brief Set a bit, skipping the atomic update once it is set.
+ */
+static inline void coverage_set(uint64_t *map, unsigned int i)
+{
+    uint64_t bit = 1ULL << (i & 63);
+    if ((__atomic_load_n(&map[i >> 6], __ATOMIC_RELAXED) & bit) == 0)
+        __atomic_fetch_or(&map[i >> 6], bit, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Record the instruction at `pc` executed, and where control went: the
+ * PC after executing it is `pc` unless it jumped.
+ *
+ * @param cov Coverage
+ * @param pc Index of the instruction executed
+ * @param next PC after executing it
+ */
+static inline void coverage_record(COVERAGE *cov, unsigned int pc, unsigned int next)
+{
+    coverage_set(cov->executed, pc);
+    coverage_set(next != pc ? cov->taken : cov->fallthrough, pc);
+}
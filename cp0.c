@@ -0,0 +1,201 @@
+#include <string.h>
+
+#include "cp0.h"
+
+/**
+ * @brief Put CP0 in its reset state: interrupts disabled, Count and Compare
+ * zero and the exception vector at `EBASE_RESET + VECTOR_OFFSET`.
+ *
+ * @param cp0 CP0
+ */
+void cp0_reset(CP0 *cp0)
+{
+    memset(cp0, 0, sizeof(CP0));
+    cp0->ebase = EBASE_RESET;
+}
+
+/**
+ * @brief Read a CP0 register (`mfc0`). Registers that are not modelled read as
+ * zero.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param reg Register number
+ * @param sel Select
+ * @return word_t
+ */
+word_t cp0_read(CPU *cpu, int reg, int sel)
+{
+    CP0 *cp0 = cpu->cp0;
+    switch (sel == 0 ? reg : -1)
+    {
+    case CP0_BADVADDR:
+        return cp0->badvaddr;
+    case CP0_COUNT:
+        return cp0->count;
+    case CP0_COMPARE:
+        return cp0->compare;
+    case CP0_STATUS:
+        return cp0->status;
+    case CP0_CAUSE:
+        return cp0->cause;
+    case CP0_EPC:
+        return cp0->epc;
+    default:
+        return reg == CP0_EBASE && sel == CP0_EBASE_SEL ? cp0->ebase : 0;
+    }
+}
+
+/**
+ * @brief Write a CP0 register (`mtc0`). Only the fields software may change are
+ * written, and writing Compare acknowledges the timer interrupt. Unlike
+ * MIPS32, every bit of EBase above the page offset is writable, so programs
+ * loaded at address 0 can put their handler at 0x180.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param reg Register number
+ * @param sel Select
+ * @param value Value to write
+ */
+void cp0_write(CPU *cpu, int reg, int sel, word_t value)
+{
+    CP0 *cp0 = cpu->cp0;
+    switch (sel == 0 ? reg : -1)
+    {
+    case CP0_COUNT:
+        cp0->count = value;
+        break;
+    case CP0_COMPARE:
+        cp0->compare = value;
+        cp0->cause &= ~(CAUSE_TI | CAUSE_IP7);
+        break;
+    case CP0_STATUS:
+        cp0->status = (cp0->status & ~STATUS_WRITABLE) | (value & STATUS_WRITABLE);
+        break;
+    case CP0_CAUSE:
+        cp0->cause = (cp0->cause & ~CAUSE_SW) | (value & CAUSE_SW);
+        break;
+    case CP0_EPC:
+        cp0->epc = value;
+        break;
+    default:
+        if (reg == CP0_EBASE && sel == CP0_EBASE_SEL)
+            cp0->ebase = value & EBASE_MASK;
+        break;
+    }
+}
+
+/**
+ * @brief Enter the exception handler at `EBase + 0x180`, unless no handler is
+ * loaded there. EPC keeps the address of the first exception while EXL is set.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param code Exception code
+ * @param index Instruction to return to
+ * @return true if the CPU now runs the handler
+ */
+static bool vector(CPU *cpu, exc_t code, unsigned int index)
+{
+    CP0 *cp0 = cpu->cp0;
+    unsigned int handler = text_index(cpu, cp0->ebase + VECTOR_OFFSET);
+    if (handler >= (unsigned int)cpu->n_instr)
+        return false;
+
+    if (!(cp0->status & STATUS_EXL))
+        cp0->epc = text_address(cpu, index);
+    cp0->cause = (cp0->cause & ~CAUSE_EXC) | (code << CAUSE_EXC_SHIFT);
+    cp0->status |= STATUS_EXL;
+    cpu->pc = handler;
+    return true;
+}
+
+/**
+ * @brief Raise an exception in the instruction at the PC. Without a handler
+ * the caller keeps the behaviour smips has for the error otherwise.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param code Exception code
+ * @return true if the exception was taken
+ */
+bool cp0_exception(CPU *cpu, exc_t code)
+{
+    if (!vector(cpu, code, cpu->pc))
+        return false;
+
+    // The engine moves on to the next instruction after this returns
+    cpu->pc--;
+    return true;
+}
+
+/**
+ * @brief Raise an address error for a misaligned access, setting BadVAddr.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param code `EXC_ADEL` or `EXC_ADES`
+ * @param addr Address accessed
+ * @return true if the exception was taken
+ */
+bool cp0_address_error(CPU *cpu, exc_t code, word_t addr)
+{
+    if (!cp0_exception(cpu, code))
+        return false;
+
+    cpu->cp0->badvaddr = addr;
+    return true;
+}
+
+/**
+ * @brief Return from an exception (`eret`) to EPC, dropping any `ll`
+ * reservation.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ */
+void cp0_eret(CPU *cpu)
+{
+    CP0 *cp0 = cpu->cp0;
+    cp0->status &= ~STATUS_EXL;
+    cpu->ll_valid = false;
+    cpu->pc = text_index(cpu, cp0->epc) - 1;
+}
+
+/**
+ * @brief Get the number of records until Count reaches Compare.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @return uint64_t Between 1 and 2^32
+ */
+uint64_t cp0_until(CPU *cpu)
+{
+    word_t until = cpu->cp0->compare - cpu->cp0->count;
+    return until == 0 ? UINT64_C(1) << 32 : until;
+}
+
+/**
+ * @brief Advance Count by the records executed, raising the timer interrupt
+ * if it reached Compare.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param records Records executed
+ */
+void cp0_tick(CPU *cpu, uint64_t records)
+{
+    CP0 *cp0 = cpu->cp0;
+    if (records >= cp0_until(cpu))
+        cp0->cause |= CAUSE_TI | CAUSE_IP7;
+    cp0->count += records;
+}
+
+/**
+ * @brief Take a pending interrupt before the instruction at the PC, if
+ * interrupts are enabled and a handler is loaded.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ */
+void cp0_interrupt(CPU *cpu)
+{
+    CP0 *cp0 = cpu->cp0;
+    if ((cp0->status & (STATUS_IE | STATUS_EXL)) != STATUS_IE ||
+        (cp0->status & cp0->cause & CAUSE_IP) == 0 || cpu->pc >= (unsigned int)cpu->n_instr)
+        return;
+
+    vector(cpu, EXC_INT, cpu->pc);
+}
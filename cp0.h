@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hardware.h"
+
+/**
+ * CP0 register numbers, with the select EBase needs.
+ */
+#define CP0_BADVADDR 8
+#define CP0_COUNT 9
+#define CP0_COMPARE 11
+#define CP0_STATUS 12
+#define CP0_CAUSE 13
+#define CP0_EPC 14
+#define CP0_EBASE 15
+#define CP0_EBASE_SEL 1
+
+/**
+ * Status fields: interrupts are taken while IE is set and EXL is clear, for
+ * the lines IM enables.
+ */
+#define STATUS_IE 0x00000001
+#define STATUS_EXL 0x00000002
+#define STATUS_IM 0x0000FF00
+#define STATUS_WRITABLE (STATUS_IM | STATUS_EXL | STATUS_IE)
+
+/**
+ * Cause fields. IP7 is the timer line and IP0/IP1 the software interrupts,
+ * which are all software can write.
+ */
+#define CAUSE_TI 0x40000000
+#define CAUSE_IP 0x0000FF00
+#define CAUSE_IP7 0x00008000
+#define CAUSE_SW 0x00000300
+#define CAUSE_EXC_SHIFT 2
+#define CAUSE_EXC 0x0000007C
+
+/**
+ * EBase at reset, and the offset of the general exception vector from it.
+ */
+#define EBASE_RESET 0x80000000
+#define EBASE_MASK 0xFFFFF000
+#define VECTOR_OFFSET 0x180
+
+/**
+ * @enum exc_t
+ * @brief Exception codes written to Cause.ExcCode.
+ */
+typedef enum exc_t
+{
+    EXC_INT = 0,  // Interrupt
+    EXC_ADEL = 4, // Address error on a load
+    EXC_ADES = 5, // Address error on a store
+    EXC_SYS = 8,  // Unknown syscall
+    EXC_BP = 9,   // Breakpoint
+    EXC_RI = 10,  // Reserved instruction
+} exc_t;
+
+void cp0_reset(CP0 *cp0);
+word_t cp0_read(CPU *cpu, int reg, int sel);
+void cp0_write(CPU *cpu, int reg, int sel, word_t value);
+bool cp0_exception(CPU *cpu, exc_t code);
+bool cp0_address_error(CPU *cpu, exc_t code, word_t addr);
+void cp0_eret(CPU *cpu);
+uint64_t cp0_until(CPU *cpu);
+void cp0_tick(CPU *cpu, uint64_t records);
+void cp0_interrupt(CPU *cpu);
+
+/**
+ * @brief Have a record run outside the slice in progress, if there is one: it
+ * ends the slice, and `hart_run` runs it again once Count has caught up. CP0
+ * instructions yield so that they see and change exact timer state.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @return true if the record yielded and must return without running
+ */
+static inline bool cp0_yield(CPU *cpu)
+{
+    if (!cpu->slicing)
+        return false;
+
+    cpu->slicing = false;
+    cpu->yield = true;
+    cpu->yield_pc = cpu->pc;
+    cpu->pc = cpu->n_instr - 1;
+    return true;
+}
@@ -0,0 +1,1032 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "cp0.h"
+#include "debug.h"
+#include "functions.h"
+#include "gdbstub.h"
+#include "hashtable.h"
+#include "memory.h"
+
+#define BUFFER 256
+
+/**
+ * The debugger the trap handlers and the SIGSEGV handler report to.
+ */
+static DEBUGGER *active = NULL;
+
+static void repl(DEBUGGER *dbg, bool stopped);
+
+/**
+ * @brief Print where execution has stopped: the instruction index, its label
+ * if it has one, and its encoding.
+ */
+static void print_location(DEBUGGER *dbg)
+{
+    CPU *cpu = dbg->cpu;
+    if (cpu->pc >= (unsigned int)dbg->n)
+    {
+        printf("Program exited\n");
+        return;
+    }
+
+    const char *label = symbol_at(dbg->symbols, cpu->pc);
+    printf("pc %u%s%s%s: 0x%08x\n",
+        cpu->pc,
+        label ? " <" : "",
+        label ? label : "",
+        label ? ">" : "",
+        (unsigned int)cpu->text[cpu->pc]);
+}
+
+static BREAKPOINT *breakpoint_at(DEBUGGER *dbg, int pc)
+{
+    for (int i = 0; i < MAX_BREAKPOINTS; i++)
+        if (dbg->bps[i].id != 0 && dbg->bps[i].pc == pc)
+            return &dbg->bps[i];
+    return NULL;
+}
+
+/**
+ * @brief Write-protect the pages of every memory watchpoint, so the next store
+ * to one of them faults.
+ */
+static void protect_watched(DEBUGGER *dbg, int prot)
+{
+    for (int i = 0; i < MAX_WATCHPOINTS; i++)
+        if (dbg->wps[i].id != 0 && !dbg->wps[i].is_reg)
+            mprotect(dbg->wps[i].page, PAGE_SIZE, prot);
+}
+
+static word_t watched_value(DEBUGGER *dbg, WATCHPOINT *wp)
+{
+    if (wp->is_reg)
+        return dbg->cpu->reg[wp->reg]->value.wd;
+    return mem_load_word(dbg->cpu->mem, wp->addr);
+}
+
+/**
+ * @brief Report every watchpoint whose value changed and re-arm the page
+ * protection.
+ *
+ * @return true if any value changed
+ */
+static bool check_watchpoints(DEBUGGER *dbg)
+{
+    bool changed = false;
+    for (int i = 0; i < MAX_WATCHPOINTS; i++)
+    {
+        WATCHPOINT *wp = &dbg->wps[i];
+        if (wp->id == 0)
+            continue;
+
+        word_t value = watched_value(dbg, wp);
+        if (value == wp->old)
+            continue;
+
+        if (wp->is_reg)
+            printf("Watchpoint %d: %s", wp->id, REG_NUM_STR[wp->reg]);
+        else
+            printf("Watchpoint %d: 0x%08x", wp->id, wp->addr);
+        printf(" changed from %d to %d\n", (__int32_t)wp->old, (__int32_t)value);
+
+        wp->old = value;
+        changed = true;
+    }
+
+    protect_watched(dbg, PROT_READ);
+    return changed;
+}
+
+/**
+ * @brief Print why execution stopped and where.
+ */
+static void report(DEBUGGER *dbg, stop_t reason)
+{
+    BREAKPOINT *bp = breakpoint_at(dbg, dbg->cpu->pc);
+    if (reason == STOP_BREAK)
+        printf("Breakpoint %d, ", bp != NULL ? bp->id : 0);
+    else if (reason == STOP_HISTORY)
+        printf("No more reverse-execution history\n");
+    print_location(dbg);
+}
+
+/**
+ * @brief Take back the instruction the engine counted when it dispatched a
+ * trap, since the trap runs in its place. Traps yield first, so that Count is
+ * up to date while the debugger has stopped.
+ */
+static void untick(CPU *cpu)
+{
+    if (cpu->history != NULL)
+        cpu->history->icount--;
+    cpu->cp0->count--;
+}
+
+/**
+ * @brief Trap patched over the record of a breakpoint.
+ */
+static void exec_trap(CPU *cpu, DECODED *d)
+{
+    if (cp0_yield(cpu))
+        return;
+
+    untick(cpu);
+    if (active->gdb_fd >= 0)
+    {
+        gdb_serve(active, GDB_SIGTRAP);
+    }
+    else
+    {
+        report(active, STOP_BREAK);
+        repl(active, true);
+    }
+
+    // The engine moves on to the next instruction after this returns
+    cpu->pc--;
+}
+
+/**
+ * @brief Trap patched over the record after a store to a watched page, to
+ * check the watched values once the store has completed.
+ */
+static void exec_watch_trap(CPU *cpu, DECODED *d)
+{
+    if (cp0_yield(cpu))
+        return;
+
+    DEBUGGER *dbg = active;
+    untick(cpu);
+    dbg->cpu->program[dbg->resume_pc].exec = dbg->resume_saved;
+    dbg->resume_pc = -1;
+    dbg->watch_fault = 0;
+
+    if (check_watchpoints(dbg))
+    {
+        print_location(dbg);
+        repl(dbg, true);
+    }
+
+    // Dispatch the restored record, or the one the debugger stopped at
+    cpu->pc--;
+}
+
+/**
+ * @brief Trap patched over every record when gdb interrupts the engine, so it
+ * stops at whichever instruction comes next.
+ */
+static void exec_interrupt(CPU *cpu, DECODED *d)
+{
+    if (cp0_yield(cpu))
+        return;
+
+    DEBUGGER *dbg = active;
+    untick(cpu);
+    for (int i = 0; i < dbg->n; i++)
+        cpu->program[i].exec = dbg->interrupt_saved[i];
+
+    dbg->interrupted = 0;
+    gdb_serve(dbg, GDB_SIGINT);
+    cpu->pc--;
+}
+
+/**
+ * @brief Have the watched values checked once the instruction writing a
+ * watched page has completed: by `debug_run` when the debugger is stepping,
+ * otherwise by a trap patched over the next record.
+ */
+static void watch_written(DEBUGGER *dbg)
+{
+    dbg->watch_fault = 1;
+
+    if (dbg->stepping || dbg->resume_pc >= 0)
+        return;
+
+    CPU *cpu = dbg->cpu;
+    int next = cpu->pc + 1 + cpu->program[cpu->pc].fused;
+    if (next < dbg->n)
+    {
+        dbg->resume_pc = next;
+        dbg->resume_saved = cpu->program[next].exec;
+        cpu->program[next].exec = exec_watch_trap;
+    }
+}
+
+/**
+ * @brief Catch stores to write-protected pages of memory watchpoints. The page
+ * is made writable so the store can complete when the handler returns, and the
+ * next record is patched to check the watched values. Faults anywhere else are
+ * re-raised with the default action.
+ */
+static void on_segv(int sig, siginfo_t *info, void *context)
+{
+    DEBUGGER *dbg = active;
+    byte_t *page = (byte_t *)((uintptr_t)info->si_addr & ~(uintptr_t)PAGE_MASK);
+
+    // The history protects every page to save it before its first store
+    bool recorded = dbg != NULL && dbg->cpu->history != NULL && history_fault(dbg->cpu->history, page);
+
+    bool watched = false;
+    for (int i = 0; i < MAX_WATCHPOINTS && dbg != NULL; i++)
+        if (dbg->wps[i].id != 0 && !dbg->wps[i].is_reg && dbg->wps[i].page == page)
+            watched = true;
+
+    if (!watched)
+    {
+        if (!recorded)
+            signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+
+    mprotect(page, PAGE_SIZE, PROT_READ | PROT_WRITE);
+    watch_written(dbg);
+}
+
+/**
+ * @brief Run the read syscall with the watched pages it fills made writable,
+ * since `readv` fails on a protected page instead of faulting. The watched
+ * values are checked once the syscall has completed.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param ctx Debugger
+ */
+static void debug_read(CPU *cpu, void *ctx)
+{
+    DEBUGGER *dbg = ctx;
+    word_t addr = cpu->reg[$a1]->value.wd;
+    word_t len = cpu->reg[$a2]->value.wd;
+    word_t last = addr + len - 1 < addr ? UINT32_MAX : addr + len - 1;
+    bool watched = false;
+
+    for (int i = 0; i < MAX_WATCHPOINTS && len > 0; i++)
+    {
+        WATCHPOINT *wp = &dbg->wps[i];
+        if (wp->id == 0 || wp->is_reg || (wp->addr | PAGE_MASK) < addr || (wp->addr & ~PAGE_MASK) > last)
+            continue;
+
+        mprotect(wp->page, PAGE_SIZE, PROT_READ | PROT_WRITE);
+        watched = true;
+    }
+
+    dbg->read_saved.handler(cpu, dbg->read_saved.ctx);
+
+    if (watched)
+        watch_written(dbg);
+}
+
+/**
+ * @brief Catch the interrupt byte gdb sends while the engine is running. The
+ * engine is stopped by patching every record with a trap; the debugger's own
+ * loop checks a flag instead.
+ */
+static void on_sigio(int sig)
+{
+    DEBUGGER *dbg = active;
+    if (dbg == NULL || dbg->gdb_fd < 0)
+        return;
+
+    char c;
+    if (recv(dbg->gdb_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) != 1 || c != GDB_INTERRUPT)
+        return;
+
+    if (dbg->stepping)
+    {
+        dbg->interrupted = 1;
+    }
+    else if (dbg->running)
+    {
+        dbg->running = 0;
+        for (int i = 0; i < dbg->n; i++)
+        {
+            dbg->interrupt_saved[i] = dbg->cpu->program[i].exec;
+            dbg->cpu->program[i].exec = exec_interrupt;
+        }
+    }
+}
+
+/**
+ * @brief Execute one instruction, decoding it afresh so patched and fused
+ * records are bypassed.
+ */
+static void step(DEBUGGER *dbg)
+{
+    CPU *cpu = dbg->cpu;
+    DECODED d;
+    decode_instruction(cpu, &d, cpu->text[cpu->pc]);
+    if (cpu->history != NULL)
+        history_tick(cpu->history);
+    cp0_tick(cpu, 1);
+    d.exec(cpu, &d);
+    cpu->pc++;
+    cp0_interrupt(cpu);
+}
+
+/**
+ * @brief Execute instructions under the debugger's control.
+ *
+ * @param dbg Debugger
+ * @param steps Number of instructions, or -1 to run until something stops it
+ * @param stopped Execution is stopped at `cpu->pc`, so a breakpoint there is
+ * stepped over rather than reported again
+ * @return stop_t Why execution stopped
+ */
+stop_t debug_run(DEBUGGER *dbg, long steps, bool stopped)
+{
+    CPU *cpu = dbg->cpu;
+    stop_t reason = STOP_STEPS;
+    dbg->stepping = 1;
+
+    for (long k = 0; steps < 0 || k < steps; k++)
+    {
+        if (cpu->pc >= (unsigned int)dbg->n)
+        {
+            reason = STOP_EXIT;
+            break;
+        }
+
+        if (breakpoint_at(dbg, cpu->pc) != NULL && (k > 0 || !stopped))
+        {
+            reason = STOP_BREAK;
+            break;
+        }
+
+        if (dbg->interrupted)
+        {
+            dbg->interrupted = 0;
+            reason = STOP_INTERRUPT;
+            break;
+        }
+
+        step(dbg);
+
+        if (dbg->watch_fault || dbg->n_reg_watches > 0)
+        {
+            dbg->watch_fault = 0;
+            if (check_watchpoints(dbg))
+            {
+                reason = STOP_WATCH;
+                break;
+            }
+        }
+    }
+
+    if (reason == STOP_STEPS && cpu->pc >= (unsigned int)dbg->n)
+        reason = STOP_EXIT;
+
+    dbg->stepping = 0;
+    return reason;
+}
+
+/**
+ * @brief Execute forward to an instruction count without stopping, after the
+ * history has gone back to a checkpoint before it.
+ */
+static void replay(DEBUGGER *dbg, unsigned long long icount)
+{
+    CPU *cpu = dbg->cpu;
+    dbg->stepping = 1;
+    while (cpu->history->icount < icount && cpu->pc < (unsigned int)dbg->n)
+        step(dbg);
+    dbg->stepping = 0;
+}
+
+/**
+ * @brief Take the watched values as they are after going back, so the jump is
+ * not reported as a change.
+ */
+static void sync_watchpoints(DEBUGGER *dbg)
+{
+    for (int i = 0; i < MAX_WATCHPOINTS; i++)
+        if (dbg->wps[i].id != 0)
+            dbg->wps[i].old = watched_value(dbg, &dbg->wps[i]);
+    dbg->watch_fault = 0;
+    protect_watched(dbg, PROT_READ);
+}
+
+/**
+ * @brief Go back a number of instructions by restoring the nearest checkpoint
+ * before the target and replaying forward to it.
+ *
+ * @param dbg Debugger
+ * @param steps Number of instructions
+ * @return stop_t STOP_HISTORY if the history does not reach back that far, in
+ * which case execution stops at the oldest checkpoint, otherwise STOP_STEPS
+ */
+stop_t debug_reverse_step(DEBUGGER *dbg, unsigned long long steps)
+{
+    HISTORY *h = dbg->cpu->history;
+    stop_t reason = STOP_STEPS;
+    unsigned long long target = h->icount - steps;
+    if (steps > h->icount - h->cps[0].icount)
+    {
+        target = h->cps[0].icount;
+        reason = STOP_HISTORY;
+    }
+
+    history_restore(h, history_find(h, target));
+    replay(dbg, target);
+    sync_watchpoints(dbg);
+    return reason;
+}
+
+/**
+ * @brief Go back to the last breakpoint reached before the current
+ * instruction. Each interval between checkpoints is replayed, newest first,
+ * until one reaches a breakpoint.
+ *
+ * @param dbg Debugger
+ * @return stop_t STOP_BREAK, or STOP_HISTORY if no breakpoint was reached
+ * since the oldest checkpoint
+ */
+stop_t debug_reverse_continue(DEBUGGER *dbg)
+{
+    CPU *cpu = dbg->cpu;
+    HISTORY *h = cpu->history;
+    unsigned long long end = h->icount;
+
+    while (end > h->cps[0].icount)
+    {
+        int k = history_find(h, end - 1);
+        history_restore(h, k);
+        unsigned long long start = h->icount;
+
+        long long last = -1;
+        dbg->stepping = 1;
+        while (h->icount < end && cpu->pc < (unsigned int)dbg->n)
+        {
+            if (breakpoint_at(dbg, cpu->pc) != NULL)
+                last = h->icount;
+            step(dbg);
+        }
+        dbg->stepping = 0;
+
+        if (last >= 0)
+        {
+            history_restore(h, history_find(h, last));
+            replay(dbg, last);
+            sync_watchpoints(dbg);
+            return STOP_BREAK;
+        }
+        end = start;
+    }
+
+    history_restore(h, 0);
+    sync_watchpoints(dbg);
+    return STOP_HISTORY;
+}
+
+/**
+ * @brief Parse an instruction index or a label.
+ *
+ * @return int Instruction index, or -1 if invalid
+ */
+static int parse_location(DEBUGGER *dbg, const char *str)
+{
+    char *end;
+    long pc = strtol(str, &end, 0);
+    if (end != str && *end == '\0')
+        return (0 <= pc && pc < dbg->n) ? pc : -1;
+
+    int index;
+    if (symbol_lookup(dbg->symbols, str, &index) && 0 <= index && index < dbg->n)
+        return index;
+    return -1;
+}
+
+/**
+ * @brief Parse a register as `$N`, `$name`, `hi` or `lo`.
+ *
+ * @return int Register, or -1 if invalid
+ */
+static int parse_register(const char *str)
+{
+    for (int i = 0; i < NUM_REGISTERS; i++)
+        if (strcasecmp(str, REG_NUM_STR[i]) == 0 || strcasecmp(str, REG_NAME_STR[i]) == 0)
+            return i;
+    return -1;
+}
+
+/**
+ * @brief Set a breakpoint by patching a trap over the record of an
+ * instruction.
+ *
+ * @param dbg Debugger
+ * @param pc Instruction index
+ * @return int Number of the breakpoint, 0 if one is already set there, or -1
+ * if there is no free slot
+ */
+int debug_break(DEBUGGER *dbg, int pc)
+{
+    if (breakpoint_at(dbg, pc) != NULL)
+        return 0;
+
+    for (int i = 0; i < MAX_BREAKPOINTS; i++)
+    {
+        BREAKPOINT *bp = &dbg->bps[i];
+        if (bp->id != 0)
+            continue;
+
+        // Fused records would run past the breakpoint without dispatching it
+        unfuse(dbg->cpu, pc);
+
+        bp->id = dbg->next_id++;
+        bp->pc = pc;
+        bp->saved = dbg->cpu->program[pc].exec;
+        dbg->cpu->program[pc].exec = exec_trap;
+        return bp->id;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Remove the breakpoint on an instruction and restore its record.
+ *
+ * @param dbg Debugger
+ * @param pc Instruction index
+ * @return true if there was a breakpoint
+ */
+bool debug_unbreak(DEBUGGER *dbg, int pc)
+{
+    BREAKPOINT *bp = breakpoint_at(dbg, pc);
+    if (bp == NULL)
+        return false;
+
+    dbg->cpu->program[bp->pc].exec = bp->saved;
+    bp->id = 0;
+    return true;
+}
+
+static void add_breakpoint(DEBUGGER *dbg, const char *arg)
+{
+    int pc = arg != NULL ? parse_location(dbg, arg) : -1;
+    if (pc < 0)
+    {
+        printf("No instruction %s\n", arg != NULL ? arg : "given");
+        return;
+    }
+
+    int id = debug_break(dbg, pc);
+    if (id == 0)
+        printf("Breakpoint already set at pc %d\n", pc);
+    else if (id < 0)
+        printf("Too many breakpoints\n");
+    else
+        printf("Breakpoint %d at pc %d\n", id, pc);
+}
+
+static void add_watchpoint(DEBUGGER *dbg, const char *arg)
+{
+    if (arg == NULL)
+    {
+        printf("Watch what?\n");
+        return;
+    }
+
+    WATCHPOINT wp = { .id = dbg->next_id };
+    if (arg[0] == '$' || strcasecmp(arg, "hi") == 0 || strcasecmp(arg, "lo") == 0)
+    {
+        wp.is_reg = true;
+        wp.reg = parse_register(arg);
+        if (wp.reg < 0)
+        {
+            printf("No register %s\n", arg);
+            return;
+        }
+    }
+    else
+    {
+        char *end;
+        wp.addr = strtoul(arg, &end, 0);
+        if (end == arg || *end != '\0' || wp.addr % 4 != 0)
+        {
+            printf("Watch needs a register or a word-aligned address\n");
+            return;
+        }
+
+        if (sysconf(_SC_PAGESIZE) != PAGE_SIZE)
+        {
+            printf("Memory watchpoints need %u-byte host pages\n", PAGE_SIZE);
+            return;
+        }
+
+        wp.page = mem_page(dbg->cpu->mem, wp.addr, true);
+    }
+
+    for (int i = 0; i < MAX_WATCHPOINTS; i++)
+    {
+        if (dbg->wps[i].id != 0)
+            continue;
+
+        wp.old = watched_value(dbg, &wp);
+        dbg->wps[i] = wp;
+        dbg->next_id++;
+        dbg->n_reg_watches += wp.is_reg;
+        protect_watched(dbg, PROT_READ);
+        printf("Watchpoint %d: %s\n", wp.id, arg);
+        return;
+    }
+
+    printf("Too many watchpoints\n");
+}
+
+static void delete_point(DEBUGGER *dbg, int id)
+{
+    for (int i = 0; i < MAX_BREAKPOINTS; i++)
+    {
+        if (dbg->bps[i].id == id)
+        {
+            debug_unbreak(dbg, dbg->bps[i].pc);
+            return;
+        }
+    }
+
+    for (int i = 0; i < MAX_WATCHPOINTS; i++)
+    {
+        WATCHPOINT *wp = &dbg->wps[i];
+        if (wp->id == id)
+        {
+            if (wp->is_reg)
+                dbg->n_reg_watches--;
+            else
+                mprotect(wp->page, PAGE_SIZE, PROT_READ | PROT_WRITE);
+            wp->id = 0;
+
+            // Another watchpoint may share the page
+            protect_watched(dbg, PROT_READ);
+            return;
+        }
+    }
+
+    printf("No breakpoint or watchpoint %d\n", id);
+}
+
+static void delete_all(DEBUGGER *dbg)
+{
+    for (int i = 0; i < MAX_BREAKPOINTS; i++)
+        if (dbg->bps[i].id != 0)
+            delete_point(dbg, dbg->bps[i].id);
+    for (int i = 0; i < MAX_WATCHPOINTS; i++)
+        if (dbg->wps[i].id != 0)
+            delete_point(dbg, dbg->wps[i].id);
+}
+
+static void print_points(DEBUGGER *dbg)
+{
+    HISTORY *h = dbg->cpu->history;
+    if (h != NULL)
+        printf("recording: instruction %llu, %d checkpoints from instruction %llu, %zu KiB saved\n",
+            h->icount,
+            h->n_cps,
+            h->cps[0].icount,
+            h->bytes >> 10);
+
+    for (int i = 0; i < MAX_BREAKPOINTS; i++)
+        if (dbg->bps[i].id != 0)
+            printf("%-3d breakpoint pc %d\n", dbg->bps[i].id, dbg->bps[i].pc);
+
+    for (int i = 0; i < MAX_WATCHPOINTS; i++)
+    {
+        WATCHPOINT *wp = &dbg->wps[i];
+        if (wp->id != 0 && wp->is_reg)
+            printf("%-3d watchpoint %s\n", wp->id, REG_NUM_STR[wp->reg]);
+        else if (wp->id != 0)
+            printf("%-3d watchpoint 0x%08x\n", wp->id, wp->addr);
+    }
+}
+
+static void print_all_registers(CPU *cpu)
+{
+    for (int i = 0; i < NUM_REGISTERS; i++)
+        printf("%-3s %-5s = %d\n", REG_NUM_STR[i], REG_NAME_STR[i], cpu->reg[i]->value.wd);
+    printf("pc        = %u\n", cpu->pc);
+}
+
+static void examine(DEBUGGER *dbg, const char *addr_str, const char *count_str)
+{
+    char *end;
+    word_t addr = addr_str != NULL ? strtoul(addr_str, &end, 0) : 0;
+    if (addr_str == NULL || end == addr_str)
+    {
+        printf("Examine which address?\n");
+        return;
+    }
+
+    int count = count_str != NULL ? atoi(count_str) : 1;
+    for (int i = 0; i < count; i++)
+    {
+        if (i % 4 == 0)
+            printf("%s0x%08x:", i > 0 ? "\n" : "", addr + 4 * i);
+        printf(" 0x%08x", mem_load_word(dbg->cpu->mem, addr + 4 * i));
+    }
+    printf("\n");
+}
+
+static void print_help(void)
+{
+    printf("break LOC        stop before instruction LOC (index or label)\n");
+    printf("delete [N]       delete break/watchpoint N, or all\n");
+    printf("watch $REG|ADDR  stop when a register or memory word changes\n");
+    printf("info             list break/watchpoints\n");
+    printf("step [N]         execute N instructions (default 1)\n");
+    printf("continue         run until a break/watchpoint or the end\n");
+    printf("reverse-step [N] go back N instructions (default 1), with --record\n");
+    printf("reverse-continue go back to the previous breakpoint, with --record\n");
+    printf("registers        print every register\n");
+    printf("print $REG       print one register\n");
+    printf("x ADDR [N]       print N memory words from ADDR\n");
+    printf("quit             stop the program\n");
+}
+
+/**
+ * @brief Read and run commands until execution should resume in the engine.
+ *
+ * @param dbg Debugger
+ * @param stopped Execution is stopped at `cpu->pc` (rather than not started)
+ */
+static void repl(DEBUGGER *dbg, bool stopped)
+{
+    CPU *cpu = dbg->cpu;
+    char line[BUFFER];
+
+    for (;;)
+    {
+        if (dbg->interactive)
+        {
+            printf("(smips) ");
+            fflush(stdout);
+        }
+
+        if (fgets(line, sizeof(line), dbg->in) == NULL)
+        {
+            // Out of commands: detach and let the program finish
+            delete_all(dbg);
+            return;
+        }
+
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '\0')
+            strcpy(line, dbg->last);
+        else
+            strcpy(dbg->last, line);
+
+        char *save;
+        char *cmd = strtok_r(line, " \t", &save);
+        char *arg = strtok_r(NULL, " \t", &save);
+        char *arg2 = strtok_r(NULL, " \t", &save);
+        if (cmd == NULL)
+            continue;
+
+        if (strcmp(cmd, "break") == 0 || strcmp(cmd, "b") == 0)
+        {
+            add_breakpoint(dbg, arg);
+        }
+        else if (strcmp(cmd, "watch") == 0 || strcmp(cmd, "w") == 0)
+        {
+            add_watchpoint(dbg, arg);
+        }
+        else if (strcmp(cmd, "delete") == 0 || strcmp(cmd, "d") == 0)
+        {
+            if (arg != NULL)
+                delete_point(dbg, atoi(arg));
+            else
+                delete_all(dbg);
+        }
+        else if (strcmp(cmd, "info") == 0 || strcmp(cmd, "i") == 0)
+        {
+            print_points(dbg);
+        }
+        else if (strcmp(cmd, "step") == 0 || strcmp(cmd, "s") == 0)
+        {
+            stop_t reason = debug_run(dbg, arg != NULL ? atol(arg) : 1, stopped);
+            stopped = true;
+            report(dbg, reason);
+            if (reason == STOP_EXIT)
+                return;
+        }
+        else if (strcmp(cmd, "continue") == 0 || strcmp(cmd, "c") == 0)
+        {
+            // Register watchpoints need a check after every instruction, so the
+            // debugger keeps control; otherwise the engine runs at full speed
+            // once the current instruction is out of the way
+            stop_t reason = debug_run(dbg, dbg->n_reg_watches > 0 ? -1 : (stopped ? 1 : 0), stopped);
+            if (reason == STOP_EXIT)
+            {
+                print_location(dbg);
+                return;
+            }
+            if (reason == STOP_STEPS)
+                return;
+
+            stopped = true;
+            report(dbg, reason);
+        }
+        else if (strcmp(cmd, "reverse-step") == 0 || strcmp(cmd, "rs") == 0)
+        {
+            if (cpu->history == NULL)
+            {
+                printf("Not recording, run with --record\n");
+                continue;
+            }
+
+            stop_t reason = debug_reverse_step(dbg, arg != NULL ? atol(arg) : 1);
+            stopped = true;
+            report(dbg, reason);
+        }
+        else if (strcmp(cmd, "reverse-continue") == 0 || strcmp(cmd, "rc") == 0)
+        {
+            if (cpu->history == NULL)
+            {
+                printf("Not recording, run with --record\n");
+                continue;
+            }
+
+            stop_t reason = debug_reverse_continue(dbg);
+            stopped = true;
+            report(dbg, reason);
+        }
+        else if (strcmp(cmd, "registers") == 0 || strcmp(cmd, "regs") == 0)
+        {
+            print_all_registers(cpu);
+        }
+        else if (strcmp(cmd, "print") == 0 || strcmp(cmd, "p") == 0)
+        {
+            int reg = arg != NULL ? parse_register(arg) : -1;
+            if (reg < 0)
+                printf("No register %s\n", arg != NULL ? arg : "given");
+            else
+                printf("%s = %d\n", REG_NUM_STR[reg], cpu->reg[reg]->value.wd);
+        }
+        else if (strcmp(cmd, "x") == 0)
+        {
+            examine(dbg, arg, arg2);
+        }
+        else if (strcmp(cmd, "quit") == 0 || strcmp(cmd, "q") == 0)
+        {
+            delete_all(dbg);
+            cpu->pc = cpu->n_instr;
+            return;
+        }
+        else if (strcmp(cmd, "help") == 0 || strcmp(cmd, "h") == 0)
+        {
+            print_help();
+        }
+        else
+        {
+            printf("Unknown command %s, try help\n", cmd);
+        }
+    }
+}
+
+/**
+ * @brief Take commands from gdb over a connection instead of from the command
+ * line. gdb's interrupt byte raises SIGIO, which stops the engine.
+ */
+static void attach_remote(DEBUGGER *dbg, int fd)
+{
+    dbg->interrupt_saved = malloc(dbg->n * sizeof(exec_t));
+    if (dbg->interrupt_saved == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Debugger\n");
+        exit(EXIT_FAILURE);
+    }
+
+    dbg->gdb_fd = fd;
+
+    struct sigaction sa = { 0 };
+    sa.sa_handler = on_sigio;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGIO, &sa, NULL);
+
+    fcntl(fd, F_SETOWN, getpid());
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_ASYNC);
+}
+
+/**
+ * @brief Initialise the debugger and install the SIGSEGV handler used by
+ * memory watchpoints, and the wrapper of the read syscall that lets it fill
+ * watched pages.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param n Number of instructions
+ * @param symbols Labels of the program
+ * @param script File of commands, or NULL to read them from the terminal
+ * @param gdb_fd Connection to gdb to take commands from instead, or -1
+ * @return DEBUGGER*
+ */
+DEBUGGER *init_DEBUGGER(CPU *cpu, int n, SYMBOLS *symbols, const char *script, int gdb_fd)
+{
+    DEBUGGER *dbg = calloc(1, sizeof(DEBUGGER));
+    if (dbg == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Debugger\n");
+        exit(EXIT_FAILURE);
+    }
+
+    dbg->cpu = cpu;
+    dbg->n = n;
+    dbg->symbols = symbols;
+    dbg->next_id = 1;
+    dbg->resume_pc = -1;
+    dbg->gdb_fd = -1;
+
+    if (gdb_fd >= 0)
+    {
+        attach_remote(dbg, gdb_fd);
+    }
+    else
+    {
+        dbg->in = fopen(script != NULL ? script : "/dev/tty", "r");
+        if (dbg->in == NULL && script == NULL)
+            dbg->in = stdin;
+        if (dbg->in == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to open %s\n", script);
+            exit(EXIT_FAILURE);
+        }
+        dbg->interactive = isatty(fileno(dbg->in));
+    }
+
+    struct sigaction sa = { 0 };
+    sa.sa_sigaction = on_segv;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, NULL);
+
+    // Syscall 14 reads a file into guest memory
+    if (cpu->syscalls->n > 14 && cpu->syscalls->table[14].handler != NULL)
+    {
+        dbg->read_saved = cpu->syscalls->table[14];
+        syscall_install(cpu->syscalls, 14, debug_read, dbg);
+    }
+
+    active = dbg;
+    return dbg;
+}
+
+/**
+ * @brief Remove every trap and let the program run to the end undisturbed.
+ *
+ * @param dbg Debugger
+ */
+void debug_detach(DEBUGGER *dbg)
+{
+    delete_all(dbg);
+    if (dbg->gdb_fd >= 0)
+    {
+        signal(SIGIO, SIG_IGN);
+        close(dbg->gdb_fd);
+        dbg->gdb_fd = -1;
+    }
+}
+
+/**
+ * @brief Remove every trap and page protection, then destroy the debugger.
+ * A connected gdb is told the program has exited.
+ *
+ * @param dbg Debugger to be destroyed
+ */
+void free_DEBUGGER(DEBUGGER *dbg)
+{
+    if (dbg->resume_pc >= 0)
+        dbg->cpu->program[dbg->resume_pc].exec = dbg->resume_saved;
+    if (dbg->gdb_fd >= 0)
+        gdb_exited(dbg);
+    debug_detach(dbg);
+    signal(SIGSEGV, SIG_DFL);
+    if (dbg->read_saved.handler != NULL)
+        dbg->cpu->syscalls->table[14] = dbg->read_saved;
+
+    if (dbg->in != NULL && dbg->in != stdin)
+        fclose(dbg->in);
+    active = NULL;
+    free(dbg->interrupt_saved);
+    free(dbg);
+    dbg = NULL;
+}
+
+/**
+ * @brief Take commands before the first instruction runs. Returns when the
+ * engine should start, at `cpu->pc`.
+ *
+ * @param dbg Debugger
+ */
+void debug_start(DEBUGGER *dbg)
+{
+    if (dbg->gdb_fd >= 0)
+    {
+        gdb_serve(dbg, 0);
+        return;
+    }
+
+    if (dbg->interactive)
+        printf("Debugging %d instructions, type help for commands\n", dbg->n);
+    repl(dbg, false);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "decode.h"
+#include "hardware.h"
+#include "history.h"
+#include "symbols.h"
+
+#define MAX_BREAKPOINTS 64
+#define MAX_WATCHPOINTS 16
+
+/**
+ * Reason the debugger stopped executing.
+ */
+typedef enum stop_t
+{
+    STOP_STEPS,     // Ran the requested number of instructions
+    STOP_BREAK,     // Reached a breakpoint
+    STOP_WATCH,     // A watched value changed
+    STOP_INTERRUPT, // Interrupted by gdb
+    STOP_HISTORY,   // Went back to the oldest checkpoint
+    STOP_EXIT,      // The program finished
+} stop_t;
+
+/**
+ * @struct BREAKPOINT
+ * @brief A breakpoint and the handler its trap replaced.
+ */
+typedef struct BREAKPOINT
+{
+    int id;       // Number shown to the user, 0 if the slot is free
+    int pc;       // Instruction index
+    exec_t saved; // Handler of the patched record
+} BREAKPOINT;
+
+/**
+ * @struct WATCHPOINT
+ * @brief A watched register, or a watched word of guest memory together with
+ * the host page that is write-protected to catch stores to it.
+ */
+typedef struct WATCHPOINT
+{
+    int id;       // Number shown to the user, 0 if the slot is free
+    bool is_reg;  // Watches a register rather than memory
+    int reg;      // Register watched
+    word_t addr;  // Guest address watched
+    byte_t *page; // Host page holding `addr`
+    word_t old;   // Value when last checked
+} WATCHPOINT;
+
+/**
+ * @struct DEBUGGER
+ * @brief State of the interactive debugger.
+ */
+typedef struct DEBUGGER
+{
+    CPU *cpu;                             // CPU being debugged
+    int n;                                // Number of instructions
+    SYMBOLS *symbols;                     // Labels for `break` and stops
+    FILE *in;                             // Command stream, NULL when gdb is connected
+    bool interactive;                     // Commands come from a terminal
+    BREAKPOINT bps[MAX_BREAKPOINTS];      // Breakpoints
+    WATCHPOINT wps[MAX_WATCHPOINTS];      // Watchpoints
+    int next_id;                          // Number of the next break/watchpoint
+    int n_reg_watches;                    // Register watchpoints in use
+    volatile sig_atomic_t watch_fault;    // A watched page was written
+    volatile sig_atomic_t stepping;       // The debugger is executing, not the engine
+    int resume_pc;                        // Record patched to check a watch fault, or -1
+    exec_t resume_saved;                  // Handler of that record
+    char last[256];                       // Last command, repeated by an empty line
+    int gdb_fd;                           // Connection to gdb, -1 for the command line
+    bool no_ack;                          // gdb turned off packet acknowledgements
+    volatile sig_atomic_t running;        // The engine is running at full speed
+    volatile sig_atomic_t interrupted;    // gdb asked to stop
+    exec_t *interrupt_saved;              // Handlers replaced to stop the engine
+    SYSCALL_ENTRY read_saved;             // Handler of the read syscall the debugger wraps
+} DEBUGGER;
+
+DEBUGGER *init_DEBUGGER(CPU *cpu, int n, SYMBOLS *symbols, const char *script, int gdb_fd);
+void free_DEBUGGER(DEBUGGER *dbg);
+void debug_start(DEBUGGER *dbg);
+stop_t debug_run(DEBUGGER *dbg, long steps, bool stopped);
+int debug_break(DEBUGGER *dbg, int pc);
+bool debug_unbreak(DEBUGGER *dbg, int pc);
+void debug_detach(DEBUGGER *dbg);
+stop_t debug_reverse_step(DEBUGGER *dbg, unsigned long long steps);
+stop_t debug_reverse_continue(DEBUGGER *dbg);
@@ -0,0 +1,515 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "coverage.h"
+#include "cp0.h"
+#include "decode.h"
+#include "functions.h"
+#include "memory.h"
+#include "opcode.h"
+#include "optimize.h"
+#include "predictor.h"
+#include "utils.h"
+
+#define NUM_CODES 64
+
+/**
+ * Adapters generated from the X-macro tables: one per instruction, calling its
+ * handler directly with the operands stored in the decoded record.
+ */
+#define _R(NAME, FUNCT, STR, FUNC_PTR)                          \
+    static void exec_##NAME(CPU *cpu, DECODED *d)               \
+    {                                                           \
+        FUNC_PTR(cpu, d->rs, d->rt, d->rd, d->shamt, d->funct); \
+    }
+R_TYPE_TABLE
+#undef _R
+
+#define _P(NAME, FUNCT, STR, FUNC_PTR)                          \
+    static void exec_##NAME(CPU *cpu, DECODED *d)               \
+    {                                                           \
+        FUNC_PTR(cpu, d->rs, d->rt, d->rd, d->shamt, d->funct); \
+    }
+P_TYPE_TABLE
+#undef _P
+
+#define _I(NAME, OP, STR, FUNC_PTR)               \
+    static void exec_##NAME(CPU *cpu, DECODED *d) \
+    {                                             \
+        FUNC_PTR(cpu, d->rs, d->rt, d->imm);      \
+    }
+I_TYPE_TABLE
+#undef _I
+
+#define _J(NAME, OP, STR, FUNC_PTR)               \
+    static void exec_##NAME(CPU *cpu, DECODED *d) \
+    {                                             \
+        FUNC_PTR(cpu, d->imm);                    \
+    }
+J_TYPE_TABLE
+#undef _J
+
+#define _F(NAME, FUNCT, STR, FUNC_PTR)                 \
+    static void exec_##NAME(CPU *cpu, DECODED *d)      \
+    {                                                  \
+        FUNC_PTR(cpu, d->fmt, d->ft, d->fs, d->fd);    \
+    }
+F_TYPE_TABLE
+#undef _F
+
+#define _R(NAME, FUNCT, STR, FUNC_PTR) [NAME] = exec_##NAME,
+static const exec_t R_EXEC[NUM_CODES] = { R_TYPE_TABLE };
+#undef _R
+
+#define _P(NAME, FUNCT, STR, FUNC_PTR) [NAME] = exec_##NAME,
+static const exec_t P_EXEC[NUM_CODES] = { P_TYPE_TABLE };
+#undef _P
+
+#define _I(NAME, OP, STR, FUNC_PTR) [NAME] = exec_##NAME,
+static const exec_t I_EXEC[NUM_CODES] = { I_TYPE_TABLE };
+#undef _I
+
+#define _J(NAME, OP, STR, FUNC_PTR) [NAME] = exec_##NAME,
+static const exec_t J_EXEC[NUM_CODES] = { J_TYPE_TABLE };
+#undef _J
+
+#define _F(NAME, FUNCT, STR, FUNC_PTR) [NAME] = exec_##NAME,
+static const exec_t F_EXEC[NUM_CODES] = { F_TYPE_TABLE };
+#undef _F
+
+/**
+ * @enum dest_t
+ * @brief How an instruction uses the general-purpose register it writes: rd in
+ * the R and P formats, rt in the I format.
+ */
+typedef enum dest_t
+{
+    DEST_NONE,  // Writes no general-purpose register
+    DEST_PURE,  // Writing the register is its only effect
+    DEST_SIDE,  // Writes the register and does something else as well
+} dest_t;
+
+static const byte_t R_DEST[NUM_CODES] = {
+    [ADD] = DEST_PURE, [ADDU] = DEST_PURE, [AND] = DEST_PURE,
+    [JALR] = DEST_SIDE, [MFHI] = DEST_PURE, [MFLO] = DEST_PURE,
+    [NOR] = DEST_PURE, [OR] = DEST_PURE, [SLL] = DEST_PURE,
+    [SLLV] = DEST_PURE, [SLT] = DEST_PURE, [SLTU] = DEST_PURE,
+    [SRA] = DEST_PURE, [SRAV] = DEST_PURE, [SRL] = DEST_PURE,
+    [SRLV] = DEST_PURE, [SUB] = DEST_PURE, [SUBU] = DEST_PURE,
+    [XOR] = DEST_PURE,
+};
+
+static const byte_t P_DEST[NUM_CODES] = {
+    [MUL] = DEST_PURE,
+};
+
+// Loads keep their memory access, which the cache simulator sees. `sc` reads
+// rt before writing it, so it looks after $zero itself
+static const byte_t I_DEST[NUM_CODES] = {
+    [ADDI] = DEST_PURE, [ADDIU] = DEST_PURE, [ANDI] = DEST_PURE,
+    [LB] = DEST_SIDE, [LH] = DEST_SIDE, [LL] = DEST_SIDE,
+    [LUI] = DEST_PURE, [LW] = DEST_SIDE, [ORI] = DEST_PURE,
+    [SLTI] = DEST_PURE, [SLTIU] = DEST_PURE, [XORI] = DEST_PURE,
+};
+
+/**
+ * @brief Do nothing, in place of an instruction with no effect.
+ */
+void exec_nop(CPU *cpu, DECODED *d)
+{
+}
+
+static void exec_mfc1(CPU *cpu, DECODED *d)
+{
+    MIPS_mfc1(cpu, d->rt, d->fs);
+}
+
+static void exec_mtc1(CPU *cpu, DECODED *d)
+{
+    MIPS_mtc1(cpu, d->rt, d->fs);
+}
+
+static void exec_bc1(CPU *cpu, DECODED *d)
+{
+    MIPS_bc1(cpu, d->ft >> 2, d->ft & 1, d->imm);
+}
+
+static void exec_mfc0(CPU *cpu, DECODED *d)
+{
+    MIPS_mfc0(cpu, d->rt, d->fs, d->funct & 0x7);
+}
+
+static void exec_mtc0(CPU *cpu, DECODED *d)
+{
+    MIPS_mtc0(cpu, d->rt, d->fs, d->funct & 0x7);
+}
+
+static void exec_eret(CPU *cpu, DECODED *d)
+{
+    MIPS_eret(cpu);
+}
+
+static void exec_invalid(CPU *cpu, DECODED *d)
+{
+    if (cp0_exception(cpu, EXC_RI))
+        return;
+
+    // Stop as an exit does; `hart_run` reports it with the PC back here
+    cpu->invalid_at = cpu->pc;
+    cpu->pc = cpu->n_instr;
+}
+
+/**
+ * @brief Keep an instruction from writing `$zero`. One whose only effect is
+ * the write becomes a no-op, and any other writes the CPU's sink register
+ * instead, so `$zero` never has to be cleared after an instruction runs.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param d Record to specialize
+ * @param dest How the instruction uses its destination
+ * @param reg Destination operand in `d`
+ */
+static void specialize_zero(CPU *cpu, DECODED *d, dest_t dest, REGISTER **reg)
+{
+    if (*reg != cpu->reg[$zero] || dest == DEST_NONE)
+        return;
+
+    if (dest == DEST_PURE)
+        d->exec = exec_nop;
+    *reg = &cpu->sink;
+}
+
+/**
+ * @brief Decode one encoded instruction into a record: pick its adapter and
+ * resolve its register operands. Instructions writing `$zero` are
+ * specialized by `specialize_zero()`.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param d Record to fill
+ * @param instr_code Encoded MIPS instruction
+ */
+void decode_instruction(CPU *cpu, DECODED *d, int instr_code)
+{
+    R_FORMAT r = extract_R_FORMAT(instr_code);
+    I_FORMAT i = extract_I_FORMAT(instr_code);
+    F_FORMAT f = extract_F_FORMAT(instr_code);
+
+    d->instr_code = instr_code;
+    d->fused = 0;
+    d->rs = cpu->reg[r.rs];
+    d->rt = cpu->reg[r.rt];
+    d->rd = cpu->reg[r.rd];
+    d->shamt = r.shamt;
+    d->funct = r.funct;
+    d->imm = i.imm;
+    d->fmt = f.fmt;
+    d->ft = f.ft;
+    d->fs = f.fs;
+    d->fd = f.fd;
+
+    if (is_P_FORMAT(instr_code))
+    {
+        d->format = FORMAT_P;
+        d->exec = P_EXEC[r.funct];
+        specialize_zero(cpu, d, P_DEST[r.funct], &d->rd);
+    }
+    else if (is_R_FORMAT(instr_code))
+    {
+        d->format = FORMAT_R;
+        d->exec = R_EXEC[r.funct];
+        specialize_zero(cpu, d, R_DEST[r.funct], &d->rd);
+    }
+    else if (is_I_FORMAT(instr_code))
+    {
+        d->format = FORMAT_I;
+        d->exec = I_EXEC[i.op];
+        specialize_zero(cpu, d, I_DEST[i.op], &d->rt);
+    }
+    else if (is_J_FORMAT(instr_code))
+    {
+        d->format = FORMAT_J;
+        d->exec = J_EXEC[r.op];
+        d->imm = extract_J_FORMAT(instr_code).addr;
+    }
+    else if (is_F_FORMAT(instr_code))
+    {
+        d->format = FORMAT_F;
+        if (f.fmt == MF)
+        {
+            d->exec = exec_mfc1;
+            specialize_zero(cpu, d, DEST_PURE, &d->rt);
+        }
+        else if (f.fmt == MT)
+            d->exec = exec_mtc1;
+        else if (f.fmt == BC)
+            d->exec = exec_bc1;
+        else
+            d->exec = F_EXEC[f.funct];
+    }
+    else if (is_C_FORMAT(instr_code))
+    {
+        d->format = FORMAT_C;
+        if (r.rs == MF)
+        {
+            d->exec = exec_mfc0;
+            specialize_zero(cpu, d, DEST_SIDE, &d->rt);
+        }
+        else if (r.rs == MT)
+            d->exec = exec_mtc0;
+        else
+            d->exec = exec_eret;
+    }
+    else
+    {
+        d->format = FORMAT_INVALID;
+        d->exec = exec_invalid;
+    }
+}
+
+/**
+ * @brief Copy `n` encoded instructions into a text segment of their size and
+ * decode them into `cpu->program`.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param words Encoded MIPS instructions
+ * @param n Number of instructions
+ */
+void decode_program(CPU *cpu, const uint32_t *words, int n)
+{
+    int *text = malloc((n > 0 ? n : 1) * sizeof(int));
+    DECODED *program = calloc(n > 0 ? n : 1, sizeof(DECODED));
+    if (text == NULL || program == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Program\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(text, words, n * sizeof(int));
+    free(cpu->text);
+    free(cpu->program);
+    cpu->text = text;
+    cpu->program = program;
+
+    for (int i = 0; i < n; i++)
+        decode_instruction(cpu, &cpu->program[i], cpu->text[i]);
+    cpu->n_instr = n;
+}
+
+/**
+ * Fused multiply/divide: run the `mult`, `multu`, `div` or `divu` handler,
+ * then the `mflo`/`mfhi` moves that follow it, and step over them.
+ */
+#define FUSED_MULDIV(NAME, FUNC_PTR)                                   \
+    static void exec_fused_##NAME(CPU *cpu, DECODED *d)                \
+    {                                                                  \
+        FUNC_PTR(cpu, d->rs, d->rt, d->rd, d->shamt, d->funct);        \
+        for (int k = 1; k <= d->fused; k++)                            \
+        {                                                              \
+            REGISTER *from = cpu->reg[d[k].funct == MFLO ? LO : HI];   \
+            d[k].rd->value.wd = from->value.wd;                        \
+        }                                                              \
+        cpu->pc += d->fused;                                           \
+    }
+FUSED_MULDIV(MULT, MIPS_mult)
+FUSED_MULDIV(MULTU, MIPS_multu)
+FUSED_MULDIV(DIV, MIPS_div)
+FUSED_MULDIV(DIVU, MIPS_divu)
+#undef FUSED_MULDIV
+
+/**
+ * @brief Fuse each `mult`, `multu`, `div` or `divu` with up to two `mflo` or
+ * `mfhi` instructions directly after it, so the common `mult`+`mflo` and
+ * `div`+`mflo`+`mfhi` sequences run as one dispatch. The moves keep their own
+ * records, so jumping straight to one still works.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param n Number of instructions
+ * @return int Number of sequences fused
+ */
+int fuse_muldiv(CPU *cpu, int n)
+{
+    int fused = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        DECODED *d = &cpu->program[i];
+        exec_t exec;
+        if (d->exec == exec_MULT)
+            exec = exec_fused_MULT;
+        else if (d->exec == exec_MULTU)
+            exec = exec_fused_MULTU;
+        else if (d->exec == exec_DIV)
+            exec = exec_fused_DIV;
+        else if (d->exec == exec_DIVU)
+            exec = exec_fused_DIVU;
+        else
+            continue;
+
+        int k = 0;
+        while (k < 2 && i + 1 + k < n &&
+               (d[1 + k].exec == exec_MFLO || d[1 + k].exec == exec_MFHI))
+            k++;
+
+        if (k > 0)
+        {
+            d->exec = exec;
+            d->fused = k;
+            fused++;
+        }
+    }
+
+    return fused;
+}
+
+/**
+ * @brief Run a fused byte-copy loop (see `fuse_copy_loops()`) as one bulk copy
+ * and leave every register as the loop would. A count that is not positive
+ * falls back to the original `lb`.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param d First record of the loop
+ */
+static void exec_copy_loop(CPU *cpu, DECODED *d)
+{
+    REGISTER *src = d[0].rs;
+    REGISTER *value = d[0].rt;
+    REGISTER *dst = d[1].rs;
+    REGISTER *count = d[4].rt;
+
+    if (count->value.wd <= 0)
+    {
+        exec_LB(cpu, d);
+        return;
+    }
+
+    word_t n = count->value.wd;
+    mem_copy_forward(cpu->mem, dst->value.wd, src->value.wd, n);
+    value->value.wd = (__int8_t)mem_load_byte(cpu->mem, dst->value.wd + n - 1);
+    src->value.wd += n;
+    dst->value.wd += n;
+    count->value.wd = 0;
+
+    // Continue after the loop's branch
+    cpu->pc += 5;
+}
+
+/**
+ * @brief Check for `addi`/`addiu reg, reg, step`.
+ */
+static bool is_increment(DECODED *d, REGISTER *reg, int step)
+{
+    return (d->exec == exec_ADDI || d->exec == exec_ADDIU) &&
+           d->rs == reg && d->rt == reg && d->imm == step;
+}
+
+/**
+ * @brief Replace canonical byte-copy loops with a single bulk copy. The loop
+ * must be exactly
+ *
+ *     loop: lb   $t, 0($s)
+ *           sb   $t, 0($d)
+ *           addi $s, $s, 1
+ *           addi $d, $d, 1
+ *           addi $n, $n, -1
+ *           bne  $n, $0, loop    (or bgtz $n, loop)
+ *
+ * with four distinct registers other than `$zero`. Only the first record is
+ * replaced, so branches into the middle of the loop still behave.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param n Number of instructions
+ * @return int Number of loops fused
+ */
+int fuse_copy_loops(CPU *cpu, int n)
+{
+    REGISTER *zero = cpu->reg[$zero];
+    int fused = 0;
+
+    for (int i = 0; i + 5 < n; i++)
+    {
+        DECODED *d = &cpu->program[i];
+        REGISTER *t = d[0].rt;
+        REGISTER *s = d[0].rs;
+        REGISTER *dst = d[1].rs;
+        REGISTER *count = d[4].rt;
+
+        if (d[0].exec != exec_LB || d[0].imm != 0 ||
+            d[1].exec != exec_SB || d[1].imm != 0 || d[1].rt != t)
+            continue;
+
+        if (!is_increment(&d[2], s, 1) ||
+            !is_increment(&d[3], dst, 1) ||
+            !is_increment(&d[4], count, -1))
+            continue;
+
+        bool back_edge = (d[5].exec == exec_BNE && d[5].rs == count && d[5].rt == zero) ||
+                         (d[5].exec == exec_BGTZ && d[5].rs == count);
+        if (!back_edge || d[5].imm != -5)
+            continue;
+
+        if (t == zero || s == zero || dst == zero || count == zero ||
+            t == s || t == dst || t == count ||
+            s == dst || s == count || dst == count)
+            continue;
+
+        d->exec = exec_copy_loop;
+        d->fused = 5;
+        fused++;
+    }
+
+    return fused;
+}
+
+/**
+ * @brief Undo every fusion that covers instruction `pc`, so that it runs on its
+ * own record again and can be trapped there.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param pc Instruction index
+ */
+void unfuse(CPU *cpu, int pc)
+{
+    for (int i = pc; i >= 0 && i >= pc - MAX_FUSED; i--)
+    {
+        DECODED *d = &cpu->program[i];
+        if (d->fused > 0 && i + d->fused >= pc)
+            decode_instruction(cpu, d, cpu->text[i]);
+    }
+}
+
+/**
+ * @brief Replace the loaded program, decode it and optimize it, with the PC
+ * pointing at its entry point. Counters kept per instruction are sized to it.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param words Encoded MIPS instructions, at most `MAX_INSTR`
+ * @param n Number of instructions
+ * @param entry Index of the instruction to start at
+ */
+void load_program(CPU *cpu, const uint32_t *words, int n, unsigned int entry)
+{
+    decode_program(cpu, words, n);
+
+    if (cpu->caches != NULL)
+        cache_resize(cpu->caches, n);
+    if (cpu->predictor != NULL)
+        predictor_resize(cpu->predictor, n);
+    if (cpu->coverage != NULL)
+        coverage_resize(cpu->coverage, n);
+
+    // The optimizer starts a block at the PC
+    cpu->pc = entry;
+
+    // A fused record skips instructions the simulators, history and coverage must see
+    if (cpu->caches == NULL && cpu->predictor == NULL && cpu->history == NULL && cpu->coverage == NULL)
+    {
+        if (cpu->optimize)
+            optimize_program(cpu, n);
+        if (cpu->fuse_muldiv)
+            fuse_muldiv(cpu, n);
+        if (cpu->fuse_loops)
+            fuse_copy_loops(cpu, n);
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "hardware.h"
+
+typedef void (*exec_t)(CPU *cpu, DECODED *d);
+
+/**
+ * Most records a fused record executes after its own.
+ */
+#define MAX_FUSED 5
+
+/**
+ * @enum format_t
+ * @brief Instruction format a record was decoded as.
+ */
+typedef enum format_t
+{
+    FORMAT_INVALID,
+    FORMAT_P,
+    FORMAT_R,
+    FORMAT_I,
+    FORMAT_J,
+    FORMAT_F,
+    FORMAT_C,
+} format_t;
+
+/**
+ * @struct DECODED
+ * @brief An instruction decoded once at load time: the handler to run and its
+ * operands already resolved to registers, so the execution loop never looks at
+ * the encoded word again.
+ */
+struct DECODED
+{
+    exec_t exec;    // Executes this instruction
+    REGISTER *rs;   // Source register
+    REGISTER *rt;   // Source or target register
+    REGISTER *rd;   // Destination register
+    int shamt;      // Shift amount
+    int funct;      // Funct value
+    int imm;        // Sign-extended immediate, or jump target
+    byte_t fmt;     // CP1 format
+    byte_t ft;      // CP1 `ft` register
+    byte_t fs;      // CP1 `fs` register
+    byte_t fd;      // CP1 `fd` register
+    byte_t format;  // Instruction format
+    int fused;      // Number of following records this one also executes
+    int instr_code; // Encoded MIPS instruction
+};
+
+void exec_nop(CPU *cpu, DECODED *d);
+void decode_instruction(CPU *cpu, DECODED *d, int instr_code);
+void decode_program(CPU *cpu, const uint32_t *words, int n);
+int fuse_muldiv(CPU *cpu, int n);
+int fuse_copy_loops(CPU *cpu, int n);
+void unfuse(CPU *cpu, int pc);
+void load_program(CPU *cpu, const uint32_t *words, int n, unsigned int entry);
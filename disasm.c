@@ -0,0 +1,438 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "disasm.h"
+#include "hashtable.h"
+#include "utils.h"
+
+#define NUM_CODES 64
+
+/**
+ * @enum operand_t
+ * @brief Field of the encoded word an operand is printed from.
+ */
+typedef enum operand_t
+{
+    OPERAND_RS,   // GPR in bits 21 - 25
+    OPERAND_RT,   // GPR in bits 16 - 20
+    OPERAND_RD,   // GPR in bits 11 - 15
+    OPERAND_FT,   // FPR in bits 16 - 20
+    OPERAND_FS,   // FPR in bits 11 - 15
+    OPERAND_FD,   // FPR in bits 6 - 10
+    OPERAND_IMM,  // Sign-extended immediate
+    OPERAND_ADDR, // Jump target
+    OPERAND_CP0,  // CP0 register number in bits 11 - 15
+    OPERAND_SEL,  // CP0 select in bits 0 - 2
+} operand_t;
+
+/**
+ * @struct TEMPLATE
+ * @brief How one opcode is printed: its mnemonic, already padded as `%-4s `,
+ * and the operands that follow it.
+ */
+typedef struct TEMPLATE
+{
+    char text[24];      // Mnemonic and separator
+    byte_t len;         // Length of `text`
+    byte_t n_operands;  // Number of operands
+    byte_t operands[3]; // Operands, in order
+} TEMPLATE;
+
+static TEMPLATE P_TEMPLATES[NUM_CODES];
+static TEMPLATE R_TEMPLATES[NUM_CODES];
+static TEMPLATE I_TEMPLATES[NUM_CODES];
+static TEMPLATE J_TEMPLATES[NUM_CODES];
+static TEMPLATE F_TEMPLATES[NUM_CODES][NUM_CODES];
+static TEMPLATE MFC1_TEMPLATE;
+static TEMPLATE MTC1_TEMPLATE;
+static TEMPLATE BC1_TEMPLATES[2];
+static TEMPLATE MFC0_TEMPLATE;
+static TEMPLATE MTC0_TEMPLATE;
+static TEMPLATE ERET_TEMPLATE;
+
+static byte_t REG_LEN[NUM_REGISTERS];
+static byte_t FP_REG_LEN[NUM_FP_REGISTERS];
+static bool ready = false;
+
+/**
+ * @brief Fill a template.
+ *
+ * @param t Template to fill
+ * @param name Mnemonic
+ * @param pad Whether to pad the mnemonic to four characters
+ * @param n Number of operands
+ * @param a First operand
+ * @param b Second operand
+ * @param c Third operand
+ */
+static void set_template(TEMPLATE *t, const char *name, bool pad, int n, operand_t a, operand_t b, operand_t c)
+{
+    int len = snprintf(t->text, sizeof(t->text), pad ? "%-4s" : "%s", name);
+    if (n > 0 && len < (int)sizeof(t->text) - 1)
+        t->text[len++] = ' ';
+    t->len = len;
+    t->n_operands = n;
+    t->operands[0] = a;
+    t->operands[1] = b;
+    t->operands[2] = c;
+}
+
+/**
+ * @brief Fill the template of a CP1 arithmetic instruction in one format.
+ *
+ * @param t Template to fill
+ * @param funct Funct value
+ * @param name Mnemonic without the format
+ * @param fmt CP1 format
+ */
+static void set_F_template(TEMPLATE *t, int funct, const char *name, int fmt)
+{
+    char full[16];
+    snprintf(full, sizeof(full), "%s.%s", name, FMT_STR[fmt]);
+
+    switch (funct)
+    {
+    case ADD_F:
+    case SUB_F:
+    case MUL_F:
+    case DIV_F:
+        set_template(t, full, true, 3, OPERAND_FD, OPERAND_FS, OPERAND_FT);
+        break;
+    case C_EQ:
+    case C_LT:
+    case C_LE:
+        set_template(t, full, true, 2, OPERAND_FS, OPERAND_FT, 0);
+        break;
+    default:
+        set_template(t, full, true, 2, OPERAND_FD, OPERAND_FS, 0);
+    }
+}
+
+/**
+ * @brief Build the templates for every opcode in the X-macro tables, once.
+ */
+static void init_templates(void)
+{
+    if (ready)
+        return;
+
+#define _P(NAME, FUNCT, STR, FUNC_PTR) \
+    set_template(&P_TEMPLATES[NAME], STR, true, 3, OPERAND_RD, OPERAND_RS, OPERAND_RT);
+    P_TYPE_TABLE
+#undef _P
+
+#define _R(NAME, FUNCT, STR, FUNC_PTR) \
+    set_template(&R_TEMPLATES[NAME], STR, true, 3, OPERAND_RD, OPERAND_RS, OPERAND_RT);
+    R_TYPE_TABLE
+#undef _R
+
+#define _I(NAME, OP, STR, FUNC_PTR) \
+    set_template(&I_TEMPLATES[NAME], STR, true, 3, OPERAND_RT, OPERAND_RS, OPERAND_IMM);
+    I_TYPE_TABLE
+#undef _I
+
+#define _J(NAME, OP, STR, FUNC_PTR) \
+    set_template(&J_TEMPLATES[NAME], STR, true, 1, OPERAND_ADDR, 0, 0);
+    J_TYPE_TABLE
+#undef _J
+
+    set_template(&P_TEMPLATES[SYSCALL], P_STR[SYSCALL], false, 0, 0, 0, 0);
+    set_template(&I_TEMPLATES[BEQ], I_STR[BEQ], true, 3, OPERAND_RS, OPERAND_RT, OPERAND_IMM);
+    set_template(&I_TEMPLATES[BNE], I_STR[BNE], true, 3, OPERAND_RS, OPERAND_RT, OPERAND_IMM);
+    set_template(&I_TEMPLATES[LUI], I_STR[LUI], true, 2, OPERAND_RT, OPERAND_IMM, 0);
+    set_template(&I_TEMPLATES[LWC1], I_STR[LWC1], true, 3, OPERAND_FT, OPERAND_RS, OPERAND_IMM);
+    set_template(&I_TEMPLATES[LDC1], I_STR[LDC1], true, 3, OPERAND_FT, OPERAND_RS, OPERAND_IMM);
+    set_template(&I_TEMPLATES[SWC1], I_STR[SWC1], true, 3, OPERAND_FT, OPERAND_RS, OPERAND_IMM);
+    set_template(&I_TEMPLATES[SDC1], I_STR[SDC1], true, 3, OPERAND_FT, OPERAND_RS, OPERAND_IMM);
+
+    // Arithmetic mnemonics get the operand format as a suffix, e.g. `add.s`
+    byte_t fmts[] = { FMT_S, FMT_D, FMT_W };
+    for (int m = 0; m < (int)sizeof(fmts); m++)
+    {
+#define _F(NAME, FUNCT, STR, FUNC_PTR) set_F_template(&F_TEMPLATES[fmts[m]][NAME], NAME, STR, fmts[m]);
+        F_TYPE_TABLE
+#undef _F
+    }
+
+    set_template(&MFC1_TEMPLATE, FMT_STR[MF], true, 2, OPERAND_RT, OPERAND_FS, 0);
+    set_template(&MTC1_TEMPLATE, FMT_STR[MT], true, 2, OPERAND_RT, OPERAND_FS, 0);
+    set_template(&BC1_TEMPLATES[0], "bc1f", false, 1, OPERAND_IMM, 0, 0);
+    set_template(&BC1_TEMPLATES[1], "bc1t", false, 1, OPERAND_IMM, 0, 0);
+    set_template(&MFC0_TEMPLATE, "mfc0", true, 3, OPERAND_RT, OPERAND_CP0, OPERAND_SEL);
+    set_template(&MTC0_TEMPLATE, "mtc0", true, 3, OPERAND_RT, OPERAND_CP0, OPERAND_SEL);
+    set_template(&ERET_TEMPLATE, "eret", false, 0, 0, 0, 0);
+
+    for (int k = 0; k < NUM_REGISTERS; k++)
+        REG_LEN[k] = strlen(REG_NUM_STR[k]);
+    for (int k = 0; k < NUM_FP_REGISTERS; k++)
+        FP_REG_LEN[k] = strlen(FP_REG_STR[k]);
+
+    ready = true;
+}
+
+/**
+ * @brief Find the template a decoded instruction is printed with.
+ *
+ * @param d Decoded MIPS instruction
+ * @return const TEMPLATE* Template, or NULL if the instruction is invalid
+ */
+static const TEMPLATE *template_of(const DECODED *d)
+{
+    int code = d->instr_code;
+    int op = (code >> 26) & 0x3F;
+    int fmt = (code >> 21) & 0x1F;
+    int funct = code & 0x3F;
+
+    switch (d->format)
+    {
+    case FORMAT_P:
+        return &P_TEMPLATES[funct];
+    case FORMAT_R:
+        return &R_TEMPLATES[funct];
+    case FORMAT_I:
+        return &I_TEMPLATES[op];
+    case FORMAT_J:
+        return &J_TEMPLATES[op];
+    case FORMAT_F:
+        if (fmt == MF)
+            return &MFC1_TEMPLATE;
+        if (fmt == MT)
+            return &MTC1_TEMPLATE;
+        if (fmt == BC)
+            return &BC1_TEMPLATES[(code >> 16) & 1];
+        return &F_TEMPLATES[fmt][funct];
+    case FORMAT_C:
+        if (fmt == MF)
+            return &MFC0_TEMPLATE;
+        if (fmt == MT)
+            return &MTC0_TEMPLATE;
+        return &ERET_TEMPLATE;
+    default:
+        return NULL;
+    }
+}
+
+/**
+ * @brief Write a decimal integer.
+ *
+ * @param out Where to write it
+ * @param value Integer
+ * @return char* End of what was written
+ */
+static char *put_int(char *out, int value)
+{
+    char digits[12];
+    unsigned int v = value < 0 ? -(unsigned int)value : (unsigned int)value;
+    int n = 0;
+    do
+    {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v > 0);
+
+    if (value < 0)
+        *out++ = '-';
+    while (n > 0)
+        *out++ = digits[--n];
+    return out;
+}
+
+/**
+ * @brief Write an encoded word as data, for words that are not instructions.
+ *
+ * @param out Where to write it
+ * @param word Encoded word
+ * @return char* End of what was written
+ */
+static char *put_word(char *out, unsigned int word)
+{
+    static const char HEX[] = "0123456789abcdef";
+    memcpy(out, ".word 0x", 8);
+    out += 8;
+    for (int shift = 28; shift >= 0; shift -= 4)
+        *out++ = HEX[(word >> shift) & 0xF];
+    return out;
+}
+
+/**
+ * @brief Format one decoded instruction as Assembly, the way the program
+ * listing prints it.
+ *
+ * @param out Buffer of at least `DISASM_LINE` characters, not NUL-terminated
+ * @param d Decoded MIPS instruction
+ * @return int Number of characters written
+ */
+int disasm_instruction(char *out, const DECODED *d)
+{
+    init_templates();
+
+    const TEMPLATE *t = template_of(d);
+    char *p = out;
+    if (t == NULL || t->len == 0)
+        return put_word(p, d->instr_code) - out;
+
+    memcpy(p, t->text, t->len);
+    p += t->len;
+
+    int code = d->instr_code;
+    for (int k = 0; k < t->n_operands; k++)
+    {
+        if (k > 0)
+        {
+            *p++ = ',';
+            *p++ = ' ';
+        }
+
+        int reg;
+        switch (t->operands[k])
+        {
+        case OPERAND_RS:
+            reg = (code >> 21) & 0x1F;
+            memcpy(p, REG_NUM_STR[reg], REG_LEN[reg]);
+            p += REG_LEN[reg];
+            break;
+        case OPERAND_RT:
+            reg = (code >> 16) & 0x1F;
+            memcpy(p, REG_NUM_STR[reg], REG_LEN[reg]);
+            p += REG_LEN[reg];
+            break;
+        case OPERAND_RD:
+            reg = (code >> 11) & 0x1F;
+            memcpy(p, REG_NUM_STR[reg], REG_LEN[reg]);
+            p += REG_LEN[reg];
+            break;
+        case OPERAND_FT:
+            reg = (code >> 16) & 0x1F;
+            memcpy(p, FP_REG_STR[reg], FP_REG_LEN[reg]);
+            p += FP_REG_LEN[reg];
+            break;
+        case OPERAND_FS:
+            reg = (code >> 11) & 0x1F;
+            memcpy(p, FP_REG_STR[reg], FP_REG_LEN[reg]);
+            p += FP_REG_LEN[reg];
+            break;
+        case OPERAND_FD:
+            reg = (code >> 6) & 0x1F;
+            memcpy(p, FP_REG_STR[reg], FP_REG_LEN[reg]);
+            p += FP_REG_LEN[reg];
+            break;
+        case OPERAND_IMM:
+            p = put_int(p, (short)(code & 0xFFFF));
+            break;
+        case OPERAND_ADDR:
+            p = put_int(p, code & 0x3FFFFFF);
+            break;
+        case OPERAND_CP0:
+            *p++ = '$';
+            p = put_int(p, (code >> 11) & 0x1F);
+            break;
+        case OPERAND_SEL:
+            p = put_int(p, code & 0x7);
+            break;
+        }
+    }
+
+    return p - out;
+}
+
+/**
+ * @brief Write a listing of decoded instructions, one `%3d: ` numbered line
+ * each, preceded by a `label:` line for every label on it. Lines are formatted
+ * into one large buffer and written out in bulk.
+ *
+ * @param out Stream to write to
+ * @param program Decoded instructions
+ * @param first Index of the first instruction, for numbering and labels
+ * @param n Number of instructions
+ * @param symbols Labels to print, or NULL
+ */
+void disasm_program(FILE *out, const DECODED *program, int first, int n, SYMBOLS *symbols)
+{
+    static char buffer[DISASM_BUFFER];
+    char *p = buffer;
+    char *end = buffer + sizeof(buffer);
+
+    // Labels are sorted by index, so one cursor walks them alongside
+    int s = 0;
+    while (symbols != NULL && s < symbols->n && symbols->syms[s].index < first)
+        s++;
+
+    for (int i = 0; i < n; i++)
+    {
+        int index = first + i;
+        for (; symbols != NULL && s < symbols->n && symbols->syms[s].index == index; s++)
+        {
+            size_t len = strlen(symbols->syms[s].name);
+            if (end - p < (long)len + 2)
+            {
+                fwrite(buffer, 1, p - buffer, out);
+                p = buffer;
+            }
+            if (end - p < (long)len + 2)
+            {
+                fprintf(out, "%s:\n", symbols->syms[s].name);
+                continue;
+            }
+            memcpy(p, symbols->syms[s].name, len);
+            p += len;
+            *p++ = ':';
+            *p++ = '\n';
+        }
+
+        if (end - p < DISASM_LINE + 16)
+        {
+            fwrite(buffer, 1, p - buffer, out);
+            p = buffer;
+        }
+
+        // Indices are right-aligned to three columns, as `%3d`
+        char *start = p;
+        p = put_int(p, index);
+        int width = p - start;
+        if (width < 3)
+        {
+            memmove(start + 3 - width, start, width);
+            memset(start, ' ', 3 - width);
+            p = start + 3;
+        }
+        *p++ = ':';
+        *p++ = ' ';
+        p += disasm_instruction(p, &program[i]);
+        *p++ = '\n';
+    }
+
+    fwrite(buffer, 1, p - buffer, out);
+}
+
+/**
+ * @brief List encoded instructions with their labels, decoding them a block at
+ * a time so that the listing is not limited to the size of the text segment.
+ *
+ * @param out Stream for the listing
+ * @param cpu CPU the instructions are decoded for
+ * @param words Encoded MIPS instructions
+ * @param first Index of the first instruction
+ * @param n Number of instructions
+ * @param symbols Labels by instruction index, may be NULL
+ */
+void disasm_words(FILE *out, CPU *cpu, const word_t *words, int first, int n, SYMBOLS *symbols)
+{
+    DECODED *block = malloc(DISASM_BLOCK * sizeof(DECODED));
+    if (block == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Program\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int done = 0; done < n; done += DISASM_BLOCK)
+    {
+        int count = n - done < DISASM_BLOCK ? n - done : DISASM_BLOCK;
+        for (int i = 0; i < count; i++)
+            decode_instruction(cpu, &block[i], words[done + i]);
+        disasm_program(out, block, first + done, count, symbols);
+    }
+
+    free(block);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "decode.h"
+#include "symbols.h"
+
+/**
+ * Size of the buffer a listing is formatted into before it is written out.
+ */
+#define DISASM_BUFFER (1 << 20)
+
+/**
+ * Longest line `disasm_instruction` formats, without the newline.
+ */
+#define DISASM_LINE 64
+
+/**
+ * Instructions `disasm_words` decodes and lists at a time.
+ */
+#define DISASM_BLOCK 65536
+
+int disasm_instruction(char *out, const DECODED *d);
+void disasm_program(FILE *out, const DECODED *program, int first, int n, SYMBOLS *symbols);
+void disasm_words(FILE *out, CPU *cpu, const word_t *words, int first, int n, SYMBOLS *symbols);
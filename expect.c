@@ -0,0 +1,201 @@
+// For fopencookie
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "expect.h"
+
+/**
+ * @brief Print bytes as a quoted C string, escaping anything unprintable.
+ */
+static void print_quoted(const char *data, size_t len)
+{
+    fputc('"', stderr);
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = data[i];
+        if (c == '\n')
+            fputs("\\n", stderr);
+        else if (c == '\t')
+            fputs("\\t", stderr);
+        else if (c == '"' || c == '\\')
+            fprintf(stderr, "\\%c", c);
+        else if (c < 0x20 || c >= 0x7F)
+            fprintf(stderr, "\\x%02x", c);
+        else
+            fputc(c, stderr);
+    }
+    fputc('"', stderr);
+}
+
+/**
+ * @brief Report where output first departs from the expected file, with the
+ * bytes leading up to it, which matched, and what each has from there. Only
+ * the write that differed is known of the actual output past that point.
+ *
+ * @param expect Expected output
+ * @param problem How the output departs from the file
+ * @param data Rest of the write that differed, from the first differing byte
+ * @param len Length of the rest of the write
+ */
+static void report(EXPECT *expect, const char *problem, const char *data, size_t len)
+{
+    size_t at = expect->offset;
+    size_t from = at > EXPECT_CONTEXT ? at - EXPECT_CONTEXT : 0;
+    size_t line = 1;
+    size_t column = 1;
+    for (size_t i = 0; i < at; i++)
+    {
+        column = expect->data[i] == '\n' ? 1 : column + 1;
+        line += expect->data[i] == '\n';
+    }
+
+    size_t ahead = expect->size - at < EXPECT_CONTEXT ? expect->size - at : EXPECT_CONTEXT;
+    size_t got = len < EXPECT_CONTEXT ? len : EXPECT_CONTEXT;
+
+    fprintf(stderr, "ERROR: Output %s %s at byte %zu (line %zu, column %zu)\n", problem, expect->file, at, line,
+            column);
+    fprintf(stderr, "  matched:  ");
+    print_quoted(expect->data + from, at - from);
+    fprintf(stderr, "\n  expected: ");
+    print_quoted(expect->data + at, ahead);
+    fprintf(stderr, "\n  actual:   ");
+    print_quoted(data, got);
+    fprintf(stderr, "\n");
+}
+
+/**
+ * @brief Compare a write with the expected output and pass on what matches.
+ * On the first difference, stop at once with `_exit`: this runs inside a
+ * write, which `exit` would try to flush.
+ */
+static ssize_t expect_write(void *cookie, const char *data, size_t len)
+{
+    EXPECT *expect = cookie;
+    if (expect->muted)
+        return len;
+
+    size_t left = expect->size - expect->offset;
+    size_t n = len < left ? len : left;
+    const char *want = expect->data + expect->offset;
+
+    size_t same = 0;
+    while (same < n && data[same] == want[same])
+        same++;
+
+    fwrite(data, 1, same, expect->out);
+    expect->offset += same;
+
+    if (same < len)
+    {
+        fflush(expect->out);
+        report(expect, same < n ? "differs from" : "runs past the end of", data + same, len - same);
+        fflush(stderr);
+        _exit(EXIT_FAILURE);
+    }
+
+    return len;
+}
+
+/**
+ * @brief Map an expected file and open a stream that checks output against
+ * it. The stream is unbuffered, so a difference is caught at the write that
+ * makes it even if the program never writes again.
+ *
+ * @param file Name of the expected file
+ * @param out Stream matching output is passed on to
+ * @return EXPECT*
+ */
+EXPECT *init_EXPECT(const char *file, FILE *out)
+{
+    EXPECT *expect = calloc(1, sizeof(EXPECT));
+    if (expect == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Expect\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int fd = open(file, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        fprintf(stderr, "ERROR: Failed to open %s\n", file);
+        exit(EXIT_FAILURE);
+    }
+
+    expect->file = file;
+    expect->size = st.st_size;
+    if (expect->size > 0)
+    {
+        void *data = mmap(NULL, expect->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            fprintf(stderr, "ERROR: Failed to map %s\n", file);
+            exit(EXIT_FAILURE);
+        }
+        expect->data = data;
+    }
+    close(fd);
+
+    cookie_io_functions_t functions = { .write = expect_write };
+    expect->out = out;
+    expect->stream = fopencookie(expect, "w", functions);
+    if (expect->stream == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Expect\n");
+        exit(EXIT_FAILURE);
+    }
+    setvbuf(expect->stream, NULL, _IONBF, 0);
+
+    return expect;
+}
+
+/**
+ * @brief Close the checking stream and unmap the expected file.
+ *
+ * @param expect Expected output to be destroyed
+ */
+void free_EXPECT(EXPECT *expect)
+{
+    fclose(expect->stream);
+    if (expect->data != NULL)
+        munmap((void *)expect->data, expect->size);
+    free(expect);
+    expect = NULL;
+}
+
+/**
+ * @brief Discard output instead of comparing it, or compare it again, as
+ * with output that would not reach the terminal.
+ *
+ * @param expect Expected output
+ * @param muted Discard output
+ */
+void expect_mute(EXPECT *expect, bool muted)
+{
+    fflush(expect->stream);
+    expect->muted = muted;
+}
+
+/**
+ * @brief Check that output did not stop short of the expected file, reporting
+ * where it did.
+ *
+ * @param expect Expected output
+ * @return true if all of the expected file was written
+ */
+bool expect_finish(EXPECT *expect)
+{
+    fflush(expect->stream);
+    fflush(expect->out);
+    if (expect->offset == expect->size)
+        return true;
+
+    report(expect, "stops short of", "", 0);
+    return false;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/**
+ * Bytes of context shown either side of where output first differs.
+ */
+#define EXPECT_CONTEXT 24
+
+/**
+ * @struct EXPECT
+ * @brief Output checked against an expected file as it is written, rather
+ * than diffed once the program has finished. Bytes written to `stream` are
+ * compared with the mapped file and passed on to `out`; the first byte that
+ * differs, or goes past the end of the file, is reported and ends the process
+ * there and then, so a program that goes wrong early does not run on.
+ */
+typedef struct EXPECT
+{
+    const char *file; // Name of the expected file
+    const char *data; // Expected bytes, mapped, or NULL when there are none
+    size_t size;      // Length of the expected file
+    size_t offset;    // Bytes matched so far
+    bool muted;       // Writes are discarded rather than compared
+    FILE *out;        // Stream matching output is passed on to
+    FILE *stream;     // Stream that checks what is written to it
+} EXPECT;
+
+EXPECT *init_EXPECT(const char *file, FILE *out);
+void free_EXPECT(EXPECT *expect);
+void expect_mute(EXPECT *expect, bool muted);
+bool expect_finish(EXPECT *expect);
@@ -1,18 +1,110 @@
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "cache.h"
+#include "cp0.h"
 #include "functions.h"
+#include "harts.h"
+#include "history.h"
+#include "io.h"
+#include "memory.h"
+#include "predictor.h"
+
+/**
+ * Report a data access to the cache simulator when it is enabled.
+ */
+static inline void trace_data(CPU *cpu, word_t addr, access_t kind)
+{
+    if (cpu->caches != NULL)
+        cache_record(cpu->caches, cpu->pc, addr, kind);
+}
+
+/**
+ * Report a conditional branch or indirect jump to the branch predictor when it
+ * is enabled.
+ */
+static inline void trace_branch(CPU *cpu, int imm, bool taken)
+{
+    if (cpu->predictor != NULL)
+        predictor_branch(cpu->predictor, cpu->pc, imm <= 0, taken);
+}
+
+static inline void trace_indirect(CPU *cpu, word_t target)
+{
+    if (cpu->predictor != NULL)
+        predictor_indirect(cpu->predictor, cpu->pc, target);
+}
+
+/**
+ * Raise an address error for an access not aligned to its size, when a
+ * handler is loaded to take it. Without one the access goes ahead.
+ */
+static inline bool misaligned(CPU *cpu, word_t addr, word_t mask, exc_t code)
+{
+    return (addr & mask) != 0 && cp0_address_error(cpu, code, addr);
+}
+
+/**
+ * CP1 register access. Singles and words are the raw bits of one register; a
+ * double is the even/odd pair starting at `r & ~1`, low word first.
+ */
+static float get_s(FPU *fpu, int r)
+{
+    float value;
+    memcpy(&value, &fpu->f[r], sizeof(value));
+    return value;
+}
+
+static void set_s(FPU *fpu, int r, float value)
+{
+    memcpy(&fpu->f[r], &value, sizeof(value));
+}
+
+static double get_d(FPU *fpu, int r)
+{
+    __uint64_t bits = fpu->f[r & ~1] | (__uint64_t)fpu->f[(r & ~1) + 1] << 32;
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static void set_d(FPU *fpu, int r, double value)
+{
+    __uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    fpu->f[r & ~1] = bits;
+    fpu->f[(r & ~1) + 1] = bits >> 32;
+}
+
+void MIPS_abs_f(CPU *cpu, int fmt, int ft, int fs, int fd)
+{
+    if (fmt == FMT_D)
+        set_d(cpu->fpu, fd, fabs(get_d(cpu->fpu, fs)));
+    else
+        set_s(cpu->fpu, fd, fabsf(get_s(cpu->fpu, fs)));
+}
 
 void MIPS_add(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct)
 {
     rd->value.wd = rs->value.wd + rt->value.wd;
 }
 
+void MIPS_add_f(CPU *cpu, int fmt, int ft, int fs, int fd)
+{
+    if (fmt == FMT_D)
+        set_d(cpu->fpu, fd, get_d(cpu->fpu, fs) + get_d(cpu->fpu, ft));
+    else
+        set_s(cpu->fpu, fd, get_s(cpu->fpu, fs) + get_s(cpu->fpu, ft));
+}
+
 void MIPS_addi(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
 {
     rt->value.wd = rs->value.wd + imm;
 }
 
-void MIPS_addiu(CPU *cpu, REGISTER *rs, REGISTER *rt, unsigned int imm)
+void MIPS_addiu(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
 {
     rt->value.wd = rs->value.wd + imm;
 }
@@ -32,88 +124,230 @@ void MIPS_addu(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, in
     rd->value.wd = rs->value.wd + rt->value.wd;
 }
 
+void MIPS_bc1(CPU *cpu, int cc, bool tf, int imm)
+{
+    bool taken = cpu->fpu->cc[cc] == tf;
+    trace_branch(cpu, imm, taken);
+    if (taken)
+        cpu->pc += imm - 1;
+}
+
 void MIPS_beq(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
 {
-    if (rs->value.wd == rt->value.wd)
+    bool taken = rs->value.wd == rt->value.wd;
+    trace_branch(cpu, imm, taken);
+    if (taken)
         cpu->pc += imm - 1;
 }
 
 void MIPS_bgez(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
 {
-    if (rs->value.wd >= 0)
+    bool taken = rs->value.wd >= 0;
+    trace_branch(cpu, imm, taken);
+    if (taken)
         cpu->pc += imm - 1;
 }
 
 void MIPS_bgtz(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
 {
-    if (rs->value.wd > 0)
+    bool taken = rs->value.wd > 0;
+    trace_branch(cpu, imm, taken);
+    if (taken)
         cpu->pc += imm - 1;
 }
 
 void MIPS_blez(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
 {
-    if (rs->value.wd <= 0)
+    bool taken = rs->value.wd <= 0;
+    trace_branch(cpu, imm, taken);
+    if (taken)
         cpu->pc += imm - 1;
 }
 
 void MIPS_bltz(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
 {
-    if (rs->value.wd < 0)
+    bool taken = rs->value.wd < 0;
+    trace_branch(cpu, imm, taken);
+    if (taken)
         cpu->pc += imm - 1;
 }
 
 void MIPS_bne(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
 {
-    if (rs->value.wd != rt->value.wd)
+    bool taken = rs->value.wd != rt->value.wd;
+    trace_branch(cpu, imm, taken);
+    if (taken)
         cpu->pc += imm - 1;
 }
 
 void MIPS_break(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct)
 {
-    cpu->pc = rd->value.wd;
+    if (!cp0_exception(cpu, EXC_BP))
+        cpu->pc = rd->value.wd;
+}
+
+void MIPS_c_eq(CPU *cpu, int fmt, int ft, int fs, int fd)
+{
+    if (fmt == FMT_D)
+        cpu->fpu->cc[fd >> 2] = get_d(cpu->fpu, fs) == get_d(cpu->fpu, ft);
+    else
+        cpu->fpu->cc[fd >> 2] = get_s(cpu->fpu, fs) == get_s(cpu->fpu, ft);
+}
+
+void MIPS_c_le(CPU *cpu, int fmt, int ft, int fs, int fd)
+{
+    if (fmt == FMT_D)
+        cpu->fpu->cc[fd >> 2] = get_d(cpu->fpu, fs) <= get_d(cpu->fpu, ft);
+    else
+        cpu->fpu->cc[fd >> 2] = get_s(cpu->fpu, fs) <= get_s(cpu->fpu, ft);
+}
+
+void MIPS_c_lt(CPU *cpu, int fmt, int ft, int fs, int fd)
+{
+    if (fmt == FMT_D)
+        cpu->fpu->cc[fd >> 2] = get_d(cpu->fpu, fs) < get_d(cpu->fpu, ft);
+    else
+        cpu->fpu->cc[fd >> 2] = get_s(cpu->fpu, fs) < get_s(cpu->fpu, ft);
+}
+
+void MIPS_cvt_d(CPU *cpu, int fmt, int ft, int fs, int fd)
+{
+    if (fmt == FMT_W)
+        set_d(cpu->fpu, fd, (__int32_t)cpu->fpu->f[fs]);
+    else
+        set_d(cpu->fpu, fd, get_s(cpu->fpu, fs));
+}
+
+void MIPS_cvt_s(CPU *cpu, int fmt, int ft, int fs, int fd)
+{
+    if (fmt == FMT_W)
+        set_s(cpu->fpu, fd, (__int32_t)cpu->fpu->f[fs]);
+    else
+        set_s(cpu->fpu, fd, get_d(cpu->fpu, fs));
+}
+
+/**
+ * @brief Convert to a word using the default round-to-nearest mode.
+ */
+void MIPS_cvt_w(CPU *cpu, int fmt, int ft, int fs, int fd)
+{
+    if (fmt == FMT_D)
+        cpu->fpu->f[fd] = (__int32_t)lrint(get_d(cpu->fpu, fs));
+    else
+        cpu->fpu->f[fd] = (__int32_t)lrintf(get_s(cpu->fpu, fs));
 }
 
+/**
+ * Division by zero leaves HI and LO unchanged (MIPS leaves them undefined), and
+ * the overflowing INT_MIN / -1 gives LO = INT_MIN, HI = 0 as on hardware.
+ */
 void MIPS_div(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct)
 {
-    cpu->reg[HI]->value.wd = rs->value.wd % rt->value.wd;
-    cpu->reg[LO]->value.wd = rs->value.wd / rt->value.wd;
+    __int32_t n = rs->value.wd;
+    __int32_t m = rt->value.wd;
+    if (m == 0)
+        return;
+
+    if (m == -1)
+    {
+        cpu->reg[LO]->value.wd = -(word_t)n;
+        cpu->reg[HI]->value.wd = 0;
+        return;
+    }
+
+    cpu->reg[LO]->value.wd = n / m;
+    cpu->reg[HI]->value.wd = n % m;
 }
 
-void MIPS_divu(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd)
+void MIPS_div_f(CPU *cpu, int fmt, int ft, int fs, int fd)
 {
-    cpu->reg[HI]->value.wd = rs->value.wd % rt->value.wd;
-    cpu->reg[LO]->value.wd = rs->value.wd / rt->value.wd;
+    if (fmt == FMT_D)
+        set_d(cpu->fpu, fd, get_d(cpu->fpu, fs) / get_d(cpu->fpu, ft));
+    else
+        set_s(cpu->fpu, fd, get_s(cpu->fpu, fs) / get_s(cpu->fpu, ft));
 }
 
-void MIPS_j(CPU *cpu, REGISTER *addr)
+void MIPS_divu(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct)
 {
-    cpu->pc = addr->value.wd;
+    word_t n = rs->value.wd;
+    word_t m = rt->value.wd;
+    if (m == 0)
+        return;
+
+    cpu->reg[LO]->value.wd = n / m;
+    cpu->reg[HI]->value.wd = n % m;
 }
 
-void MIPS_jal(CPU *cpu, REGISTER *addr)
+void MIPS_eret(CPU *cpu)
 {
-    cpu->pc = addr->value.wd;
+    if (!cp0_yield(cpu))
+        cp0_eret(cpu);
 }
 
-void MIPS_jalr(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd)
+/**
+ * Jumps take word addresses in `addr`, within the 256 MB region of the
+ * instruction after the jump, and byte addresses in registers, so a link
+ * register holds the address of the instruction after it. The `- 1` makes up
+ * for the execution loop's `pc++`.
+ */
+void MIPS_j(CPU *cpu, int addr)
 {
-    rd->value.wd = cpu->pc;
-    cpu->pc = rs->value.wd;
+    cpu->pc = jump_index(cpu, cpu->pc, addr) - 1;
+}
+
+void MIPS_jal(CPU *cpu, int addr)
+{
+    cpu->reg[$ra]->value.wd = text_address(cpu, cpu->pc + 1);
+    cpu->pc = jump_index(cpu, cpu->pc, addr) - 1;
+}
+
+void MIPS_jalr(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct)
+{
+    word_t target = rs->value.wd;
+    trace_indirect(cpu, text_index(cpu, target));
+    rd->value.wd = text_address(cpu, cpu->pc + 1);
+    cpu->pc = text_index(cpu, target) - 1;
 }
 
 void MIPS_jr(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct)
 {
-    cpu->pc = rs->value.wd;
+    trace_indirect(cpu, text_index(cpu, rs->value.wd));
+    cpu->pc = text_index(cpu, rs->value.wd) - 1;
 }
 
 void MIPS_lb(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
 {
-    rt->value.wd = rs->value.wd;
+    trace_data(cpu, rs->value.wd + imm, ACCESS_LOAD);
+    rt->value.wd = (__int8_t)mem_load_byte(cpu->mem, rs->value.wd + imm);
+}
+
+void MIPS_ldc1(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
+{
+    trace_data(cpu, rs->value.wd + imm, ACCESS_LOAD);
+    cpu->fpu->f[rt->name & ~1] = mem_load_word(cpu->mem, rs->value.wd + imm);
+    cpu->fpu->f[(rt->name & ~1) + 1] = mem_load_word(cpu->mem, rs->value.wd + imm + 4);
 }
 
 void MIPS_lh(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
 {
-    rt->value.wd = rs->value.wd;
+    if (misaligned(cpu, rs->value.wd + imm, 1, EXC_ADEL))
+        return;
+    trace_data(cpu, rs->value.wd + imm, ACCESS_LOAD);
+    rt->value.wd = (__int16_t)mem_load_half(cpu->mem, rs->value.wd + imm);
+}
+
+void MIPS_ll(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
+{
+    word_t addr = rs->value.wd + imm;
+    if (misaligned(cpu, addr, 3, EXC_ADEL))
+        return;
+    trace_data(cpu, addr, ACCESS_LOAD);
+    rt->value.wd = mem_load_word(cpu->mem, addr);
+
+    // Reserve the word; `sc` succeeds only if it still holds this value
+    cpu->ll_addr = addr;
+    cpu->ll_value = rt->value.wd;
+    cpu->ll_valid = true;
 }
 
 void MIPS_lui(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
@@ -123,12 +357,31 @@ void MIPS_lui(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
 
 void MIPS_lw(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
 {
-    rt->value.wd = rs->value.wd;
+    if (misaligned(cpu, rs->value.wd + imm, 3, EXC_ADEL))
+        return;
+    trace_data(cpu, rs->value.wd + imm, ACCESS_LOAD);
+    rt->value.wd = mem_load_word(cpu->mem, rs->value.wd + imm);
+}
+
+void MIPS_lwc1(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
+{
+    trace_data(cpu, rs->value.wd + imm, ACCESS_LOAD);
+    cpu->fpu->f[rt->name] = mem_load_word(cpu->mem, rs->value.wd + imm);
 }
 
-void MIPS_mfc0()
+/**
+ * CP0 instructions yield when run in a slice, so that Count is exact and a
+ * change to the timer or interrupt state is seen before the next slice.
+ */
+void MIPS_mfc0(CPU *cpu, REGISTER *rt, int rd, int sel)
 {
+    if (!cp0_yield(cpu))
+        rt->value.wd = cp0_read(cpu, rd, sel);
+}
 
+void MIPS_mfc1(CPU *cpu, REGISTER *rt, int fs)
+{
+    rt->value.wd = cpu->fpu->f[fs];
 }
 
 void MIPS_mfhi(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct)
@@ -141,36 +394,74 @@ void MIPS_mflo(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, in
     rd->value.wd = cpu->reg[LO]->value.wd;
 }
 
-void MIPS_mtc0()
+void MIPS_mtc0(CPU *cpu, REGISTER *rt, int rd, int sel)
 {
+    if (!cp0_yield(cpu))
+        cp0_write(cpu, rd, sel, rt->value.wd);
+}
 
+void MIPS_mov_f(CPU *cpu, int fmt, int ft, int fs, int fd)
+{
+    if (fmt == FMT_D)
+        set_d(cpu->fpu, fd, get_d(cpu->fpu, fs));
+    else
+        cpu->fpu->f[fd] = cpu->fpu->f[fs];
+}
+
+void MIPS_mtc1(CPU *cpu, REGISTER *rt, int fs)
+{
+    cpu->fpu->f[fs] = rt->value.wd;
 }
 
 void MIPS_mthi(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct)
 {
-    cpu->reg[HI]->value.wd = rd->value.wd;
+    cpu->reg[HI]->value.wd = rs->value.wd;
 }
 
 void MIPS_mtlo(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct)
 {
-    cpu->reg[LO]->value.wd = rd->value.wd;
+    cpu->reg[LO]->value.wd = rs->value.wd;
 }
 
+/**
+ * The full 64-bit product comes from one host multiply, split into HI and LO.
+ */
 void MIPS_mult(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct)
 {
-    cpu->reg[HI]->value.wd = cpu->reg[LO]->value.wd = rs->value.wd * rt->value.wd;
+    __int64_t product = (__int64_t)rs->value.wd * rt->value.wd;
+    cpu->reg[LO]->value.wd = (word_t)product;
+    cpu->reg[HI]->value.wd = (word_t)(product >> 32);
 }
 
 void MIPS_multu(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct)
 {
-    cpu->reg[HI]->value.wd = cpu->reg[LO]->value.wd = rs->value.wd * rt->value.wd;
+    __uint64_t product = (__uint64_t)(word_t)rs->value.wd * (word_t)rt->value.wd;
+    cpu->reg[LO]->value.wd = (word_t)product;
+    cpu->reg[HI]->value.wd = (word_t)(product >> 32);
 }
 
+/**
+ * `mul` only writes `rd`; MIPS32 leaves HI and LO unpredictable afterwards.
+ */
 void MIPS_mul(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct)
 {
-    // rd->value.wd = rs->value.wd * rt->value.wd;
-    MIPS_mult(cpu, rs, rt, rd, shamt, funct);
-    MIPS_mflo(cpu, rs, rt, rd, shamt, funct);
+    rd->value.wd = (word_t)rs->value.wd * (word_t)rt->value.wd;
+}
+
+void MIPS_mul_f(CPU *cpu, int fmt, int ft, int fs, int fd)
+{
+    if (fmt == FMT_D)
+        set_d(cpu->fpu, fd, get_d(cpu->fpu, fs) * get_d(cpu->fpu, ft));
+    else
+        set_s(cpu->fpu, fd, get_s(cpu->fpu, fs) * get_s(cpu->fpu, ft));
+}
+
+void MIPS_neg_f(CPU *cpu, int fmt, int ft, int fs, int fd)
+{
+    if (fmt == FMT_D)
+        set_d(cpu->fpu, fd, -get_d(cpu->fpu, fs));
+    else
+        set_s(cpu->fpu, fd, -get_s(cpu->fpu, fs));
 }
 
 void MIPS_nor(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct)
@@ -190,12 +481,39 @@ void MIPS_ori(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
 
 void MIPS_sb(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
 {
-    rs->value.wd = rt->value.wd;
+    trace_data(cpu, rs->value.wd + imm, ACCESS_STORE);
+    mem_store_byte(cpu->mem, rs->value.wd + imm, rt->value.wd);
+}
+
+void MIPS_sc(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
+{
+    word_t addr = rs->value.wd + imm;
+    if (misaligned(cpu, addr, 3, EXC_ADES))
+        return;
+    trace_data(cpu, addr, ACCESS_STORE);
+
+    bool stored = cpu->ll_valid && cpu->ll_addr == addr &&
+                  mem_swap_word(cpu->mem, addr, cpu->ll_value, rt->value.wd);
+    cpu->ll_valid = false;
+
+    // The decoder does not send `sc` to the sink, as rt is also its source
+    if (rt != cpu->reg[$zero])
+        rt->value.wd = stored;
+}
+
+void MIPS_sdc1(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
+{
+    trace_data(cpu, rs->value.wd + imm, ACCESS_STORE);
+    mem_store_word(cpu->mem, rs->value.wd + imm, cpu->fpu->f[rt->name & ~1]);
+    mem_store_word(cpu->mem, rs->value.wd + imm + 4, cpu->fpu->f[(rt->name & ~1) + 1]);
 }
 
 void MIPS_sh(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
 {
-    rs->value.wd = rt->value.wd;
+    if (misaligned(cpu, rs->value.wd + imm, 1, EXC_ADES))
+        return;
+    trace_data(cpu, rs->value.wd + imm, ACCESS_STORE);
+    mem_store_half(cpu->mem, rs->value.wd + imm, rt->value.wd);
 }
 
 void MIPS_sll(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct)
@@ -218,14 +536,14 @@ void MIPS_slti(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
     rt->value.wd = rs->value.wd < imm ? 1 : 0;
 }
 
-void MIPS_sltiu(CPU *cpu, REGISTER *rs, REGISTER *rt, unsigned int imm)
+void MIPS_sltiu(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
 {
-    rt->value.wd = rs->value.wd < imm ? 1 : 0;
+    rt->value.wd = (word_t)rs->value.wd < (word_t)imm ? 1 : 0;
 }
 
 void MIPS_sltu(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct)
 {
-    rd->value.wd = rs->value.wd < rt->value.wd ? 1 : 0;
+    rd->value.wd = (word_t)rs->value.wd < (word_t)rt->value.wd ? 1 : 0;
 }
 
 void MIPS_sra(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct)
@@ -238,14 +556,22 @@ void MIPS_srav(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, in
     rd->value.wd = rt->value.wd >> rs->value.wd;
 }
 
-void MIPS_srl(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, unsigned int shamt, int funct)
+void MIPS_srl(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct)
 {
-    rd->value.wd = rs->value.wd >> shamt;
+    rd->value.wd = (word_t)rt->value.wd >> shamt;
 }
 
-void MIPS_srlv(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, unsigned int shamt, int funct)
+void MIPS_srlv(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct)
 {
-    rd->value.wd = rt->value.wd >> rs->value.wd;
+    rd->value.wd = (word_t)rt->value.wd >> (rs->value.wd & 0x1F);
+}
+
+void MIPS_sqrt_f(CPU *cpu, int fmt, int ft, int fs, int fd)
+{
+    if (fmt == FMT_D)
+        set_d(cpu->fpu, fd, sqrt(get_d(cpu->fpu, fs)));
+    else
+        set_s(cpu->fpu, fd, sqrtf(get_s(cpu->fpu, fs)));
 }
 
 void MIPS_sub(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct)
@@ -253,6 +579,14 @@ void MIPS_sub(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int
     rd->value.wd = rs->value.wd - rt->value.wd;
 }
 
+void MIPS_sub_f(CPU *cpu, int fmt, int ft, int fs, int fd)
+{
+    if (fmt == FMT_D)
+        set_d(cpu->fpu, fd, get_d(cpu->fpu, fs) - get_d(cpu->fpu, ft));
+    else
+        set_s(cpu->fpu, fd, get_s(cpu->fpu, fs) - get_s(cpu->fpu, ft));
+}
+
 void MIPS_subu(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct)
 {
     rd->value.wd = rs->value.wd - rt->value.wd;
@@ -260,63 +594,263 @@ void MIPS_subu(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, in
 
 void MIPS_sw(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
 {
-    rs->value.wd = rt->value.wd;
+    if (misaligned(cpu, rs->value.wd + imm, 3, EXC_ADES))
+        return;
+    trace_data(cpu, rs->value.wd + imm, ACCESS_STORE);
+    mem_store_word(cpu->mem, rs->value.wd + imm, rt->value.wd);
+}
+
+void MIPS_swc1(CPU *cpu, REGISTER *rs, REGISTER *rt, int imm)
+{
+    trace_data(cpu, rs->value.wd + imm, ACCESS_STORE);
+    mem_store_word(cpu->mem, rs->value.wd + imm, cpu->fpu->f[rt->name]);
+}
+
+/**
+ * Built-in syscalls, taking arguments in `$a0` - `$a3`, or `$f12` for floats,
+ * and returning results in `$v0`, or `$f0` for floats.
+ */
+static void sys_print_int(CPU *cpu, void *ctx)
+{
+    fprintf(cpu->io->out, "%d", cpu->reg[$a0]->value.wd);
+}
+
+static void sys_print_float(CPU *cpu, void *ctx)
+{
+    fprintf(cpu->io->out, "%.8f", get_s(cpu->fpu, 12));
+}
+
+static void sys_print_double(CPU *cpu, void *ctx)
+{
+    fprintf(cpu->io->out, "%.18g", get_d(cpu->fpu, 12));
+}
+
+static void sys_print_string(CPU *cpu, void *ctx)
+{
+    io_print_string(cpu->io, cpu->mem, cpu->reg[$a0]->value.wd);
+}
+
+static void sys_read_int(CPU *cpu, void *ctx)
+{
+    cpu->reg[$v0]->value.wd = io_read_int(cpu->io);
+}
+
+static void sys_read_float(CPU *cpu, void *ctx)
+{
+    set_s(cpu->fpu, 0, io_read_double(cpu->io));
+}
+
+static void sys_read_double(CPU *cpu, void *ctx)
+{
+    set_d(cpu->fpu, 0, io_read_double(cpu->io));
+}
+
+static void sys_read_string(CPU *cpu, void *ctx)
+{
+    io_read_string(cpu->io, cpu->mem, cpu->reg[$a0]->value.wd, cpu->reg[$a1]->value.wd);
+}
+
+static void sys_sbrk(CPU *cpu, void *ctx)
+{
+    cpu->reg[$v0]->value.wd = cpu->mem->brk;
+    cpu->mem->brk += (cpu->reg[$a0]->value.wd + 3) & ~3;
+}
+
+static void sys_exit(CPU *cpu, void *ctx)
+{
+    cpu->pc = cpu->n_instr;
+}
+
+static void sys_print_char(CPU *cpu, void *ctx)
+{
+    fputc(cpu->reg[$a0]->value.wd, cpu->io->out);
+}
+
+static void sys_read_char(CPU *cpu, void *ctx)
+{
+    cpu->reg[$v0]->value.wd = io_getc(cpu->io);
+}
+
+static void sys_open(CPU *cpu, void *ctx)
+{
+    REGISTER **reg = cpu->reg;
+    reg[$v0]->value.wd = io_open(cpu->io, cpu->mem,
+        reg[$a0]->value.wd,
+        reg[$a1]->value.wd,
+        reg[$a2]->value.wd);
+}
+
+static void sys_read(CPU *cpu, void *ctx)
+{
+    REGISTER **reg = cpu->reg;
+    reg[$v0]->value.wd = io_read(cpu->io, cpu->mem,
+        reg[$a0]->value.wd,
+        reg[$a1]->value.wd,
+        reg[$a2]->value.wd);
+}
+
+static void sys_write(CPU *cpu, void *ctx)
+{
+    REGISTER **reg = cpu->reg;
+    reg[$v0]->value.wd = io_write(cpu->io, cpu->mem,
+        reg[$a0]->value.wd,
+        reg[$a1]->value.wd,
+        reg[$a2]->value.wd);
+}
+
+static void sys_close(CPU *cpu, void *ctx)
+{
+    io_close(cpu->io, cpu->reg[$a0]->value.wd);
+}
+
+static void sys_exit2(CPU *cpu, void *ctx)
+{
+    cpu->exit_code = cpu->reg[$a0]->value.wd;
+    cpu->pc = cpu->n_instr;
+}
+
+static void sys_memcpy(CPU *cpu, void *ctx)
+{
+    REGISTER **reg = cpu->reg;
+    mem_copy(cpu->mem, reg[$a0]->value.wd, reg[$a1]->value.wd, (word_t)reg[$a2]->value.wd);
+    reg[$v0]->value.wd = reg[$a0]->value.wd;
+}
+
+static void sys_memset(CPU *cpu, void *ctx)
+{
+    REGISTER **reg = cpu->reg;
+    mem_set(cpu->mem, reg[$a0]->value.wd, reg[$a1]->value.wd, (word_t)reg[$a2]->value.wd);
+    reg[$v0]->value.wd = reg[$a0]->value.wd;
+}
+
+static void sys_memcmp(CPU *cpu, void *ctx)
+{
+    REGISTER **reg = cpu->reg;
+    reg[$v0]->value.wd = mem_compare(cpu->mem,
+        reg[$a0]->value.wd,
+        reg[$a1]->value.wd,
+        (word_t)reg[$a2]->value.wd);
+}
+
+static void sys_strlen(CPU *cpu, void *ctx)
+{
+    cpu->reg[$v0]->value.wd = mem_strlen(cpu->mem, cpu->reg[$a0]->value.wd);
+}
+
+#define _S(NAME, CODE, FUNC_PTR) [NAME] = { FUNC_PTR, NULL },
+static const SYSCALL_ENTRY DEFAULT_SYSCALLS[] = { SYSCALL_TABLE };
+#undef _S
+
+#define NUM_DEFAULT_SYSCALLS (int)(sizeof(DEFAULT_SYSCALLS) / sizeof(DEFAULT_SYSCALLS[0]))
+
+/**
+ * @brief Initialise a syscall table holding the built-in syscalls.
+ *
+ * @return SYSCALLS*
+ */
+SYSCALLS *init_SYSCALLS(void)
+{
+    SYSCALLS *syscalls = malloc(sizeof(SYSCALLS));
+    SYSCALL_ENTRY *table = malloc(sizeof(DEFAULT_SYSCALLS));
+    if (syscalls == NULL || table == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Syscalls\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(table, DEFAULT_SYSCALLS, sizeof(DEFAULT_SYSCALLS));
+    syscalls->table = table;
+    syscalls->n = NUM_DEFAULT_SYSCALLS;
+
+    return syscalls;
+}
+
+/**
+ * @brief Destroy a syscall table.
+ *
+ * @param syscalls Syscall table to be destroyed
+ */
+void free_SYSCALLS(SYSCALLS *syscalls)
+{
+    free(syscalls->table);
+    free(syscalls);
+    syscalls = NULL;
+}
+
+/**
+ * @brief Install the handler for a syscall code, growing the table to reach
+ * it. A NULL handler restores the built-in syscall, or leaves the code
+ * unknown if there is none.
+ *
+ * @param syscalls Syscall table
+ * @param code `$v0` value, from 0 to `VM_MAX_SYSCALL`
+ * @param handler Handler, or NULL
+ * @param ctx Passed to `handler`
+ */
+void syscall_install(SYSCALLS *syscalls, int code, syscall_t handler, void *ctx)
+{
+    if (code >= syscalls->n)
+    {
+        syscalls->table = realloc(syscalls->table, ((size_t)code + 1) * sizeof(SYSCALL_ENTRY));
+        if (syscalls->table == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to allocate memory for Syscalls\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(&syscalls->table[syscalls->n], 0, ((size_t)code + 1 - syscalls->n) * sizeof(SYSCALL_ENTRY));
+        syscalls->n = code + 1;
+    }
+
+    if (handler == NULL && code < NUM_DEFAULT_SYSCALLS)
+        syscalls->table[code] = DEFAULT_SYSCALLS[code];
+    else
+        syscalls->table[code] = (SYSCALL_ENTRY){ handler, ctx };
 }
 
 /**
- * @brief Emulation of syscall function which checks `$v0` to set syscall
- * behaviour and arguments `$a0`, `$a1`, `$a2`, `$a3`.
+ * @brief Carry out the syscall selected by `$v0` through the CPU's syscall
+ * table. An unknown code halts the program.
  *
  * @param cpu Pointer to instantiation of CPU
  */
-void MIPS_syscall(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct)
+void run_syscall(CPU *cpu)
 {
-    switch (cpu->reg[$v0]->value.wd)
+    unsigned int code = cpu->reg[$v0]->value.wd;
+    SYSCALLS *syscalls = cpu->syscalls;
+
+    // Harts share I/O and the program break, so one syscall runs at a time
+    if (cpu->harts != NULL)
+        pthread_mutex_lock(&cpu->harts->lock);
+
+    if (code < (unsigned int)syscalls->n && syscalls->table[code].handler != NULL)
     {
-    case 1:
-        printf("%d", cpu->reg[$a0]->value.wd);
-        break;
-    // case 2:
-    //     printf("%lf", cpu->reg[$f12]->value.fl);
-    //     break;
-    // case 3:
-    //     printf("%lf", cpu->reg[$f12]->value.fl);
-    //     printf("%lf", cpu->reg[$f13]->value.fl);
-    //     break;
-    // case 4:
-    //     printf("%s", (char *)(__intptr_t)(cpu->reg[$v0]->value.wd));
-    //     break;
-    // case 5:
-    //     scanf("%d", &(cpu->reg[$v0]->value.wd));
-    //     break;
-    // case 6:
-    //     scanf("%f", &(cpu->reg[$f0]->value.fl));
-    //     break;
-    // case 7:
-    //     scanf("%f", &(cpu->reg[$f0]->value.fl));
-    //     scanf("%f", &(cpu->reg[$f1]->value.fl));
-    //     break;
-    // case 8:
-    //     fgets((char *)(__intptr_t)cpu->reg[$a0]->value.wd,
-    //         cpu->reg[$a1]->value.wd,
-    //         stdin);
-    //     break;
-    // case 9:
-    //     cpu->reg[$v0]->value.wd = (__intptr_t)sbrk(cpu->reg[$a0]->value.wd);
-    //     break;
-    case 10:
-        cpu->pc = MAX_INSTR;
-        break;
-    case 11:
-        printf("%c", cpu->reg[$a0]->value.wd);
-        break;
-    default:
-        printf("Unknown system call: %d\n", cpu->reg[$v0]->value.wd);
-        cpu->pc = MAX_INSTR;
+        syscalls->table[code].handler(cpu, syscalls->table[code].ctx);
     }
+    else if (!cp0_exception(cpu, EXC_SYS))
+    {
+        fprintf(cpu->io->out, "Unknown system call: %d\n", cpu->reg[$v0]->value.wd);
+        cpu->pc = cpu->n_instr;
+    }
+
+    if (cpu->harts != NULL)
+        pthread_mutex_unlock(&cpu->harts->lock);
+}
+
+/**
+ * @brief Emulation of syscall function. While execution is recorded, the
+ * history logs or replays it.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ */
+void MIPS_syscall(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct)
+{
+    if (cpu->history != NULL)
+        history_syscall(cpu->history);
+    else
+        run_syscall(cpu);
 }
 
-void MIPS_xor(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd)
+void MIPS_xor(CPU *cpu, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct)
 {
     rd->value.wd = rs->value.wd ^ rt->value.wd;
 }
@@ -0,0 +1,722 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "gdbstub.h"
+#include "memory.h"
+
+#define PACKET_SIZE 4096
+
+/**
+ * gdb's numbers for the registers that are not general purpose.
+ */
+enum
+{
+    GDB_STATUS = 32,
+    GDB_LO,
+    GDB_HI,
+    GDB_BADVADDR,
+    GDB_CAUSE,
+    GDB_PC,
+    GDB_F0,
+    GDB_FCSR = GDB_F0 + NUM_FP_REGISTERS,
+    GDB_FIR,
+};
+
+static const char HEX[] = "0123456789abcdef";
+
+static int hex_digit(char c)
+{
+    if ('0' <= c && c <= '9')
+        return c - '0';
+    if ('a' <= c && c <= 'f')
+        return c - 'a' + 10;
+    if ('A' <= c && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * @brief Decode a hex byte.
+ *
+ * @return int Byte, or -1 if either digit is invalid
+ */
+static int hex_byte(const char *str)
+{
+    int hi = hex_digit(str[0]);
+    int lo = hi >= 0 ? hex_digit(str[1]) : -1;
+    return lo >= 0 ? hi << 4 | lo : -1;
+}
+
+/**
+ * @brief Append a word to a reply in target byte order, least significant
+ * byte first.
+ */
+static char *put_word(char *out, word_t value)
+{
+    for (int i = 0; i < 4; i++, value >>= 8)
+    {
+        *out++ = HEX[(value >> 4) & 0xf];
+        *out++ = HEX[value & 0xf];
+    }
+    *out = '\0';
+    return out;
+}
+
+/**
+ * @brief Decode a word in target byte order.
+ *
+ * @return bool true if all eight digits are valid
+ */
+static bool get_word(const char *str, word_t *value)
+{
+    *value = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        int b = hex_byte(str + 2 * i);
+        if (b < 0)
+            return false;
+        *value |= (word_t)b << (8 * i);
+    }
+    return true;
+}
+
+static int get_char(DEBUGGER *dbg)
+{
+    unsigned char c;
+    ssize_t r;
+    do
+        r = recv(dbg->gdb_fd, &c, 1, 0);
+    while (r < 0 && errno == EINTR);
+    return r == 1 ? c : -1;
+}
+
+static void put_bytes(DEBUGGER *dbg, const char *buf, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t r = send(dbg->gdb_fd, buf, n, MSG_NOSIGNAL);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return;
+        buf += r;
+        n -= r;
+    }
+}
+
+/**
+ * @brief Read the next packet, acknowledging it unless gdb turned that off.
+ * Acknowledgements and interrupt bytes between packets are skipped.
+ *
+ * @param dbg Debugger
+ * @param buf Filled with the packet data, NUL-terminated
+ * @return int Length of the packet, or -1 if gdb hung up
+ */
+static int read_packet(DEBUGGER *dbg, char *buf)
+{
+    for (;;)
+    {
+        int c;
+        while ((c = get_char(dbg)) != '$')
+            if (c < 0)
+                return -1;
+
+        int len = 0;
+        unsigned char sum = 0;
+        while ((c = get_char(dbg)) != '#')
+        {
+            if (c < 0)
+                return -1;
+            if (len < PACKET_SIZE - 1)
+                buf[len++] = c;
+            sum += c;
+        }
+        buf[len] = '\0';
+
+        char check[2];
+        for (int i = 0; i < 2; i++)
+            if ((c = get_char(dbg)) < 0)
+                return -1;
+            else
+                check[i] = c;
+
+        if (dbg->no_ack)
+            return len;
+
+        if (hex_byte(check) == sum)
+        {
+            put_bytes(dbg, "+", 1);
+            return len;
+        }
+        put_bytes(dbg, "-", 1);
+    }
+}
+
+/**
+ * @brief Send a packet, resending it until gdb acknowledges it.
+ *
+ * @param dbg Debugger
+ * @param data Packet data
+ */
+static void send_packet(DEBUGGER *dbg, const char *data)
+{
+    static char buf[PACKET_SIZE + 4];
+    unsigned char sum = 0;
+    size_t len = 0;
+
+    buf[len++] = '$';
+    for (const char *p = data; *p != '\0' && len < PACKET_SIZE; p++)
+    {
+        buf[len++] = *p;
+        sum += *p;
+    }
+    buf[len++] = '#';
+    buf[len++] = HEX[sum >> 4];
+    buf[len++] = HEX[sum & 0xf];
+
+    for (;;)
+    {
+        put_bytes(dbg, buf, len);
+        if (dbg->no_ack)
+            return;
+
+        int c;
+        while ((c = get_char(dbg)) != '+' && c != '-')
+            if (c < 0)
+                return;
+        if (c == '+')
+            return;
+    }
+}
+
+/**
+ * @brief Condition flags of the FPU packed as in the FCSR: flag 0 in bit 23,
+ * flags 1 - 7 in bits 25 - 31.
+ */
+static word_t fcsr(FPU *fpu)
+{
+    word_t value = fpu->cc[0] ? 1U << 23 : 0;
+    for (int i = 1; i < 8; i++)
+        if (fpu->cc[i])
+            value |= 1U << (24 + i);
+    return value;
+}
+
+static word_t get_register(CPU *cpu, int regnum)
+{
+    if (regnum < GDB_STATUS)
+        return cpu->reg[regnum]->value.wd;
+    if (GDB_F0 <= regnum && regnum < GDB_FCSR)
+        return cpu->fpu->f[regnum - GDB_F0];
+
+    switch (regnum)
+    {
+    case GDB_LO:
+        return cpu->reg[LO]->value.wd;
+    case GDB_HI:
+        return cpu->reg[HI]->value.wd;
+    case GDB_PC:
+        return text_address(cpu, cpu->pc);
+    case GDB_STATUS:
+        return cpu->cp0->status;
+    case GDB_BADVADDR:
+        return cpu->cp0->badvaddr;
+    case GDB_CAUSE:
+        return cpu->cp0->cause;
+    case GDB_FCSR:
+        return fcsr(cpu->fpu);
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Set a register. Writes to CP0 registers and FIR are ignored.
+ */
+static void set_register(CPU *cpu, int regnum, word_t value)
+{
+    if (regnum < GDB_STATUS)
+    {
+        cpu->reg[regnum]->value.wd = regnum == $zero ? 0 : value;
+        return;
+    }
+
+    if (GDB_F0 <= regnum && regnum < GDB_FCSR)
+    {
+        cpu->fpu->f[regnum - GDB_F0] = value;
+        return;
+    }
+
+    switch (regnum)
+    {
+    case GDB_LO:
+        cpu->reg[LO]->value.wd = value;
+        break;
+    case GDB_HI:
+        cpu->reg[HI]->value.wd = value;
+        break;
+    case GDB_PC:
+        cpu->pc = text_index(cpu, value);
+        break;
+    case GDB_FCSR:
+        cpu->fpu->cc[0] = (value >> 23) & 1;
+        for (int i = 1; i < 8; i++)
+            cpu->fpu->cc[i] = (value >> (24 + i)) & 1;
+        break;
+    }
+}
+
+/**
+ * @brief Read a byte as gdb sees memory: the text segment from its base
+ * address, guest memory elsewhere.
+ */
+static byte_t read_byte(DEBUGGER *dbg, word_t addr)
+{
+    word_t offset = addr - dbg->cpu->text_base;
+    if (offset < (word_t)dbg->n * 4)
+        return (dbg->cpu->text[offset / 4] >> (8 * (offset % 4))) & 0xff;
+    return mem_load_byte(dbg->cpu->mem, addr);
+}
+
+/**
+ * @brief Write a byte as gdb sees memory. A write to the text segment
+ * re-decodes the instruction, keeping any breakpoint on it.
+ */
+static void write_byte(DEBUGGER *dbg, word_t addr, byte_t value)
+{
+    CPU *cpu = dbg->cpu;
+    word_t offset = addr - cpu->text_base;
+    if (offset >= (word_t)dbg->n * 4)
+    {
+        mem_store_byte(cpu->mem, addr, value);
+        return;
+    }
+
+    int pc = offset / 4;
+    int shift = 8 * (offset % 4);
+    cpu->text[pc] = (cpu->text[pc] & ~(0xff << shift)) | (value << shift);
+
+    bool had = debug_unbreak(dbg, pc);
+    unfuse(cpu, pc);
+    decode_instruction(cpu, &cpu->program[pc], cpu->text[pc]);
+    if (had)
+        debug_break(dbg, pc);
+}
+
+/**
+ * @brief Describe the registers to gdb: the standard MIPS features in the
+ * numbering `g` packets use.
+ */
+static const char *target_xml(void)
+{
+    static char xml[PACKET_SIZE * 2];
+    if (xml[0] != '\0')
+        return xml;
+
+    char *p = xml;
+    p += sprintf(p,
+        "<?xml version=\"1.0\"?>"
+        "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+        "<target><architecture>mips</architecture>"
+        "<feature name=\"org.gnu.gdb.mips.cpu\">");
+    for (int i = 0; i < 32; i++)
+        p += sprintf(p, "<reg name=\"r%d\" bitsize=\"32\" regnum=\"%d\"/>", i, i);
+    p += sprintf(p,
+        "<reg name=\"lo\" bitsize=\"32\" regnum=\"%d\"/>"
+        "<reg name=\"hi\" bitsize=\"32\" regnum=\"%d\"/>"
+        "<reg name=\"pc\" bitsize=\"32\" regnum=\"%d\"/>"
+        "</feature><feature name=\"org.gnu.gdb.mips.cp0\">"
+        "<reg name=\"status\" bitsize=\"32\" regnum=\"%d\"/>"
+        "<reg name=\"badvaddr\" bitsize=\"32\" regnum=\"%d\"/>"
+        "<reg name=\"cause\" bitsize=\"32\" regnum=\"%d\"/>"
+        "</feature><feature name=\"org.gnu.gdb.mips.fpu\">",
+        GDB_LO, GDB_HI, GDB_PC, GDB_STATUS, GDB_BADVADDR, GDB_CAUSE);
+    for (int i = 0; i < NUM_FP_REGISTERS; i++)
+        p += sprintf(p, "<reg name=\"f%d\" bitsize=\"32\" type=\"ieee_single\" regnum=\"%d\"/>", i, GDB_F0 + i);
+    sprintf(p,
+        "<reg name=\"fcsr\" bitsize=\"32\" group=\"float\" regnum=\"%d\"/>"
+        "<reg name=\"fir\" bitsize=\"32\" group=\"float\" regnum=\"%d\"/>"
+        "</feature></target>",
+        GDB_FCSR, GDB_FIR);
+    return xml;
+}
+
+/**
+ * @brief Answer `qXfer:features:read:target.xml:OFFSET,LENGTH`.
+ */
+static void read_features(const char *args, char *reply)
+{
+    unsigned int offset, length;
+    if (strncmp(args, "target.xml:", 11) != 0 || sscanf(args + 11, "%x,%x", &offset, &length) != 2)
+    {
+        strcpy(reply, "E00");
+        return;
+    }
+
+    const char *xml = target_xml();
+    size_t size = strlen(xml);
+    if (offset > size)
+        offset = size;
+    if (length > PACKET_SIZE - 2)
+        length = PACKET_SIZE - 2;
+
+    size_t n = size - offset < length ? size - offset : length;
+    reply[0] = offset + n < size ? 'm' : 'l';
+    memcpy(reply + 1, xml + offset, n);
+    reply[n + 1] = '\0';
+}
+
+static void handle_query(DEBUGGER *dbg, const char *packet, char *reply)
+{
+    if (strncmp(packet, "qSupported", 10) == 0)
+        sprintf(reply, "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+%s",
+            PACKET_SIZE,
+            dbg->cpu->history != NULL ? ";ReverseStep+;ReverseContinue+" : "");
+    else if (strncmp(packet, "qXfer:features:read:", 20) == 0)
+        read_features(packet + 20, reply);
+    else if (strcmp(packet, "qAttached") == 0)
+        strcpy(reply, "1");
+    else if (strcmp(packet, "qC") == 0)
+        strcpy(reply, "QC1");
+    else if (strcmp(packet, "qfThreadInfo") == 0)
+        strcpy(reply, "m1");
+    else if (strcmp(packet, "qsThreadInfo") == 0)
+        strcpy(reply, "l");
+    else if (strcmp(packet, "qSymbol::") == 0)
+        strcpy(reply, "OK");
+}
+
+/**
+ * @brief Answer `m ADDR,LENGTH`.
+ */
+static void read_memory(DEBUGGER *dbg, const char *args, char *reply)
+{
+    unsigned int addr, length;
+    if (sscanf(args, "%x,%x", &addr, &length) != 2)
+    {
+        strcpy(reply, "E01");
+        return;
+    }
+
+    if (length > (PACKET_SIZE - 1) / 2)
+        length = (PACKET_SIZE - 1) / 2;
+
+    char *p = reply;
+    for (unsigned int i = 0; i < length; i++)
+    {
+        byte_t b = read_byte(dbg, addr + i);
+        *p++ = HEX[b >> 4];
+        *p++ = HEX[b & 0xf];
+    }
+    *p = '\0';
+}
+
+/**
+ * @brief Answer `M ADDR,LENGTH:BYTES`.
+ */
+static void write_memory(DEBUGGER *dbg, const char *args, char *reply)
+{
+    unsigned int addr, length;
+    const char *data = strchr(args, ':');
+    if (sscanf(args, "%x,%x", &addr, &length) != 2 || data == NULL || strlen(data + 1) < 2 * length)
+    {
+        strcpy(reply, "E01");
+        return;
+    }
+
+    for (unsigned int i = 0; i < length; i++)
+    {
+        int b = hex_byte(data + 1 + 2 * i);
+        if (b < 0)
+        {
+            strcpy(reply, "E01");
+            return;
+        }
+        write_byte(dbg, addr + i, b);
+    }
+    strcpy(reply, "OK");
+}
+
+/**
+ * @brief Answer `Z` and `z`: insert or remove a software or hardware
+ * breakpoint, both of which are patched traps. Watchpoints are left to gdb.
+ */
+static void handle_breakpoint(DEBUGGER *dbg, const char *packet, char *reply)
+{
+    unsigned int addr;
+    if (packet[1] != '0' && packet[1] != '1')
+        return;
+
+    if (sscanf(packet + 2, ",%x", &addr) != 1 || addr % 4 != 0 ||
+        text_index(dbg->cpu, addr) >= (unsigned int)dbg->n)
+    {
+        strcpy(reply, "E01");
+        return;
+    }
+
+    int pc = text_index(dbg->cpu, addr);
+    if (packet[0] == 'z')
+        debug_unbreak(dbg, pc);
+    else if (debug_break(dbg, pc) < 0)
+    {
+        strcpy(reply, "E02");
+        return;
+    }
+    strcpy(reply, "OK");
+}
+
+/**
+ * @brief Answer `c [ADDR]` and `s [ADDR]`.
+ *
+ * @return true if the engine should resume at full speed or the program has
+ * finished, false if the reply has been written
+ */
+static bool resume(DEBUGGER *dbg, const char *packet, char *reply)
+{
+    unsigned int addr;
+    if (sscanf(packet + 1, "%x", &addr) == 1)
+        dbg->cpu->pc = text_index(dbg->cpu, addr);
+
+    // gdb is stopped at `cpu->pc`, so a breakpoint there is stepped over
+    stop_t reason = debug_run(dbg, 1, true);
+    if (reason == STOP_EXIT)
+        return true;
+
+    if (packet[0] == 'c' && reason == STOP_STEPS)
+    {
+        dbg->running = 1;
+        return true;
+    }
+
+    sprintf(reply, "S%02x", reason == STOP_INTERRUPT ? GDB_SIGINT : GDB_SIGTRAP);
+    return false;
+}
+
+/**
+ * @brief Answer `bs` and `bc` by going back through the recorded history.
+ */
+static void reverse(DEBUGGER *dbg, const char *packet, char *reply)
+{
+    if (dbg->cpu->history == NULL || (packet[1] != 's' && packet[1] != 'c'))
+        return;
+
+    stop_t reason = packet[1] == 's' ? debug_reverse_step(dbg, 1) : debug_reverse_continue(dbg);
+    if (reason == STOP_HISTORY)
+        sprintf(reply, "T%02xreplaylog:begin;", GDB_SIGTRAP);
+    else
+        sprintf(reply, "S%02x", GDB_SIGTRAP);
+}
+
+/**
+ * @brief Serve gdb while the program is stopped. Returns when the engine
+ * should run on from `cpu->pc`, or after gdb kills or detaches from it.
+ *
+ * @param dbg Debugger connected to gdb
+ * @param sig Signal to report as the reason for stopping, or 0 if gdb has not
+ * resumed the program yet
+ */
+void gdb_serve(DEBUGGER *dbg, int sig)
+{
+    CPU *cpu = dbg->cpu;
+    char packet[PACKET_SIZE];
+    char reply[PACKET_SIZE];
+    dbg->running = 0;
+
+    if (sig != 0)
+    {
+        sprintf(reply, "S%02x", sig);
+        send_packet(dbg, reply);
+    }
+
+    for (;;)
+    {
+        if (read_packet(dbg, packet) < 0)
+        {
+            // gdb went away: let the program finish on its own
+            debug_detach(dbg);
+            return;
+        }
+
+        reply[0] = '\0';
+        switch (packet[0])
+        {
+        case '?':
+            sprintf(reply, "S%02x", GDB_SIGTRAP);
+            break;
+        case 'g':
+            for (int i = 0; i < GDB_NUM_REGISTERS; i++)
+                put_word(reply + 8 * i, get_register(cpu, i));
+            break;
+        case 'G':
+            for (int i = 0; i < GDB_NUM_REGISTERS; i++)
+            {
+                word_t value;
+                if (get_word(packet + 1 + 8 * i, &value))
+                    set_register(cpu, i, value);
+            }
+            strcpy(reply, "OK");
+            break;
+        case 'p':
+        {
+            int regnum = strtol(packet + 1, NULL, 16);
+            if (regnum < GDB_NUM_REGISTERS)
+                put_word(reply, get_register(cpu, regnum));
+            else
+                strcpy(reply, "E01");
+            break;
+        }
+        case 'P':
+        {
+            char *value_str;
+            int regnum = strtol(packet + 1, &value_str, 16);
+            word_t value;
+            if (regnum < GDB_NUM_REGISTERS && *value_str == '=' && get_word(value_str + 1, &value))
+            {
+                set_register(cpu, regnum, value);
+                strcpy(reply, "OK");
+            }
+            else
+            {
+                strcpy(reply, "E01");
+            }
+            break;
+        }
+        case 'm':
+            read_memory(dbg, packet + 1, reply);
+            break;
+        case 'M':
+            write_memory(dbg, packet + 1, reply);
+            break;
+        case 'Z':
+        case 'z':
+            handle_breakpoint(dbg, packet, reply);
+            break;
+        case 'c':
+        case 's':
+            if (resume(dbg, packet, reply))
+                return;
+            break;
+        case 'b':
+            reverse(dbg, packet, reply);
+            break;
+        case 'H':
+        case 'T':
+            strcpy(reply, "OK");
+            break;
+        case 'q':
+            handle_query(dbg, packet, reply);
+            break;
+        case 'Q':
+            if (strcmp(packet, "QStartNoAckMode") == 0)
+            {
+                send_packet(dbg, "OK");
+                dbg->no_ack = true;
+                continue;
+            }
+            break;
+        case 'D':
+            send_packet(dbg, "OK");
+            debug_detach(dbg);
+            return;
+        case 'k':
+            cpu->pc = cpu->n_instr;
+            debug_detach(dbg);
+            return;
+        case 'v':
+            if (strncmp(packet, "vKill", 5) == 0)
+            {
+                send_packet(dbg, "OK");
+                cpu->pc = cpu->n_instr;
+                debug_detach(dbg);
+                return;
+            }
+            break;
+        }
+
+        send_packet(dbg, reply);
+    }
+}
+
+/**
+ * @brief Tell gdb the program has exited, with its exit status.
+ *
+ * @param dbg Debugger connected to gdb
+ */
+void gdb_exited(DEBUGGER *dbg)
+{
+    char reply[8];
+    sprintf(reply, "W%02x", dbg->cpu->exit_code & 0xff);
+    send_packet(dbg, reply);
+}
+
+/**
+ * @brief Listen on a Unix socket or a localhost TCP port and wait for gdb to
+ * connect.
+ *
+ * @param socket_path Path of the Unix socket, or NULL to use `port`
+ * @param port TCP port on 127.0.0.1
+ * @return int Connection to gdb
+ */
+int gdb_accept(const char *socket_path, int port)
+{
+    int listener;
+    if (socket_path != NULL)
+    {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        if (strlen(socket_path) >= sizeof(addr.sun_path))
+        {
+            fprintf(stderr, "ERROR: Socket path too long %s\n", socket_path);
+            exit(EXIT_FAILURE);
+        }
+        strcpy(addr.sun_path, socket_path);
+        unlink(socket_path);
+
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listener, 1) < 0)
+        {
+            fprintf(stderr, "ERROR: Failed to listen on %s\n", socket_path);
+            exit(EXIT_FAILURE);
+        }
+        fprintf(stderr, "Waiting for gdb on %s\n", socket_path);
+    }
+    else
+    {
+        struct sockaddr_in addr = { .sin_family = AF_INET };
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        int on = 1;
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        if (listener >= 0)
+            setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listener, 1) < 0)
+        {
+            fprintf(stderr, "ERROR: Failed to listen on port %d\n", port);
+            exit(EXIT_FAILURE);
+        }
+        fprintf(stderr, "Waiting for gdb on localhost:%d\n", port);
+    }
+
+    int fd = accept(listener, NULL, NULL);
+    close(listener);
+    if (socket_path != NULL)
+        unlink(socket_path);
+    if (fd < 0)
+    {
+        fprintf(stderr, "ERROR: Failed to accept gdb\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int on = 1;
+    if (socket_path == NULL)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
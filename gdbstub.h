@@ -0,0 +1,24 @@
+#pragma once
+
+#include "debug.h"
+
+/**
+ * Signals reported to gdb in stop replies.
+ */
+#define GDB_SIGINT 2
+#define GDB_SIGTRAP 5
+
+/**
+ * Byte gdb sends outside a packet to interrupt the target.
+ */
+#define GDB_INTERRUPT 0x03
+
+/**
+ * Registers in gdb's numbering for MIPS32: $0 - $31, status, lo, hi, badvaddr,
+ * cause, pc, $f0 - $f31, fcsr and fir.
+ */
+#define GDB_NUM_REGISTERS 72
+
+int gdb_accept(const char *socket_path, int port);
+void gdb_serve(DEBUGGER *dbg, int sig);
+void gdb_exited(DEBUGGER *dbg);
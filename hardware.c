@@ -1,7 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 
+#include "cache.h"
+#include "coverage.h"
+#include "cp0.h"
+#include "functions.h"
 #include "hardware.h"
+#include "harts.h"
+#include "history.h"
+#include "io.h"
+#include "predictor.h"
 
 /**
  * @brief Initialise a register given a register name.
@@ -28,6 +37,62 @@ REGISTER *init_reg(reg_name_t name)
     return reg;
 }
 
+/**
+ * @brief Initialise empty guest memory. Page tables and pages are allocated on
+ * demand.
+ *
+ * @return MEMORY*
+ */
+MEMORY *init_MEMORY()
+{
+    MEMORY *mem = calloc(1, sizeof(MEMORY));
+    if (mem == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    mem->brk = HEAP_BASE;
+
+    return mem;
+}
+
+/**
+ * @brief Initialise the floating-point coprocessor with zeroed registers and
+ * condition flags.
+ *
+ * @return FPU*
+ */
+FPU *init_FPU()
+{
+    FPU *fpu = calloc(1, sizeof(FPU));
+    if (fpu == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for FPU\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return fpu;
+}
+
+/**
+ * @brief Initialise the system control coprocessor in its reset state.
+ *
+ * @return CP0*
+ */
+CP0 *init_CP0()
+{
+    CP0 *cp0 = malloc(sizeof(CP0));
+    if (cp0 == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for CP0\n");
+        exit(EXIT_FAILURE);
+    }
+
+    cp0_reset(cp0);
+    return cp0;
+}
+
 /**
  * @brief Initialise the CPU and its registers.
  *
@@ -46,9 +111,34 @@ CPU *init_CPU()
 
     for (int i = 0; i < NUM_REGISTERS; i++)
         cpu->reg[i] = init_reg(i);
+    cpu->sink = (REGISTER){ .name = $zero };
 
-    for (int i = 0; i < MAX_INSTR; i++)
-        cpu->cache[i] = 0;
+    cpu->text = NULL;
+    cpu->text_base = 0;
+    cpu->program = NULL;
+    cpu->n_instr = 0;
+    cpu->fpu = init_FPU();
+    cpu->cp0 = init_CP0();
+    cpu->mem = init_MEMORY();
+    cpu->exit_code = EXIT_SUCCESS;
+    cpu->caches = NULL;
+    cpu->predictor = NULL;
+    cpu->coverage = NULL;
+    cpu->history = NULL;
+    cpu->io = init_IO();
+    cpu->syscalls = init_SYSCALLS();
+    cpu->fuse_muldiv = true;
+    cpu->fuse_loops = false;
+    cpu->optimize = false;
+    cpu->harts = NULL;
+    cpu->hart_id = 0;
+    cpu->ll_addr = 0;
+    cpu->ll_value = 0;
+    cpu->ll_valid = false;
+    cpu->slicing = false;
+    cpu->yield = false;
+    cpu->yield_pc = 0;
+    cpu->invalid_at = -1;
 
     return cpu;
 }
@@ -64,6 +154,70 @@ void free_reg(REGISTER *reg)
     reg = NULL;
 }
 
+/**
+ * @brief Check whether a guest page lies in one of the file mappings.
+ */
+static bool mapped(MEMORY *mem, byte_t *page)
+{
+    for (int i = 0; i < mem->n_maps; i++)
+    {
+        if (mem->maps[i].base <= page && page < mem->maps[i].base + mem->maps[i].len)
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Destroy guest memory by freeing every allocated page and page table,
+ * and unmapping the files mapped into it.
+ *
+ * @param mem Memory to be destroyed
+ */
+void free_MEMORY(MEMORY *mem)
+{
+    for (unsigned int i = 0; i < NUM_DIRS; i++)
+    {
+        if (mem->dir[i] == NULL)
+            continue;
+
+        for (unsigned int j = 0; j < NUM_PAGES_PER_DIR; j++)
+        {
+            if (mem->dir[i][j] != NULL && !mapped(mem, mem->dir[i][j]))
+                free(mem->dir[i][j]);
+        }
+        free(mem->dir[i]);
+    }
+
+    for (int i = 0; i < mem->n_maps; i++)
+        munmap(mem->maps[i].base, mem->maps[i].len);
+
+    free(mem);
+    mem = NULL;
+}
+
+/**
+ * @brief Destroy the floating-point coprocessor.
+ *
+ * @param fpu FPU to be destroyed
+ */
+void free_FPU(FPU *fpu)
+{
+    free(fpu);
+    fpu = NULL;
+}
+
+/**
+ * @brief Destroy the system control coprocessor.
+ *
+ * @param cp0 CP0 to be destroyed
+ */
+void free_CP0(CP0 *cp0)
+{
+    free(cp0);
+    cp0 = NULL;
+}
+
 /**
  * @brief Destroy the CPU by freeing all its registers and then itself.
  *
@@ -71,9 +225,35 @@ void free_reg(REGISTER *reg)
  */
 void free_CPU(CPU *cpu)
 {
+    // The other harts share hart 0's memory, I/O, syscalls and coverage
+    bool owner = cpu->hart_id == 0;
+    if (owner && cpu->harts != NULL)
+        free_HARTS(cpu->harts);
+
     for (int i = 0; i < NUM_REGISTERS; i++)
         free_reg(cpu->reg[i]);
 
+    free(cpu->text);
+    free(cpu->program);
+    free_FPU(cpu->fpu);
+    free_CP0(cpu->cp0);
+
+    // Pages must be writable again before they are freed
+    if (cpu->history != NULL)
+        free_HISTORY(cpu->history);
+    if (owner)
+        free_MEMORY(cpu->mem);
+    if (cpu->caches != NULL)
+        free_CACHE_SIM(cpu->caches);
+    if (cpu->predictor != NULL)
+        free_PREDICTOR(cpu->predictor);
+    if (owner)
+    {
+        if (cpu->coverage != NULL)
+            free_COVERAGE(cpu->coverage);
+        free_IO(cpu->io);
+        free_SYSCALLS(cpu->syscalls);
+    }
     free(cpu);
     cpu = NULL;
 }
@@ -1,10 +1,45 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #include "utils.h"
 
-#define MAX_INSTR 1000
+/**
+ * Most instructions a text segment can hold. The text and its decoded copy
+ * are allocated to the size of the program loaded.
+ */
+#define MAX_INSTR (1 << 22)
 #define MAX_MEMORY 65536
 
+/**
+ * Guest memory is a sparse two-level page table over the 32-bit address space.
+ * Pages are allocated on first write; reads of unmapped pages return zero.
+ */
+#define PAGE_BITS 12
+#define PAGE_SIZE (1U << PAGE_BITS)
+#define PAGE_MASK (PAGE_SIZE - 1)
+#define DIR_BITS 10
+#define NUM_DIRS (1U << DIR_BITS)
+#define NUM_PAGES_PER_DIR (1U << (32 - PAGE_BITS - DIR_BITS))
+
+/**
+ * SPIM memory layout.
+ */
+#define DATA_BASE 0x10010000
+#define HEAP_BASE 0x10040000
+#define STACK_TOP 0x7fffeffc
+
+/**
+ * Most file mappings guest memory can hold, one per loaded segment.
+ */
+#define MAX_MAPPINGS 16
+
+/**
+ * Most page handlers guest memory can hold, one per memory-mapped device.
+ */
+#define MAX_PAGE_HANDLERS 4
+
 /**
  * MIPS data types
  */
@@ -33,37 +68,194 @@ typedef struct REGISTER
 } REGISTER;
 
 /**
- * @struct MEMORY
- * @brief
+ * @struct MAPPING
+ * @brief Host pages mapped from a file and installed as guest pages, which are
+ * unmapped rather than freed.
  */
-typedef struct MEMORY
+typedef struct MAPPING
 {
-    int memory[MAX_INSTR];
-} MEMORY;
+    byte_t *base; // Host address of the mapping
+    size_t len;   // Length of the mapping in bytes
+} MAPPING;
+
+typedef struct MEMORY MEMORY;
 
 /**
- * @struct CPU
- * @brief A MIPS CPU has a program counter, registers and cache.
+ * Device access through a page handler: `offset` is from the handler's base
+ * and `size` is 1, 2 or 4 bytes.
+ */
+typedef word_t (*page_read_t)(MEMORY *mem, void *ctx, word_t offset, int size);
+typedef void (*page_write_t)(MEMORY *mem, void *ctx, word_t offset, word_t value, int size);
+
+/**
+ * @struct PAGE_HANDLER
+ * @brief Pages whose loads and stores go to a device instead of RAM. They are
+ * never installed in the page table, so only accesses that miss it are
+ * checked against the handlers.
  */
-typedef struct CPU
+typedef struct PAGE_HANDLER
 {
-    unsigned int pc;              // Program Counter
-    REGISTER *reg[NUM_REGISTERS]; // Array of CPU registers
-    int cache[MAX_INSTR];         // Cache to store programs
-} CPU;
+    word_t base;        // Guest address of the first page
+    word_t len;         // Length in bytes, a multiple of the page size
+    page_read_t read;   // Called for loads
+    page_write_t write; // Called for stores
+    void *ctx;          // Passed to `read` and `write`
+} PAGE_HANDLER;
+
+/**
+ * @struct MEMORY
+ * @brief Guest memory as a page directory of lazily allocated page tables, the
+ * program break used by `sbrk`, and the devices mapped into it.
+ */
+struct MEMORY
+{
+    byte_t **dir[NUM_DIRS];                   // Page tables, NULL until a page in them is touched
+    word_t brk;                               // Program break
+    MAPPING maps[MAX_MAPPINGS];               // File mappings backing some of the pages
+    int n_maps;                               // Number of file mappings
+    PAGE_HANDLER handlers[MAX_PAGE_HANDLERS]; // Memory-mapped devices
+    int n_handlers;                           // Number of page handlers
+};
 
 /**
  * @struct FPU
- * @brief A MIPS FPU has a program counter, registers and cache.
+ * @brief A MIPS floating-point coprocessor (CP1) has 32 single-precision
+ * registers, where a double occupies an even/odd pair with the low word in the
+ * even register, and eight condition flags set by compares.
  */
 typedef struct FPU
+{
+    word_t f[NUM_FP_REGISTERS]; // Raw bits of $f0 - $f31
+    bool cc[8];                 // Condition flags
+} FPU;
+
+/**
+ * @struct CP0
+ * @brief The MIPS system control coprocessor (CP0): the registers exceptions
+ * and the Count/Compare timer use.
+ */
+typedef struct CP0
+{
+    word_t status;   // Status (12): interrupt mask, EXL and IE
+    word_t cause;    // Cause (13): timer and pending interrupts, ExcCode
+    word_t epc;      // EPC (14): address to return to with `eret`
+    word_t badvaddr; // BadVAddr (8): address of the last address error
+    word_t count;    // Count (9): records executed
+    word_t compare;  // Compare (11): Count value raising the timer interrupt
+    word_t ebase;    // EBase (15, select 1): base of the exception vector
+} CP0;
+
+typedef struct DECODED DECODED;
+typedef struct CACHE_SIM CACHE_SIM;
+typedef struct PREDICTOR PREDICTOR;
+typedef struct COVERAGE COVERAGE;
+typedef struct HISTORY HISTORY;
+typedef struct IO IO;
+typedef struct HARTS HARTS;
+typedef struct CPU CPU;
+
+/**
+ * Handler for a syscall code, called with the context it was installed with.
+ */
+typedef void (*syscall_t)(CPU *cpu, void *ctx);
+
+/**
+ * @struct SYSCALL_ENTRY
+ * @brief The handler installed for one syscall code.
+ */
+typedef struct SYSCALL_ENTRY
+{
+    syscall_t handler; // Handler, NULL if the code is unknown
+    void *ctx;         // Passed to `handler`
+} SYSCALL_ENTRY;
+
+/**
+ * @struct SYSCALLS
+ * @brief Syscall handlers indexed by `$v0`. The built-in syscalls are the
+ * default entries, and hosts can replace them or add codes of their own.
+ */
+typedef struct SYSCALLS
+{
+    SYSCALL_ENTRY *table; // Handlers indexed by code
+    int n;                // Length of `table`
+} SYSCALLS;
+
+/**
+ * @struct CPU
+ * @brief A MIPS CPU has a program counter, registers and a text segment.
+ */
+struct CPU
 {
     unsigned int pc;              // Program Counter
     REGISTER *reg[NUM_REGISTERS]; // Array of CPU registers
-    int cache[MAX_INSTR];         // Cache to store programs
-} FPU;
+    REGISTER sink;                // Written in place of `$zero`, never read
+    int *text;                    // Text segment holding the program
+    word_t text_base;             // Guest address of the first instruction
+    DECODED *program;             // Decoded copy of the program in text
+    int n_instr;                  // Number of instructions loaded
+    FPU *fpu;                     // Floating-point coprocessor
+    CP0 *cp0;                     // System control coprocessor
+    MEMORY *mem;                  // Guest memory
+    int exit_code;                // Exit status set by `exit2`
+    int invalid_at;               // Invalid instruction that stopped the hart, or -1
+    CACHE_SIM *caches;            // Cache simulator, NULL when disabled
+    PREDICTOR *predictor;         // Branch predictor, NULL when disabled
+    COVERAGE *coverage;           // Instruction coverage, NULL when disabled
+    HISTORY *history;             // Execution history, NULL when not recording
+    IO *io;                       // Host side of I/O syscalls
+    SYSCALLS *syscalls;           // Syscall handlers
+    bool fuse_muldiv;             // Fuse multiply/divide with its moves on load
+    bool fuse_loops;              // Fuse byte-copy loops on load
+    bool optimize;                // Optimize basic blocks on load
+    HARTS *harts;                 // Harts sharing this one's memory, NULL if single
+    int hart_id;                  // Index in `harts`, 0 for the VM itself
+    word_t ll_addr;               // Address reserved by `ll`
+    word_t ll_value;              // Value `ll` read there
+    bool ll_valid;                // A reservation is held
+    bool slicing;                 // Running a slice, so CP0 instructions yield
+    bool yield;                   // A record ended the slice by yielding
+    unsigned int yield_pc;        // Index of the record that yielded
+};
+
+/**
+ * @brief Get the index in the text segment of the instruction at a guest
+ * address. Addresses outside the text segment give indices past its end.
+ */
+static inline unsigned int text_index(const CPU *cpu, word_t addr)
+{
+    return (addr - cpu->text_base) / 4;
+}
+
+/**
+ * @brief Get the guest address of an instruction in the text segment.
+ */
+static inline word_t text_address(const CPU *cpu, unsigned int index)
+{
+    return cpu->text_base + index * 4;
+}
+
+/**
+ * @brief Get the index of the instruction a `j`/`jal` target field names: a
+ * word address within the 256 MB region of the instruction after the jump.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param index Index of the jump
+ * @param addr Target field
+ * @return unsigned int
+ */
+static inline unsigned int jump_index(const CPU *cpu, unsigned int index, word_t addr)
+{
+    word_t region = text_address(cpu, index + 1) & 0xF0000000;
+    return text_index(cpu, region | (addr << 2));
+}
 
 REGISTER *init_reg(reg_name_t name);
+MEMORY *init_MEMORY();
+FPU *init_FPU();
+CP0 *init_CP0();
 CPU *init_CPU();
 void free_reg(REGISTER *reg);
+void free_MEMORY(MEMORY *mem);
+void free_FPU(FPU *fpu);
+void free_CP0(CP0 *cp0);
 void free_CPU(CPU *cpu);
@@ -0,0 +1,427 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cache.h"
+#include "coverage.h"
+#include "cp0.h"
+#include "decode.h"
+#include "functions.h"
+#include "harts.h"
+#include "history.h"
+#include "io.h"
+#include "memory.h"
+#include "vm.h"
+
+/**
+ * @brief Let one CPU run several harts.
+ *
+ * @param cpu CPU to become hart 0
+ * @param max Most harts, hart 0 included
+ * @param quantum Records per turn in round-robin mode, 0 to run each hart on
+ * a host thread of its own
+ * @return HARTS*
+ */
+HARTS *init_HARTS(CPU *cpu, int max, int quantum)
+{
+    HARTS *harts = malloc(sizeof(HARTS));
+    if (harts == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Harts\n");
+        exit(EXIT_FAILURE);
+    }
+
+    harts->hart[0] = cpu;
+    harts->done[0] = false;
+    harts->waiting[0] = -1;
+    harts->n = 1;
+    harts->max = max;
+    harts->quantum = quantum;
+    harts->stop = false;
+    pthread_mutex_init(&harts->lock, NULL);
+    pthread_cond_init(&harts->finished, NULL);
+
+    cpu->harts = harts;
+    cpu->hart_id = 0;
+    return harts;
+}
+
+/**
+ * @brief Stop every hart but hart 0 and destroy them.
+ *
+ * @param harts Harts
+ */
+void harts_reset(HARTS *harts)
+{
+    pthread_mutex_lock(&harts->lock);
+    harts->stop = true;
+    pthread_cond_broadcast(&harts->finished);
+    pthread_mutex_unlock(&harts->lock);
+
+    for (int id = 1; id < harts->n; id++)
+    {
+        if (harts->quantum == 0)
+            pthread_join(harts->thread[id], NULL);
+        free_CPU(harts->hart[id]);
+    }
+
+    harts->n = 1;
+    harts->done[0] = false;
+    harts->waiting[0] = -1;
+    harts->stop = false;
+}
+
+/**
+ * @brief Destroy the harts of a CPU, leaving hart 0 to run alone.
+ *
+ * @param harts Harts to be destroyed
+ */
+void free_HARTS(HARTS *harts)
+{
+    harts_reset(harts);
+    harts->hart[0]->harts = NULL;
+    pthread_mutex_destroy(&harts->lock);
+    pthread_cond_destroy(&harts->finished);
+    free(harts);
+    harts = NULL;
+}
+
+/**
+ * @brief Carry out the CPU's processes for one decoded instruction.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param d Decoded MIPS instruction
+ */
+static inline void processes(CPU *cpu, DECODED *d)
+{
+    d->exec(cpu, d);
+}
+
+/**
+ * @brief Run records from the PC until the program finishes, `limit` have
+ * executed or a record yields. The loops never look at CP0: `hart_run` sizes
+ * the slice so that it ends where the timer is next due.
+ *
+ * @param cpu Hart
+ * @param limit Most records to execute
+ * @return uint64_t Number of records dispatched
+ */
+static uint64_t run_slice(CPU *cpu, uint64_t limit)
+{
+    unsigned int n = cpu->n_instr;
+    uint64_t left = limit;
+
+    if (cpu->history != NULL)
+    {
+        for (; cpu->pc < n && left > 0; cpu->pc++, left--)
+        {
+            history_tick(cpu->history);
+            processes(cpu, &cpu->program[cpu->pc]);
+        }
+    }
+    else if (cpu->caches != NULL)
+    {
+        for (; cpu->pc < n && left > 0; cpu->pc++, left--)
+        {
+            cache_fetch(cpu->caches, cpu->pc);
+            processes(cpu, &cpu->program[cpu->pc]);
+        }
+    }
+    else if (cpu->coverage != NULL)
+    {
+        for (; cpu->pc < n && left > 0; cpu->pc++, left--)
+        {
+            unsigned int pc = cpu->pc;
+            processes(cpu, &cpu->program[pc]);
+            coverage_record(cpu->coverage, pc, cpu->pc);
+        }
+    }
+    else
+    {
+        // Execute the program loaded in text while PC is in [0, n)
+        for (; cpu->pc < n && left > 0; cpu->pc++, left--)
+            processes(cpu, &cpu->program[cpu->pc]);
+    }
+
+    return limit - left;
+}
+
+/**
+ * @brief Run one hart from its PC until it finishes or `budget` decoded
+ * records have executed. A run stopped by the budget continues where it left
+ * off when called again.
+ *
+ * Execution goes in slices that end when Count reaches Compare, and at the
+ * next checkpoint while recording, so that Count is brought up to date and
+ * pending interrupts are taken between slices rather than checked for at
+ * every record. A CP0 instruction or debugger trap yields to end its slice
+ * early, and is then run here with Count exact.
+ *
+ * An invalid instruction that CP0 does not take as an exception stops the
+ * hart with the PC on it.
+ *
+ * @param cpu Hart
+ * @param budget Most records to execute, 0 for no limit
+ * @param executed Set to the number of records executed, may be NULL
+ * @return int `VM_EXITED`, `VM_BUDGET` or `VM_ERR_INVALID`
+ */
+int hart_run(CPU *cpu, uint64_t budget, uint64_t *executed)
+{
+    unsigned int n = cpu->n_instr;
+    uint64_t limit = budget > 0 ? budget : UINT64_MAX;
+    uint64_t left = limit;
+
+    cpu->invalid_at = -1;
+    while (cpu->pc < n && left > 0)
+    {
+        uint64_t slice = cp0_until(cpu);
+        if (cpu->history != NULL)
+        {
+            HISTORY *h = cpu->history;
+            uint64_t due = h->next > h->icount ? h->next - h->icount : h->interval;
+            if (due > 0 && due < slice)
+                slice = due;
+        }
+        if (slice > left)
+            slice = left;
+
+        cpu->slicing = true;
+        uint64_t ran = run_slice(cpu, slice);
+        cpu->slicing = false;
+
+        // Count includes the record that yielded by the time it runs
+        cp0_tick(cpu, ran);
+        if (cpu->yield)
+        {
+            cpu->yield = false;
+            cpu->pc = cpu->yield_pc;
+            processes(cpu, &cpu->program[cpu->pc]);
+            cpu->pc++;
+        }
+
+        left -= ran;
+        if (cpu->invalid_at >= 0)
+            break;
+        cp0_interrupt(cpu);
+    }
+
+    if (executed != NULL)
+        *executed = limit - left;
+
+    // Left on the instruction, a hart run again stops there again
+    if (cpu->invalid_at >= 0)
+    {
+        cpu->pc = cpu->invalid_at;
+        return VM_ERR_INVALID;
+    }
+    if (cpu->pc < n)
+        return VM_BUDGET;
+
+    // An exit points the PC at the end of the program, and the loop steps past it
+    cpu->pc = n;
+    return VM_EXITED;
+}
+
+/**
+ * @brief Mark a hart finished and wake the harts waiting for it.
+ */
+static void finish(HARTS *harts, int id)
+{
+    pthread_mutex_lock(&harts->lock);
+    harts->done[id] = true;
+    pthread_cond_broadcast(&harts->finished);
+    pthread_mutex_unlock(&harts->lock);
+}
+
+/**
+ * @brief Host thread running a hart until it finishes or is stopped.
+ *
+ * @param arg Hart
+ * @return void*
+ */
+static void *hart_thread(void *arg)
+{
+    CPU *hart = arg;
+    HARTS *harts = hart->harts;
+
+    while (!__atomic_load_n(&harts->stop, __ATOMIC_RELAXED) &&
+           hart_run(hart, HART_SLICE, NULL) == VM_BUDGET)
+        ;
+
+    finish(harts, hart->hart_id);
+    return NULL;
+}
+
+/**
+ * @brief Give every unfinished hart a turn of `quantum` records in order of
+ * id, until hart 0 finishes or the budget runs out. A hart waiting in `join`
+ * sits its turns out until the hart it waits for has finished. A hart
+ * stopped by an invalid instruction is finished.
+ *
+ * @return int `VM_EXITED`, `VM_BUDGET`, or `VM_ERR_INVALID` if hart 0 stopped
+ * at one
+ */
+static int round_robin(HARTS *harts, uint64_t budget, uint64_t *executed)
+{
+    uint64_t limit = budget > 0 ? budget : UINT64_MAX;
+    uint64_t left = limit;
+    int status = VM_BUDGET;
+
+    while (left > 0 && !harts->done[0])
+    {
+        bool progress = false;
+
+        for (int id = 0; id < harts->n && left > 0 && !harts->done[0]; id++)
+        {
+            int waiting = harts->waiting[id];
+            if (harts->done[id] || (waiting >= 0 && !harts->done[waiting]))
+                continue;
+
+            harts->waiting[id] = -1;
+            uint64_t turn = left < (uint64_t)harts->quantum ? left : (uint64_t)harts->quantum;
+            uint64_t count;
+            int ran = hart_run(harts->hart[id], turn, &count);
+            if (ran != VM_BUDGET)
+                harts->done[id] = true;
+            if (id == 0)
+                status = ran;
+
+            left -= count;
+            progress = progress || count > 0;
+        }
+
+        // Every hart left waits for another: nothing can ever run again
+        if (!progress)
+            harts->done[0] = true;
+    }
+
+    if (executed != NULL)
+        *executed = limit - left;
+    if (status == VM_ERR_INVALID)
+        return status;
+    return harts->done[0] ? VM_EXITED : VM_BUDGET;
+}
+
+/**
+ * @brief Run hart 0 until it finishes or `budget` records have executed, and
+ * the other harts alongside it. When hart 0 finishes, the others are stopped
+ * and destroyed, as they are when it stops at an invalid instruction. In
+ * round-robin mode the budget counts the records of every hart.
+ *
+ * @param harts Harts
+ * @param budget Most records to execute, 0 for no limit
+ * @param executed Set to the number of records executed, may be NULL
+ * @return int `VM_EXITED`, `VM_BUDGET` or `VM_ERR_INVALID`
+ */
+int harts_run(HARTS *harts, uint64_t budget, uint64_t *executed)
+{
+    int status;
+    if (harts->quantum > 0)
+        status = round_robin(harts, budget, executed);
+    else
+        status = hart_run(harts->hart[0], budget, executed);
+
+    if (status != VM_BUDGET)
+        harts_reset(harts);
+    return status;
+}
+
+/**
+ * @brief Start a hart (syscall 110). Called with the harts' lock held.
+ *
+ * @param cpu Hart making the syscall
+ * @param ctx Unused
+ */
+void sys_spawn(CPU *cpu, void *ctx)
+{
+    HARTS *harts = cpu->harts;
+    REGISTER **reg = cpu->reg;
+
+    if (harts == NULL || harts->n == harts->max)
+    {
+        reg[$v0]->value.wd = -1;
+        return;
+    }
+
+    // A fresh CPU gives the hart its registers, then it takes on the shared parts
+    CPU *owner = harts->hart[0];
+    CPU *hart = init_CPU();
+    free_MEMORY(hart->mem);
+    free_IO(hart->io);
+    free_SYSCALLS(hart->syscalls);
+    hart->mem = owner->mem;
+    hart->io = owner->io;
+    hart->syscalls = owner->syscalls;
+    hart->coverage = owner->coverage;
+    hart->harts = harts;
+    hart->hart_id = harts->n;
+
+    // Records hold pointers to the registers of the hart that runs them
+    vm_set_fusion(hart, owner->fuse_muldiv, owner->fuse_loops);
+    vm_set_optimize(hart, owner->optimize);
+    // Not checked again, since words of an executable's text may be data
+    hart->text_base = owner->text_base;
+    load_program(hart, (uint32_t *)owner->text, owner->n_instr, text_index(hart, reg[$a0]->value.wd));
+
+    // Returning from the entry point runs off the end of the program
+    hart->reg[$a0]->value.wd = reg[$a1]->value.wd;
+    hart->reg[$sp]->value.wd = reg[$a2]->value.wd;
+    hart->reg[$gp]->value.wd = reg[$gp]->value.wd;
+    hart->reg[$ra]->value.wd = text_address(hart, owner->n_instr);
+    hart->cp0->ebase = cpu->cp0->ebase;
+
+    int id = harts->n;
+    harts->hart[id] = hart;
+    harts->done[id] = false;
+    harts->waiting[id] = -1;
+    harts->n++;
+
+    // Without a thread for it the hart is never started, as when there are too many
+    if (harts->quantum == 0 && pthread_create(&harts->thread[id], NULL, hart_thread, hart) != 0)
+    {
+        harts->n--;
+        free_CPU(hart);
+        reg[$v0]->value.wd = -1;
+        return;
+    }
+
+    reg[$v0]->value.wd = id;
+}
+
+/**
+ * @brief Wait for a hart to finish (syscall 111). Called with the harts' lock
+ * held, which a thread gives up while it waits. In round-robin mode the
+ * syscall is instead run again on the hart's next turn.
+ *
+ * @param cpu Hart making the syscall
+ * @param ctx Unused
+ */
+void sys_join(CPU *cpu, void *ctx)
+{
+    HARTS *harts = cpu->harts;
+    REGISTER **reg = cpu->reg;
+    int id = reg[$a0]->value.wd;
+
+    // Hart 0 outlives every other, so waiting for it would never end
+    if (harts == NULL || id <= 0 || id >= harts->n || id == cpu->hart_id)
+    {
+        reg[$v0]->value.wd = -1;
+        return;
+    }
+
+    if (harts->quantum > 0)
+    {
+        if (!harts->done[id])
+        {
+            harts->waiting[cpu->hart_id] = id;
+            cpu->pc--;
+            return;
+        }
+    }
+    else
+    {
+        while (!harts->done[id] && !harts->stop)
+            pthread_cond_wait(&harts->finished, &harts->lock);
+    }
+
+    reg[$v0]->value.wd = harts->hart[id]->reg[$v0]->value.wd;
+}
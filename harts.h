@@ -0,0 +1,57 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "hardware.h"
+
+/**
+ * Most harts a VM can run, hart 0 included.
+ */
+#define MAX_HARTS 64
+
+/**
+ * Records a hart runs per turn in round-robin mode, unless chosen otherwise.
+ */
+#define HARTS_DEFAULT_QUANTUM 1000
+
+/**
+ * Records a hart thread runs between looks at whether it has been stopped.
+ */
+#define HART_SLICE 65536
+
+/**
+ * @struct HARTS
+ * @brief Guest harts sharing hart 0's memory, program, I/O and syscalls, each
+ * with its own registers, coprocessor and PC. Harts run on host threads of
+ * their own, or take turns on the caller's thread in round-robin mode so that
+ * runs are reproducible.
+ *
+ * Guests start a hart with syscall 110: `$a0` is the address to start at,
+ * `$a1` is passed in the new hart's `$a0` and `$a2` becomes its `$sp`. `$v0`
+ * gets the new hart's id, or -1 if no more can start. The hart finishes when
+ * it returns from its entry point, runs off the end of the program, calls
+ * `exit` or reaches an invalid instruction. Syscall 111 waits for the hart with id `$a0` to finish and sets `$v0`
+ * to that hart's `$v0`, or -1 for an id that cannot be waited for.
+ */
+struct HARTS
+{
+    CPU *hart[MAX_HARTS];        // Harts by id, hart 0 being the VM itself
+    pthread_t thread[MAX_HARTS]; // Host thread of each hart after hart 0
+    bool done[MAX_HARTS];        // The hart has finished
+    int waiting[MAX_HARTS];      // Hart a round-robin `join` waits for, or -1
+    int n;                       // Harts started, hart 0 included
+    int max;                     // Most harts
+    int quantum;                 // Records per turn in round-robin mode, 0 for threads
+    bool stop;                   // Tells hart threads to stop
+    pthread_mutex_t lock;        // Held while a syscall runs
+    pthread_cond_t finished;     // Broadcast when a hart finishes
+};
+
+HARTS *init_HARTS(CPU *cpu, int max, int quantum);
+void free_HARTS(HARTS *harts);
+void harts_reset(HARTS *harts);
+int hart_run(CPU *cpu, uint64_t budget, uint64_t *executed);
+int harts_run(HARTS *harts, uint64_t budget, uint64_t *executed);
+void sys_spawn(CPU *cpu, void *ctx);
+void sys_join(CPU *cpu, void *ctx);
@@ -24,6 +24,11 @@ const int NUM_P_INSTR = SIZEOF((int[]) { P_TYPE_TABLE });
 int P_LIST[] = { [0 ... NUM_P_INSTR] = -1, P_TYPE_TABLE };
 #undef _P
 
+#define _F(NAME, FUNCT, STR, FUNC_PTR) [NAME] = FUNCT,
+const int NUM_F_INSTR = SIZEOF((int[]) { F_TYPE_TABLE });
+int F_LIST[] = { [0 ... NUM_F_INSTR] = -1, F_TYPE_TABLE };
+#undef _F
+
 #define _R(NAME, FUNCT, STR, FUNC_PTR) [NAME] = FUNC_PTR,
 void (*R_FUNCT_PTR[])(CPU *, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct) = { R_TYPE_TABLE };
 #undef _R
@@ -33,13 +38,17 @@ void (*I_FUNCT_PTR[])(CPU *, REGISTER *rs, REGISTER *rt, int imm) = { I_TYPE_TAB
 #undef _I
 
 #define _J(NAME, OP, STR, FUNC_PTR) [NAME] = FUNC_PTR,
-void (*J_FUNCT_PTR[])(CPU *, REGISTER *addr) = { J_TYPE_TABLE };
+void (*J_FUNCT_PTR[])(CPU *, int addr) = { J_TYPE_TABLE };
 #undef _J
 
 #define _P(NAME, FUNCT, STR, FUNC_PTR) [NAME] = FUNC_PTR,
 void (*P_FUNCT_PTR[])(CPU *, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct) = { P_TYPE_TABLE };
 #undef _P
 
+#define _F(NAME, FUNCT, STR, FUNC_PTR) [NAME] = FUNC_PTR,
+void (*F_FUNCT_PTR[])(CPU *, int fmt, int ft, int fs, int fd) = { F_TYPE_TABLE };
+#undef _F
+
 #define _X(REG_NUM, REG_NAME, NUM_STR, NAME_STR) NUM_STR,
 char *REG_NUM_STR[] = { REGISTER_TABLE };
 #undef _X
@@ -63,3 +72,18 @@ char *J_STR[] = { J_TYPE_TABLE };
 #define _P(NAME, FUNCT, STR, FUNC_PTR) [NAME] = STR,
 char *P_STR[] = { P_TYPE_TABLE };
 #undef _P
+
+#define _F(NAME, FUNCT, STR, FUNC_PTR) [NAME] = STR,
+char *F_STR[] = { F_TYPE_TABLE };
+#undef _F
+
+#define _M(NAME, FMT, STR) [NAME] = STR,
+char *FMT_STR[] = { FMT_TABLE };
+#undef _M
+
+char *FP_REG_STR[] = {
+    "$f0", "$f1", "$f2", "$f3", "$f4", "$f5", "$f6", "$f7",
+    "$f8", "$f9", "$f10", "$f11", "$f12", "$f13", "$f14", "$f15",
+    "$f16", "$f17", "$f18", "$f19", "$f20", "$f21", "$f22", "$f23",
+    "$f24", "$f25", "$f26", "$f27", "$f28", "$f29", "$f30", "$f31",
+};
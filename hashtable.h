@@ -7,18 +7,21 @@ extern int R_LIST[];
 extern int I_LIST[];
 extern int J_LIST[];
 extern int P_LIST[];
+extern int F_LIST[];
 
 // Size of lists
 extern const int NUM_R_INSTR;
 extern const int NUM_I_INSTR;
 extern const int NUM_J_INSTR;
 extern const int NUM_P_INSTR;
+extern const int NUM_F_INSTR;
 
 // Function pointer lists
 extern void (*R_FUNCT_PTR[])(CPU *, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct);
 extern void (*I_FUNCT_PTR[])(CPU *, REGISTER *rs, REGISTER *rt, int imm);
-extern void (*J_FUNCT_PTR[])(CPU *, REGISTER *addr);
+extern void (*J_FUNCT_PTR[])(CPU *, int addr);
 extern void (*P_FUNCT_PTR[])(CPU *, REGISTER *rs, REGISTER *rt, REGISTER *rd, int shamt, int funct);
+extern void (*F_FUNCT_PTR[])(CPU *, int fmt, int ft, int fs, int fd);
 
 // String lists
 extern char *REG_NUM_STR[];
@@ -27,3 +30,6 @@ extern char *R_STR[];
 extern char *I_STR[];
 extern char *J_STR[];
 extern char *P_STR[];
+extern char *F_STR[];
+extern char *FMT_STR[];
+extern char *FP_REG_STR[];
@@ -0,0 +1,433 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "functions.h"
+#include "history.h"
+#include "memory.h"
+
+static void *grow(void *array, int *cap, size_t size)
+{
+    *cap = *cap > 0 ? *cap * 2 : 16;
+    array = realloc(array, *cap * size);
+    if (array == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for History\n");
+        exit(EXIT_FAILURE);
+    }
+    return array;
+}
+
+/**
+ * @brief Initialise recording. SPEC is `INTERVAL[:MAX_MB]`: instructions
+ * between checkpoints, and megabytes that saved pages and syscall data may
+ * use before the oldest checkpoints are dropped. The first checkpoint is taken
+ * immediately.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param spec Settings, or NULL for the defaults
+ * @return HISTORY*
+ */
+HISTORY *init_HISTORY(CPU *cpu, const char *spec)
+{
+    HISTORY *h = calloc(1, sizeof(HISTORY));
+    if (h == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for History\n");
+        exit(EXIT_FAILURE);
+    }
+
+    h->cpu = cpu;
+    h->interval = HISTORY_DEFAULT_INTERVAL;
+    h->max_bytes = (size_t)HISTORY_DEFAULT_MB << 20;
+
+    if (spec != NULL)
+    {
+        char *end;
+        long long interval = strtoll(spec, &end, 10);
+        long long mb = HISTORY_DEFAULT_MB;
+        if (*end == ':')
+            mb = strtoll(end + 1, &end, 10);
+
+        if (*end != '\0' || interval < 1 || mb < 1)
+        {
+            fprintf(stderr, "ERROR: Recording takes INTERVAL[:MAX_MB], both positive\n");
+            exit(EXIT_FAILURE);
+        }
+        h->interval = interval;
+        h->max_bytes = (size_t)mb << 20;
+    }
+
+    history_checkpoint(h);
+    return h;
+}
+
+static void free_checkpoint(HISTORY *h, CHECKPOINT *cp)
+{
+    for (int i = 0; i < cp->n_pages; i++)
+    {
+        if (cp->pages[i].data != NULL)
+            h->bytes -= PAGE_SIZE;
+        free(cp->pages[i].data);
+    }
+    free(cp->pages);
+    cp->pages = NULL;
+    cp->n_pages = 0;
+    cp->cap_pages = 0;
+}
+
+/**
+ * @brief Make every page writable again, then destroy the history.
+ *
+ * @param h History to be destroyed
+ */
+void free_HISTORY(HISTORY *h)
+{
+    for (int i = 0; i < h->n_tracked; i++)
+        mprotect(h->tracked[i], PAGE_SIZE, PROT_READ | PROT_WRITE);
+
+    for (int i = 0; i < h->n_cps; i++)
+        free_checkpoint(h, &h->cps[i]);
+    for (size_t i = 0; i < h->n_log; i++)
+        free(h->log[i].data);
+
+    free(h->cps);
+    free(h->log);
+    free(h->tracked);
+    free(h);
+    h = NULL;
+}
+
+static int compare_pages(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t) * (byte_t *const *)a;
+    uintptr_t y = (uintptr_t) * (byte_t *const *)b;
+    return (x > y) - (x < y);
+}
+
+static bool is_tracked(HISTORY *h, byte_t *page)
+{
+    return bsearch(&page, h->tracked, h->n_tracked, sizeof(byte_t *), compare_pages) != NULL;
+}
+
+static void add_copy(HISTORY *h, CHECKPOINT *cp, byte_t *page, byte_t *data)
+{
+    if (cp->n_pages == cp->cap_pages)
+        cp->pages = grow(cp->pages, &cp->cap_pages, sizeof(PAGE_COPY));
+    cp->pages[cp->n_pages].page = page;
+    cp->pages[cp->n_pages].data = data;
+    cp->n_pages++;
+    if (data != NULL)
+        h->bytes += PAGE_SIZE;
+}
+
+/**
+ * @brief Write-protect every guest page so the first store to each one after
+ * a checkpoint faults. Pages allocated since the last walk did not exist at
+ * the latest checkpoint, so restoring it must zero them.
+ */
+static void protect_pages(HISTORY *h)
+{
+    MEMORY *mem = h->cpu->mem;
+    byte_t **old = h->tracked;
+    int n_old = h->n_tracked;
+    int cap = 0;
+
+    h->tracked = NULL;
+    h->n_tracked = 0;
+    h->cap_tracked = 0;
+
+    for (unsigned int i = 0; i < NUM_DIRS; i++)
+    {
+        if (mem->dir[i] == NULL)
+            continue;
+
+        for (unsigned int j = 0; j < NUM_PAGES_PER_DIR; j++)
+        {
+            byte_t *page = mem->dir[i][j];
+            if (page == NULL)
+                continue;
+
+            if (h->n_cps > 0 && bsearch(&page, old, n_old, sizeof(byte_t *), compare_pages) == NULL)
+                add_copy(h, &h->cps[h->n_cps - 1], page, NULL);
+
+            if (h->n_tracked == cap)
+                h->tracked = grow(h->tracked, &cap, sizeof(byte_t *));
+            h->tracked[h->n_tracked++] = page;
+            mprotect(page, PAGE_SIZE, PROT_READ);
+        }
+    }
+
+    h->cap_tracked = cap;
+    free(old);
+    qsort(h->tracked, h->n_tracked, sizeof(byte_t *), compare_pages);
+}
+
+/**
+ * @brief Forget the oldest checkpoint, and the syscalls only it could replay.
+ */
+static void drop_oldest(HISTORY *h)
+{
+    free_checkpoint(h, &h->cps[0]);
+    h->n_cps--;
+    memmove(h->cps, h->cps + 1, h->n_cps * sizeof(CHECKPOINT));
+
+    size_t drop = h->cps[0].log_pos;
+    for (size_t i = 0; i < drop; i++)
+    {
+        h->bytes -= h->log[i].len;
+        free(h->log[i].data);
+    }
+    h->n_log -= drop;
+    h->log_pos -= drop;
+    memmove(h->log, h->log + drop, h->n_log * sizeof(SYSCALL_RECORD));
+    for (int i = 0; i < h->n_cps; i++)
+        h->cps[i].log_pos -= drop;
+}
+
+/**
+ * @brief Save the architectural state and start tracking writes afresh. The
+ * oldest checkpoints are dropped while the history is over its budget.
+ *
+ * @param h History
+ */
+void history_checkpoint(HISTORY *h)
+{
+    CPU *cpu = h->cpu;
+    protect_pages(h);
+
+    if (h->n_cps == h->cap_cps)
+        h->cps = grow(h->cps, &h->cap_cps, sizeof(CHECKPOINT));
+
+    CHECKPOINT *cp = &h->cps[h->n_cps++];
+    memset(cp, 0, sizeof(CHECKPOINT));
+    cp->icount = h->icount;
+    cp->pc = cpu->pc;
+    for (int i = 0; i < NUM_REGISTERS; i++)
+        cp->reg[i] = cpu->reg[i]->value;
+    cp->fpu = *cpu->fpu;
+    cp->cp0 = *cpu->cp0;
+    cp->brk = cpu->mem->brk;
+    cp->exit_code = cpu->exit_code;
+    cp->log_pos = h->log_pos;
+
+    h->next = h->icount + h->interval;
+    while (h->bytes > h->max_bytes && h->n_cps > 1)
+        drop_oldest(h);
+}
+
+/**
+ * @brief Go back to a checkpoint, undoing every page written since, and forget
+ * the checkpoints after it. Executing forward again replays the syscall log
+ * until the furthest point reached.
+ *
+ * @param h History
+ * @param k Checkpoint
+ */
+void history_restore(HISTORY *h, int k)
+{
+    CPU *cpu = h->cpu;
+    if (h->icount > h->end)
+        h->end = h->icount;
+
+    // Catch pages allocated since the latest checkpoint
+    protect_pages(h);
+
+    for (int i = h->n_cps - 1; i >= k; i--)
+    {
+        CHECKPOINT *cp = &h->cps[i];
+        for (int j = cp->n_pages - 1; j >= 0; j--)
+        {
+            PAGE_COPY *copy = &cp->pages[j];
+            mprotect(copy->page, PAGE_SIZE, PROT_READ | PROT_WRITE);
+            if (copy->data != NULL)
+                memcpy(copy->page, copy->data, PAGE_SIZE);
+            else
+                memset(copy->page, 0, PAGE_SIZE);
+        }
+        free_checkpoint(h, cp);
+    }
+    h->n_cps = k + 1;
+
+    CHECKPOINT *cp = &h->cps[k];
+    cpu->pc = cp->pc;
+    for (int i = 0; i < NUM_REGISTERS; i++)
+        cpu->reg[i]->value = cp->reg[i];
+    *cpu->fpu = cp->fpu;
+    *cpu->cp0 = cp->cp0;
+    cpu->mem->brk = cp->brk;
+    cpu->exit_code = cp->exit_code;
+    h->log_pos = cp->log_pos;
+    h->icount = cp->icount;
+    h->next = h->icount + h->interval;
+
+    protect_pages(h);
+}
+
+/**
+ * @brief Find the newest checkpoint at or before an instruction count.
+ *
+ * @param h History
+ * @param icount Instruction count
+ * @return int Checkpoint, or -1 if the count is older than the history
+ */
+int history_find(HISTORY *h, unsigned long long icount)
+{
+    for (int k = h->n_cps - 1; k >= 0; k--)
+        if (h->cps[k].icount <= icount)
+            return k;
+    return -1;
+}
+
+static void save_page(HISTORY *h, byte_t *page)
+{
+    CHECKPOINT *cp = &h->cps[h->n_cps - 1];
+    for (int i = 0; i < cp->n_pages; i++)
+        if (cp->pages[i].page == page)
+            return;
+
+    byte_t *data = malloc(PAGE_SIZE);
+    if (data == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for History\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(data, page, PAGE_SIZE);
+    add_copy(h, cp, page, data);
+}
+
+/**
+ * @brief Handle a store to a write-protected page: save its contents for the
+ * latest checkpoint and make it writable.
+ *
+ * @param h History
+ * @param page Host page written
+ * @return true if the page is one the history protected
+ */
+bool history_fault(HISTORY *h, byte_t *page)
+{
+    if (!is_tracked(h, page))
+        return false;
+
+    save_page(h, page);
+    mprotect(page, PAGE_SIZE, PROT_READ | PROT_WRITE);
+    return true;
+}
+
+/**
+ * @brief Save the pages of a range a syscall is about to fill with `readv`,
+ * which fails on a protected page instead of faulting.
+ */
+static void unprotect_range(HISTORY *h, word_t addr, word_t len)
+{
+    if (len == 0)
+        return;
+
+    word_t last = addr + len - 1 < addr ? UINT32_MAX : addr + len - 1;
+    for (word_t p = addr >> PAGE_BITS; p <= last >> PAGE_BITS; p++)
+    {
+        byte_t *page = mem_page(h->cpu->mem, p << PAGE_BITS, false);
+        if (page != NULL)
+            history_fault(h, page);
+        if (p == UINT32_MAX >> PAGE_BITS)
+            break;
+    }
+}
+
+/**
+ * @brief Run a syscall while recording. Syscalls that read from outside the
+ * guest are logged, and replayed from the log, without the I/O, until
+ * execution passes the furthest point reached. Output is not repeated during
+ * replay.
+ *
+ * @param h History
+ */
+void history_syscall(HISTORY *h)
+{
+    CPU *cpu = h->cpu;
+    REGISTER **reg = cpu->reg;
+    bool replay = h->icount <= h->end;
+
+    switch (reg[$v0]->value.wd)
+    {
+    case 1:
+    case 2:
+    case 3:
+    case 4:
+    case 11:
+        if (!replay)
+            run_syscall(cpu);
+        return;
+    case 5:
+    case 6:
+    case 7:
+    case 8:
+    case 12:
+    case 13:
+    case 14:
+    case 15:
+    case 16:
+        break;
+    default:
+        run_syscall(cpu);
+        return;
+    }
+
+    if (replay && h->log_pos < h->n_log)
+    {
+        SYSCALL_RECORD *r = &h->log[h->log_pos++];
+        reg[$v0]->value = r->v0;
+        cpu->fpu->f[0] = r->f0;
+        cpu->fpu->f[1] = r->f1;
+        if (r->len > 0)
+            mem_write(cpu->mem, r->addr, r->data, r->len);
+        return;
+    }
+
+    SYSCALL_RECORD r = { 0 };
+    int code = reg[$v0]->value.wd;
+    if (code == 8)
+        r.addr = reg[$a0]->value.wd;
+    else if (code == 14)
+    {
+        r.addr = reg[$a1]->value.wd;
+        unprotect_range(h, r.addr, reg[$a2]->value.wd);
+    }
+
+    run_syscall(cpu);
+
+    if (code == 8 && reg[$a1]->value.wd > 0)
+        r.len = mem_strlen(cpu->mem, r.addr) + 1;
+    else if (code == 14 && reg[$v0]->value.wd > 0)
+        r.len = reg[$v0]->value.wd;
+    r.v0 = reg[$v0]->value;
+    r.f0 = cpu->fpu->f[0];
+    r.f1 = cpu->fpu->f[1];
+
+    if (r.len > 0)
+    {
+        r.data = malloc(r.len);
+        if (r.data == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to allocate memory for History\n");
+            exit(EXIT_FAILURE);
+        }
+        mem_read(cpu->mem, r.addr, r.data, r.len);
+        h->bytes += r.len;
+    }
+
+    // Anything logged past here belonged to a future that was replayed away
+    for (size_t i = h->log_pos; i < h->n_log; i++)
+    {
+        h->bytes -= h->log[i].len;
+        free(h->log[i].data);
+    }
+    h->n_log = h->log_pos;
+
+    if (h->n_log == (size_t)h->cap_log)
+        h->log = grow(h->log, &h->cap_log, sizeof(SYSCALL_RECORD));
+    h->log[h->n_log++] = r;
+    h->log_pos = h->n_log;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "hardware.h"
+
+/**
+ * Default instructions between checkpoints and memory budget for them.
+ */
+#define HISTORY_DEFAULT_INTERVAL 100000
+#define HISTORY_DEFAULT_MB 64
+
+/**
+ * @struct PAGE_COPY
+ * @brief Contents of a guest page when a checkpoint was taken, saved the first
+ * time the page is written afterwards.
+ */
+typedef struct PAGE_COPY
+{
+    byte_t *page; // Host page
+    byte_t *data; // Saved contents, NULL if the page did not exist yet
+} PAGE_COPY;
+
+/**
+ * @struct CHECKPOINT
+ * @brief Architectural state at an instruction count, and the pages written
+ * until the next checkpoint.
+ */
+typedef struct CHECKPOINT
+{
+    unsigned long long icount;  // Instructions executed before it
+    unsigned int pc;            // Program Counter
+    reg_t reg[NUM_REGISTERS];   // Registers
+    FPU fpu;                    // Floating-point coprocessor
+    CP0 cp0;                    // System control coprocessor
+    word_t brk;                 // Program break
+    int exit_code;              // Exit status
+    size_t log_pos;             // Next syscall in the log
+    PAGE_COPY *pages;           // Pages written since
+    int n_pages;                // Number of pages written since
+    int cap_pages;              // Capacity of `pages`
+} CHECKPOINT;
+
+/**
+ * @struct SYSCALL_RECORD
+ * @brief Result of a syscall that reads from outside the guest, so replay can
+ * reproduce it without doing the I/O again.
+ */
+typedef struct SYSCALL_RECORD
+{
+    reg_t v0;     // `$v0` afterwards
+    word_t f0;    // `$f0` afterwards
+    word_t f1;    // `$f1` afterwards
+    word_t addr;  // Guest address the syscall stored to
+    word_t len;   // Number of bytes stored
+    byte_t *data; // Bytes stored
+} SYSCALL_RECORD;
+
+/**
+ * @struct HISTORY
+ * @brief Checkpoints and syscall log for reverse execution.
+ */
+typedef struct HISTORY
+{
+    CPU *cpu;                     // CPU being recorded
+    unsigned long long icount;    // Instructions executed
+    unsigned long long end;       // Furthest instruction count reached
+    unsigned long long interval;  // Instructions between checkpoints
+    unsigned long long next;      // Instruction count of the next checkpoint
+    size_t max_bytes;             // Budget for saved pages and syscall data
+    size_t bytes;                 // Saved pages and syscall data held
+    CHECKPOINT *cps;              // Checkpoints, oldest first
+    int n_cps;                    // Number of checkpoints
+    int cap_cps;                  // Capacity of `cps`
+    SYSCALL_RECORD *log;          // Syscall log
+    size_t n_log;                 // Number of syscalls logged
+    int cap_log;                  // Capacity of `log`
+    size_t log_pos;               // Next syscall to replay
+    byte_t **tracked;             // Write-protected pages, sorted
+    int n_tracked;                // Number of write-protected pages
+    int cap_tracked;              // Capacity of `tracked`
+} HISTORY;
+
+HISTORY *init_HISTORY(CPU *cpu, const char *spec);
+void free_HISTORY(HISTORY *h);
+void history_checkpoint(HISTORY *h);
+void history_restore(HISTORY *h, int k);
+int history_find(HISTORY *h, unsigned long long icount);
+bool history_fault(HISTORY *h, byte_t *page);
+void history_syscall(HISTORY *h);
+
+/**
+ * Count the instruction about to execute, first taking a checkpoint when one
+ * is due.
+ */
+static inline void history_tick(HISTORY *h)
+{
+    if (h->icount >= h->next)
+        history_checkpoint(h);
+    h->icount++;
+}
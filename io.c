@@ -0,0 +1,582 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef SYS_openat2
+#include <linux/openat2.h>
+#endif
+
+#include "io.h"
+#include "memory.h"
+
+#define MAX_PATH 4096
+#define MAX_IOV 64
+
+/**
+ * @brief Initialise guest I/O on the host's standard streams, sandboxed to the
+ * current working directory.
+ *
+ * @return IO*
+ */
+IO *init_IO(void)
+{
+    IO *io = calloc(1, sizeof(IO));
+    if (io == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for IO\n");
+        exit(EXIT_FAILURE);
+    }
+
+    io->in_fd = STDIN_FILENO;
+    io->out = stdout;
+    io->sandbox_fd = -1;
+
+    return io;
+}
+
+/**
+ * @brief Close the files a guest left open and forget buffered input, so the
+ * next run starts afresh.
+ *
+ * @param io Guest I/O
+ */
+void io_reset(IO *io)
+{
+    for (int fd = STDERR_FILENO + 1; fd < IO_MAX_FILES; fd++)
+        io_close(io, fd);
+
+    io->in_pos = 0;
+    io->in_len = 0;
+    io->console = (CONSOLE){ .attached = io->console.attached };
+}
+
+/**
+ * @brief Destroy guest I/O, closing the files the guest left open.
+ *
+ * @param io Guest I/O to be destroyed
+ */
+void free_IO(IO *io)
+{
+    io_reset(io);
+    if (io->sandbox_fd >= 0)
+        close(io->sandbox_fd);
+    free(io);
+    io = NULL;
+}
+
+/**
+ * @brief Serve guest stdin from memory instead of the host's stdin. The data
+ * is not copied and must outlive the run.
+ *
+ * @param io Guest I/O
+ * @param data Input
+ * @param len Length of the input
+ */
+void io_set_input(IO *io, const char *data, size_t len)
+{
+    io->in_data = data;
+    io->in_data_len = len;
+    io->in_pos = 0;
+    io->in_len = 0;
+}
+
+/**
+ * @brief Refill the input buffer once it has been consumed. Pending output is
+ * flushed first so prompts appear before the guest blocks on input.
+ *
+ * @param io Guest I/O
+ * @return true if there is at least one unread byte
+ */
+static bool io_fill(IO *io)
+{
+    if (io->in_pos < io->in_len)
+        return true;
+
+    fflush(io->out);
+
+    io->in_pos = 0;
+    if (io->in_data != NULL)
+    {
+        io->in_len = io->in_data_len < sizeof(io->in_buf) ? io->in_data_len : sizeof(io->in_buf);
+        memcpy(io->in_buf, io->in_data, io->in_len);
+        io->in_data += io->in_len;
+        io->in_data_len -= io->in_len;
+        return io->in_len > 0;
+    }
+
+    ssize_t n = read(io->in_fd, io->in_buf, sizeof(io->in_buf));
+    io->in_len = n > 0 ? n : 0;
+    return io->in_len > 0;
+}
+
+/**
+ * @brief Read one byte of guest input.
+ *
+ * @param io Guest I/O
+ * @return int The byte, or EOF
+ */
+int io_getc(IO *io)
+{
+    if (!io_fill(io))
+        return EOF;
+    return (unsigned char)io->in_buf[io->in_pos++];
+}
+
+/**
+ * @brief Take up to `max` bytes of guest input in one go, waiting for more
+ * only if none is buffered.
+ *
+ * @param io Guest I/O
+ * @param max Most bytes to take
+ * @param data Set to the bytes taken, valid until input is next read
+ * @return size_t Number of bytes taken, 0 at the end of input
+ */
+size_t io_take(IO *io, size_t max, const char **data)
+{
+    if (!io_fill(io))
+        return 0;
+
+    size_t n = io->in_len - io->in_pos;
+    if (n > max)
+        n = max;
+
+    *data = io->in_buf + io->in_pos;
+    io->in_pos += n;
+    return n;
+}
+
+/**
+ * @brief Skip the rest of the current input line, including the newline.
+ *
+ * @param io Guest I/O
+ */
+static void io_skip_line(IO *io)
+{
+    while (io_fill(io))
+    {
+        char *nl = memchr(io->in_buf + io->in_pos, '\n', io->in_len - io->in_pos);
+        if (nl != NULL)
+        {
+            io->in_pos = nl - io->in_buf + 1;
+            return;
+        }
+        io->in_pos = io->in_len;
+    }
+}
+
+/**
+ * @brief Read an integer the way SPIM does: parse a decimal number after any
+ * leading whitespace and discard the rest of the line. Values wrap to 32 bits
+ * and malformed input reads as 0.
+ *
+ * @param io Guest I/O
+ * @return __int32_t
+ */
+__int32_t io_read_int(IO *io)
+{
+    int c = io_getc(io);
+    while (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+        c = io_getc(io);
+
+    bool negative = c == '-';
+    if (c == '-' || c == '+')
+        c = io_getc(io);
+
+    word_t value = 0;
+    while ('0' <= c && c <= '9')
+    {
+        value = value * 10 + (c - '0');
+        c = io_getc(io);
+    }
+
+    if (c != '\n' && c != EOF)
+        io_skip_line(io);
+
+    return negative ? -value : value;
+}
+
+/**
+ * @brief Read a floating-point number: parse the first whitespace-delimited
+ * token with `strtod` and discard the rest of the line. Malformed input reads
+ * as 0.
+ *
+ * @param io Guest I/O
+ * @return double
+ */
+double io_read_double(IO *io)
+{
+    int c = io_getc(io);
+    while (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+        c = io_getc(io);
+
+    char token[64];
+    size_t len = 0;
+    while (c != EOF && c != ' ' && c != '\t' && c != '\n' && c != '\r')
+    {
+        if (len < sizeof(token) - 1)
+            token[len++] = c;
+        c = io_getc(io);
+    }
+    token[len] = '\0';
+
+    if (c != '\n' && c != EOF)
+        io_skip_line(io);
+
+    return strtod(token, NULL);
+}
+
+/**
+ * @brief Read a line of at most `len - 1` bytes into guest memory like
+ * `fgets`, keeping the newline and NUL-terminating. Whole spans of the input
+ * buffer are copied at once.
+ *
+ * @param io Guest I/O
+ * @param mem Guest memory
+ * @param addr Guest address of the buffer
+ * @param len Size of the guest buffer
+ */
+void io_read_string(IO *io, MEMORY *mem, word_t addr, word_t len)
+{
+    if (len == 0)
+        return;
+
+    word_t left = len - 1;
+    while (left > 0 && io_fill(io))
+    {
+        size_t avail = io->in_len - io->in_pos;
+        size_t n = avail < left ? avail : left;
+        char *nl = memchr(io->in_buf + io->in_pos, '\n', n);
+        if (nl != NULL)
+            n = nl - (io->in_buf + io->in_pos) + 1;
+
+        mem_write(mem, addr, io->in_buf + io->in_pos, n);
+        io->in_pos += n;
+        addr += n;
+        left -= n;
+
+        if (nl != NULL)
+            break;
+    }
+
+    mem_store_byte(mem, addr, '\0');
+}
+
+/**
+ * @brief Print a NUL-terminated guest string, writing each page span straight
+ * from guest memory.
+ *
+ * @param io Guest I/O
+ * @param mem Guest memory
+ * @param addr Guest address of the string
+ */
+void io_print_string(IO *io, MEMORY *mem, word_t addr)
+{
+    for (;;)
+    {
+        byte_t *span;
+        size_t len = mem_span(mem, addr, PAGE_SIZE, false, &span);
+        byte_t *nul = memchr(span, '\0', len);
+        if (nul != NULL)
+            len = nul - span;
+
+        fwrite(span, 1, len, io->out);
+        addr += len;
+
+        if (nul != NULL)
+            return;
+    }
+}
+
+/**
+ * @brief Confine guest file syscalls to a directory. Until this is called the
+ * sandbox is the current working directory.
+ *
+ * @param io Guest I/O
+ * @param dir Sandbox directory
+ * @return int 0 on success, or -1 if the directory cannot be opened
+ */
+int io_set_sandbox(IO *io, const char *dir)
+{
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return -1;
+
+    if (io->sandbox_fd >= 0)
+        close(io->sandbox_fd);
+    io->sandbox_fd = fd;
+    return 0;
+}
+
+/**
+ * @brief Check that a guest path stays inside the sandbox lexically: it must be
+ * relative and have no `..` components.
+ *
+ * @param path Guest path
+ * @return true if the path is allowed
+ */
+static bool io_path_allowed(const char *path)
+{
+    if (path[0] == '\0' || path[0] == '/')
+        return false;
+
+    for (const char *p = path; *p != '\0';)
+    {
+        size_t len = strcspn(p, "/");
+        if (len == 2 && p[0] == '.' && p[1] == '.')
+            return false;
+        p += len;
+        p += strspn(p, "/");
+    }
+
+    return true;
+}
+
+/**
+ * @brief Open a path beneath a directory one component at a time, refusing
+ * to follow a symlink at any of them. Directories are opened with
+ * `O_DIRECTORY`, so only the final component can name anything else.
+ *
+ * @param dir_fd Directory the path is relative to
+ * @param path Relative path, shorter than `MAX_PATH`, without `..` components
+ * @param flags Host open flags
+ * @param mode Permissions for a created file
+ * @return int Host file descriptor, or -1 on error
+ */
+static int io_open_walk(int dir_fd, const char *path, int flags, int mode)
+{
+    char name[MAX_PATH];
+    int fd = dir_fd;
+    const char *p = path;
+
+    for (;;)
+    {
+        size_t len = strcspn(p, "/");
+        const char *next = p + len + strspn(p + len, "/");
+        memcpy(name, p, len);
+        name[len] = '\0';
+
+        // The last component is opened as asked; a trailing `/` needs a directory
+        int sub_fd = *next == '\0'
+                         ? openat(fd, name, flags | O_NOFOLLOW | (next > p + len ? O_DIRECTORY : 0), mode)
+                         : openat(fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd != dir_fd)
+            close(fd);
+        if (sub_fd < 0 || *next == '\0')
+            return sub_fd;
+
+        fd = sub_fd;
+        p = next;
+    }
+}
+
+/**
+ * @brief Open a path beneath the sandbox directory, never through a symlink.
+ * Where the kernel supports `openat2`, `RESOLVE_BENEATH` does this in one
+ * call; otherwise the path is walked one component at a time.
+ *
+ * @param io Guest I/O
+ * @param path Relative guest path
+ * @param flags Host open flags
+ * @param mode Permissions for a created file
+ * @return int Host file descriptor, or -1 on error
+ */
+static int io_open_beneath(IO *io, const char *path, int flags, int mode)
+{
+    if (io->sandbox_fd < 0 && io_set_sandbox(io, ".") < 0)
+        return -1;
+
+#ifdef SYS_openat2
+    struct open_how how = {
+        .flags = flags,
+        .mode = (flags & O_CREAT) ? mode : 0,
+        .resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS,
+    };
+    int fd = syscall(SYS_openat2, io->sandbox_fd, path, &how, sizeof(how));
+    if (fd >= 0 || errno != ENOSYS)
+        return fd;
+#endif
+
+    return io_open_walk(io->sandbox_fd, path, flags, mode);
+}
+
+/**
+ * @brief Map a guest file descriptor to the host one backing it.
+ *
+ * @param io Guest I/O
+ * @param fd Guest file descriptor
+ * @return int Host file descriptor, or -1 if the guest does not own it
+ */
+static int io_host_fd(IO *io, int fd)
+{
+    if (fd < 0 || fd >= IO_MAX_FILES)
+        return -1;
+    if (fd <= STDERR_FILENO)
+        return fd;
+    return io->files[fd] - 1;
+}
+
+/**
+ * @brief Open a file named by a guest string inside the sandbox. Flags follow
+ * the MARS convention: 0 for read, 1 for write and 9 for append; writing
+ * creates the file.
+ *
+ * @param io Guest I/O
+ * @param mem Guest memory
+ * @param path Guest address of the path
+ * @param flags Guest open flags
+ * @param mode Permissions for a created file
+ * @return int Guest file descriptor, or -1 on error
+ */
+int io_open(IO *io, MEMORY *mem, word_t path, int flags, int mode)
+{
+    char name[MAX_PATH];
+    mem_read_string(mem, path, name, sizeof(name));
+    if (!io_path_allowed(name))
+        return -1;
+
+    int fd = STDERR_FILENO + 1;
+    while (fd < IO_MAX_FILES && io->files[fd] != 0)
+        fd++;
+    if (fd == IO_MAX_FILES)
+        return -1;
+
+    // Whether or not it opens, the run now depends on more than its input
+    io->opened_files = true;
+
+    int host_flags = O_RDONLY;
+    if ((flags & O_ACCMODE) != O_RDONLY)
+        host_flags = (flags & O_ACCMODE) | O_CREAT | ((flags & 8) ? O_APPEND : O_TRUNC);
+
+    int host_fd = io_open_beneath(io, name, host_flags | O_CLOEXEC, mode ? mode : 0644);
+    if (host_fd < 0)
+        return -1;
+
+    io->files[fd] = host_fd + 1;
+    return fd;
+}
+
+/**
+ * @brief Read from a file descriptor into guest memory. Guest stdin is served
+ * from the input buffer first; files are read with `readv` straight into the
+ * guest pages.
+ *
+ * @param io Guest I/O
+ * @param mem Guest memory
+ * @param fd Guest file descriptor
+ * @param buf Guest address of the buffer
+ * @param len Number of bytes to read
+ * @return int Number of bytes read, or -1 on error
+ */
+int io_read(IO *io, MEMORY *mem, int fd, word_t buf, word_t len)
+{
+    if (fd == STDIN_FILENO)
+    {
+        if (len == 0 || !io_fill(io))
+            return 0;
+
+        size_t n = io->in_len - io->in_pos < len ? io->in_len - io->in_pos : len;
+        mem_write(mem, buf, io->in_buf + io->in_pos, n);
+        io->in_pos += n;
+        return n;
+    }
+
+    int host_fd = io_host_fd(io, fd);
+    if (host_fd < 0)
+        return -1;
+
+    struct iovec iov[MAX_IOV];
+    word_t total = 0;
+    while (total < len)
+    {
+        int count = mem_iovec(mem, buf + total, len - total, true, iov, MAX_IOV);
+        size_t want = 0;
+        for (int i = 0; i < count; i++)
+            want += iov[i].iov_len;
+
+        ssize_t n = readv(host_fd, iov, count);
+        if (n < 0)
+            return total > 0 ? (int)total : -1;
+
+        total += n;
+        if ((size_t)n < want)
+            break;
+    }
+
+    return total;
+}
+
+/**
+ * @brief Write guest memory to a file descriptor. Guest stdout and stderr go
+ * through stdio so they stay ordered with the other print syscalls; files are
+ * written with `writev` straight from the guest pages.
+ *
+ * @param io Guest I/O
+ * @param mem Guest memory
+ * @param fd Guest file descriptor
+ * @param buf Guest address of the buffer
+ * @param len Number of bytes to write
+ * @return int Number of bytes written, or -1 on error
+ */
+int io_write(IO *io, MEMORY *mem, int fd, word_t buf, word_t len)
+{
+    struct iovec iov[MAX_IOV];
+    word_t total = 0;
+
+    if (fd == STDOUT_FILENO || fd == STDERR_FILENO)
+    {
+        FILE *stream = fd == STDOUT_FILENO ? io->out : stderr;
+        while (total < len)
+        {
+            int count = mem_iovec(mem, buf + total, len - total, false, iov, MAX_IOV);
+            for (int i = 0; i < count; i++)
+            {
+                size_t n = fwrite(iov[i].iov_base, 1, iov[i].iov_len, stream);
+                total += n;
+                if (n < iov[i].iov_len)
+                    return total > 0 ? (int)total : -1;
+            }
+        }
+        return total;
+    }
+
+    int host_fd = io_host_fd(io, fd);
+    if (host_fd < 0)
+        return -1;
+
+    while (total < len)
+    {
+        int count = mem_iovec(mem, buf + total, len - total, false, iov, MAX_IOV);
+        ssize_t n = writev(host_fd, iov, count);
+        if (n <= 0)
+            return total > 0 ? (int)total : -1;
+        total += n;
+    }
+
+    return total;
+}
+
+/**
+ * @brief Close a file descriptor opened by the guest. The standard streams
+ * are left open.
+ *
+ * @param fd Guest file descriptor
+ * @return int 0 on success, or -1 on error
+ */
+int io_close(IO *io, int fd)
+{
+    if (fd >= 0 && fd <= STDERR_FILENO)
+        return 0;
+
+    int host_fd = io_host_fd(io, fd);
+    if (host_fd < 0)
+        return -1;
+
+    io->files[fd] = 0;
+    return close(host_fd);
+}
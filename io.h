@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "hardware.h"
+
+#define IO_BUFFER 65536
+#define IO_MAX_FILES 64
+
+/**
+ * @struct CONSOLE
+ * @brief Host side of the memory-mapped console: how far each ring's free-
+ * running byte count has got.
+ */
+typedef struct CONSOLE
+{
+    bool attached;  // The device is mapped into guest memory
+    word_t tx_tail; // Bytes of the transmit ring written out
+    word_t rx_head; // Bytes put in the receive ring
+    word_t rx_tail; // Bytes the guest has taken from the receive ring
+    bool rx_eof;    // Guest stdin has run out
+} CONSOLE;
+
+/**
+ * @struct IO
+ * @brief Host side of a guest's I/O syscalls. Guest stdin is read through one
+ * large buffer rather than stdio so integers and lines can be parsed straight
+ * out of it. Guest file descriptors index `files`, which holds the host
+ * descriptor plus one (0 marks a free slot), and paths are resolved beneath
+ * `sandbox_fd`.
+ */
+struct IO
+{
+    char in_buf[IO_BUFFER];    // Buffered guest stdin
+    size_t in_pos;             // Next unread byte of `in_buf`
+    size_t in_len;             // Bytes held in `in_buf`
+    int in_fd;                 // Host descriptor for guest stdin
+    const char *in_data;       // Guest stdin held in memory, or NULL
+    size_t in_data_len;        // Unread bytes at `in_data`
+    FILE *out;                 // Guest stdout
+    int files[IO_MAX_FILES];   // Open guest files
+    int sandbox_fd;            // Directory guest paths resolve beneath
+    bool opened_files;         // The guest has tried to open a file
+    CONSOLE console;           // Memory-mapped console
+};
+
+IO *init_IO(void);
+void free_IO(IO *io);
+void io_reset(IO *io);
+void io_set_input(IO *io, const char *data, size_t len);
+int io_set_sandbox(IO *io, const char *dir);
+int io_getc(IO *io);
+size_t io_take(IO *io, size_t max, const char **data);
+__int32_t io_read_int(IO *io);
+double io_read_double(IO *io);
+void io_read_string(IO *io, MEMORY *mem, word_t addr, word_t len);
+void io_print_string(IO *io, MEMORY *mem, word_t addr);
+int io_open(IO *io, MEMORY *mem, word_t path, int flags, int mode);
+int io_read(IO *io, MEMORY *mem, int fd, word_t buf, word_t len);
+int io_write(IO *io, MEMORY *mem, int fd, word_t buf, word_t len);
+int io_close(IO *io, int fd);
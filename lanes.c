@@ -0,0 +1,857 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cp0.h"
+#include "harts.h"
+#include "lanes.h"
+#include "memory.h"
+#include "opcode.h"
+
+#define ROW(lanes, r) (&(lanes)->gpr[(size_t)(r) * (lanes)->n])
+
+/**
+ * @brief Create an engine of `n` lanes, each a fresh VM. Lanes run every
+ * instruction unfused, as a fused record would cover instructions the engine
+ * runs itself.
+ *
+ * @param n Number of lanes, 1 - `MAX_LANES`
+ * @return LANES*
+ */
+LANES *init_LANES(int n)
+{
+    LANES *lanes = calloc(1, sizeof(LANES));
+    if (lanes == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Lanes\n");
+        exit(EXIT_FAILURE);
+    }
+
+    lanes->n = n;
+    lanes->vm = calloc(n, sizeof(VM *));
+    lanes->gpr = calloc((size_t)NUM_REGISTERS * n, sizeof(int32_t));
+    lanes->hi = calloc(n, sizeof(int32_t));
+    lanes->lo = calloc(n, sizeof(int32_t));
+    lanes->pc = calloc(n, sizeof(unsigned int));
+    lanes->mask = calloc(n, sizeof(int32_t));
+    lanes->ran = calloc(n, sizeof(uint32_t));
+    if (lanes->vm == NULL || lanes->gpr == NULL || lanes->hi == NULL || lanes->lo == NULL ||
+        lanes->pc == NULL || lanes->mask == NULL || lanes->ran == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Lanes\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int l = 0; l < n; l++)
+    {
+        lanes->vm[l] = init_VM();
+        vm_set_fusion(lanes->vm[l], false, false);
+    }
+
+    return lanes;
+}
+
+/**
+ * @brief Destroy an engine and the VMs of its lanes.
+ *
+ * @param lanes Lanes to be destroyed
+ */
+void free_LANES(LANES *lanes)
+{
+    for (int l = 0; l < lanes->n; l++)
+        free_VM(lanes->vm[l]);
+
+    free(lanes->vm);
+    free(lanes->ops);
+    free(lanes->gpr);
+    free(lanes->hi);
+    free(lanes->lo);
+    free(lanes->pc);
+    free(lanes->mask);
+    free(lanes->ran);
+    free(lanes);
+    lanes = NULL;
+}
+
+/**
+ * @brief Decode one instruction for the engine. Instructions it does not run
+ * across lanes itself are left to each lane's VM.
+ *
+ * @param cpu VM the program is loaded in
+ * @param k Index of the instruction
+ * @return LANE_OP
+ */
+static LANE_OP decode_op(CPU *cpu, int k)
+{
+    int code = cpu->text[k];
+    R_FORMAT r = extract_R_FORMAT(code);
+    I_FORMAT i = extract_I_FORMAT(code);
+    LANE_OP op = { .op = LANE_FALLBACK, .a = r.rs, .b = r.rt, .dest = r.rd, .imm = r.shamt };
+
+    if (is_P_FORMAT(code))
+    {
+        if (r.funct == MUL)
+            op.op = LANE_MUL;
+    }
+    else if (is_R_FORMAT(code))
+    {
+        switch (r.funct)
+        {
+        case ADD:
+        case ADDU:
+            op.op = LANE_ADD;
+            break;
+        case SUB:
+        case SUBU:
+            op.op = LANE_SUB;
+            break;
+        case AND:
+            op.op = LANE_AND;
+            break;
+        case OR:
+            op.op = LANE_OR;
+            break;
+        case XOR:
+            op.op = LANE_XOR;
+            break;
+        case NOR:
+            op.op = LANE_NOR;
+            break;
+        case SLT:
+            op.op = LANE_SLT;
+            break;
+        case SLTU:
+            op.op = LANE_SLTU;
+            break;
+        case SLL:
+        case SRL:
+        case SRA:
+        case SLLV:
+        case SRLV:
+        case SRAV:
+            // The value shifted is rt, by rs or the shift amount
+            op.op = r.funct == SLL ? LANE_SLL : r.funct == SRL ? LANE_SRL : r.funct == SRA ? LANE_SRA
+                  : r.funct == SLLV ? LANE_SLLV : r.funct == SRLV ? LANE_SRLV : LANE_SRAV;
+            op.a = r.rt;
+            op.b = r.rs;
+            break;
+        case MULT:
+            op.op = LANE_MULT;
+            break;
+        case MULTU:
+            op.op = LANE_MULTU;
+            break;
+        case DIV:
+            op.op = LANE_DIV;
+            break;
+        case DIVU:
+            op.op = LANE_DIVU;
+            break;
+        case MFHI:
+            op.op = LANE_MFHI;
+            break;
+        case MFLO:
+            op.op = LANE_MFLO;
+            break;
+        case MTHI:
+            op.op = LANE_MTHI;
+            break;
+        case MTLO:
+            op.op = LANE_MTLO;
+            break;
+        case JR:
+            op.op = LANE_JR;
+            break;
+        case JALR:
+            op.op = LANE_JALR;
+            op.link = text_address(cpu, k + 1);
+            break;
+        }
+    }
+    else if (is_J_FORMAT(code))
+    {
+        op.op = r.op == JAL ? LANE_JAL : LANE_J;
+        op.dest = $ra;
+        op.imm = jump_index(cpu, k, extract_J_FORMAT(code).addr);
+        op.link = text_address(cpu, k + 1);
+    }
+    else if (is_I_FORMAT(code))
+    {
+        op.dest = i.rt;
+        op.b = i.rt;
+        op.imm = i.imm;
+
+        switch (i.op)
+        {
+        case ADDI:
+        case ADDIU:
+            op.op = LANE_ADDI;
+            break;
+        case ANDI:
+            op.op = LANE_ANDI;
+            break;
+        case ORI:
+            op.op = LANE_ORI;
+            break;
+        case XORI:
+            op.op = LANE_XORI;
+            break;
+        case SLTI:
+            op.op = LANE_SLTI;
+            break;
+        case SLTIU:
+            op.op = LANE_SLTIU;
+            break;
+        case LUI:
+            op.op = LANE_LUI;
+            break;
+        case BEQ:
+        case BNE:
+        case BGEZ:
+        case BGTZ:
+        case BLEZ:
+            op.op = i.op == BEQ ? LANE_BEQ : i.op == BNE ? LANE_BNE : i.op == BGEZ ? LANE_BGEZ
+                  : i.op == BGTZ ? LANE_BGTZ : LANE_BLEZ;
+            op.imm = k + i.imm;
+            break;
+        case LB:
+            op.op = LANE_LB;
+            break;
+        case LH:
+            op.op = LANE_LH;
+            break;
+        case LW:
+            op.op = LANE_LW;
+            break;
+        case SB:
+            op.op = LANE_SB;
+            break;
+        case SH:
+            op.op = LANE_SH;
+            break;
+        case SW:
+            op.op = LANE_SW;
+            break;
+        }
+    }
+
+    // Writing only $zero changes nothing, as HI, LO, memory and the PC are not involved
+    if (op.dest == $zero && op.op >= LANE_ADD && op.op <= LANE_LUI)
+        op.op = LANE_NOP;
+    if (op.dest == $zero && (op.op == LANE_MFHI || op.op == LANE_MFLO))
+        op.op = LANE_NOP;
+    return op;
+}
+
+/**
+ * @brief Decode the program loaded in the first lane for the engine.
+ */
+static void decode_ops(LANES *lanes)
+{
+    CPU *cpu = lanes->vm[0];
+    free(lanes->ops);
+    lanes->n_instr = cpu->n_instr;
+    lanes->ops = malloc((cpu->n_instr > 0 ? cpu->n_instr : 1) * sizeof(LANE_OP));
+    if (lanes->ops == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Lanes\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int k = 0; k < cpu->n_instr; k++)
+        lanes->ops[k] = decode_op(cpu, k);
+}
+
+/**
+ * @brief Load a program of encoded instructions into every lane, as
+ * `vm_load` does.
+ *
+ * @param lanes Lanes
+ * @param words Encoded MIPS instructions
+ * @param n Number of instructions
+ * @param bad Set to the index of the first invalid instruction, may be NULL
+ * @return int `VM_OK`, `VM_ERR_TOO_LARGE` or `VM_ERR_INVALID`
+ */
+int lanes_load(LANES *lanes, const uint32_t *words, int n, int *bad)
+{
+    for (int l = 0; l < lanes->n; l++)
+    {
+        int status = vm_load(lanes->vm[l], words, n, bad);
+        if (status != VM_OK)
+            return status;
+    }
+
+    decode_ops(lanes);
+    return VM_OK;
+}
+
+/**
+ * @brief Load an executable into every lane, as `vm_load_elf` does.
+ *
+ * @param lanes Lanes
+ * @param file Name of the executable
+ * @return int `VM_OK`, `VM_ERR_IO`, `VM_ERR_FORMAT` or `VM_ERR_TOO_LARGE`
+ */
+int lanes_load_elf(LANES *lanes, const char *file)
+{
+    for (int l = 0; l < lanes->n; l++)
+    {
+        int status = vm_load_elf(lanes->vm[l], file);
+        if (status != VM_OK)
+            return status;
+    }
+
+    decode_ops(lanes);
+    return VM_OK;
+}
+
+/**
+ * @brief Move the lanes' registers and PCs out of their VMs into the engine.
+ */
+static void gather(LANES *lanes)
+{
+    int n = lanes->n;
+    for (int l = 0; l < n; l++)
+    {
+        CPU *cpu = lanes->vm[l];
+        for (int r = $0; r <= $31; r++)
+            lanes->gpr[r * n + l] = cpu->reg[r]->value.wd;
+        lanes->hi[l] = cpu->reg[HI]->value.wd;
+        lanes->lo[l] = cpu->reg[LO]->value.wd;
+        lanes->pc[l] = cpu->pc;
+        cpu->invalid_at = -1;
+    }
+}
+
+/**
+ * @brief Move one lane's registers and PC from the engine back into its VM. A
+ * lane stopped at an invalid instruction is left on it, as `vm_run` leaves a
+ * VM.
+ */
+static void scatter(LANES *lanes, int l)
+{
+    int n = lanes->n;
+    CPU *cpu = lanes->vm[l];
+    for (int r = $1; r <= $31; r++)
+        cpu->reg[r]->value.wd = lanes->gpr[r * n + l];
+    cpu->reg[HI]->value.wd = lanes->hi[l];
+    cpu->reg[LO]->value.wd = lanes->lo[l];
+    cpu->pc = cpu->invalid_at >= 0 ? (unsigned int)cpu->invalid_at : lanes->pc[l];
+}
+
+/**
+ * @brief Run the instruction at `at` on one lane's VM, through its own run
+ * loop so that CP0 instructions, exceptions and interrupts behave as they do
+ * there, with the lane's registers moved over for it and back. A lane that
+ * stops at an invalid instruction is finished as far as the engine goes.
+ */
+static void fallback(LANES *lanes, int l, unsigned int at)
+{
+    int n = lanes->n;
+    CPU *cpu = lanes->vm[l];
+
+    lanes->pc[l] = at;
+    scatter(lanes, l);
+    lanes->resync = true;
+
+    // Count is exact when the instruction runs, and an interrupt now due comes
+    // first. The group's pending steps are added to the lane when it regroups.
+    cp0_tick(cpu, lanes->ran[l] + lanes->pending);
+    lanes->ran[l] = -lanes->pending;
+    cp0_interrupt(cpu);
+    if (cpu->pc == at && hart_run(cpu, 1, NULL) == VM_ERR_INVALID)
+    {
+        cpu->invalid_at = at;
+        cpu->pc = cpu->n_instr;
+    }
+
+    for (int r = $1; r <= $31; r++)
+        lanes->gpr[r * n + l] = cpu->reg[r]->value.wd;
+    lanes->hi[l] = cpu->reg[HI]->value.wd;
+    lanes->lo[l] = cpu->reg[LO]->value.wd;
+    lanes->pc[l] = cpu->pc;
+}
+
+/**
+ * @brief Bring each lane's Count up to date with the instructions it ran in
+ * the engine, and take any interrupt that is then due.
+ *
+ * @param lanes Lanes
+ * @return uint64_t Steps before any lane's timer can be due again
+ */
+static uint64_t sync_timers(LANES *lanes)
+{
+    uint64_t horizon = UINT64_MAX;
+    for (int l = 0; l < lanes->n; l++)
+    {
+        CPU *cpu = lanes->vm[l];
+        if (lanes->ran[l] > 0)
+        {
+            cpu->pc = lanes->pc[l];
+            cp0_tick(cpu, lanes->ran[l]);
+            lanes->ran[l] = 0;
+            cp0_interrupt(cpu);
+            lanes->pc[l] = cpu->pc;
+        }
+
+        uint64_t until = cp0_until(cpu);
+        horizon = until < horizon ? until : horizon;
+    }
+
+    lanes->resync = false;
+    return horizon;
+}
+
+/**
+ * @brief Pick the group to run next: the lanes at the lowest PC.
+ *
+ * @param lanes Lanes
+ * @param at Set to the PC of the group
+ * @param first Set to the first lane in the group
+ * @param last Set to one past the last lane in the group
+ * @param all Set if every lane still running is in the group
+ * @return int Lanes in the group, 0 once every lane has finished
+ */
+static int schedule(LANES *lanes, unsigned int *at, int *first, int *last, bool *all)
+{
+    int n = lanes->n;
+    unsigned int *pc = lanes->pc;
+    unsigned int end = lanes->n_instr;
+
+    unsigned int min = UINT_MAX;
+    for (int l = 0; l < n; l++)
+        min = pc[l] < min ? pc[l] : min;
+    if (min >= end)
+        return 0;
+
+    int group = 0;
+    int running = 0;
+    for (int l = 0; l < n; l++)
+    {
+        int32_t in = pc[l] == min;
+        lanes->mask[l] = -in;
+        group += in;
+        running += pc[l] < end;
+    }
+
+    int lo = 0;
+    int hi = n;
+    while (lanes->mask[lo] == 0)
+        lo++;
+    while (lanes->mask[hi - 1] == 0)
+        hi--;
+
+    *at = min;
+    *first = lo;
+    *last = hi;
+    *all = group == running;
+    return group;
+}
+
+/**
+ * @brief Write the group's state the run loop keeps aside back to the lanes:
+ * its PC, when the group is known to be at `at`, and the steps it has run.
+ *
+ * @param lanes Lanes
+ * @param at PC of the group
+ * @param first First lane in the group
+ * @param last One past the last lane in the group
+ * @param moved The group's PCs are `at` rather than in `pc`
+ */
+static void settle(LANES *lanes, unsigned int at, int first, int last, bool moved)
+{
+    const int32_t *mask = lanes->mask;
+    uint32_t pending = lanes->pending;
+
+    for (int l = first; l < last; l++)
+    {
+        lanes->ran[l] += mask[l] & pending;
+        if (moved)
+            lanes->pc[l] = mask[l] ? at : lanes->pc[l];
+    }
+    lanes->pending = 0;
+}
+
+/**
+ * Apply `expr`, of each lane's `a` and `b` (or `imm`), to the lanes in the
+ * group, blending with the mask so the loop has no branches to stop it being
+ * vectorised.
+ */
+#define LANES_ALU(expr)                                           \
+    do                                                            \
+    {                                                             \
+        word_t *dst = (word_t *)ROW(lanes, op->dest);             \
+        const word_t *ra = (const word_t *)ROW(lanes, op->a);     \
+        const word_t *rb = (const word_t *)ROW(lanes, op->b);     \
+        word_t imm = op->imm;                                     \
+        for (int l = first; l < last; l++)                        \
+        {                                                         \
+            word_t a = ra[l];                                     \
+            word_t b = rb[l];                                     \
+            word_t m = mask[l];                                   \
+            (void)a, (void)b, (void)imm;                          \
+            dst[l] = ((word_t)(expr) & m) | (dst[l] & ~m);        \
+        }                                                         \
+    } while (0)
+
+/**
+ * Count the lanes in the group for which `cond` holds. When they all go the
+ * same way the group moves on whole; otherwise each lane's PC is set.
+ */
+#define LANES_BRANCH(cond)                                                     \
+    do                                                                         \
+    {                                                                          \
+        const int32_t *ra = ROW(lanes, op->a);                                 \
+        const int32_t *rb = ROW(lanes, op->b);                                 \
+        int taken = 0;                                                         \
+        for (int l = first; l < last; l++)                                     \
+        {                                                                      \
+            int32_t a = ra[l];                                                 \
+            int32_t b = rb[l];                                                 \
+            (void)a, (void)b;                                                  \
+            taken += (cond) & mask[l];                                         \
+        }                                                                      \
+        if (taken == 0 || taken == group)                                      \
+            return taken == 0 ? at + 1 : (unsigned int)op->imm;                \
+        for (int l = first; l < last; l++)                                     \
+        {                                                                      \
+            int32_t a = ra[l];                                                 \
+            int32_t b = rb[l];                                                 \
+            (void)a, (void)b;                                                  \
+            unsigned int next = (cond) ? (unsigned int)op->imm : at + 1;       \
+            pc[l] = mask[l] ? next : pc[l];                                    \
+        }                                                                      \
+        return UINT_MAX;                                                       \
+    } while (0)
+
+/**
+ * Run a load or store on each lane in the group, leaving a lane whose
+ * address is not aligned to `align` to its VM, which raises the address
+ * error where a handler is loaded.
+ */
+#define LANES_MEMORY(align, access)                                  \
+    do                                                               \
+    {                                                                \
+        int32_t *dst = ROW(lanes, op->dest);                         \
+        const int32_t *ra = ROW(lanes, op->a);                       \
+        const int32_t *rb = ROW(lanes, op->b);                       \
+        bool split = false;                                          \
+        for (int l = first; l < last; l++)                           \
+        {                                                            \
+            if (!mask[l])                                            \
+                continue;                                            \
+            word_t addr = ra[l] + op->imm;                           \
+            if ((addr & (align)) != 0)                               \
+            {                                                        \
+                lanes->ran[l]--;                                     \
+                fallback(lanes, l, at);                              \
+                split = true;                                        \
+                continue;                                            \
+            }                                                        \
+            MEMORY *mem = lanes->vm[l]->mem;                         \
+            (void)dst, (void)rb;                                     \
+            access;                                                  \
+            pc[l] = at + 1;                                          \
+        }                                                            \
+        return split ? UINT_MAX : at + 1;                            \
+    } while (0)
+
+/**
+ * @brief Run the instruction at `at` on the lanes in the group.
+ *
+ * @param lanes Lanes
+ * @param at PC of the group
+ * @param first First lane in the group
+ * @param last One past the last lane in the group
+ * @param group Lanes in the group
+ * @return unsigned int PC the whole group went on to, or `UINT_MAX` if the
+ * lanes went different ways and each lane's PC is set
+ */
+static unsigned int step(LANES *lanes, unsigned int at, int first, int last, int group)
+{
+    const LANE_OP *op = &lanes->ops[at];
+    const int32_t *mask = lanes->mask;
+    unsigned int *pc = lanes->pc;
+    int32_t *hi = lanes->hi;
+    int32_t *lo = lanes->lo;
+
+    switch (op->op)
+    {
+    case LANE_FALLBACK:
+        for (int l = first; l < last; l++)
+        {
+            if (mask[l])
+                fallback(lanes, l, at);
+        }
+        return UINT_MAX;
+    case LANE_NOP:
+        break;
+    case LANE_ADD:
+        LANES_ALU(a + b);
+        break;
+    case LANE_SUB:
+        LANES_ALU(a - b);
+        break;
+    case LANE_AND:
+        LANES_ALU(a & b);
+        break;
+    case LANE_OR:
+        LANES_ALU(a | b);
+        break;
+    case LANE_XOR:
+        LANES_ALU(a ^ b);
+        break;
+    case LANE_NOR:
+        LANES_ALU(~(a | b));
+        break;
+    case LANE_SLT:
+        LANES_ALU((int32_t)a < (int32_t)b);
+        break;
+    case LANE_SLTU:
+        LANES_ALU(a < b);
+        break;
+    case LANE_SLLV:
+        LANES_ALU(a << (b & 0x1F));
+        break;
+    case LANE_SRLV:
+        LANES_ALU(a >> (b & 0x1F));
+        break;
+    case LANE_SRAV:
+        LANES_ALU((int32_t)a >> (b & 0x1F));
+        break;
+    case LANE_MUL:
+        LANES_ALU(a * b);
+        break;
+    case LANE_SLL:
+        LANES_ALU(a << imm);
+        break;
+    case LANE_SRL:
+        LANES_ALU(a >> imm);
+        break;
+    case LANE_SRA:
+        LANES_ALU((int32_t)a >> imm);
+        break;
+    case LANE_ADDI:
+        LANES_ALU(a + imm);
+        break;
+    case LANE_ANDI:
+        LANES_ALU(a & imm);
+        break;
+    case LANE_ORI:
+        LANES_ALU(a | imm);
+        break;
+    case LANE_XORI:
+        LANES_ALU(a ^ imm);
+        break;
+    case LANE_SLTI:
+        LANES_ALU((int32_t)a < (int32_t)imm);
+        break;
+    case LANE_SLTIU:
+        LANES_ALU(a < imm);
+        break;
+    case LANE_LUI:
+        LANES_ALU(imm << 16);
+        break;
+    case LANE_MULT:
+    case LANE_MULTU:
+    {
+        const int32_t *ra = ROW(lanes, op->a);
+        const int32_t *rb = ROW(lanes, op->b);
+        bool sign = op->op == LANE_MULT;
+        for (int l = first; l < last; l++)
+        {
+            uint64_t product = sign ? (uint64_t)((int64_t)ra[l] * rb[l])
+                                    : (uint64_t)(word_t)ra[l] * (word_t)rb[l];
+            lo[l] = mask[l] ? (int32_t)product : lo[l];
+            hi[l] = mask[l] ? (int32_t)(product >> 32) : hi[l];
+        }
+        break;
+    }
+    case LANE_DIV:
+    case LANE_DIVU:
+    {
+        // As `MIPS_div`: HI and LO are kept on division by zero
+        const int32_t *ra = ROW(lanes, op->a);
+        const int32_t *rb = ROW(lanes, op->b);
+        for (int l = first; l < last; l++)
+        {
+            if (!mask[l] || rb[l] == 0)
+                continue;
+            if (op->op == LANE_DIVU)
+            {
+                lo[l] = (word_t)ra[l] / (word_t)rb[l];
+                hi[l] = (word_t)ra[l] % (word_t)rb[l];
+            }
+            else if (rb[l] == -1)
+            {
+                lo[l] = -(word_t)ra[l];
+                hi[l] = 0;
+            }
+            else
+            {
+                lo[l] = ra[l] / rb[l];
+                hi[l] = ra[l] % rb[l];
+            }
+        }
+        break;
+    }
+    case LANE_MFHI:
+    case LANE_MFLO:
+    {
+        int32_t *dst = ROW(lanes, op->dest);
+        const int32_t *src = op->op == LANE_MFHI ? hi : lo;
+        for (int l = first; l < last; l++)
+            dst[l] = mask[l] ? src[l] : dst[l];
+        break;
+    }
+    case LANE_MTHI:
+    case LANE_MTLO:
+    {
+        const int32_t *ra = ROW(lanes, op->a);
+        int32_t *dst = op->op == LANE_MTHI ? hi : lo;
+        for (int l = first; l < last; l++)
+            dst[l] = mask[l] ? ra[l] : dst[l];
+        break;
+    }
+    case LANE_BEQ:
+        LANES_BRANCH(a == b);
+    case LANE_BNE:
+        LANES_BRANCH(a != b);
+    case LANE_BGEZ:
+        LANES_BRANCH(a >= 0);
+    case LANE_BGTZ:
+        LANES_BRANCH(a > 0);
+    case LANE_BLEZ:
+        LANES_BRANCH(a <= 0);
+    case LANE_J:
+        return op->imm;
+    case LANE_JAL:
+    {
+        int32_t *ra = ROW(lanes, $ra);
+        for (int l = first; l < last; l++)
+            ra[l] = mask[l] ? op->link : ra[l];
+        return op->imm;
+    }
+    case LANE_JR:
+    case LANE_JALR:
+    {
+        // The target is read before the link is written, as rd may be rs
+        CPU *cpu = lanes->vm[0];
+        int32_t *dst = ROW(lanes, op->dest);
+        const int32_t *ra = ROW(lanes, op->a);
+        bool link = op->op == LANE_JALR && op->dest != $zero;
+        unsigned int target = text_index(cpu, ra[first]);
+        bool together = true;
+        for (int l = first; l < last; l++)
+        {
+            if (!mask[l])
+                continue;
+            pc[l] = text_index(cpu, ra[l]);
+            together = together && pc[l] == target;
+            if (link)
+                dst[l] = op->link;
+        }
+        return together ? target : UINT_MAX;
+    }
+    case LANE_LB:
+        LANES_MEMORY(0, {
+            int32_t value = (int8_t)mem_load_byte(mem, addr);
+            if (op->dest != $zero)
+                dst[l] = value;
+        });
+    case LANE_LH:
+        LANES_MEMORY(1, {
+            int32_t value = (int16_t)mem_load_half(mem, addr);
+            if (op->dest != $zero)
+                dst[l] = value;
+        });
+    case LANE_LW:
+        LANES_MEMORY(3, {
+            int32_t value = mem_load_word(mem, addr);
+            if (op->dest != $zero)
+                dst[l] = value;
+        });
+    case LANE_SB:
+        LANES_MEMORY(0, mem_store_byte(mem, addr, rb[l]));
+    case LANE_SH:
+        LANES_MEMORY(1, mem_store_half(mem, addr, rb[l]));
+    case LANE_SW:
+        LANES_MEMORY(3, mem_store_word(mem, addr, rb[l]));
+    }
+
+    return at + 1;
+}
+
+/**
+ * @brief Run every lane from its PC until all have finished or `budget` steps
+ * have run, a step being one instruction run for one group of lanes. A run
+ * stopped by the budget continues where it left off when called again. Lanes
+ * take their registers and PC from their VMs and leave them there, so they
+ * can be set up and inspected through the `vm_*` calls. Lanes run no harts.
+ *
+ * While every lane still running is in the group and the group moves on
+ * together, it keeps running without being picked again, and its PCs and
+ * Count are only written back when it splits.
+ *
+ * @param lanes Lanes with a program loaded
+ * @param budget Most steps to run, 0 for no limit
+ * @param steps Set to the number of steps run, may be NULL
+ * @return int `VM_EXITED` once every lane has finished, otherwise `VM_BUDGET`,
+ * or `VM_ERR_INVALID` if a lane stopped at an invalid instruction
+ */
+int lanes_run(LANES *lanes, uint64_t budget, uint64_t *steps)
+{
+    uint64_t limit = budget > 0 ? budget : UINT64_MAX;
+    uint64_t left = limit;
+    unsigned int end = lanes->n_instr;
+    unsigned int at = 0;
+    int first = 0;
+    int last = 0;
+    int group = 0;
+    bool all = false;
+    bool moved = false;
+    bool regroup = true;
+
+    gather(lanes);
+    lanes->pending = 0;
+    uint64_t horizon = sync_timers(lanes);
+
+    while (left > 0)
+    {
+        if (regroup || horizon == 0 || lanes->resync)
+        {
+            settle(lanes, at, first, last, moved);
+            if (horizon == 0 || lanes->resync)
+                horizon = sync_timers(lanes);
+            group = schedule(lanes, &at, &first, &last, &all);
+            if (group == 0)
+                break;
+        }
+
+        lanes->pending += lanes->ops[at].op != LANE_FALLBACK;
+        unsigned int next = step(lanes, at, first, last, group);
+        horizon--;
+        left--;
+
+        // With every running lane in the group, moving on together keeps it whole
+        moved = next != UINT_MAX;
+        regroup = !(moved && all && next < end);
+        at = moved ? next : at;
+    }
+
+    // An interrupt taken here moves a lane, so whether all are done is decided after
+    settle(lanes, at, first, last, moved);
+    sync_timers(lanes);
+    int status = schedule(lanes, &at, &first, &last, &all) == 0 ? VM_EXITED : VM_BUDGET;
+
+    for (int l = 0; l < lanes->n; l++)
+    {
+        if (lanes->vm[l]->invalid_at >= 0)
+            status = VM_ERR_INVALID;
+        scatter(lanes, l);
+    }
+
+    if (steps != NULL)
+        *steps = limit - left;
+    return status;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hardware.h"
+#include "vm.h"
+
+/**
+ * Most lanes one engine runs.
+ */
+#define MAX_LANES 1024
+
+/**
+ * @enum lane_op_t
+ * @brief What the engine does for an instruction. Integer ALU operations,
+ * loads, stores, branches and jumps run across every lane at that instruction
+ * at once; anything else runs on each lane's own VM in turn.
+ */
+typedef enum lane_op_t
+{
+    LANE_FALLBACK, // Run the lane VM's own decoded record
+    LANE_NOP,      // Only writes $zero
+    LANE_ADD,
+    LANE_SUB,
+    LANE_AND,
+    LANE_OR,
+    LANE_XOR,
+    LANE_NOR,
+    LANE_SLT,
+    LANE_SLTU,
+    LANE_SLLV,
+    LANE_SRLV,
+    LANE_SRAV,
+    LANE_MUL,
+    LANE_SLL,
+    LANE_SRL,
+    LANE_SRA,
+    LANE_ADDI,
+    LANE_ANDI,
+    LANE_ORI,
+    LANE_XORI,
+    LANE_SLTI,
+    LANE_SLTIU,
+    LANE_LUI,
+    LANE_MULT,
+    LANE_MULTU,
+    LANE_DIV,
+    LANE_DIVU,
+    LANE_MFHI,
+    LANE_MFLO,
+    LANE_MTHI,
+    LANE_MTLO,
+    LANE_BEQ,
+    LANE_BNE,
+    LANE_BGEZ,
+    LANE_BGTZ,
+    LANE_BLEZ,
+    LANE_J,
+    LANE_JAL,
+    LANE_JR,
+    LANE_JALR,
+    LANE_LB,
+    LANE_LH,
+    LANE_LW,
+    LANE_SB,
+    LANE_SH,
+    LANE_SW,
+} lane_op_t;
+
+/**
+ * @struct LANE_OP
+ * @brief An instruction decoded for the engine, with its register fields
+ * normalised to a destination and two sources.
+ */
+typedef struct LANE_OP
+{
+    lane_op_t op; // Operation
+    byte_t dest;  // Register written
+    byte_t a;     // First source register
+    byte_t b;     // Second source register
+    int32_t imm;  // Immediate, shift amount, or branch or jump target index
+    int32_t link; // Return address a `jal`/`jalr` writes
+} LANE_OP;
+
+/**
+ * @struct LANES
+ * @brief One program run in lockstep over many inputs. Each lane is a VM of
+ * its own, holding its memory, I/O, coprocessors and syscalls, but while the
+ * engine runs, the lanes' integer registers live in structure-of-arrays form
+ * (`gpr[r * n + lane]`) so that one instruction is applied to every lane at
+ * it in a loop the compiler can vectorise.
+ *
+ * Lanes that branch different ways split into groups by PC. Each step runs
+ * the group with the lowest PC, so the lanes ahead wait where the paths join
+ * again and the groups merge there: lanes leaving a loop wait after it for
+ * those still looping, and the two sides of an `if` meet after it.
+ *
+ * CP0's Count is brought up to date, and interrupts taken, every so many
+ * steps: no sooner than the first lane's timer can be due.
+ */
+typedef struct LANES
+{
+    int n;             // Number of lanes
+    VM **vm;           // Each lane's VM
+    int n_instr;       // Instructions in the program
+    LANE_OP *ops;      // Program decoded for the engine
+    int32_t *gpr;      // $0 - $31 of every lane, `n` values per register
+    int32_t *hi;       // HI of every lane
+    int32_t *lo;       // LO of every lane
+    unsigned int *pc;  // PC of every lane
+    int32_t *mask;     // -1 for the lanes in the group being run, else 0
+    uint32_t *ran;     // Instructions each lane ran natively since Count was updated
+    uint32_t pending;  // Steps the group has run and not yet added to `ran`
+    bool resync;       // A lane ran on its VM, which may have changed its timer
+} LANES;
+
+LANES *init_LANES(int n);
+void free_LANES(LANES *lanes);
+int lanes_load(LANES *lanes, const uint32_t *words, int n, int *bad);
+int lanes_load_elf(LANES *lanes, const char *file);
+int lanes_run(LANES *lanes, uint64_t budget, uint64_t *steps);
@@ -0,0 +1,329 @@
+#include <elf.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "loader.h"
+#include "memory.h"
+#include "vm.h"
+
+/**
+ * @brief Check whether a file starts with the ELF magic number.
+ *
+ * @param file Name of the file
+ * @return true if it looks like an ELF file
+ */
+bool is_elf(const char *file)
+{
+    FILE *f = fopen(file, "rb");
+    if (f == NULL)
+        return false;
+
+    unsigned char magic[SELFMAG];
+    bool elf = fread(magic, 1, SELFMAG, f) == SELFMAG && memcmp(magic, ELFMAG, SELFMAG) == 0;
+    fclose(f);
+    return elf;
+}
+
+/**
+ * @brief Check that `[offset, offset + len)` lies within the file.
+ */
+static bool in_file(const ELF_IMAGE *image, uint64_t offset, uint64_t len)
+{
+    return offset <= image->size && len <= image->size - offset;
+}
+
+/**
+ * @brief Get the program headers, which `elf_open` has checked lie within the
+ * file.
+ */
+static const Elf32_Phdr *program_headers(const ELF_IMAGE *image, int *n)
+{
+    const Elf32_Ehdr *eh = (const Elf32_Ehdr *)image->file;
+    *n = eh->e_phnum;
+    return (const Elf32_Phdr *)(image->file + eh->e_phoff);
+}
+
+/**
+ * @brief Check the headers of an executable and pick out its loadable
+ * segments.
+ *
+ * @param image Image with the file mapped
+ * @return int `VM_OK` or `VM_ERR_FORMAT`
+ */
+static int check(ELF_IMAGE *image)
+{
+    const Elf32_Ehdr *eh = (const Elf32_Ehdr *)image->file;
+    if (image->size < sizeof(Elf32_Ehdr) || memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 ||
+        eh->e_ident[EI_CLASS] != ELFCLASS32 || eh->e_ident[EI_DATA] != ELFDATA2LSB ||
+        eh->e_machine != EM_MIPS || eh->e_type != ET_EXEC ||
+        eh->e_phentsize != sizeof(Elf32_Phdr) ||
+        !in_file(image, eh->e_phoff, (uint64_t)eh->e_phnum * sizeof(Elf32_Phdr)) ||
+        eh->e_phoff % 4 != 0)
+        return VM_ERR_FORMAT;
+
+    image->entry = eh->e_entry;
+    image->end = 0;
+    image->text = NULL;
+
+    int n;
+    const Elf32_Phdr *ph = program_headers(image, &n);
+    for (int i = 0; i < n; i++)
+    {
+        if (ph[i].p_type != PT_LOAD)
+            continue;
+
+        uint64_t end = (uint64_t)ph[i].p_vaddr + ph[i].p_memsz;
+        if (ph[i].p_filesz > ph[i].p_memsz || end > UINT32_MAX ||
+            !in_file(image, ph[i].p_offset, ph[i].p_filesz))
+            return VM_ERR_FORMAT;
+
+        if (end > image->end)
+            image->end = end;
+
+        // The segment holding the entry point is the one to decode
+        bool entry = ph[i].p_vaddr <= image->entry && image->entry < ph[i].p_vaddr + ph[i].p_filesz;
+        if ((ph[i].p_flags & PF_X) && entry && image->text == NULL)
+        {
+            if (ph[i].p_vaddr % 4 != 0 || ph[i].p_offset % 4 != 0 || image->entry % 4 != 0)
+                return VM_ERR_FORMAT;
+
+            image->text = (const uint32_t *)(image->file + ph[i].p_offset);
+            image->n = ph[i].p_filesz / 4;
+            image->text_base = ph[i].p_vaddr;
+        }
+    }
+
+    return image->text != NULL ? VM_OK : VM_ERR_FORMAT;
+}
+
+/**
+ * @brief Open an ELF32 little-endian MIPS executable and check its headers.
+ * Its entry point must lie in an executable segment.
+ *
+ * @param image Filled with the opened executable
+ * @param file Name of the file
+ * @return int `VM_OK`, `VM_ERR_IO` or `VM_ERR_FORMAT`
+ */
+int elf_open(ELF_IMAGE *image, const char *file)
+{
+    *image = (ELF_IMAGE){ .fd = -1 };
+
+    image->fd = open(file, O_RDONLY);
+    struct stat st;
+    if (image->fd < 0 || fstat(image->fd, &st) < 0)
+    {
+        elf_close(image);
+        return VM_ERR_IO;
+    }
+
+    if (st.st_size < (off_t)sizeof(Elf32_Ehdr))
+    {
+        elf_close(image);
+        return VM_ERR_FORMAT;
+    }
+
+    image->size = st.st_size;
+    void *view = mmap(NULL, image->size, PROT_READ, MAP_PRIVATE, image->fd, 0);
+    if (view == MAP_FAILED)
+    {
+        elf_close(image);
+        return VM_ERR_IO;
+    }
+    image->file = view;
+
+    int status = check(image);
+    if (status != VM_OK)
+        elf_close(image);
+    return status;
+}
+
+/**
+ * @brief Map the loadable segments into guest memory. Each is mapped from the
+ * file with copy-on-write, or copied in when its alignment rules that out,
+ * and the rest of the page after its file contents is cleared. Pages beyond
+ * that are left to be allocated as zeroes when touched.
+ *
+ * @param image Opened executable
+ * @param mem Guest memory
+ */
+void elf_map(ELF_IMAGE *image, MEMORY *mem)
+{
+    int n;
+    const Elf32_Phdr *ph = program_headers(image, &n);
+    for (int i = 0; i < n; i++)
+    {
+        if (ph[i].p_type != PT_LOAD)
+            continue;
+
+        word_t addr = ph[i].p_vaddr;
+        if (!mem_map(mem, addr, image->fd, ph[i].p_offset, ph[i].p_filesz))
+            mem_write(mem, addr, image->file + ph[i].p_offset, ph[i].p_filesz);
+
+        // The tail of the last file page holds whatever follows in the file
+        word_t end = addr + ph[i].p_filesz;
+        word_t zeroes = ph[i].p_memsz - ph[i].p_filesz;
+        if ((end & PAGE_MASK) != 0 && zeroes > 0)
+        {
+            word_t left = PAGE_SIZE - (end & PAGE_MASK);
+            mem_set(mem, end, 0, zeroes < left ? zeroes : left);
+        }
+    }
+}
+
+/**
+ * @brief Get the symbol table and the string table its names are in.
+ *
+ * @return const Elf32_Sym* Symbols, or NULL if there is no valid table
+ */
+static const Elf32_Sym *symbol_table(ELF_IMAGE *image, int *n, const char **names, size_t *names_len)
+{
+    const Elf32_Ehdr *eh = (const Elf32_Ehdr *)image->file;
+    if (eh->e_shoff == 0 || eh->e_shentsize != sizeof(Elf32_Shdr) || eh->e_shoff % 4 != 0 ||
+        !in_file(image, eh->e_shoff, (uint64_t)eh->e_shnum * sizeof(Elf32_Shdr)))
+        return NULL;
+
+    const Elf32_Shdr *sh = (const Elf32_Shdr *)(image->file + eh->e_shoff);
+    for (int i = 0; i < eh->e_shnum; i++)
+    {
+        if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum ||
+            sh[i].sh_offset % 4 != 0 || !in_file(image, sh[i].sh_offset, sh[i].sh_size))
+            continue;
+
+        const Elf32_Shdr *strtab = &sh[sh[i].sh_link];
+        if (!in_file(image, strtab->sh_offset, strtab->sh_size))
+            continue;
+
+        *n = sh[i].sh_size / sizeof(Elf32_Sym);
+        *names = (const char *)(image->file + strtab->sh_offset);
+        *names_len = strtab->sh_size;
+        return (const Elf32_Sym *)(image->file + sh[i].sh_offset);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Get the name of a symbol, or NULL if it has none or it runs off the
+ * end of the string table.
+ */
+static const char *symbol_name(const Elf32_Sym *sym, const char *names, size_t names_len)
+{
+    if (sym->st_name == 0 || sym->st_name >= names_len)
+        return NULL;
+
+    const char *name = names + sym->st_name;
+    return memchr(name, '\0', names_len - sym->st_name) != NULL ? name : NULL;
+}
+
+/**
+ * @brief Look up the value of a symbol, e.g. `_gp`.
+ *
+ * @param image Opened executable
+ * @param name Name of the symbol
+ * @param value Set to the value of the symbol if found
+ * @return true if the symbol exists
+ */
+bool elf_find_symbol(ELF_IMAGE *image, const char *name, word_t *value)
+{
+    int n;
+    const char *names;
+    size_t names_len;
+    const Elf32_Sym *syms = symbol_table(image, &n, &names, &names_len);
+
+    for (int i = 0; syms != NULL && i < n; i++)
+    {
+        const char *s = symbol_name(&syms[i], names, names_len);
+        if (s != NULL && syms[i].st_shndx != SHN_UNDEF && strcmp(s, name) == 0)
+        {
+            *value = syms[i].st_value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Collect the labels of the text segment from the symbol table:
+ * functions, and the untyped symbols assemblers give plain labels.
+ *
+ * @param image Opened executable
+ * @return SYMBOLS* Labels by instruction index, empty if the file is stripped
+ */
+SYMBOLS *elf_symbols(ELF_IMAGE *image)
+{
+    SYMBOLS *symbols = calloc(1, sizeof(SYMBOLS));
+    if (symbols == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Symbols\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int n;
+    const char *names;
+    size_t names_len;
+    const Elf32_Sym *syms = symbol_table(image, &n, &names, &names_len);
+
+    for (int i = 0; syms != NULL && i < n; i++)
+    {
+        int type = ELF32_ST_TYPE(syms[i].st_info);
+        const char *name = symbol_name(&syms[i], names, names_len);
+        word_t offset = syms[i].st_value - image->text_base;
+        if (name == NULL || (type != STT_FUNC && type != STT_NOTYPE) ||
+            syms[i].st_shndx == SHN_UNDEF || syms[i].st_shndx == SHN_ABS ||
+            offset % 4 != 0 || offset / 4 >= (word_t)image->n)
+            continue;
+
+        symbol_add(symbols, name, offset / 4);
+    }
+
+    symbols_sort(symbols);
+    return symbols;
+}
+
+/**
+ * @brief Load the labels of an executable's text segment from its symbol
+ * table.
+ *
+ * @param file Name of the executable
+ * @return SYMBOLS* Labels, empty if the file cannot be loaded or is stripped
+ */
+SYMBOLS *load_elf_symbols(const char *file)
+{
+    ELF_IMAGE image;
+    if (elf_open(&image, file) != VM_OK)
+    {
+        SYMBOLS *symbols = calloc(1, sizeof(SYMBOLS));
+        if (symbols == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to allocate memory for Symbols\n");
+            exit(EXIT_FAILURE);
+        }
+        return symbols;
+    }
+
+    SYMBOLS *symbols = elf_symbols(&image);
+    elf_close(&image);
+    return symbols;
+}
+
+/**
+ * @brief Close an executable. Segments mapped into guest memory stay there.
+ *
+ * @param image Opened executable
+ */
+void elf_close(ELF_IMAGE *image)
+{
+    if (image->file != NULL)
+        munmap((void *)image->file, image->size);
+    if (image->fd >= 0)
+        close(image->fd);
+
+    image->file = NULL;
+    image->fd = -1;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hardware.h"
+#include "symbols.h"
+
+/**
+ * @struct ELF_IMAGE
+ * @brief An ELF32 little-endian MIPS executable opened for loading. The file
+ * is mapped read-only while it is open, and its executable segment, the one
+ * holding the entry point, becomes the text segment.
+ */
+typedef struct ELF_IMAGE
+{
+    int fd;               // Open file, mapped again for each loaded segment
+    const byte_t *file;   // Read-only view of the whole file
+    size_t size;          // Length of the file
+    const uint32_t *text; // Words of the executable segment
+    int n;                // Number of words in the executable segment
+    word_t text_base;     // Guest address of the executable segment
+    word_t entry;         // Guest address execution starts at
+    word_t end;           // Guest address just past the highest segment
+} ELF_IMAGE;
+
+bool is_elf(const char *file);
+int elf_open(ELF_IMAGE *image, const char *file);
+void elf_map(ELF_IMAGE *image, MEMORY *mem);
+bool elf_find_symbol(ELF_IMAGE *image, const char *name, word_t *value);
+SYMBOLS *elf_symbols(ELF_IMAGE *image);
+SYMBOLS *load_elf_symbols(const char *file);
+void elf_close(ELF_IMAGE *image);
@@ -0,0 +1,604 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "memory.h"
+
+/**
+ * Backing for reads of pages that have never been written.
+ */
+static byte_t zero_page[PAGE_SIZE];
+
+/**
+ * Sink for host writes that land on a device's pages, which have no RAM.
+ */
+static byte_t discard_page[PAGE_SIZE];
+
+/**
+ * @brief Publish a newly allocated page or page table in an empty slot. Harts
+ * on other host threads may race to fill the same slot, so the loser frees
+ * its allocation and takes the winner's.
+ *
+ * @param slot Slot to fill
+ * @param fresh Zeroed allocation
+ * @return void* What the slot holds afterwards
+ */
+static void *publish(void **slot, void *fresh)
+{
+    void *expected = NULL;
+    if (__atomic_compare_exchange_n(slot, &expected, fresh, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return fresh;
+
+    free(fresh);
+    return expected;
+}
+
+/**
+ * @brief Look up the page table entry of a guest address.
+ *
+ * @param mem Guest memory
+ * @param addr Guest address
+ * @param alloc Allocate the page table if it does not exist yet
+ * @return byte_t** Entry, or NULL if the page table does not exist and `alloc`
+ * is false
+ */
+static byte_t **page_entry(MEMORY *mem, word_t addr, bool alloc)
+{
+    byte_t ***dir = &mem->dir[addr >> (32 - DIR_BITS)];
+    byte_t **table = __atomic_load_n(dir, __ATOMIC_ACQUIRE);
+    if (table == NULL)
+    {
+        if (!alloc)
+            return NULL;
+
+        table = calloc(NUM_PAGES_PER_DIR, sizeof(byte_t *));
+        if (table == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to allocate memory for Page Table\n");
+            exit(EXIT_FAILURE);
+        }
+        table = publish((void **)dir, table);
+    }
+
+    return &table[(addr >> PAGE_BITS) & (NUM_PAGES_PER_DIR - 1)];
+}
+
+/**
+ * @brief Find the device mapped at a guest address.
+ *
+ * @param mem Guest memory
+ * @param addr Guest address
+ * @return PAGE_HANDLER* Handler, or NULL if the address is not a device's
+ */
+static PAGE_HANDLER *page_handler(MEMORY *mem, word_t addr)
+{
+    for (int i = 0; i < mem->n_handlers; i++)
+    {
+        if (addr - mem->handlers[i].base < mem->handlers[i].len)
+            return &mem->handlers[i];
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Look up the page holding a guest address. Words are stored
+ * little-endian, matching the host byte order of the supported platforms.
+ *
+ * @param mem Guest memory
+ * @param addr Guest address
+ * @param alloc Allocate the page if it does not exist yet
+ * @return byte_t* Base of the page, or NULL if unmapped and `alloc` is false
+ */
+byte_t *mem_page(MEMORY *mem, word_t addr, bool alloc)
+{
+    byte_t **entry = page_entry(mem, addr, alloc);
+    if (entry == NULL)
+        return NULL;
+
+    byte_t *page = __atomic_load_n(entry, __ATOMIC_ACQUIRE);
+    if (page == NULL && alloc)
+    {
+        // Bulk host copies into a device are dropped rather than given RAM
+        if (page_handler(mem, addr) != NULL)
+            return discard_page;
+
+        page = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+        if (page == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to allocate memory for Page\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(page, 0, PAGE_SIZE);
+        page = publish((void **)entry, page);
+    }
+
+    return page;
+}
+
+/**
+ * @brief Hand the loads and stores of a range of pages to a device. Its pages
+ * stay out of the page table, so RAM accesses never look at the handlers:
+ * only a load or store that misses the page table does. Bulk host copies,
+ * e.g. syscall buffers, read a device as zeroes and their writes to it are
+ * dropped.
+ *
+ * @param mem Guest memory
+ * @param base Guest address of the first page, page-aligned
+ * @param len Length in bytes, a multiple of the page size
+ * @param read Called for loads
+ * @param write Called for stores
+ * @param ctx Passed to `read` and `write`
+ * @return true if added, false if the range is misaligned, already holds
+ * pages or there is no room for another handler
+ */
+bool mem_add_handler(MEMORY *mem, word_t base, word_t len, page_read_t read, page_write_t write, void *ctx)
+{
+    if ((base & PAGE_MASK) != 0 || (len & PAGE_MASK) != 0 || len == 0 ||
+        (uint64_t)base + len > (uint64_t)UINT32_MAX + 1 || mem->n_handlers == MAX_PAGE_HANDLERS)
+        return false;
+
+    for (uint64_t at = base; at < (uint64_t)base + len; at += PAGE_SIZE)
+    {
+        if (mem_page(mem, at, false) != NULL || page_handler(mem, at) != NULL)
+            return false;
+    }
+
+    mem->handlers[mem->n_handlers++] = (PAGE_HANDLER){
+        .base = base,
+        .len = len,
+        .read = read,
+        .write = write,
+        .ctx = ctx,
+    };
+    return true;
+}
+
+/**
+ * @brief Map `[offset, offset + len)` of a file into guest memory at `addr`
+ * as private pages, so the file is only read as the guest touches it and
+ * copy-on-write keeps guest stores out of it. Pages that already exist, e.g.
+ * where two segments share a page, get the segment's bytes copied in instead.
+ * Bytes of the first and last page outside the range hold whatever the file
+ * has there.
+ *
+ * @param mem Guest memory
+ * @param addr Guest address of the first byte
+ * @param fd File opened for reading
+ * @param offset Offset of the first byte in the file, congruent with `addr`
+ * modulo the page size
+ * @param len Number of bytes
+ * @return true if mapped, false if the range cannot be mapped and should be
+ * copied in instead
+ */
+bool mem_map(MEMORY *mem, word_t addr, int fd, off_t offset, size_t len)
+{
+    if (len == 0)
+        return true;
+    if ((addr & PAGE_MASK) != (offset & PAGE_MASK) || mem->n_maps == MAX_MAPPINGS)
+        return false;
+
+    word_t first = addr & ~PAGE_MASK;
+    size_t span = ((size_t)(addr - first) + len + PAGE_MASK) & ~(size_t)PAGE_MASK;
+    if ((uint64_t)first + span > (uint64_t)UINT32_MAX + 1)
+        return false;
+
+    byte_t *base = mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset & ~(off_t)PAGE_MASK);
+    if (base == MAP_FAILED)
+        return false;
+
+    mem->maps[mem->n_maps++] = (MAPPING){ .base = base, .len = span };
+
+    for (size_t at = 0; at < span; at += PAGE_SIZE)
+    {
+        byte_t **entry = page_entry(mem, first + at, true);
+        if (*entry == NULL)
+        {
+            *entry = base + at;
+            continue;
+        }
+
+        // Only the segment's part of the page, counted from `first`
+        size_t start = addr - first;
+        size_t lo = at > start ? at : start;
+        size_t hi = at + PAGE_SIZE < start + len ? at + PAGE_SIZE : start + len;
+        memcpy(*entry + (lo - at), base + lo, hi - lo);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Get the longest contiguous host span backing `[addr, addr + n)` that
+ * does not cross a page boundary. Unmapped pages read as a shared zero page
+ * when `alloc` is false, so the span must not be written through.
+ *
+ * @param mem Guest memory
+ * @param addr Guest address
+ * @param n Number of bytes wanted
+ * @param alloc Allocate the page if it does not exist yet
+ * @param span Set to the host address of `addr`
+ * @return size_t Number of bytes available at `span`
+ */
+size_t mem_span(MEMORY *mem, word_t addr, size_t n, bool alloc, byte_t **span)
+{
+    byte_t *page = mem_page(mem, addr, alloc);
+    if (page == NULL)
+        page = zero_page;
+
+    size_t left = PAGE_SIZE - (addr & PAGE_MASK);
+    *span = page + (addr & PAGE_MASK);
+    return n < left ? n : left;
+}
+
+/**
+ * @brief Describe `[addr, addr + n)` as a list of host spans, one per page, so
+ * host I/O can move data to and from guest pages without a bounce buffer.
+ *
+ * @param mem Guest memory
+ * @param addr Guest address
+ * @param n Number of bytes
+ * @param alloc Allocate pages that do not exist yet (needed when writing)
+ * @param iov Array to fill
+ * @param max Capacity of `iov`
+ * @return int Number of entries filled, which may cover less than `n` bytes
+ */
+int mem_iovec(MEMORY *mem, word_t addr, size_t n, bool alloc, struct iovec *iov, int max)
+{
+    int count = 0;
+    while (n > 0 && count < max)
+    {
+        byte_t *span;
+        size_t len = mem_span(mem, addr, n, alloc, &span);
+        iov[count].iov_base = span;
+        iov[count].iov_len = len;
+        count++;
+        addr += len;
+        n -= len;
+    }
+
+    return count;
+}
+
+/**
+ * @brief Load `size` bytes that miss the page table, or straddle a page: from
+ * a device if one is mapped there, otherwise as `mem_read` would.
+ */
+static word_t load_slow(MEMORY *mem, word_t addr, int size)
+{
+    PAGE_HANDLER *handler = page_handler(mem, addr);
+    if (handler != NULL)
+        return handler->read(mem, handler->ctx, addr - handler->base, size);
+
+    word_t value = 0;
+    mem_read(mem, addr, &value, size);
+    return value;
+}
+
+/**
+ * @brief Store the low `size` bytes of `value` where a load would have taken
+ * `load_slow`.
+ */
+static void store_slow(MEMORY *mem, word_t addr, word_t value, int size)
+{
+    PAGE_HANDLER *handler = page_handler(mem, addr);
+    if (handler != NULL)
+    {
+        handler->write(mem, handler->ctx, addr - handler->base, value, size);
+        return;
+    }
+
+    mem_write(mem, addr, &value, size);
+}
+
+word_t mem_load_word(MEMORY *mem, word_t addr)
+{
+    byte_t *page = mem_page(mem, addr, false);
+    if (page == NULL || (addr & PAGE_MASK) > PAGE_SIZE - sizeof(word_t))
+        return load_slow(mem, addr, sizeof(word_t));
+
+    word_t value;
+    memcpy(&value, page + (addr & PAGE_MASK), sizeof(value));
+    return value;
+}
+
+half_t mem_load_half(MEMORY *mem, word_t addr)
+{
+    byte_t *page = mem_page(mem, addr, false);
+    if (page == NULL || (addr & PAGE_MASK) > PAGE_SIZE - sizeof(half_t))
+        return load_slow(mem, addr, sizeof(half_t));
+
+    half_t value;
+    memcpy(&value, page + (addr & PAGE_MASK), sizeof(value));
+    return value;
+}
+
+byte_t mem_load_byte(MEMORY *mem, word_t addr)
+{
+    byte_t *page = mem_page(mem, addr, false);
+    if (page == NULL)
+        return load_slow(mem, addr, sizeof(byte_t));
+    return page[addr & PAGE_MASK];
+}
+
+void mem_store_word(MEMORY *mem, word_t addr, word_t value)
+{
+    byte_t *page = mem_page(mem, addr, false);
+    if (page == NULL || (addr & PAGE_MASK) > PAGE_SIZE - sizeof(word_t))
+    {
+        store_slow(mem, addr, value, sizeof(word_t));
+        return;
+    }
+
+    memcpy(page + (addr & PAGE_MASK), &value, sizeof(value));
+}
+
+void mem_store_half(MEMORY *mem, word_t addr, half_t value)
+{
+    byte_t *page = mem_page(mem, addr, false);
+    if (page == NULL || (addr & PAGE_MASK) > PAGE_SIZE - sizeof(half_t))
+    {
+        store_slow(mem, addr, value, sizeof(half_t));
+        return;
+    }
+
+    memcpy(page + (addr & PAGE_MASK), &value, sizeof(value));
+}
+
+void mem_store_byte(MEMORY *mem, word_t addr, byte_t value)
+{
+    byte_t *page = mem_page(mem, addr, false);
+    if (page == NULL)
+    {
+        store_slow(mem, addr, value, sizeof(byte_t));
+        return;
+    }
+
+    page[addr & PAGE_MASK] = value;
+}
+
+/**
+ * @brief Store a word only if it still holds `expected`, atomically with
+ * respect to other harts doing the same.
+ *
+ * @param mem Guest memory
+ * @param addr Guest address
+ * @param expected Value the word must hold
+ * @param value Value to store
+ * @return bool The word was stored
+ */
+bool mem_swap_word(MEMORY *mem, word_t addr, word_t expected, word_t value)
+{
+    // An unaligned word may straddle two pages, so it is not swapped atomically
+    if ((addr & 3) != 0)
+    {
+        if (mem_load_word(mem, addr) != expected)
+            return false;
+        mem_store_word(mem, addr, value);
+        return true;
+    }
+
+    word_t *word = (word_t *)(mem_page(mem, addr, true) + (addr & PAGE_MASK));
+    return __atomic_compare_exchange_n(word, &expected, value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief Copy `n` bytes out of guest memory, one page-sized span at a time.
+ *
+ * @param mem Guest memory
+ * @param addr Guest address to read from
+ * @param dst Host buffer
+ * @param n Number of bytes
+ */
+void mem_read(MEMORY *mem, word_t addr, void *dst, size_t n)
+{
+    byte_t *out = dst;
+    while (n > 0)
+    {
+        byte_t *span;
+        size_t len = mem_span(mem, addr, n, false, &span);
+        memcpy(out, span, len);
+        out += len;
+        addr += len;
+        n -= len;
+    }
+}
+
+/**
+ * @brief Copy `n` bytes into guest memory, one page-sized span at a time.
+ *
+ * @param mem Guest memory
+ * @param addr Guest address to write to
+ * @param src Host buffer
+ * @param n Number of bytes
+ */
+void mem_write(MEMORY *mem, word_t addr, const void *src, size_t n)
+{
+    const byte_t *in = src;
+    while (n > 0)
+    {
+        byte_t *span;
+        size_t len = mem_span(mem, addr, n, true, &span);
+        memcpy(span, in, len);
+        in += len;
+        addr += len;
+        n -= len;
+    }
+}
+
+/**
+ * @brief Copy a NUL-terminated guest string into a host buffer, scanning each
+ * page span with `memchr` rather than byte by byte.
+ *
+ * @param mem Guest memory
+ * @param addr Guest address of the string
+ * @param dst Host buffer of `max` bytes, always NUL-terminated
+ * @param max Size of `dst`
+ * @return size_t Length of the copied string
+ */
+size_t mem_read_string(MEMORY *mem, word_t addr, char *dst, size_t max)
+{
+    size_t total = 0;
+    while (total + 1 < max)
+    {
+        byte_t *span;
+        size_t len = mem_span(mem, addr, max - 1 - total, false, &span);
+        byte_t *nul = memchr(span, '\0', len);
+        if (nul != NULL)
+            len = nul - span;
+
+        memcpy(dst + total, span, len);
+        total += len;
+        addr += len;
+
+        if (nul != NULL)
+            break;
+    }
+
+    dst[total] = '\0';
+    return total;
+}
+
+/**
+ * @brief Copy `n` bytes between guest buffers with `memmove` semantics. Each
+ * step copies the largest run that stays inside one source page and one
+ * destination page, using the host's vectorised `memmove`; overlapping copies
+ * to a higher address run from the end.
+ *
+ * @param mem Guest memory
+ * @param dst Guest destination address
+ * @param src Guest source address
+ * @param n Number of bytes
+ */
+void mem_copy(MEMORY *mem, word_t dst, word_t src, size_t n)
+{
+    bool backward = dst > src && dst - src < n;
+
+    while (n > 0)
+    {
+        size_t len = n;
+        word_t d = dst;
+        word_t s = src;
+
+        if (backward)
+        {
+            size_t d_left = ((dst + n - 1) & PAGE_MASK) + 1;
+            size_t s_left = ((src + n - 1) & PAGE_MASK) + 1;
+            len = d_left < len ? d_left : len;
+            len = s_left < len ? s_left : len;
+            d = dst + n - len;
+            s = src + n - len;
+        }
+
+        byte_t *d_span;
+        byte_t *s_span;
+        len = mem_span(mem, d, len, true, &d_span);
+        len = mem_span(mem, s, len, false, &s_span);
+        memmove(d_span, s_span, len);
+
+        if (!backward)
+        {
+            dst += len;
+            src += len;
+        }
+        n -= len;
+    }
+}
+
+/**
+ * @brief Copy `n` bytes exactly as a forward byte-by-byte loop would, so a
+ * destination that overlaps just above the source repeats the first
+ * `dst - src` bytes. That case is copied in runs of `dst - src` bytes, each of
+ * which only reads bytes already final.
+ *
+ * @param mem Guest memory
+ * @param dst Guest destination address
+ * @param src Guest source address
+ * @param n Number of bytes
+ */
+void mem_copy_forward(MEMORY *mem, word_t dst, word_t src, size_t n)
+{
+    word_t distance = dst - src;
+    if (dst <= src || distance >= n)
+    {
+        mem_copy(mem, dst, src, n);
+        return;
+    }
+
+    for (size_t done = 0; done < n; done += distance)
+        mem_copy(mem, dst + done, src + done, n - done < distance ? n - done : distance);
+}
+
+/**
+ * @brief Fill `n` bytes of guest memory, one page span per `memset`.
+ *
+ * @param mem Guest memory
+ * @param dst Guest destination address
+ * @param value Byte to fill with
+ * @param n Number of bytes
+ */
+void mem_set(MEMORY *mem, word_t dst, byte_t value, size_t n)
+{
+    while (n > 0)
+    {
+        byte_t *span;
+        size_t len = mem_span(mem, dst, n, true, &span);
+        memset(span, value, len);
+        dst += len;
+        n -= len;
+    }
+}
+
+/**
+ * @brief Compare two guest buffers like `memcmp`, a pair of page spans at a
+ * time.
+ *
+ * @param mem Guest memory
+ * @param a Guest address of the first buffer
+ * @param b Guest address of the second buffer
+ * @param n Number of bytes
+ * @return int Negative, zero or positive like `memcmp`
+ */
+int mem_compare(MEMORY *mem, word_t a, word_t b, size_t n)
+{
+    while (n > 0)
+    {
+        byte_t *a_span;
+        byte_t *b_span;
+        size_t len = mem_span(mem, a, n, false, &a_span);
+        len = mem_span(mem, b, len, false, &b_span);
+
+        int diff = memcmp(a_span, b_span, len);
+        if (diff != 0)
+            return diff;
+
+        a += len;
+        b += len;
+        n -= len;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Length of a NUL-terminated guest string, scanning a page span per
+ * `memchr`.
+ *
+ * @param mem Guest memory
+ * @param addr Guest address of the string
+ * @return word_t
+ */
+word_t mem_strlen(MEMORY *mem, word_t addr)
+{
+    word_t len = 0;
+    for (;;)
+    {
+        byte_t *span;
+        size_t n = mem_span(mem, addr + len, PAGE_SIZE, false, &span);
+        byte_t *nul = memchr(span, '\0', n);
+        if (nul != NULL)
+            return len + (nul - span);
+        len += n;
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "hardware.h"
+
+byte_t *mem_page(MEMORY *mem, word_t addr, bool alloc);
+bool mem_add_handler(MEMORY *mem, word_t base, word_t len, page_read_t read, page_write_t write, void *ctx);
+bool mem_map(MEMORY *mem, word_t addr, int fd, off_t offset, size_t len);
+size_t mem_span(MEMORY *mem, word_t addr, size_t n, bool alloc, byte_t **span);
+int mem_iovec(MEMORY *mem, word_t addr, size_t n, bool alloc, struct iovec *iov, int max);
+word_t mem_load_word(MEMORY *mem, word_t addr);
+half_t mem_load_half(MEMORY *mem, word_t addr);
+byte_t mem_load_byte(MEMORY *mem, word_t addr);
+void mem_store_word(MEMORY *mem, word_t addr, word_t value);
+void mem_store_half(MEMORY *mem, word_t addr, half_t value);
+void mem_store_byte(MEMORY *mem, word_t addr, byte_t value);
+bool mem_swap_word(MEMORY *mem, word_t addr, word_t expected, word_t value);
+void mem_read(MEMORY *mem, word_t addr, void *dst, size_t n);
+void mem_write(MEMORY *mem, word_t addr, const void *src, size_t n);
+size_t mem_read_string(MEMORY *mem, word_t addr, char *dst, size_t max);
+void mem_copy(MEMORY *mem, word_t dst, word_t src, size_t n);
+void mem_copy_forward(MEMORY *mem, word_t dst, word_t src, size_t n);
+void mem_set(MEMORY *mem, word_t dst, byte_t value, size_t n);
+int mem_compare(MEMORY *mem, word_t a, word_t b, size_t n);
+word_t mem_strlen(MEMORY *mem, word_t addr);
@@ -53,6 +53,25 @@ J_FORMAT extract_J_FORMAT(int instr_code)
     return instr;
 }
 
+/**
+ * @brief Extracts the bit fields from an encoded instruction for a CP1
+ * instruction.
+ *
+ * @param instr_code Encoded MIPS instruction
+ * @return F_FORMAT
+ */
+F_FORMAT extract_F_FORMAT(int instr_code)
+{
+    F_FORMAT instr;
+    instr.op = (instr_code >> 26);
+    instr.fmt = ((instr_code >> 21) & 0x1F);
+    instr.ft = ((instr_code >> 16) & 0x1F);
+    instr.fs = ((instr_code >> 11) & 0x1F);
+    instr.fd = ((instr_code >> 6) & 0x1F);
+    instr.funct = (instr_code & 0x3F);
+    return instr;
+}
+
 /**
  * @brief Check if opcode is in R-format by comparing its funct value against
  * known R-instructions.
@@ -109,7 +128,8 @@ bool is_J_FORMAT(int instr_code)
 
 /**
  * @brief Check if opcode is a pseudo instruction by comparing its funct value
- * against known pseudo instructions.
+ * against known pseudo instructions. `mul` lives under SPECIAL2 and `syscall`
+ * under SPECIAL, so the op value must match too.
  *
  * @param instr_code Encoded MIPS instruction
  * @return true
@@ -118,8 +138,60 @@ bool is_J_FORMAT(int instr_code)
 bool is_P_FORMAT(int instr_code)
 {
     R_FORMAT instr = extract_R_FORMAT(instr_code);
+    if (!(instr.op == 0b011100 && instr.funct == MUL) &&
+        !(instr.op == 0b000000 && instr.funct == SYSCALL))
+        return false;
+
     for (int i = 0; i < NUM_P_INSTR; i++)
         if (instr.funct == P_LIST[i])
             return true;
     return false;
 }
+
+/**
+ * @brief Check if instruction is a CP1 instruction: a move to or from CP1, a
+ * CP1 branch, or arithmetic on a known format with a known funct value.
+ *
+ * @param instr_code Encoded MIPS instruction
+ * @return true
+ * @return false
+ */
+bool is_F_FORMAT(int instr_code)
+{
+    F_FORMAT instr = extract_F_FORMAT(instr_code);
+    if (instr.op != COP1)
+        return false;
+
+    switch (instr.fmt)
+    {
+    case MF:
+    case MT:
+    case BC:
+        return true;
+    case FMT_S:
+    case FMT_D:
+    case FMT_W:
+        for (int i = 0; i < NUM_F_INSTR; i++)
+            if (instr.funct == F_LIST[i])
+                return true;
+        return false;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Check if instruction is a CP0 instruction: `mfc0`, `mtc0` or `eret`.
+ *
+ * @param instr_code Encoded MIPS instruction
+ * @return true
+ * @return false
+ */
+bool is_C_FORMAT(int instr_code)
+{
+    R_FORMAT instr = extract_R_FORMAT(instr_code);
+    if (instr.op != COP0)
+        return false;
+
+    return instr.rs == MF || instr.rs == MT || (instr.rs == CO && instr.funct == ERET);
+}
@@ -39,10 +39,38 @@ typedef struct J_FORMAT
     unsigned addr : 26;
 } J_FORMAT;
 
+/**
+ * @struct F_FORMAT
+ * @brief Struct with bit fields to store the CP1 fields `op`, `fmt`, `ft`,
+ * `fs`, `fd`, `funct`.
+ */
+typedef struct F_FORMAT
+{
+    unsigned op : 6;
+    unsigned fmt : 5;
+    unsigned ft : 5;
+    unsigned fs : 5;
+    unsigned fd : 5;
+    unsigned funct : 6;
+} F_FORMAT;
+
+#define COP0 0b010000
+#define COP1 0b010001
+
+/**
+ * COP0 instructions beyond `mfc0` and `mtc0`, whose rs field shares its values
+ * with the COP1 `MF` and `MT`: with `CO` in rs, funct selects the operation.
+ */
+#define CO 0b10000
+#define ERET 0b011000
+
 R_FORMAT extract_R_FORMAT(int instr_code);
 I_FORMAT extract_I_FORMAT(int instr_code);
 J_FORMAT extract_J_FORMAT(int instr_code);
+F_FORMAT extract_F_FORMAT(int instr_code);
 bool is_R_FORMAT(int instr_code);
 bool is_J_FORMAT(int instr_code);
 bool is_P_FORMAT(int instr_code);
 bool is_I_FORMAT(int instr_code);
+bool is_F_FORMAT(int instr_code);
+bool is_C_FORMAT(int instr_code);
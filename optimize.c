@@ -0,0 +1,542 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cp0.h"
+#include "decode.h"
+#include "functions.h"
+#include "opcode.h"
+#include "optimize.h"
+#include "utils.h"
+
+#define BIT(reg) (UINT64_C(1) << (reg))
+#define ALL_REGISTERS (BIT(NUM_REGISTERS) - 1)
+
+/**
+ * @struct EFFECT
+ * @brief The registers an instruction reads and writes, HI and LO included.
+ * Writes to `$zero` do not count, as the decoder already sends them to the
+ * sink.
+ */
+typedef struct EFFECT
+{
+    uint64_t reads;  // Registers read
+    uint64_t writes; // Registers written
+    int dest;        // Register written by an instruction with no other effect, or -1
+    bool ends;       // Control may leave the block after this instruction
+    bool barrier;    // May read or write any register, as a syscall does
+} EFFECT;
+
+/**
+ * Replacement adapters. Each keeps the same operands as the handler it
+ * replaces, so registers end up exactly as they would have.
+ */
+static void exec_const(CPU *cpu, DECODED *d)
+{
+    d->rd->value.wd = d->imm;
+}
+
+static void exec_move(CPU *cpu, DECODED *d)
+{
+    d->rd->value.wd = d->rs->value.wd;
+}
+
+static void exec_add_imm(CPU *cpu, DECODED *d)
+{
+    d->rd->value.wd = (word_t)d->rs->value.wd + (word_t)d->imm;
+}
+
+#define SHIFT_IMM(NAME, FUNC_PTR)                               \
+    static void exec_##NAME(CPU *cpu, DECODED *d)               \
+    {                                                           \
+        FUNC_PTR(cpu, d->rs, d->rt, d->rd, d->shamt, d->funct); \
+    }
+SHIFT_IMM(sll, MIPS_sll)
+SHIFT_IMM(srl, MIPS_srl)
+SHIFT_IMM(sra, MIPS_sra)
+#undef SHIFT_IMM
+
+/**
+ * @brief Work out which registers a decoded instruction reads and writes.
+ *
+ * @param d Decoded MIPS instruction
+ * @param e Effect to fill
+ */
+static void effect_of(const DECODED *d, EFFECT *e)
+{
+    int code = d->instr_code;
+    R_FORMAT r = extract_R_FORMAT(code);
+    I_FORMAT i = extract_I_FORMAT(code);
+    F_FORMAT f = extract_F_FORMAT(code);
+
+    *e = (EFFECT){ .dest = -1 };
+
+    // Already a no-op, because it only wrote $zero
+    if (d->exec == exec_nop)
+        return;
+
+    switch (d->format)
+    {
+    case FORMAT_P:
+        if (r.funct == MUL)
+        {
+            e->reads = BIT(r.rs) | BIT(r.rt);
+            e->dest = r.rd;
+        }
+        else
+        {
+            e->barrier = true;
+            e->ends = true;
+        }
+        break;
+    case FORMAT_R:
+        switch (r.funct)
+        {
+        case SLL:
+        case SRA:
+        case SRL:
+            e->reads = BIT(r.rt);
+            e->dest = r.rd;
+            break;
+        case JR:
+            e->reads = BIT(r.rs);
+            e->ends = true;
+            break;
+        case JALR:
+            e->reads = BIT(r.rs);
+            e->writes = BIT(r.rd);
+            e->ends = true;
+            break;
+        case MFHI:
+            e->reads = BIT(HI);
+            e->dest = r.rd;
+            break;
+        case MFLO:
+            e->reads = BIT(LO);
+            e->dest = r.rd;
+            break;
+        case MTHI:
+            e->reads = BIT(r.rs);
+            e->writes = BIT(HI);
+            break;
+        case MTLO:
+            e->reads = BIT(r.rs);
+            e->writes = BIT(LO);
+            break;
+        case MULT:
+        case MULTU:
+        case DIV:
+        case DIVU:
+            e->reads = BIT(r.rs) | BIT(r.rt);
+            e->writes = BIT(HI) | BIT(LO);
+            break;
+        case BREAK:
+            e->barrier = true;
+            e->ends = true;
+            break;
+        default:
+            e->reads = BIT(r.rs) | BIT(r.rt);
+            e->dest = r.rd;
+        }
+        break;
+    case FORMAT_I:
+        switch (i.op)
+        {
+        case BEQ:
+        case BNE:
+            e->reads = BIT(i.rs) | BIT(i.rt);
+            e->ends = true;
+            break;
+        case BGEZ:
+        case BGTZ:
+        case BLEZ:
+            e->reads = BIT(i.rs);
+            e->ends = true;
+            break;
+        case LB:
+        case LH:
+        case LL:
+        case LW:
+            e->reads = BIT(i.rs);
+            e->writes = BIT(i.rt);
+            break;
+        case SC:
+            e->reads = BIT(i.rs) | BIT(i.rt);
+            e->writes = BIT(i.rt);
+            break;
+        case SB:
+        case SH:
+        case SW:
+            e->reads = BIT(i.rs) | BIT(i.rt);
+            break;
+        case LWC1:
+        case LDC1:
+        case SWC1:
+        case SDC1:
+            e->reads = BIT(i.rs);
+            break;
+        case LUI:
+            e->dest = i.rt;
+            break;
+        default:
+            e->reads = BIT(i.rs);
+            e->dest = i.rt;
+        }
+        break;
+    case FORMAT_J:
+        if (r.op == JAL)
+            e->writes = BIT($ra);
+        e->ends = true;
+        break;
+    case FORMAT_F:
+        if (f.fmt == MF)
+            e->writes = BIT(f.ft);
+        else if (f.fmt == MT)
+            e->reads = BIT(f.ft);
+        else if (f.fmt == BC)
+            e->ends = true;
+        break;
+    default:
+        e->barrier = true;
+        e->ends = true;
+    }
+
+    if (e->dest == $zero)
+        e->dest = -1;
+    if (e->dest >= 0)
+        e->writes = BIT(e->dest);
+    e->writes &= ~BIT($zero);
+}
+
+/**
+ * @brief Check whether the program may jump somewhere its code does not name:
+ * a `jr` or `jalr` through any register but `$ra`, a write to `$ra` other
+ * than a link, or an `eret` back to wherever an exception was taken.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param n Number of instructions
+ * @param fx Effect of each instruction
+ * @return bool Any instruction may be jumped to
+ */
+static bool jumps_anywhere(CPU *cpu, int n, const EFFECT *fx)
+{
+    for (int k = 0; k < n; k++)
+    {
+        DECODED *d = &cpu->program[k];
+        R_FORMAT r = extract_R_FORMAT(d->instr_code);
+        bool jump = d->format == FORMAT_R && (r.funct == JR || r.funct == JALR);
+        bool link = (d->format == FORMAT_J && r.op == JAL) || (jump && r.funct == JALR);
+
+        if (jump && r.rs != $ra)
+            return true;
+        if ((fx[k].writes & BIT($ra)) && !link)
+            return true;
+        if (d->format == FORMAT_C && r.rs == CO && r.funct == ERET)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Mark the instructions a basic block starts at: the first one, the
+ * entry point the PC is set to, branch and jump targets, and those after a
+ * control transfer, which is where `jr $ra` returns. EBase can be set to any
+ * page, so every instruction at the exception vector's offset in a page is
+ * marked too. If the program may jump anywhere, every instruction is marked.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param n Number of instructions
+ * @param fx Effect of each instruction
+ * @param leader Set for each instruction that starts a block
+ */
+static void find_leaders(CPU *cpu, int n, const EFFECT *fx, bool *leader)
+{
+    if (jumps_anywhere(cpu, n, fx))
+    {
+        for (int k = 0; k < n; k++)
+            leader[k] = true;
+        return;
+    }
+
+    leader[0] = true;
+    if (cpu->pc < (unsigned int)n)
+        leader[cpu->pc] = true;
+
+    for (int k = 0; k < n; k++)
+    {
+        DECODED *d = &cpu->program[k];
+        int target = -1;
+
+        if (fx[k].ends && k + 1 < n)
+            leader[k + 1] = true;
+        if ((text_address(cpu, k) & ~EBASE_MASK) == VECTOR_OFFSET)
+            leader[k] = true;
+
+        if (d->format == FORMAT_J)
+            target = jump_index(cpu, k, d->imm);
+        else if (fx[k].ends && (d->format == FORMAT_I || d->format == FORMAT_F))
+            target = k + d->imm;
+        if (target >= 0 && target < n)
+            leader[target] = true;
+    }
+}
+
+/**
+ * @brief Compute the value of an instruction whose operands are all known, by
+ * running its own handler on scratch registers.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param d Decoded MIPS instruction writing `dest` and nothing else
+ * @param values Known register values
+ * @return int32_t
+ */
+static int32_t evaluate(CPU *cpu, const DECODED *d, const int32_t *values)
+{
+    R_FORMAT r = extract_R_FORMAT(d->instr_code);
+    REGISTER rs = { .value.wd = values[r.rs] };
+    REGISTER rt = { .value.wd = values[r.rt] };
+    REGISTER out = { .value.wd = 0 };
+
+    DECODED t = *d;
+    t.rs = &rs;
+    t.rt = d->format == FORMAT_I ? &out : &rt;
+    t.rd = &out;
+    t.exec(cpu, &t);
+    return out.value.wd;
+}
+
+/**
+ * @brief Replace an instruction with one operand known by a cheaper form:
+ * register adds with a constant become immediate adds or moves, variable
+ * shifts by a constant become fixed shifts, and `mul` by a power of two
+ * becomes a shift.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param d Decoded MIPS instruction writing `e->dest` and nothing else
+ * @param e Its effect, updated to the replacement's
+ * @param known Registers whose value is known
+ * @param values Known register values
+ * @return bool The instruction was replaced
+ */
+static bool reduce(CPU *cpu, DECODED *d, EFFECT *e, uint64_t known, const int32_t *values)
+{
+    R_FORMAT r = extract_R_FORMAT(d->instr_code);
+    bool rs_known = known & BIT(r.rs);
+    bool rt_known = known & BIT(r.rt);
+    REGISTER *dest = cpu->reg[e->dest];
+
+    if (d->format == FORMAT_I)
+    {
+        int op = extract_I_FORMAT(d->instr_code).op;
+        if ((op != ADDI && op != ADDIU && op != ORI && op != XORI) || d->imm != 0)
+            return false;
+
+        d->exec = exec_move;
+        d->rd = dest;
+        return true;
+    }
+
+    int funct = d->format == FORMAT_P ? -1 : r.funct;
+    switch (funct)
+    {
+    case ADD:
+    case ADDU:
+    case SUB:
+    case SUBU:
+    case OR:
+    case XOR:
+    {
+        bool subtract = funct == SUB || funct == SUBU;
+        bool add = funct == ADD || funct == ADDU || subtract;
+        int from;
+        word_t c;
+
+        // The unknown operand is kept in rs and the constant in imm
+        if (rt_known)
+        {
+            from = r.rs;
+            c = subtract ? -(word_t)values[r.rt] : (word_t)values[r.rt];
+        }
+        else if (rs_known && !subtract)
+        {
+            from = r.rt;
+            c = values[r.rs];
+        }
+        else
+        {
+            return false;
+        }
+
+        if (c != 0 && !add)
+            return false;
+
+        d->rs = cpu->reg[from];
+        d->imm = c;
+        d->exec = c == 0 ? exec_move : exec_add_imm;
+        e->reads = BIT(from);
+        break;
+    }
+    case SLLV:
+    case SRLV:
+    case SRAV:
+        if (!rs_known || values[r.rs] < 0 || values[r.rs] > 31)
+            return false;
+
+        d->shamt = values[r.rs];
+        d->exec = funct == SLLV ? exec_sll : funct == SRLV ? exec_srl : exec_sra;
+        e->reads = BIT(r.rt);
+        break;
+    case -1:
+    {
+        // mul by a power of two
+        if (!rs_known && !rt_known)
+            return false;
+
+        word_t c = rt_known ? values[r.rt] : values[r.rs];
+        if (c == 0 || (c & (c - 1)) != 0)
+            return false;
+
+        // The shift reads its operand from rt
+        if (rt_known)
+            d->rt = d->rs;
+        d->shamt = __builtin_ctz(c);
+        d->exec = exec_sll;
+        e->reads = BIT(rt_known ? r.rs : r.rt);
+        break;
+    }
+    default:
+        return false;
+    }
+
+    d->rd = dest;
+    return true;
+}
+
+/**
+ * @brief Fold constants forward through a block: an instruction whose operands
+ * are all known becomes a load of the value it computes, and one with some
+ * known operands may become a cheaper form.
+ *
+ * @return int Number of instructions replaced
+ */
+static int propagate(CPU *cpu, EFFECT *fx, int first, int end)
+{
+    uint64_t known = BIT($zero);
+    int32_t values[NUM_REGISTERS] = { 0 };
+    int replaced = 0;
+
+    for (int k = first; k < end; k++)
+    {
+        DECODED *d = &cpu->program[k];
+        EFFECT *e = &fx[k];
+
+        if (e->barrier)
+        {
+            known = BIT($zero);
+            continue;
+        }
+
+        if (e->dest >= 0 && (e->reads & ~known) == 0)
+        {
+            int32_t value = evaluate(cpu, d, values);
+
+            // Instructions reading only $zero are already as cheap
+            if (e->reads & ~BIT($zero))
+            {
+                d->exec = exec_const;
+                d->rd = cpu->reg[e->dest];
+                d->imm = value;
+                e->reads = 0;
+                replaced++;
+            }
+
+            known |= BIT(e->dest);
+            values[e->dest] = value;
+            continue;
+        }
+
+        if (e->dest >= 0 && reduce(cpu, d, e, known, values))
+            replaced++;
+        known &= ~e->writes;
+    }
+
+    return replaced;
+}
+
+/**
+ * @brief Remove writes that are overwritten later in a block before anything
+ * reads them. Every register is taken to be live when the block ends.
+ *
+ * @return int Number of instructions removed
+ */
+static int eliminate(CPU *cpu, EFFECT *fx, int first, int end)
+{
+    uint64_t live = ALL_REGISTERS;
+    int removed = 0;
+
+    for (int k = end - 1; k >= first; k--)
+    {
+        EFFECT *e = &fx[k];
+
+        if (e->barrier)
+        {
+            live = ALL_REGISTERS;
+            continue;
+        }
+
+        if (e->dest >= 0 && !(live & BIT(e->dest)))
+        {
+            cpu->program[k].exec = exec_nop;
+            *e = (EFFECT){ .dest = -1 };
+            removed++;
+            continue;
+        }
+
+        live = (live & ~e->writes) | e->reads;
+    }
+
+    return removed;
+}
+
+/**
+ * @brief Optimize each basic block of the decoded program with constant
+ * folding and propagation, strength reduction and dead-write elimination.
+ * Records stay one per instruction, so any jump into a block still finds
+ * the instruction it expects, and the registers, memory and output when
+ * control leaves a block are unchanged.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param n Number of instructions
+ * @return int Number of instructions replaced or removed
+ */
+int optimize_program(CPU *cpu, int n)
+{
+    if (n == 0)
+        return 0;
+
+    EFFECT *fx = malloc(n * sizeof(EFFECT));
+    bool *leader = calloc(n, sizeof(bool));
+    if (fx == NULL || leader == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Optimizer\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int k = 0; k < n; k++)
+        effect_of(&cpu->program[k], &fx[k]);
+    find_leaders(cpu, n, fx, leader);
+
+    int changed = 0;
+    for (int first = 0, end; first < n; first = end)
+    {
+        for (end = first + 1; end < n && !leader[end]; end++)
+            ;
+
+        changed += propagate(cpu, fx, first, end);
+        changed += eliminate(cpu, fx, first, end);
+    }
+
+    free(leader);
+    free(fx);
+    return changed;
+}
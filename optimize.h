@@ -0,0 +1,5 @@
+#pragma once
+
+#include "hardware.h"
+
+int optimize_program(CPU *cpu, int n);
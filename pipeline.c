@@ -0,0 +1,416 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cache.h"
+#include "cp0.h"
+#include "decode.h"
+#include "hashtable.h"
+#include "opcode.h"
+#include "pipeline.h"
+#include "utils.h"
+
+/**
+ * Scoreboard slots: the general registers, then the FP registers, then the FP
+ * condition flags.
+ */
+#define FP_SLOT(n) (32 + (n))
+#define FCC_SLOT 64
+#define NUM_SLOTS 65
+
+/**
+ * How an instruction changes control flow.
+ */
+typedef enum control_t
+{
+    CTRL_NONE,
+    CTRL_BRANCH, // PC-relative, offset counted from the delay slot
+    CTRL_JUMP,   // Absolute target
+    CTRL_CALL,   // Absolute target, links past the delay slot
+} control_t;
+
+/**
+ * @struct TIMING
+ * @brief What the pipeline model needs to know about one instruction.
+ */
+typedef struct TIMING
+{
+    int reads[3];      // Slots read, -1 if unused
+    int write;         // Slot written, -1 if none
+    bool in_id;        // Operands are needed in ID (branches and jumps)
+    bool load;         // Result is only available after MEM
+    bool reads_hilo;   // `mfhi` or `mflo`
+    int hilo_latency;  // Cycles HI/LO stay busy after EX, 0 if not written
+    control_t control; // Control flow
+} TIMING;
+
+/**
+ * @struct PIPELINE
+ * @brief State of the 5-stage pipeline between instructions. Cycles are
+ * counted from 1, the first fetch.
+ */
+typedef struct PIPELINE
+{
+    unsigned long long last;             // Cycle the last instruction was in ID
+    unsigned long long ready[NUM_SLOTS]; // First cycle a slot's value can enter EX
+    unsigned long long hilo_ready;       // First cycle HI/LO can be used in EX
+} PIPELINE;
+
+/**
+ * @brief Describe the registers an instruction reads and writes and how it
+ * changes control flow.
+ *
+ * @param d Decoded MIPS instruction
+ * @param t Description to fill
+ */
+static void classify(DECODED *d, TIMING *t)
+{
+    int code = d->instr_code;
+    R_FORMAT r = extract_R_FORMAT(code);
+    I_FORMAT i = extract_I_FORMAT(code);
+    F_FORMAT f = extract_F_FORMAT(code);
+    int *reads = t->reads;
+
+    *t = (TIMING){ .reads = { -1, -1, -1 }, .write = -1 };
+
+    if (is_P_FORMAT(code))
+    {
+        if (r.funct == SYSCALL)
+        {
+            reads[0] = $v0;
+            reads[1] = $a0;
+            reads[2] = $a1;
+            t->write = $v0;
+        }
+        else
+        {
+            reads[0] = r.rs;
+            reads[1] = r.rt;
+            t->write = r.rd;
+        }
+    }
+    else if (is_R_FORMAT(code))
+    {
+        switch (r.funct)
+        {
+        case SLL:
+        case SRA:
+        case SRL:
+            reads[0] = r.rt;
+            t->write = r.rd;
+            break;
+        case JR:
+            reads[0] = r.rs;
+            t->in_id = true;
+            t->control = CTRL_JUMP;
+            break;
+        case JALR:
+            reads[0] = r.rs;
+            t->write = r.rd;
+            t->in_id = true;
+            t->control = CTRL_CALL;
+            break;
+        case MFHI:
+        case MFLO:
+            t->reads_hilo = true;
+            t->write = r.rd;
+            break;
+        case MTHI:
+        case MTLO:
+            reads[0] = r.rs;
+            t->hilo_latency = 1;
+            break;
+        case MULT:
+        case MULTU:
+            reads[0] = r.rs;
+            reads[1] = r.rt;
+            t->hilo_latency = MULT_LATENCY;
+            break;
+        case DIV:
+        case DIVU:
+            reads[0] = r.rs;
+            reads[1] = r.rt;
+            t->hilo_latency = DIV_LATENCY;
+            break;
+        case BREAK:
+            break;
+        default:
+            reads[0] = r.rs;
+            reads[1] = r.rt;
+            t->write = r.rd;
+        }
+    }
+    else if (is_I_FORMAT(code))
+    {
+        switch (i.op)
+        {
+        case BEQ:
+        case BNE:
+            reads[1] = i.rt;
+            // fall through
+        case BGEZ:
+        case BGTZ:
+        case BLEZ:
+            reads[0] = i.rs;
+            t->in_id = true;
+            t->control = CTRL_BRANCH;
+            break;
+        case LB:
+        case LH:
+        case LL:
+        case LW:
+            reads[0] = i.rs;
+            t->write = i.rt;
+            t->load = true;
+            break;
+        case LWC1:
+        case LDC1:
+            reads[0] = i.rs;
+            t->write = FP_SLOT(i.rt);
+            t->load = true;
+            break;
+        case SB:
+        case SH:
+        case SW:
+            reads[0] = i.rs;
+            reads[1] = i.rt;
+            break;
+        case SC:
+            reads[0] = i.rs;
+            reads[1] = i.rt;
+            t->write = i.rt;
+            break;
+        case SWC1:
+        case SDC1:
+            reads[0] = i.rs;
+            reads[1] = FP_SLOT(i.rt);
+            break;
+        case LUI:
+            t->write = i.rt;
+            break;
+        default:
+            reads[0] = i.rs;
+            t->write = i.rt;
+        }
+    }
+    else if (is_J_FORMAT(code))
+    {
+        if (r.op == JAL)
+        {
+            t->write = $ra;
+            t->control = CTRL_CALL;
+        }
+        else
+        {
+            t->control = CTRL_JUMP;
+        }
+    }
+    else if (is_F_FORMAT(code))
+    {
+        if (f.fmt == MF)
+        {
+            reads[0] = FP_SLOT(f.fs);
+            t->write = f.ft;
+        }
+        else if (f.fmt == MT)
+        {
+            reads[0] = f.ft;
+            t->write = FP_SLOT(f.fs);
+        }
+        else if (f.fmt == BC)
+        {
+            reads[0] = FCC_SLOT;
+            t->in_id = true;
+            t->control = CTRL_BRANCH;
+        }
+        else
+        {
+            reads[0] = FP_SLOT(f.fs);
+            switch (f.funct)
+            {
+            case C_EQ:
+            case C_LT:
+            case C_LE:
+                reads[1] = FP_SLOT(f.ft);
+                t->write = FCC_SLOT;
+                break;
+            case ADD_F:
+            case SUB_F:
+            case MUL_F:
+            case DIV_F:
+                reads[1] = FP_SLOT(f.ft);
+                // fall through
+            default:
+                t->write = FP_SLOT(f.fd);
+            }
+        }
+    }
+    else if (is_C_FORMAT(code))
+    {
+        // `eret` has no delay slot, so it is not timed as a jump
+        if (r.rs == MF)
+            t->write = r.rt;
+        else if (r.rs == MT)
+            reads[0] = r.rt;
+    }
+
+    // $zero never carries a dependency
+    for (int k = 0; k < 3; k++)
+        if (reads[k] == $zero)
+            reads[k] = -1;
+    if (t->write == $zero)
+        t->write = -1;
+}
+
+/**
+ * @brief Advance the pipeline by one instruction: find the first cycle it can
+ * leave ID given its operands, and record when its own result is ready.
+ *
+ * With full forwarding an ALU result feeds the next instruction's EX without a
+ * stall, while a load result costs one cycle. Branches and jumps resolve in ID,
+ * so they wait one cycle more for either. The multiply/divide unit is not
+ * pipelined: `mfhi`/`mflo` and the next `mult`/`div` wait until it is done.
+ *
+ * @param pipe Pipeline state
+ * @param t Instruction entering ID
+ * @param stats Counters to update
+ */
+static void account(PIPELINE *pipe, TIMING *t, PIPELINE_STATS *stats)
+{
+    unsigned long long issue = pipe->last + 1;
+    unsigned long long cycle = issue;
+
+    for (int k = 0; k < 3; k++)
+    {
+        if (t->reads[k] < 0)
+            continue;
+
+        unsigned long long ready = pipe->ready[t->reads[k]];
+        unsigned long long need = t->in_id ? ready : ready - 1;
+        if (ready > 0 && need > cycle)
+            cycle = need;
+    }
+
+    if (t->in_id)
+        stats->branch += cycle - issue;
+    else
+        stats->load_use += cycle - issue;
+
+    if (t->reads_hilo || t->hilo_latency > 1)
+    {
+        unsigned long long need = pipe->hilo_ready - 1;
+        if (pipe->hilo_ready > 0 && need > cycle)
+        {
+            stats->hilo += need - cycle;
+            cycle = need;
+        }
+    }
+
+    if (t->hilo_latency > 0)
+        pipe->hilo_ready = cycle + 1 + t->hilo_latency;
+    if (t->write >= 0)
+        pipe->ready[t->write] = cycle + (t->load ? 3 : 2);
+
+    pipe->last = cycle;
+    stats->instructions++;
+}
+
+/**
+ * @brief Fetch and execute one instruction, advancing Count.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param d Decoded MIPS instruction
+ */
+static void step(CPU *cpu, DECODED *d)
+{
+    if (cpu->caches != NULL)
+        cache_fetch(cpu->caches, cpu->pc);
+
+    cp0_tick(cpu, 1);
+    d->exec(cpu, d);
+}
+
+/**
+ * @brief Run the decoded program from the PC with MIPS branch delay slots
+ * while timing it on a classic 5-stage pipeline (IF, ID, EX, MEM, WB).
+ *
+ * The instruction after a branch or jump always executes. Branch offsets are
+ * counted from that delay slot and `jal`/`jalr` link past it, as on hardware.
+ * A control transfer inside a delay slot is undefined on MIPS; here it simply
+ * takes effect. Pending interrupts are taken before each instruction that is
+ * not in a delay slot.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param n Number of instructions
+ * @param stats Filled with cycle and stall counts
+ */
+void pipeline_run(CPU *cpu, int n, PIPELINE_STATS *stats)
+{
+    TIMING *timing = malloc((n > 0 ? n : 1) * sizeof(TIMING));
+    PIPELINE *pipe = calloc(1, sizeof(PIPELINE));
+    if (timing == NULL || pipe == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Pipeline\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < n; i++)
+        classify(&cpu->program[i], &timing[i]);
+
+    *stats = (PIPELINE_STATS){ 0 };
+    pipe->last = 1;
+
+    for (; cpu->pc < n; cpu->pc++)
+    {
+        cp0_interrupt(cpu);
+        unsigned int pc = cpu->pc;
+        TIMING *t = &timing[pc];
+
+        account(pipe, t, stats);
+        step(cpu, &cpu->program[pc]);
+        if (t->control == CTRL_NONE)
+            continue;
+
+        bool taken = t->control != CTRL_BRANCH || cpu->pc != pc;
+        unsigned int target = cpu->pc + 1 + (t->control == CTRL_BRANCH);
+        if (t->control == CTRL_CALL && t->write >= 0)
+            cpu->reg[t->write]->value.wd += 4;
+
+        // Delay slot
+        unsigned int slot = pc + 1;
+        if (slot < n)
+        {
+            cpu->pc = slot;
+            account(pipe, &timing[slot], stats);
+            step(cpu, &cpu->program[slot]);
+            if (cpu->pc != slot)
+                continue;
+        }
+
+        cpu->pc = taken ? target - 1 : slot;
+    }
+
+    stats->cycles = stats->instructions > 0 ? pipe->last + 3 : 0;
+
+    free(pipe);
+    free(timing);
+}
+
+/**
+ * @brief Print the cycle count, CPI and stalls by cause.
+ *
+ * @param stats Counters from `pipeline_run()`
+ */
+void print_pipeline_stats(PIPELINE_STATS *stats)
+{
+    unsigned long long stalls = stats->load_use + stats->branch + stats->hilo;
+
+    printf("Pipeline\n");
+    printf("Cycles       = %llu\n", stats->cycles);
+    printf("Instructions = %llu\n", stats->instructions);
+    printf("CPI          = %.3f\n",
+        stats->instructions > 0 ? (double)stats->cycles / stats->instructions : 0.0);
+    printf("Stalls       = %llu\n", stalls);
+    printf("  load-use   = %llu\n", stats->load_use);
+    printf("  branch     = %llu\n", stats->branch);
+    printf("  HI/LO      = %llu\n", stats->hilo);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "hardware.h"
+
+/**
+ * Cycles the multiply/divide unit is busy before HI and LO are readable,
+ * following the R3000.
+ */
+#define MULT_LATENCY 12
+#define DIV_LATENCY 35
+
+/**
+ * @struct PIPELINE_STATS
+ * @brief Counters gathered by the timing mode.
+ */
+typedef struct PIPELINE_STATS
+{
+    unsigned long long cycles;       // Cycles until the last instruction retires
+    unsigned long long instructions; // Instructions executed
+    unsigned long long load_use;     // Stalls waiting on a load result
+    unsigned long long branch;       // Stalls waiting on a branch operand
+    unsigned long long hilo;         // Stalls waiting on the multiply/divide unit
+} PIPELINE_STATS;
+
+void pipeline_run(CPU *cpu, int n, PIPELINE_STATS *stats);
+void print_pipeline_stats(PIPELINE_STATS *stats);
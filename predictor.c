@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "predictor.h"
+
+static const char *KIND_STR[] = {
+    [PREDICT_STATIC] = "static",
+    [PREDICT_BIMODAL] = "bimodal",
+    [PREDICT_GSHARE] = "gshare",
+    [PREDICT_TOURNAMENT] = "tournament",
+};
+
+/**
+ * @brief Allocate a table of 2-bit counters.
+ *
+ * @param n Number of counters
+ * @param value Initial value of each counter
+ * @return byte_t*
+ */
+static byte_t *init_counters(word_t n, byte_t value)
+{
+    byte_t *table = malloc(n);
+    if (table == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Predictor\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(table, value, n);
+    return table;
+}
+
+/**
+ * @brief Initialise a predictor from `KIND[:BITS]`, where KIND is `static`,
+ * `bimodal`, `gshare` or `tournament` and BITS is log2 of the table size.
+ *
+ * @param spec Predictor as string, or NULL for bimodal
+ * @return PREDICTOR*
+ */
+PREDICTOR *init_PREDICTOR(const char *spec)
+{
+    PREDICTOR *p = calloc(1, sizeof(PREDICTOR));
+    if (p == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Predictor\n");
+        exit(EXIT_FAILURE);
+    }
+
+    p->kind = PREDICT_BIMODAL;
+    p->bits = PREDICTOR_DEFAULT_BITS;
+
+    if (spec != NULL)
+    {
+        const char *colon = strchr(spec, ':');
+        size_t len = colon != NULL ? (size_t)(colon - spec) : strlen(spec);
+
+        int kind = -1;
+        for (int k = 0; k < (int)(sizeof(KIND_STR) / sizeof(KIND_STR[0])); k++)
+            if (strlen(KIND_STR[k]) == len && strncmp(spec, KIND_STR[k], len) == 0)
+                kind = k;
+
+        if (kind < 0)
+        {
+            fprintf(stderr, "ERROR: Unknown predictor %.*s\n", (int)len, spec);
+            exit(EXIT_FAILURE);
+        }
+        p->kind = kind;
+
+        if (colon != NULL)
+        {
+            char *end;
+            p->bits = strtol(colon + 1, &end, 10);
+            if (*end != '\0' || p->bits < 1 || p->bits > PREDICTOR_MAX_BITS)
+            {
+                fprintf(stderr, "ERROR: Predictor table bits must be 1 to %d\n", PREDICTOR_MAX_BITS);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    word_t n = 1U << p->bits;
+    p->mask = n - 1;
+
+    // Counters start weakly not taken, the chooser weakly favouring bimodal
+    if (p->kind == PREDICT_BIMODAL || p->kind == PREDICT_TOURNAMENT)
+        p->bimodal = init_counters(n, 1);
+    if (p->kind == PREDICT_GSHARE || p->kind == PREDICT_TOURNAMENT)
+        p->gshare = init_counters(n, 1);
+    if (p->kind == PREDICT_TOURNAMENT)
+        p->chooser = init_counters(n, 1);
+
+    return p;
+}
+
+/**
+ * @brief Destroy the predictor.
+ *
+ * @param p Predictor to be destroyed
+ */
+void free_PREDICTOR(PREDICTOR *p)
+{
+    free(p->bimodal);
+    free(p->gshare);
+    free(p->chooser);
+    free(p->sites);
+    free(p);
+    p = NULL;
+}
+
+/**
+ * @brief Give every instruction of a program of `n` counters, keeping those
+ * already counted.
+ *
+ * @param p Predictor
+ * @param n Number of instructions
+ */
+void predictor_resize(PREDICTOR *p, int n)
+{
+    if (n <= p->n_sites)
+        return;
+
+    p->sites = realloc(p->sites, n * sizeof(BRANCH_SITE));
+    if (p->sites == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Predictor\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(&p->sites[p->n_sites], 0, (n - p->n_sites) * sizeof(BRANCH_SITE));
+    p->n_sites = n;
+}
+
+/**
+ * @brief Move a saturating 2-bit counter towards taken or not taken.
+ */
+static inline void train(byte_t *counter, bool taken)
+{
+    if (taken && *counter < 3)
+        (*counter)++;
+    else if (!taken && *counter > 0)
+        (*counter)--;
+}
+
+/**
+ * @brief Predict a conditional branch, then train on its outcome. The
+ * predictor kind is chosen once at start-up; the switch compiles to a jump
+ * table rather than an indirect call per branch.
+ *
+ * @param p Predictor
+ * @param pc Instruction of the branch
+ * @param backward Branch target is at or before the branch
+ * @param taken Outcome
+ */
+void predictor_branch(PREDICTOR *p, word_t pc, bool backward, bool taken)
+{
+    word_t local = pc & p->mask;
+    word_t global = (pc ^ p->history) & p->mask;
+    bool guess = false;
+
+    switch (p->kind)
+    {
+    case PREDICT_STATIC:
+        guess = backward;
+        break;
+    case PREDICT_BIMODAL:
+        guess = p->bimodal[local] >= 2;
+        train(&p->bimodal[local], taken);
+        break;
+    case PREDICT_GSHARE:
+        guess = p->gshare[global] >= 2;
+        train(&p->gshare[global], taken);
+        break;
+    case PREDICT_TOURNAMENT:
+    {
+        bool by_bimodal = p->bimodal[local] >= 2;
+        bool by_gshare = p->gshare[global] >= 2;
+        guess = p->chooser[local] >= 2 ? by_gshare : by_bimodal;
+        if (by_bimodal != by_gshare)
+            train(&p->chooser[local], by_gshare == taken);
+        train(&p->bimodal[local], taken);
+        train(&p->gshare[global], taken);
+        break;
+    }
+    }
+
+    p->history = (p->history << 1) | taken;
+    p->branches++;
+    p->mispredicted += guess != taken;
+
+    if (pc < (word_t)p->n_sites)
+    {
+        p->sites[pc].executed++;
+        p->sites[pc].taken += taken;
+        p->sites[pc].mispredicted += guess != taken;
+    }
+}
+
+/**
+ * @brief Look up an indirect jump in the BTB, then record its target.
+ *
+ * @param p Predictor
+ * @param pc Instruction of the jump
+ * @param target Instruction jumped to
+ */
+void predictor_indirect(PREDICTOR *p, word_t pc, word_t target)
+{
+    BTB_ENTRY *e = &p->btb[pc & (BTB_ENTRIES - 1)];
+    bool hit = e->valid && e->pc == pc && e->target == target;
+
+    *e = (BTB_ENTRY){ pc, target, true };
+    p->indirect++;
+    p->btb_misses += !hit;
+
+    if (pc < (word_t)p->n_sites)
+    {
+        p->sites[pc].executed++;
+        p->sites[pc].taken++;
+        p->sites[pc].mispredicted += !hit;
+    }
+}
+
+static double rate(unsigned long long part, unsigned long long whole)
+{
+    return whole > 0 ? 100.0 * part / whole : 0.0;
+}
+
+/**
+ * @brief Print overall misprediction rates and a line per branch site.
+ *
+ * @param p Predictor
+ */
+void print_predictor_stats(PREDICTOR *p)
+{
+    printf("Branch prediction (%s", KIND_STR[p->kind]);
+    if (p->kind != PREDICT_STATIC)
+        printf(", %u entries", p->mask + 1);
+    printf(")\n");
+
+    printf("Branches     = %llu, mispredicted %llu (%.2f%%)\n",
+        p->branches, p->mispredicted, rate(p->mispredicted, p->branches));
+    printf("Indirect     = %llu, BTB misses %llu (%.2f%%)\n",
+        p->indirect, p->btb_misses, rate(p->btb_misses, p->indirect));
+
+    printf("%4s %10s %10s %12s %9s\n", "PC", "Executed", "Taken", "Mispredicted", "Rate");
+    for (int i = 0; i < p->n_sites; i++)
+    {
+        BRANCH_SITE *s = &p->sites[i];
+        if (s->executed > 0)
+            printf("%4d %10llu %10llu %12llu %8.2f%%\n",
+                i, s->executed, s->taken, s->mispredicted, rate(s->mispredicted, s->executed));
+    }
+}
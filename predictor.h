@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "hardware.h"
+
+/**
+ * Default log2 of the number of counters in each predictor table.
+ */
+#define PREDICTOR_DEFAULT_BITS 10
+#define PREDICTOR_MAX_BITS 20
+
+/**
+ * Entries in the branch target buffer used for `jr` and `jalr`.
+ */
+#define BTB_ENTRIES 512
+
+typedef enum predictor_kind_t
+{
+    PREDICT_STATIC,     // Backward taken, forward not taken
+    PREDICT_BIMODAL,    // 2-bit counters indexed by PC
+    PREDICT_GSHARE,     // 2-bit counters indexed by PC xor global history
+    PREDICT_TOURNAMENT, // Bimodal and gshare with a per-PC chooser
+} predictor_kind_t;
+
+/**
+ * @struct BRANCH_SITE
+ * @brief Counters for one branch or indirect jump.
+ */
+typedef struct BRANCH_SITE
+{
+    unsigned long long executed;
+    unsigned long long taken;
+    unsigned long long mispredicted;
+} BRANCH_SITE;
+
+/**
+ * @struct BTB_ENTRY
+ * @brief A branch target buffer entry: the last target seen at a PC.
+ */
+typedef struct BTB_ENTRY
+{
+    word_t pc;     // Instruction of the jump
+    word_t target; // Last target
+    bool valid;    // Entry is in use
+} BTB_ENTRY;
+
+/**
+ * @struct PREDICTOR
+ * @brief The selected predictor's tables, the BTB, and counters.
+ */
+typedef struct PREDICTOR
+{
+    predictor_kind_t kind;           // Predictor in use
+    int bits;                        // log2 of the table size
+    word_t mask;                     // Table size - 1
+    byte_t *bimodal;                 // Bimodal counters
+    byte_t *gshare;                  // Gshare counters
+    byte_t *chooser;                 // Tournament chooser, high selects gshare
+    word_t history;                  // Global branch history, newest in bit 0
+    BTB_ENTRY btb[BTB_ENTRIES];      // Targets of indirect jumps
+    unsigned long long branches;     // Conditional branches executed
+    unsigned long long mispredicted; // Conditional branches mispredicted
+    unsigned long long indirect;     // Indirect jumps executed
+    unsigned long long btb_misses;   // Indirect jumps with a wrong or no target
+    BRANCH_SITE *sites;              // Counters per instruction
+    int n_sites;                     // Length of `sites`
+} PREDICTOR;
+
+PREDICTOR *init_PREDICTOR(const char *spec);
+void free_PREDICTOR(PREDICTOR *p);
+void predictor_resize(PREDICTOR *p, int n);
+void predictor_branch(PREDICTOR *p, word_t pc, bool backward, bool taken);
+void predictor_indirect(PREDICTOR *p, word_t pc, word_t target);
+void print_predictor_stats(PREDICTOR *p);
@@ -0,0 +1,527 @@
+// For fopencookie
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "results.h"
+
+/**
+ * Seconds after which a temporary file is taken to be left by a worker that
+ * died while writing it.
+ */
+#define STALE_TEMP 3600
+
+/**
+ * Results of different builds are kept apart, as they may differ: the key
+ * starts with the contents of the running executable.
+ */
+#define RESULTS_BUILD "/proc/self/exe"
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/**
+ * @brief Mix one 64-byte block into the hash.
+ */
+static void sha256_block(SHA256 *sha, const uint8_t *p)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = sha->h[0], b = sha->h[1], c = sha->h[2], d = sha->h[3];
+    uint32_t e = sha->h[4], f = sha->h[5], g = sha->h[6], h = sha->h[7];
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    sha->h[0] += a;
+    sha->h[1] += b;
+    sha->h[2] += c;
+    sha->h[3] += d;
+    sha->h[4] += e;
+    sha->h[5] += f;
+    sha->h[6] += g;
+    sha->h[7] += h;
+}
+
+static void sha256_init(SHA256 *sha)
+{
+    static const uint32_t h0[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(sha->h, h0, sizeof(h0));
+    sha->len = 0;
+}
+
+static void sha256_update(SHA256 *sha, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    size_t fill = sha->len & 63;
+    sha->len += len;
+
+    if (fill > 0)
+    {
+        size_t n = 64 - fill < len ? 64 - fill : len;
+        memcpy(sha->block + fill, p, n);
+        p += n;
+        len -= n;
+        if (fill + n < 64)
+            return;
+        sha256_block(sha, sha->block);
+    }
+
+    for (; len >= 64; p += 64, len -= 64)
+        sha256_block(sha, p);
+    memcpy(sha->block, p, len);
+}
+
+static void sha256_final(SHA256 *sha, uint8_t digest[32])
+{
+    uint64_t bits = sha->len * 8;
+    uint8_t pad[72] = { 0x80 };
+    size_t n = (sha->len & 63) < 56 ? 56 - (sha->len & 63) : 120 - (sha->len & 63);
+    for (int i = 0; i < 8; i++)
+        pad[n + i] = bits >> (56 - 8 * i);
+    sha256_update(sha, pad, n + 8);
+
+    for (int i = 0; i < 32; i++)
+        digest[i] = sha->h[i / 4] >> (24 - 8 * (i % 4));
+}
+
+/**
+ * @brief Open a result cache, creating its directory if need be.
+ *
+ * @param spec `DIR[:MAX_MB]`
+ * @return RESULTS*
+ */
+RESULTS *init_RESULTS(const char *spec)
+{
+    RESULTS *results = calloc(1, sizeof(RESULTS));
+    char *dir = strdup(spec);
+    if (results == NULL || dir == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Results\n");
+        exit(EXIT_FAILURE);
+    }
+
+    long long mb = RESULTS_DEFAULT_MB;
+    char *colon = strrchr(dir, ':');
+    if (colon != NULL)
+    {
+        char *end;
+        mb = strtoll(colon + 1, &end, 10);
+        if (*end != '\0' || mb < 1)
+        {
+            fprintf(stderr, "ERROR: Result cache takes DIR[:MAX_MB], MAX_MB positive\n");
+            exit(EXIT_FAILURE);
+        }
+        *colon = '\0';
+    }
+
+    struct stat st;
+    if ((mkdir(dir, 0755) < 0 && errno != EEXIST) || stat(dir, &st) < 0 || !S_ISDIR(st.st_mode))
+    {
+        fprintf(stderr, "ERROR: Failed to open result cache %s\n", dir);
+        exit(EXIT_FAILURE);
+    }
+
+    results->dir = dir;
+    results->max_bytes = (uint64_t)mb << 20;
+    sha256_init(&results->sha);
+    if (!results_hash_file(results, RESULTS_BUILD))
+    {
+        fprintf(stderr, "ERROR: Failed to read %s for the result cache\n", RESULTS_BUILD);
+        exit(EXIT_FAILURE);
+    }
+    return results;
+}
+
+/**
+ * @brief Close a result cache, and the capture of a run if one was started.
+ * The caller must have stopped writing to the capturing streams.
+ *
+ * @param results Result cache to be destroyed
+ */
+void free_RESULTS(RESULTS *results)
+{
+    if (results->out_tee != NULL)
+    {
+        fclose(results->out_tee);
+        fclose(results->err_tee);
+        fclose(results->out_mem);
+        fclose(results->err_mem);
+    }
+    free(results->out_buf);
+    free(results->err_buf);
+    free(results->dir);
+    free(results);
+    results = NULL;
+}
+
+/**
+ * @brief Add a piece of what a run depends on to its key. Each piece is
+ * hashed after its length, so pieces cannot run into one another.
+ *
+ * @param results Result cache
+ * @param data Bytes of the piece
+ * @param len Length of the piece
+ */
+void results_hash(RESULTS *results, const void *data, size_t len)
+{
+    uint64_t n = len;
+    sha256_update(&results->sha, &n, sizeof(n));
+    sha256_update(&results->sha, data, len);
+}
+
+/**
+ * @brief Add the contents of a file to the key of a run.
+ *
+ * @param results Result cache
+ * @param file Name of the file
+ * @return true if the file was read
+ */
+bool results_hash_file(RESULTS *results, const char *file)
+{
+    int fd = open(file, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+
+    uint64_t n = st.st_size;
+    sha256_update(&results->sha, &n, sizeof(n));
+
+    char buf[65536];
+    ssize_t got;
+    uint64_t total = 0;
+    while ((got = read(fd, buf, sizeof(buf))) > 0)
+    {
+        sha256_update(&results->sha, buf, got);
+        total += got;
+    }
+    close(fd);
+    return got == 0 && total == n;
+}
+
+/**
+ * @brief Finish the key, once everything the run depends on is hashed.
+ */
+static void seal(RESULTS *results)
+{
+    if (results->key[0] != '\0')
+        return;
+
+    uint8_t digest[32];
+    sha256_final(&results->sha, digest);
+    for (int i = 0; i < 32; i++)
+        sprintf(results->key + 2 * i, "%02x", digest[i]);
+}
+
+/**
+ * @brief Path of a file in the cache directory. The caller frees it.
+ */
+static char *path(RESULTS *results, const char *name)
+{
+    size_t len = strlen(results->dir) + strlen(name) + 2;
+    char *p = malloc(len);
+    if (p == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Results\n");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(p, len, "%s/%s", results->dir, name);
+    return p;
+}
+
+/**
+ * @brief Look the run up and, if it is there, write out what it wrote and
+ * mark it used. A file that is not a whole result is taken as a miss.
+ *
+ * @param results Result cache, with the key hashed
+ * @param out Stream to replay stdout to
+ * @param err Stream to replay stderr to
+ * @param exit_code Set to the exit status of the run, if found
+ * @return true if the run was found and replayed
+ */
+bool results_replay(RESULTS *results, FILE *out, FILE *err, int *exit_code)
+{
+    seal(results);
+    char *file = path(results, results->key);
+    int fd = open(file, O_RDONLY);
+    free(file);
+
+    struct stat st;
+    RESULT_HEADER h;
+    if (fd < 0)
+        return false;
+    if (fstat(fd, &st) < 0 || read(fd, &h, sizeof(h)) != sizeof(h) ||
+        memcmp(h.magic, RESULTS_MAGIC, RESULTS_MAGIC_LEN) != 0 ||
+        h.out_len > (uint64_t)st.st_size || h.err_len > (uint64_t)st.st_size ||
+        sizeof(h) + h.out_len + h.err_len != (uint64_t)st.st_size)
+    {
+        close(fd);
+        return false;
+    }
+
+    char *data = malloc(h.out_len + h.err_len + 1);
+    if (data == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Results\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t len = h.out_len + h.err_len;
+    size_t done = 0;
+    ssize_t got = 0;
+    while (done < len && (got = read(fd, data + done, len - done)) > 0)
+        done += got;
+
+    // Replaying a result makes it the most recently used
+    if (done == len)
+        futimens(fd, NULL);
+    close(fd);
+
+    if (done == len)
+    {
+        fwrite(data, 1, h.out_len, out);
+        fwrite(data + h.out_len, 1, h.err_len, err);
+        fflush(out);
+        *exit_code = h.exit_code;
+    }
+    free(data);
+    return done == len;
+}
+
+/**
+ * @brief Capture stdout as it is passed on. Muted output would be discarded
+ * downstream, so it is dropped here.
+ */
+static ssize_t tee_out(void *cookie, const char *data, size_t len)
+{
+    RESULTS *results = cookie;
+    if (results->muted)
+        return len;
+
+    fwrite(data, 1, len, results->out_mem);
+    return fwrite(data, 1, len, results->out);
+}
+
+static ssize_t tee_err(void *cookie, const char *data, size_t len)
+{
+    RESULTS *results = cookie;
+    fwrite(data, 1, len, results->err_mem);
+    return fwrite(data, 1, len, results->err);
+}
+
+/**
+ * @brief Start capturing a run that was not found, through streams to be
+ * written in place of `out` and `err`: `out_tee` and `err_tee`. They are
+ * unbuffered, so output reaches `out` and `err` as it would otherwise.
+ *
+ * @param results Result cache
+ * @param out Stream stdout is passed on to
+ * @param err Stream stderr is passed on to
+ */
+void results_capture(RESULTS *results, FILE *out, FILE *err)
+{
+    results->out = out;
+    results->err = err;
+    results->out_mem = open_memstream(&results->out_buf, &results->out_len);
+    results->err_mem = open_memstream(&results->err_buf, &results->err_len);
+    results->out_tee = fopencookie(results, "w", (cookie_io_functions_t){ .write = tee_out });
+    results->err_tee = fopencookie(results, "w", (cookie_io_functions_t){ .write = tee_err });
+    if (results->out_mem == NULL || results->err_mem == NULL || results->out_tee == NULL ||
+        results->err_tee == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Results\n");
+        exit(EXIT_FAILURE);
+    }
+    setvbuf(results->out_tee, NULL, _IONBF, 0);
+    setvbuf(results->err_tee, NULL, _IONBF, 0);
+}
+
+/**
+ * @brief Discard stdout instead of capturing and passing it on, or capture it
+ * again, as with output that would not reach the terminal.
+ *
+ * @param results Result cache
+ * @param muted Discard stdout
+ */
+void results_mute(RESULTS *results, bool muted)
+{
+    if (results->out_tee != NULL)
+        fflush(results->out_tee);
+    results->muted = muted;
+}
+
+typedef struct ENTRY
+{
+    char *name;                // Name of the result file
+    off_t size;                // Length of the file
+    struct timespec last_used; // When it was last written or replayed
+} ENTRY;
+
+static int by_last_used(const void *a, const void *b)
+{
+    const ENTRY *x = a;
+    const ENTRY *y = b;
+    if (x->last_used.tv_sec != y->last_used.tv_sec)
+        return (x->last_used.tv_sec > y->last_used.tv_sec) - (x->last_used.tv_sec < y->last_used.tv_sec);
+    return (x->last_used.tv_nsec > y->last_used.tv_nsec) - (x->last_used.tv_nsec < y->last_used.tv_nsec);
+}
+
+static bool is_key(const char *name)
+{
+    return strlen(name) == RESULTS_KEY_LEN && strspn(name, "0123456789abcdef") == RESULTS_KEY_LEN;
+}
+
+/**
+ * @brief Remove the least recently used results until the directory is within
+ * its size limit, and temporary files long abandoned. Workers may remove the
+ * same files at once, so files already gone are skipped.
+ */
+static void evict(RESULTS *results)
+{
+    DIR *d = opendir(results->dir);
+    if (d == NULL)
+        return;
+
+    ENTRY *entries = NULL;
+    size_t n = 0;
+    size_t cap = 0;
+    uint64_t total = 0;
+    time_t now = time(NULL);
+
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL)
+    {
+        struct stat st;
+        bool temp = strncmp(de->d_name, ".tmp-", 5) == 0;
+        if ((!temp && !is_key(de->d_name)) || fstatat(dirfd(d), de->d_name, &st, 0) < 0)
+            continue;
+
+        if (temp)
+        {
+            if (now - st.st_mtime > STALE_TEMP)
+                unlinkat(dirfd(d), de->d_name, 0);
+            continue;
+        }
+
+        if (n == cap)
+        {
+            cap = cap ? 2 * cap : 64;
+            ENTRY *grown = realloc(entries, cap * sizeof(ENTRY));
+            if (grown == NULL)
+                break;
+            entries = grown;
+        }
+        entries[n].name = strdup(de->d_name);
+        entries[n].size = st.st_size;
+        entries[n].last_used = st.st_mtim;
+        if (entries[n].name == NULL)
+            break;
+        total += st.st_size;
+        n++;
+    }
+
+    if (total > results->max_bytes)
+    {
+        qsort(entries, n, sizeof(ENTRY), by_last_used);
+        for (size_t i = 0; i < n && total > results->max_bytes; i++)
+        {
+            unlinkat(dirfd(d), entries[i].name, 0);
+            total -= entries[i].size;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++)
+        free(entries[i].name);
+    free(entries);
+    closedir(d);
+}
+
+/**
+ * @brief Store the captured run under its key. The result is written to a
+ * temporary file and renamed into place, so a worker looking it up at the
+ * same time finds either nothing or all of it. Results larger than the whole
+ * cache are not stored.
+ *
+ * @param results Result cache, capturing a run
+ * @param exit_code Exit status of the run
+ * @return true if stored
+ */
+bool results_store(RESULTS *results, int exit_code)
+{
+    fflush(results->out_tee);
+    fflush(results->err_tee);
+    fflush(results->out_mem);
+    fflush(results->err_mem);
+
+    RESULT_HEADER h = {
+        .exit_code = exit_code,
+        .out_len = results->out_len,
+        .err_len = results->err_len,
+    };
+    memcpy(h.magic, RESULTS_MAGIC, RESULTS_MAGIC_LEN);
+    if (sizeof(h) + h.out_len + h.err_len > results->max_bytes)
+        return false;
+
+    seal(results);
+    char name[RESULTS_KEY_LEN + 64];
+    snprintf(name, sizeof(name), ".tmp-%s-%ld", results->key, (long)getpid());
+    char *temp = path(results, name);
+    char *file = path(results, results->key);
+
+    FILE *f = fopen(temp, "wb");
+    bool ok = f != NULL && fwrite(&h, sizeof(h), 1, f) == 1 &&
+              fwrite(results->out_buf, 1, h.out_len, f) == h.out_len &&
+              fwrite(results->err_buf, 1, h.err_len, f) == h.err_len;
+    ok = f != NULL && fclose(f) == 0 && ok;
+    ok = ok && rename(temp, file) == 0;
+    if (!ok)
+        unlink(temp);
+
+    free(temp);
+    free(file);
+    if (ok)
+        evict(results);
+    return ok;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Most megabytes of results a cache directory holds unless told otherwise.
+ */
+#define RESULTS_DEFAULT_MB 256
+
+/**
+ * Result files start with these bytes, without a NUL.
+ */
+#define RESULTS_MAGIC "SMIPSRES"
+#define RESULTS_MAGIC_LEN 8
+
+/**
+ * Hex digits in a key, which names its result file.
+ */
+#define RESULTS_KEY_LEN 64
+
+/**
+ * @struct RESULT_HEADER
+ * @brief Start of a result file, followed by the run's stdout and then its
+ * stderr.
+ */
+typedef struct RESULT_HEADER
+{
+    char magic[RESULTS_MAGIC_LEN]; // `RESULTS_MAGIC`
+    int32_t exit_code;             // Exit status of the run
+    uint32_t reserved;             // 0
+    uint64_t out_len;              // Bytes of stdout
+    uint64_t err_len;              // Bytes of stderr
+} RESULT_HEADER;
+
+/**
+ * @struct SHA256
+ * @brief SHA-256 state, hashing the key of a run.
+ */
+typedef struct SHA256
+{
+    uint32_t h[8];     // Hash so far
+    uint8_t block[64]; // Block being filled
+    uint64_t len;      // Bytes hashed
+} SHA256;
+
+/**
+ * @struct RESULTS
+ * @brief A directory of results, each in a file named by the SHA-256 of
+ * everything the run depended on: the build of smips, its settings, the
+ * program and its input. A run found there is replayed rather than executed.
+ * Otherwise its stdout and stderr are captured as they pass through, and
+ * stored once it finishes. Files are written under a temporary name and
+ * renamed into place, so workers sharing the directory only ever see whole
+ * results, and the least recently used are removed past the size limit.
+ */
+typedef struct RESULTS
+{
+    char *dir;                     // Directory of result files
+    uint64_t max_bytes;            // Most bytes of result files kept
+    SHA256 sha;                    // Key being hashed
+    char key[RESULTS_KEY_LEN + 1]; // Key once sealed, as hex
+    bool muted;                    // Stdout is discarded rather than captured
+    FILE *out;                     // Stream stdout is passed on to
+    FILE *err;                     // Stream stderr is passed on to
+    FILE *out_tee;                 // Stream capturing stdout
+    FILE *err_tee;                 // Stream capturing stderr
+    FILE *out_mem;                 // Captured stdout
+    FILE *err_mem;                 // Captured stderr
+    char *out_buf;                 // Captured stdout, once flushed
+    size_t out_len;                // Bytes of captured stdout
+    char *err_buf;                 // Captured stderr, once flushed
+    size_t err_len;                // Bytes of captured stderr
+} RESULTS;
+
+RESULTS *init_RESULTS(const char *spec);
+void free_RESULTS(RESULTS *results);
+void results_hash(RESULTS *results, const void *data, size_t len);
+bool results_hash_file(RESULTS *results, const char *file);
+bool results_replay(RESULTS *results, FILE *out, FILE *err, int *exit_code);
+void results_capture(RESULTS *results, FILE *out, FILE *err);
+void results_mute(RESULTS *results, bool muted);
+bool results_store(RESULTS *results, int exit_code);
@@ -45,19 +45,172 @@ fi
 echo "***  Testing $QNAME  ***"
 echo
 
-for gg in tests/*.hex
+for gg in tests/*.hex tests/*.elf
 do
-    g=$(basename -- "$gg")
-	g=${g%%.*}
-	echo $BIN tests/$g.hex ">" tests/$g.out
-	$BIN tests/$g.hex > tests/$g.out
+    f=$(basename -- "$gg")
+	g=${f%%.*}
+	args=""
+	if [ -f tests/$g.args ]
+	then
+		args=$(cat tests/$g.args)
+	fi
+	# A run whose output goes wrong stops there rather than running on,
+	# unless the test checks its own output
+	expect=""
+	if [ -f tests/$g.exp ]
+	then
+		case "$args" in
+		*--expect*)
+			;;
+		*)
+			expect="--expect tests/$g.exp"
+			;;
+		esac
+	fi
+	# A test may give its stdin, the exit status it should end with if not
+	# 0, and its stderr
+	input=/dev/null
+	if [ -f tests/$g.in ]
+	then
+		input=tests/$g.in
+	fi
+	want_status=0
+	if [ -f tests/$g.status ]
+	then
+		want_status=$(cat tests/$g.status)
+	fi
+	# A test with a script of gdb packets is driven through the stub instead
+	if [ -f tests/$g.rsp ]
+	then
+		echo python3 tests/rsp.py $BIN $gg tests/$g.rsp ">" tests/$g.out
+		python3 tests/rsp.py $BIN $gg tests/$g.rsp > tests/$g.out
+	elif [ -f tests/$g.err ]
+	then
+		echo $BIN $expect $args $gg "<" $input ">" tests/$g.out "2>" tests/$g.stderr
+		$BIN $expect $args $gg < $input > tests/$g.out 2> tests/$g.stderr
+	else
+		echo $BIN $expect $args $gg "<" $input ">" tests/$g.out
+		$BIN $expect $args $gg < $input > tests/$g.out
+	fi
+	status=$?
 	echo "------------------------------ "
-	if diff tests/$g.exp tests/$g.out
+	if [ "$status" -ne "$want_status" ]
+	then
+		printf "${RED}Test $f failed\n$RESET_COLOR"
+		printf "${YELLOW}Exit status was $status, expected $want_status\n$RESET_COLOR"
+	elif [ -f tests/$g.err ] && ! diff tests/$g.err tests/$g.stderr
+	then
+		printf "${RED}Test $f failed\n$RESET_COLOR"
+		printf "${YELLOW}Check differences between tests/$g.err and tests/$g.stderr\n$RESET_COLOR"
+	elif diff tests/$g.exp tests/$g.out
     then
-        printf "${GREEN}Test $g.hex passed\n$RESET_COLOR"
+        printf "${GREEN}Test $f passed\n$RESET_COLOR"
     else
-        printf "${RED}Test $g.hex failed\n$RESET_COLOR"
-        printf "${YELLOW}Check differences between tests/$g.hex and tests/$g.out\n$RESET_COLOR"
+        printf "${RED}Test $f failed\n$RESET_COLOR"
+        printf "${YELLOW}Check differences between $gg and tests/$g.out\n$RESET_COLOR"
     fi
 	echo "------------------------------ "
 done
+
+echo "***  Comparing runs with and without --optimize  ***"
+echo
+
+for gg in tests/*.hex tests/*.elf examples/*.hex examples/*.s
+do
+	g=${gg%.*}
+	args=""
+	if [ -f $g.args ]
+	then
+		args=$(cat $g.args)
+	fi
+	case "$args" in
+	*--timing*|*--debug*|*--gdb*|*--disasm*)
+		continue
+		;;
+	esac
+	args=${args#--optimize}
+	input=/dev/null
+	if [ -f $g.in ]
+	then
+		input=$g.in
+	fi
+	$BIN $args $gg < $input > $g.plain 2>&1
+	$BIN --optimize $args $gg < $input > $g.optimized 2>&1
+	if cmp -s $g.plain $g.optimized
+	then
+		printf "${GREEN}$gg behaves the same optimized\n$RESET_COLOR"
+	else
+		printf "${RED}$gg behaves differently optimized\n$RESET_COLOR"
+		printf "${YELLOW}Check differences between $g.plain and $g.optimized\n$RESET_COLOR"
+	fi
+	rm -f $g.plain $g.optimized
+done
+
+echo "***  Testing the library API  ***"
+echo
+
+echo tests/api ">" tests/api.out
+tests/api > tests/api.out
+echo "------------------------------ "
+if diff tests/api.exp tests/api.out
+then
+	printf "${GREEN}Test api passed\n$RESET_COLOR"
+else
+	printf "${RED}Test api failed\n$RESET_COLOR"
+	printf "${YELLOW}Check differences between tests/api.exp and tests/api.out\n$RESET_COLOR"
+fi
+echo "------------------------------ "
+
+echo "***  Testing the result cache  ***"
+echo
+
+# Runs `tests/results/stars.hex` printing $1 stars, with the cache given by $2,
+# into tests/results/$3.out, .err and .status
+cached_run()
+{
+	echo $1 | $BIN --sections=output $2 tests/results/stars.hex \
+		> tests/results/$3.out 2> tests/results/$3.err
+	echo $? > tests/results/$3.status
+}
+
+# Passes if the command given succeeds
+check()
+{
+	what=$1
+	shift
+	if "$@"
+	then
+		printf "${GREEN}Result cache $what passed\n$RESET_COLOR"
+	else
+		printf "${RED}Result cache $what failed\n$RESET_COLOR"
+	fi
+}
+
+same_run()
+{
+	cmp -s tests/results/$1.out tests/results/$2.out &&
+		cmp -s tests/results/$1.err tests/results/$2.err &&
+		cmp -s tests/results/$1.status tests/results/$2.status
+}
+
+cache=tests/results/cache
+rm -rf $cache
+cached_run 5 "--result-cache $cache" miss
+check "miss" test "$(ls $cache | wc -l)" -eq 1 -a "$(cat tests/results/miss.status)" -eq 3
+cached_run 5 "--result-cache $cache" hit
+check "hit" same_run miss hit
+
+# A hit replays the stored result rather than running the program
+sed -i 's/Output/OUTPUT/' $cache/*
+cached_run 5 "--result-cache $cache" replay
+check "replay" grep -q OUTPUT tests/results/replay.out
+cached_run 5 "--result-cache $cache --no-result-cache" bypass
+check "bypass" same_run miss bypass
+
+# Past MAX_MB the least recently used results go, leaving the newest: a
+# 32-byte header, then its stdout and stderr
+cached_run 600000 "--result-cache $cache:1" big1
+cached_run 600001 "--result-cache $cache:1" big2
+kept=$(($(cat tests/results/big2.out tests/results/big2.err | wc -c) + 32))
+check "eviction" test "$(ls $cache | wc -l)" -eq 1 -a "$(cat $cache/* | wc -c)" -eq $kept
+rm -rf $cache
@@ -39,24 +39,122 @@
  *  - stack frames
  *  - assembly parser
  *  - resolve cases where some instructions have common codes
- *  - syscall
  */
 
 #include <assert.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-#include "functions.h"
+#include "cache.h"
+#include "console.h"
+#include "coverage.h"
+#include "debug.h"
+#include "disasm.h"
+#include "expect.h"
+#include "gdbstub.h"
 #include "hardware.h"
+#include "harts.h"
 #include "hashtable.h"
-#include "opcode.h"
+#include "history.h"
+#include "lanes.h"
+#include "loader.h"
+#include "pipeline.h"
+#include "predictor.h"
+#include "results.h"
+#include "symbols.h"
 #include "utils.h"
+#include "vm.h"
 
 #define BUFFER 4096
 
+/**
+ * Sections of the report, selected with `--sections`.
+ */
+#define SECTION_PROGRAM 0x1
+#define SECTION_OUTPUT 0x2
+#define SECTION_REGISTERS 0x4
+#define SECTION_ALL (SECTION_PROGRAM | SECTION_OUTPUT | SECTION_REGISTERS)
+
+/**
+ * @struct OPTIONS
+ * @brief Settings chosen on the command line.
+ */
+typedef struct OPTIONS
+{
+    char *sandbox;      // Directory guest file syscalls are confined to
+    bool console;       // Map the console device
+    bool fuse_loops;    // Replace byte-copy loops with bulk copies
+    bool optimize;      // Optimize basic blocks on load
+    int harts;          // Most guest harts, 1 for a single one
+    int quantum;        // Round-robin turn in records, 0 for host threads
+    bool timing;        // Run with delay slots on the pipeline model
+    bool cache;         // Simulate the cache hierarchy
+    char *cache_spec;   // Cache geometry, NULL for the default
+    bool predict;       // Simulate a branch predictor
+    char *predictor;    // Predictor kind, NULL for the default
+    char *coverage;     // File to write instruction coverage to, or NULL
+    char *merge;        // File to merge coverage files into, or NULL
+    char *lanes;        // File of one stdin line per lane, or NULL
+    char *expect;       // File output is checked against as it is written, or NULL
+    char *results;      // Result cache, `DIR[:MAX_MB]`, or NULL
+    bool no_results;    // Bypass the result cache
+    bool debug;         // Start the debugger
+    char *debug_script; // Debugger commands, NULL for the terminal
+    char *gdb_socket;   // Unix socket to serve gdb on, or NULL
+    int gdb_port;       // TCP port to serve gdb on, or 0
+    bool record;        // Record history for reverse execution
+    char *record_spec;  // Checkpoint interval and budget, NULL for the default
+    bool disasm;        // List the program instead of running it
+    int sections;       // `SECTION_*` bits of the report to print
+} OPTIONS;
+
+static OPTIONS options = {
+    .sandbox = NULL,
+    .console = false,
+    .fuse_loops = false,
+    .optimize = false,
+    .harts = 1,
+    .quantum = 0,
+    .timing = false,
+    .cache = false,
+    .cache_spec = NULL,
+    .predict = false,
+    .predictor = NULL,
+    .coverage = NULL,
+    .merge = NULL,
+    .lanes = NULL,
+    .expect = NULL,
+    .results = NULL,
+    .no_results = false,
+    .debug = false,
+    .debug_script = NULL,
+    .gdb_socket = NULL,
+    .gdb_port = 0,
+    .record = false,
+    .record_spec = NULL,
+    .disasm = false,
+    .sections = SECTION_ALL,
+};
+
+static PIPELINE_STATS pipeline_stats;
+static SYMBOLS *symbols = NULL;
+static DEBUGGER *debugger = NULL;
+static LANES *lanes = NULL;
+static EXPECT *expect = NULL;
+static RESULTS *results = NULL;
+static char *input = NULL;
+static size_t input_len = 0;
+static char **lane_input = NULL;
+static char **lane_output = NULL;
+static size_t *lane_output_len = NULL;
+static FILE **lane_out = NULL;
+static int saved_stdout = -1;
+
 /**
  * @brief Print bits from MSB to LSB.
  *
@@ -73,173 +171,462 @@ void print_bits(__uint64_t value, int n_bits)
     printf("\n");
 }
 
+/**
+ * @brief Print non-zero registers, $0 - $31, without a heading.
+ *
+ * @param vm VM that ran the program
+ */
+void print_register_values(VM *vm)
+{
+    for (int i = $0; i <= $31; i++)
+    {
+        int32_t value;
+        vm_get_reg(vm, i, &value);
+        if (value != 0)
+            printf("%-3s = %d\n", REG_NUM_STR[i], value);
+    }
+}
+
 /**
  * @brief Print non-zero registers, $0 - $31.
  *
- * @param cpu Pointer to instantiation of CPU
+ * @param vm VM that ran the program
  */
-void print_registers(CPU *cpu)
+void print_registers(VM *vm)
 {
     printf("Registers After Execution\n");
-
-    for (int i = 0; i < NUM_REGISTERS; i++)
-        if (cpu->reg[i]->value.wd != 0 && $0 <= i && i <= $31)
-            printf("%-3s = %d\n",
-                REG_NUM_STR[cpu->reg[i]->name],
-                cpu->reg[i]->value.wd);
+    print_register_values(vm);
 }
 
 /**
- * @brief Check if instruction code is valid. If it is not valid, print the
- * file, line number and instruction then exit.
- *
- * @param file File name
- * @param instr_code Encoded MIPS instruction
- * @param i Line number
+ * @brief Print the non-zero registers of every lane, a lane at a time.
  */
-void check_valid_instruction(char *file, int instr_code, int i)
+void print_lane_registers(void)
 {
-    if (!is_P_FORMAT(instr_code) &&
-        !is_R_FORMAT(instr_code) &&
-        !is_I_FORMAT(instr_code) &&
-        !is_J_FORMAT(instr_code))
+    printf("Registers After Execution\n");
+    for (int l = 0; l < lanes->n; l++)
     {
-        printf("%s:%d: invalid instruction code: %.6d\n", file, i, instr_code);
-        exit(EXIT_FAILURE);
+        printf("Lane %d\n", l);
+        print_register_values(lanes->vm[l]);
     }
 }
 
 /**
- * @brief Prints to stdout an equivalent Assembly instruction for a given
- * encoded instruction.
+ * @brief Set up a lane for each line of a file, the line being all of that
+ * lane's stdin. Each lane's stdout is kept in memory until every lane is done.
  *
- * @param cpu Pointer to instantiation of CPU
- * @param instr_code Encoded MIPS instruction
+ * @param file Name of the file of inputs
  */
-void print_instruction_by_format(CPU *cpu, int instr_code)
+void init_lanes(const char *file)
 {
-    if (is_P_FORMAT(instr_code))
+    FILE *f = fopen(file, "r");
+    if (f == NULL)
     {
-        R_FORMAT instr = extract_R_FORMAT(instr_code);
-        if (instr.funct == SYSCALL)
-        {
-            printf("%s", P_STR[instr.funct]);
-        }
-        else
+        fprintf(stderr, "ERROR: Failed to open %s\n", file);
+        exit(EXIT_FAILURE);
+    }
+
+    lane_input = calloc(MAX_LANES, sizeof(char *));
+    if (lane_input == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Lanes\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int n = 0;
+    size_t cap = 0;
+    char *line = NULL;
+    while (getline(&line, &cap, f) >= 0)
+    {
+        if (n == MAX_LANES)
         {
-            printf("%-4s %s, %s, %s",
-                P_STR[instr.funct],
-                REG_NUM_STR[instr.rd],
-                REG_NUM_STR[instr.rs],
-                REG_NUM_STR[instr.rt]);
+            fprintf(stderr, "ERROR: %s has more than %d lanes\n", file, MAX_LANES);
+            exit(EXIT_FAILURE);
         }
+        lane_input[n++] = line;
+        line = NULL;
+        cap = 0;
     }
-    else if (is_R_FORMAT(instr_code))
+    free(line);
+    fclose(f);
+
+    if (n == 0)
     {
-        R_FORMAT instr = extract_R_FORMAT(instr_code);
-        printf("%-4s %s, %s, %s",
-            R_STR[instr.funct],
-            REG_NUM_STR[instr.rd],
-            REG_NUM_STR[instr.rs],
-            REG_NUM_STR[instr.rt]);
+        fprintf(stderr, "ERROR: %s has no lanes\n", file);
+        exit(EXIT_FAILURE);
     }
-    else if (is_I_FORMAT(instr_code))
+
+    lanes = init_LANES(n);
+    lane_output = calloc(n, sizeof(char *));
+    lane_output_len = calloc(n, sizeof(size_t));
+    lane_out = calloc(n, sizeof(FILE *));
+    if (lane_output == NULL || lane_output_len == NULL || lane_out == NULL)
     {
-        I_FORMAT instr = extract_I_FORMAT(instr_code);
-        if (instr.op == BEQ || instr.op == BNE)
+        fprintf(stderr, "ERROR: Failed to allocate memory for Lanes\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int l = 0; l < n; l++)
+    {
+        lane_out[l] = open_memstream(&lane_output[l], &lane_output_len[l]);
+        if (lane_out[l] == NULL)
         {
-            printf("%-4s %s, %s, %d",
-                I_STR[instr.op],
-                REG_NUM_STR[instr.rs],
-                REG_NUM_STR[instr.rt],
-                instr.imm);
+            fprintf(stderr, "ERROR: Failed to allocate memory for Lanes\n");
+            exit(EXIT_FAILURE);
         }
-        else if (instr.op == LUI)
+        vm_set_input(lanes->vm[l], lane_input[l], strlen(lane_input[l]));
+        vm_set_output(lanes->vm[l], lane_out[l]);
+        if (options.sandbox != NULL && vm_set_sandbox(lanes->vm[l], options.sandbox) != VM_OK)
         {
-            printf("%-4s %s, %d",
-                I_STR[instr.op],
-                REG_NUM_STR[instr.rt],
-                instr.imm);
+            fprintf(stderr, "ERROR: Failed to open sandbox %s\n", options.sandbox);
+            exit(EXIT_FAILURE);
         }
+    }
+}
+
+/**
+ * @brief Run the program on every lane, then print each lane's output.
+ *
+ * @param words Encoded MIPS instructions, unless `file` is an executable
+ * @param n Number of instructions
+ * @param file Name of the program
+ * @param elf The program is an executable
+ */
+void run_lanes(const word_t *words, int n, char *file, bool elf)
+{
+    int status = elf ? lanes_load_elf(lanes, file) : lanes_load(lanes, words, n, NULL);
+    if (status != VM_OK)
+    {
+        fprintf(stderr, "ERROR: Failed to load %s: %s\n", file, vm_strerror(status));
+        exit(EXIT_FAILURE);
+    }
+
+    lanes_run(lanes, 0, NULL);
+
+    for (int l = 0; l < lanes->n; l++)
+    {
+        VM *vm = lanes->vm[l];
+        fflush(lane_out[l]);
+        printf("Lane %d\n", l);
+        fwrite(lane_output[l], 1, lane_output_len[l], stdout);
+        if (lane_output_len[l] > 0 && lane_output[l][lane_output_len[l] - 1] != '\n')
+            printf("\n");
+        int pc = vm_invalid_pc(vm);
+        uint32_t word;
+        if (pc >= 0 && vm_get_instruction(vm, pc, &word) == VM_OK)
+            printf("Invalid instruction code: %.6d\n", word);
+    }
+}
+
+/**
+ * @brief Get the exit code of the lanes as a whole.
+ *
+ * @return int Exit code of the first lane that did not succeed, if any
+ */
+int lane_exit_code(void)
+{
+    int exit_code = EXIT_SUCCESS;
+    for (int l = 0; l < lanes->n && exit_code == EXIT_SUCCESS; l++)
+        exit_code = lanes->vm[l]->invalid_at >= 0 ? EXIT_FAILURE : vm_exit_code(lanes->vm[l]);
+    return exit_code;
+}
+
+/**
+ * @brief Destroy the lanes and their inputs and outputs.
+ */
+void free_lanes(void)
+{
+    for (int l = 0; l < lanes->n; l++)
+    {
+        fclose(lane_out[l]);
+        free(lane_output[l]);
+        free(lane_input[l]);
+    }
+    free_LANES(lanes);
+    free(lane_out);
+    free(lane_output);
+    free(lane_output_len);
+    free(lane_input);
+    lanes = NULL;
+}
+
+/**
+ * @brief Parse the hart settings, `MAX[:rr[:QUANTUM]]`, into the options.
+ *
+ * @param spec Most harts, optionally followed by `rr` and a turn length for
+ * deterministic round-robin scheduling
+ */
+void parse_harts(const char *spec)
+{
+    char *end;
+    options.harts = strtol(spec, &end, 10);
+    options.quantum = 0;
+
+    bool valid = options.harts >= 1 && options.harts <= MAX_HARTS;
+    if (strncmp(end, ":rr", 3) == 0)
+    {
+        end += 3;
+        options.quantum = *end == ':' ? strtol(end + 1, &end, 10) : HARTS_DEFAULT_QUANTUM;
+        valid = valid && options.quantum > 0;
+    }
+
+    if (!valid || *end != '\0')
+    {
+        fprintf(stderr, "ERROR: Invalid harts %s\n", spec);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Parse the sections of the report to print.
+ *
+ * @param list Comma-separated `program`, `output` and `registers`
+ * @return int `SECTION_*` bits
+ */
+int parse_sections(const char *list)
+{
+    char *copy = strdup(list);
+    if (copy == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Options\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int sections = 0;
+    char *save;
+    for (char *item = strtok_r(copy, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
+    {
+        if (strcmp(item, "program") == 0)
+            sections |= SECTION_PROGRAM;
+        else if (strcmp(item, "output") == 0)
+            sections |= SECTION_OUTPUT;
+        else if (strcmp(item, "registers") == 0)
+            sections |= SECTION_REGISTERS;
         else
         {
-            printf("%-4s %s, %s, %d",
-                I_STR[instr.op],
-                REG_NUM_STR[instr.rt],
-                REG_NUM_STR[instr.rs],
-                instr.imm);
+            fprintf(stderr, "ERROR: Unknown section %s\n", item);
+            exit(EXIT_FAILURE);
         }
     }
-    else if (is_J_FORMAT(instr_code))
+
+    free(copy);
+    return sections;
+}
+
+/**
+ * @brief Discard what the guest writes to stdout until `unmute_output`.
+ */
+void mute_output(void)
+{
+    if (expect != NULL)
+        expect_mute(expect, true);
+    if (results != NULL)
+        results_mute(results, true);
+
+    fflush(stdout);
+    saved_stdout = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    if (saved_stdout < 0 || null < 0 || dup2(null, STDOUT_FILENO) < 0)
     {
-        J_FORMAT instr = extract_J_FORMAT(instr_code);
-        printf("%-4s %d", J_STR[instr.op], instr.addr);
+        fprintf(stderr, "ERROR: Failed to discard program output\n");
+        exit(EXIT_FAILURE);
     }
+    close(null);
 }
 
 /**
- * @brief Carry out the CPU's processes.
+ * @brief Write to stdout again after `mute_output`.
+ */
+void unmute_output(void)
+{
+    if (saved_stdout < 0)
+        return;
+
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    saved_stdout = -1;
+
+    if (expect != NULL)
+        expect_mute(expect, false);
+    if (results != NULL)
+        results_mute(results, false);
+}
+
+/**
+ * @brief Check everything written to stdout from here on against a file of
+ * expected output, stopping at the first difference.
  *
- * @param cpu Pointer to instantiation of CPU
- * @param instr_code Encoded MIPS instruction
+ * @param file Name of the expected file
+ */
+void start_expect(const char *file)
+{
+    fflush(stdout);
+    expect = init_EXPECT(file, stdout);
+    stdout = expect->stream;
+}
+
+/**
+ * @brief Look a run up in the result cache by everything it depends on: the
+ * settings that change what it does, the program, the lanes' inputs and
+ * stdin, which is read in full first. A run that is found is replayed; any
+ * other is captured, through the cache's streams in place of stdout and
+ * stderr. Runs on a terminal are neither, as their input is not known up
+ * front.
+ *
+ * @param file Name of the program
+ * @param exit_code Set to the exit status of a replayed run
+ * @return true if the run was replayed
  */
-void processes(CPU *cpu, int instr_code)
+bool start_results(const char *file, int *exit_code)
 {
-    if (is_P_FORMAT(instr_code))
+    if (isatty(STDIN_FILENO))
+        return false;
+
+    results = init_RESULTS(options.results);
+
+    char settings[BUFFER];
+    snprintf(settings, sizeof(settings),
+             "console=%d fuse-loops=%d optimize=%d harts=%d:%d timing=%d cache=%d:%s predict=%d:%s sections=%d",
+             options.console, options.fuse_loops, options.optimize, options.harts, options.quantum,
+             options.timing, options.cache, options.cache_spec ? options.cache_spec : "",
+             options.predict, options.predictor ? options.predictor : "", options.sections);
+    results_hash(results, settings, strlen(settings));
+
+    if (!results_hash_file(results, file) ||
+        (options.lanes != NULL && !results_hash_file(results, options.lanes)))
     {
-        R_FORMAT instr = extract_R_FORMAT(instr_code);
-        (*P_FUNCT_PTR[instr.funct])(cpu,
-            cpu->reg[instr.rs],
-            cpu->reg[instr.rt],
-            cpu->reg[instr.rd],
-            instr.shamt,
-            instr.funct);
+        fprintf(stderr, "ERROR: Failed to open %s\n", options.lanes != NULL ? options.lanes : file);
+        exit(EXIT_FAILURE);
     }
-    else if (is_R_FORMAT(instr_code))
+
+    size_t len = 0;
+    size_t cap = BUFFER;
+    input = malloc(cap);
+    size_t got;
+    while (input != NULL && (got = fread(input + len, 1, cap - len, stdin)) > 0)
     {
-        R_FORMAT instr = extract_R_FORMAT(instr_code);
-        (*R_FUNCT_PTR[instr.funct])(cpu,
-            cpu->reg[instr.rs],
-            cpu->reg[instr.rt],
-            cpu->reg[instr.rd],
-            instr.shamt,
-            instr.funct);
+        len += got;
+        if (len == cap)
+            input = realloc(input, cap *= 2);
     }
-    else if (is_I_FORMAT(instr_code))
+    if (input == NULL)
     {
-        I_FORMAT instr = extract_I_FORMAT(instr_code);
-        (*I_FUNCT_PTR[instr.op])(cpu,
-            cpu->reg[instr.rs],
-            cpu->reg[instr.rt],
-            instr.imm);
+        fprintf(stderr, "ERROR: Failed to allocate memory for Input\n");
+        exit(EXIT_FAILURE);
     }
-    else if (is_J_FORMAT(instr_code))
+    results_hash(results, input, len);
+    input_len = len;
+
+    if (results_replay(results, stdout, stderr, exit_code))
     {
-        J_FORMAT instr = extract_J_FORMAT(instr_code);
-        (*J_FUNCT_PTR[instr.op])(cpu, cpu->reg[instr.addr]);
+        free_RESULTS(results);
+        results = NULL;
+        free(input);
+        input = NULL;
+        return true;
     }
-    else
+
+    fflush(stdout);
+    results_capture(results, stdout, stderr);
+    stdout = results->out_tee;
+    stderr = results->err_tee;
+    return false;
+}
+
+/**
+ * @brief Stop capturing the run, and store it unless it used guest files,
+ * which the cache knows nothing of.
+ *
+ * @param vm VM that ran the program
+ * @param exit_code Exit status of the run
+ */
+void finish_results(VM *vm, int exit_code)
+{
+    if (results == NULL)
+        return;
+
+    bool opened = vm_opened_files(vm);
+    for (int l = 0; lanes != NULL && l < lanes->n; l++)
+        opened = opened || vm_opened_files(lanes->vm[l]);
+
+    if (!opened)
+        results_store(results, exit_code);
+
+    stdout = results->out;
+    stderr = results->err;
+    free_RESULTS(results);
+    results = NULL;
+}
+
+/**
+ * @brief Stop checking stdout, making sure none of the expected file was
+ * left unwritten.
+ *
+ * @param exit_code Exit code of the run
+ * @return int `EXIT_FAILURE` if output stopped short, otherwise `exit_code`
+ */
+int finish_expect(int exit_code)
+{
+    if (expect == NULL)
+        return exit_code;
+
+    bool complete = expect_finish(expect);
+    stdout = expect->out;
+    free_EXPECT(expect);
+    expect = NULL;
+    return complete ? exit_code : EXIT_FAILURE;
+}
+
+/**
+ * @brief Report the invalid instruction a run stopped at and fail, as the
+ * emulator always has.
+ *
+ * @param vm VM that stopped
+ * @param pc Index of the invalid instruction
+ */
+void invalid_instruction(VM *vm, int pc)
+{
+    uint32_t word = 0;
+    vm_get_instruction(vm, pc, &word);
+    printf("Invalid instruction code: %.6d\n", word);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Append an instruction to those read, doubling their buffer each time
+ * the count reaches a power of two.
+ *
+ * @param words Encoded MIPS instructions read
+ * @param j Instruction counter
+ * @param word Encoded MIPS instruction
+ */
+void append_word(word_t **words, int *j, word_t word)
+{
+    if ((*j & (*j - 1)) == 0)
     {
-        printf("Invalid instruction code: %.6d\n", instr_code);
-        exit(EXIT_FAILURE);
+        *words = realloc(*words, (*j > 0 ? 2 * *j : 1) * sizeof(word_t));
+        if (*words == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to allocate memory for Program\n");
+            exit(EXIT_FAILURE);
+        }
     }
 
-    // Clean up registers
-    cpu->reg[$zero]->value.wd = 0;
+    (*words)[(*j)++] = word;
 }
 
 /**
  * @brief
  *
  * @param f Stream of encoded MIPS instructions
- * @param cpu Pointer to instantiation of CPU
- * @param file Name of instruction file
+ * @param words Encoded MIPS instructions read
  * @param j Instruction counter
  */
-void assembly_loader(FILE *f, CPU *cpu, char *file, int *j)
+void assembly_loader(FILE *f, word_t **words, int *j)
 {
     char line[BUFFER];
-    for (int i = 0; fgets(line, sizeof(line), f) && *j < MAX_INSTR; i++, (*j)++)
+    while (fgets(line, sizeof(line), f) && *j < MAX_INSTR)
     {
         // .data
 
@@ -261,8 +648,7 @@ void assembly_loader(FILE *f, CPU *cpu, char *file, int *j)
 
         // }
 
-        check_valid_instruction(file, instr_code, i);
-        cpu->cache[i] = instr_code;
+        append_word(words, j, instr_code);
     }
 }
 
@@ -270,41 +656,42 @@ void assembly_loader(FILE *f, CPU *cpu, char *file, int *j)
  * @brief
  *
  * @param f Stream of encoded MIPS instructions
- * @param cpu Pointer to instantiation of CPU
- * @param file Name of instruction file
+ * @param words Encoded MIPS instructions read
  * @param j Instruction counter
  */
-void hexadecimal_loader(FILE *f, CPU *cpu, char *file, int *j)
+void hexadecimal_loader(FILE *f, word_t **words, int *j)
 {
     char line[BUFFER];
-    for (int i = 0; fgets(line, sizeof(line), f) && *j < MAX_INSTR; i++, (*j)++)
-    {
-        int instr_code = (int)strtol(line, NULL, 16);
-        check_valid_instruction(file, instr_code, i);
-        cpu->cache[i] = instr_code;
-    }
+    while (fgets(line, sizeof(line), f) && *j < MAX_INSTR)
+        append_word(words, j, (int)strtol(line, NULL, 16));
 }
 
 /**
- * @brief
+ * @brief Load a program into the VM, list it and run it.
  *
  * @param f Stream of encoded MIPS instructions
- * @param cpu Pointer to instantiation of CPU
+ * @param vm VM to run it on
  * @param file Name of instruction file
  */
-void parser(FILE *f, CPU *cpu, char *file)
+void parser(FILE *f, VM *vm, char *file)
 {
+    word_t *words = NULL;
     int j = 0; // Counter for number of instructions loaded
+    bool elf = is_elf(file);
 
-    // Check file type and load program into cache
+    // Check file type and read the program
     char *file_type = strrchr(file, '.');
-    if (strncmp(file_type, ".s", 3) == 0)
+    if (elf)
     {
-        assembly_loader(f, cpu, file, &j);
+        // Executables are mapped rather than read
     }
-    else if (strncmp(file_type, ".hex", 5) == 0)
+    else if (file_type != NULL && strncmp(file_type, ".s", 3) == 0)
     {
-        hexadecimal_loader(f, cpu, file, &j);
+        assembly_loader(f, &words, &j);
+    }
+    else if (file_type != NULL && strncmp(file_type, ".hex", 5) == 0)
+    {
+        hexadecimal_loader(f, &words, &j);
     }
     else
     {
@@ -312,21 +699,239 @@ void parser(FILE *f, CPU *cpu, char *file)
         exit(EXIT_FAILURE);
     }
 
-    printf("Program\n");
+    // The timing models see every instruction, so nothing is fused
+    vm_set_fusion(vm, !options.timing, !options.timing && options.fuse_loops);
+    vm_set_optimize(vm, options.optimize);
 
-    // Print program instructions
-    for (int i = 0; i < j; i++)
+    if (elf)
     {
-        printf("%3d: ", i);
-        print_instruction_by_format(cpu, cpu->cache[i]);
-        printf("\n");
+        int status = vm_load_elf(vm, file);
+        if (status != VM_OK)
+        {
+            fprintf(stderr, "ERROR: Failed to load %s: %s\n", file, vm_strerror(status));
+            exit(EXIT_FAILURE);
+        }
+        j = vm_instruction_count(vm);
+
+        // History starts from the state the executable was loaded in
+        if (options.record)
+            vm_record(vm, options.record_spec);
+    }
+    else
+    {
+        int bad;
+        if (vm_load(vm, words, j, &bad) == VM_ERR_INVALID)
+        {
+            printf("%s:%d: invalid instruction code: %.6d\n", file, bad, (int)words[bad]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Only list the program when asked, as it can be longer than the output
+    if (options.sections & SECTION_PROGRAM)
+    {
+        printf("Program\n");
+        vm_disassemble(vm, stdout);
     }
 
-    printf("Output\n");
+    if (options.sections & SECTION_OUTPUT)
+        printf("Output\n");
+    else
+        mute_output();
 
-    // Execute the program loaded in cache while PC is in [0, j)
-    for (cpu->pc = 0; 0 <= cpu->pc && cpu->pc < j; cpu->pc++)
-        processes(cpu, cpu->cache[cpu->pc]);
+    if (options.timing)
+    {
+        pipeline_run(vm, j, &pipeline_stats);
+        free(words);
+        if (vm_invalid_pc(vm) >= 0)
+            invalid_instruction(vm, vm_invalid_pc(vm));
+        return;
+    }
+
+    if (lanes != NULL)
+    {
+        run_lanes(words, j, file, elf);
+        free(words);
+        return;
+    }
+
+    free(words);
+    if (options.debug || options.gdb_socket != NULL || options.gdb_port != 0)
+    {
+        int gdb_fd = -1;
+        if (options.gdb_socket != NULL || options.gdb_port != 0)
+            gdb_fd = gdb_accept(options.gdb_socket, options.gdb_port);
+
+        symbols = elf ? load_elf_symbols(file) : load_symbols(file);
+        debugger = init_DEBUGGER(vm, j, symbols, options.debug_script, gdb_fd);
+        debug_start(debugger);
+    }
+
+    if (vm_run(vm, 0, NULL) == VM_ERR_INVALID)
+        invalid_instruction(vm, vm_get_pc(vm));
+}
+
+/**
+ * @brief Print an Assembly listing of the text segment of an executable, with
+ * the labels from its symbol table, a block at a time.
+ *
+ * @param cpu Pointer to instantiation of CPU
+ * @param file Name of the executable
+ */
+void elf_disassembler(CPU *cpu, char *file)
+{
+    ELF_IMAGE image;
+    int status = elf_open(&image, file);
+    if (status != VM_OK)
+    {
+        fprintf(stderr, "ERROR: Failed to load %s: %s\n", file, vm_strerror(status));
+        exit(EXIT_FAILURE);
+    }
+
+    SYMBOLS *labels = elf_symbols(&image);
+    disasm_words(stdout, cpu, image.text, 0, image.n, labels);
+    free_symbols(labels);
+    elf_close(&image);
+}
+
+/**
+ * @brief Print an Assembly listing of a file of encoded instructions, with the
+ * labels from its symbol file. The file is decoded and listed a block at a
+ * time, so it is not limited to the size of the text segment.
+ *
+ * @param f Stream of encoded MIPS instructions
+ * @param cpu Pointer to instantiation of CPU
+ * @param file Name of instruction file
+ */
+void disassembler(FILE *f, CPU *cpu, char *file)
+{
+    SYMBOLS *labels = load_symbols(file);
+    word_t *words = malloc(DISASM_BLOCK * sizeof(word_t));
+    if (words == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Program\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char line[BUFFER];
+    int first = 0;
+    int n = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        words[n++] = (int)strtol(line, NULL, 16);
+        if (n == DISASM_BLOCK)
+        {
+            disasm_words(stdout, cpu, words, first, n, labels);
+            first += n;
+            n = 0;
+        }
+    }
+    disasm_words(stdout, cpu, words, first, n, labels);
+
+    free(words);
+    free_symbols(labels);
+}
+
+/**
+ * Long-only command line options.
+ */
+enum
+{
+    OPT_SANDBOX = 256,
+    OPT_CONSOLE,
+    OPT_FUSE_LOOPS,
+    OPT_OPTIMIZE,
+    OPT_HARTS,
+    OPT_TIMING,
+    OPT_CACHE,
+    OPT_PREDICT,
+    OPT_COVERAGE,
+    OPT_MERGE_COVERAGE,
+    OPT_LANES,
+    OPT_EXPECT,
+    OPT_RESULT_CACHE,
+    OPT_NO_RESULT_CACHE,
+    OPT_DEBUG,
+    OPT_GDB_SOCKET,
+    OPT_GDB_PORT,
+    OPT_RECORD,
+    OPT_DISASM,
+    OPT_SECTIONS,
+};
+
+static struct option long_options[] = {
+    { "sandbox", required_argument, NULL, OPT_SANDBOX },
+    { "console", no_argument, NULL, OPT_CONSOLE },
+    { "fuse-loops", no_argument, NULL, OPT_FUSE_LOOPS },
+    { "optimize", no_argument, NULL, OPT_OPTIMIZE },
+    { "harts", required_argument, NULL, OPT_HARTS },
+    { "timing", no_argument, NULL, OPT_TIMING },
+    { "cache", optional_argument, NULL, OPT_CACHE },
+    { "predict", optional_argument, NULL, OPT_PREDICT },
+    { "coverage", required_argument, NULL, OPT_COVERAGE },
+    { "merge-coverage", required_argument, NULL, OPT_MERGE_COVERAGE },
+    { "lanes", required_argument, NULL, OPT_LANES },
+    { "expect", required_argument, NULL, OPT_EXPECT },
+    { "result-cache", required_argument, NULL, OPT_RESULT_CACHE },
+    { "no-result-cache", no_argument, NULL, OPT_NO_RESULT_CACHE },
+    { "debug", optional_argument, NULL, OPT_DEBUG },
+    { "gdb-socket", required_argument, NULL, OPT_GDB_SOCKET },
+    { "gdb-port", required_argument, NULL, OPT_GDB_PORT },
+    { "record", optional_argument, NULL, OPT_RECORD },
+    { "disasm", no_argument, NULL, OPT_DISASM },
+    { "sections", required_argument, NULL, OPT_SECTIONS },
+    { NULL, 0, NULL, 0 },
+};
+
+/**
+ * @brief Print command line usage.
+ *
+ * @param name Program name
+ */
+void print_usage(char *name)
+{
+    fprintf(stderr, "Usage: %s [options] <file.hex | file.s | ELF executable>\n", name);
+    fprintf(stderr, "  --sandbox DIR   confine guest file syscalls to DIR (default: .)\n");
+    fprintf(stderr, "  --console       map a console at 0x%08x: a doorbell register page, then\n", CONSOLE_BASE);
+    fprintf(stderr, "                  transmit and receive rings of %d bytes\n", CONSOLE_RING_SIZE);
+    fprintf(stderr, "  --fuse-loops    run canonical lb/sb copy loops as bulk copies\n");
+    fprintf(stderr, "  --optimize      fold constants and remove dead writes in each basic block\n");
+    fprintf(stderr, "  --harts MAX[:rr[:QUANTUM]]\n");
+    fprintf(stderr, "                  let the program start up to MAX harts, on host threads or\n");
+    fprintf(stderr, "                  taking turns of QUANTUM instructions (default %d)\n", HARTS_DEFAULT_QUANTUM);
+    fprintf(stderr, "  --timing        use branch delay slots and report 5-stage pipeline timing\n");
+    fprintf(stderr, "  --cache[=SPEC]  simulate L1I/L1D/L2 caches; SPEC is a comma-separated list of\n");
+    fprintf(stderr, "                  LEVEL=SIZE:WAYS:LINE[:lru|fifo|random[:wb|wt]] or LEVEL=off,\n");
+    fprintf(stderr, "                  LEVEL one of l1i, l1d, l2 (default %s)\n", CACHE_DEFAULT_SPEC);
+    fprintf(stderr, "  --predict[=KIND[:BITS]]\n");
+    fprintf(stderr, "                  simulate a static, bimodal, gshare or tournament branch\n");
+    fprintf(stderr, "                  predictor with 2^BITS entries (default bimodal:%d) and a BTB\n", PREDICTOR_DEFAULT_BITS);
+    fprintf(stderr, "  --coverage FILE write which instructions ran and which way branches went to\n");
+    fprintf(stderr, "                  FILE, and list what did not\n");
+    fprintf(stderr, "  --merge-coverage OUT\n");
+    fprintf(stderr, "                  OR the coverage files given instead of a program into OUT,\n");
+    fprintf(stderr, "                  and list what none of them covered\n");
+    fprintf(stderr, "  --lanes FILE    run the program once per line of FILE, in lockstep, with the\n");
+    fprintf(stderr, "                  line as its stdin, and report each run as a lane\n");
+    fprintf(stderr, "  --expect FILE   check output against FILE as it is written, and stop at the\n");
+    fprintf(stderr, "                  first byte that differs\n");
+    fprintf(stderr, "  --result-cache DIR[:MAX_MB]\n");
+    fprintf(stderr, "                  replay the output of a run of the same program, input and\n");
+    fprintf(stderr, "                  settings from DIR, or store it there (default %d MB)\n", RESULTS_DEFAULT_MB);
+    fprintf(stderr, "  --no-result-cache\n");
+    fprintf(stderr, "                  run and store nothing, even when given --result-cache\n");
+    fprintf(stderr, "  --debug[=FILE]  start the debugger, reading commands from FILE or the terminal\n");
+    fprintf(stderr, "  --gdb-socket PATH\n");
+    fprintf(stderr, "                  wait for gdb on a Unix socket, e.g.\n");
+    fprintf(stderr, "                  target remote | socat - UNIX-CONNECT:PATH\n");
+    fprintf(stderr, "  --gdb-port PORT wait for gdb on localhost:PORT\n");
+    fprintf(stderr, "  --record[=INTERVAL[:MAX_MB]]\n");
+    fprintf(stderr, "                  let the debugger go backwards, checkpointing every INTERVAL\n");
+    fprintf(stderr, "                  instructions within MAX_MB of saved pages (default %d:%d)\n", HISTORY_DEFAULT_INTERVAL, HISTORY_DEFAULT_MB);
+    fprintf(stderr, "  --disasm        print the program as Assembly, with labels from its .sym\n");
+    fprintf(stderr, "                  file or symbol table, instead of running it\n");
+    fprintf(stderr, "  --sections LIST print only the comma-separated sections in LIST, out of\n");
+    fprintf(stderr, "                  program, output and registers (default: all)\n");
 }
 
 /**
@@ -338,25 +943,271 @@ void parser(FILE *f, CPU *cpu, char *file)
  */
 int main(int argv, char *argc[])
 {
-    if (argv != 2)
+    int opt;
+    while ((opt = getopt_long(argv, argc, "", long_options, NULL)) != -1)
     {
-        fprintf(stderr, "ERROR: Given %d arguments instead of 2\n", argv);
+        switch (opt)
+        {
+        case OPT_SANDBOX:
+            options.sandbox = optarg;
+            break;
+        case OPT_CONSOLE:
+            options.console = true;
+            break;
+        case OPT_FUSE_LOOPS:
+            options.fuse_loops = true;
+            break;
+        case OPT_OPTIMIZE:
+            options.optimize = true;
+            break;
+        case OPT_HARTS:
+            parse_harts(optarg);
+            break;
+        case OPT_TIMING:
+            options.timing = true;
+            break;
+        case OPT_CACHE:
+            options.cache = true;
+            options.cache_spec = optarg;
+            break;
+        case OPT_PREDICT:
+            options.predict = true;
+            options.predictor = optarg;
+            break;
+        case OPT_COVERAGE:
+            options.coverage = optarg;
+            break;
+        case OPT_MERGE_COVERAGE:
+            options.merge = optarg;
+            break;
+        case OPT_LANES:
+            options.lanes = optarg;
+            break;
+        case OPT_EXPECT:
+            options.expect = optarg;
+            break;
+        case OPT_RESULT_CACHE:
+            options.results = optarg;
+            break;
+        case OPT_NO_RESULT_CACHE:
+            options.no_results = true;
+            break;
+        case OPT_DEBUG:
+            options.debug = true;
+            options.debug_script = optarg;
+            break;
+        case OPT_GDB_SOCKET:
+            options.gdb_socket = optarg;
+            break;
+        case OPT_GDB_PORT:
+            options.gdb_port = atoi(optarg);
+            if (options.gdb_port <= 0 || options.gdb_port > 65535)
+            {
+                fprintf(stderr, "ERROR: Invalid port %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_RECORD:
+            options.record = true;
+            options.record_spec = optarg;
+            break;
+        case OPT_DISASM:
+            options.disasm = true;
+            break;
+        case OPT_SECTIONS:
+            options.sections = parse_sections(optarg);
+            break;
+        default:
+            print_usage(argc[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    bool gdb = options.gdb_socket != NULL || options.gdb_port != 0;
+    if ((options.debug || gdb) && options.timing)
+    {
+        fprintf(stderr, "ERROR: --debug and --gdb-* cannot be combined with --timing\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The optimizer assumes no delay slots and only keeps registers exact
+    // between basic blocks
+    if (options.optimize && (options.timing || options.debug || gdb))
+    {
+        fprintf(stderr, "ERROR: --optimize cannot be combined with --timing, --debug or --gdb-*\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The timing models, simulators and debuggers follow a single hart
+    if (options.harts > 1 &&
+        (options.timing || options.cache || options.predict || options.debug || gdb))
+    {
+        fprintf(stderr, "ERROR: --harts cannot be combined with --timing, --cache, --predict, --debug or --gdb-*\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (options.debug && gdb)
+    {
+        fprintf(stderr, "ERROR: --debug cannot be combined with --gdb-*\n");
         exit(EXIT_FAILURE);
     }
 
-    FILE *f = fopen(argc[1], "r");
+    if (options.record && !options.debug && !gdb)
+    {
+        fprintf(stderr, "ERROR: --record needs --debug or --gdb-*\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Replay would count the simulated events again
+    if (options.record && (options.cache || options.predict))
+    {
+        fprintf(stderr, "ERROR: --record cannot be combined with --cache or --predict\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Coverage is collected by the plain run loop, which the simulators,
+    // timing model and debuggers replace with their own
+    if (options.coverage != NULL && (options.timing || options.cache || options.debug || gdb))
+    {
+        fprintf(stderr, "ERROR: --coverage cannot be combined with --timing, --cache, --debug or --gdb-*\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Lanes run in the engine's own loop, each on a VM with a single hart
+    if (options.lanes != NULL &&
+        (options.timing || options.cache || options.predict || options.coverage != NULL ||
+         options.debug || gdb || options.harts > 1 || options.console || options.disasm))
+    {
+        fprintf(stderr, "ERROR: --lanes cannot be combined with --timing, --cache, --predict, --coverage, "
+                        "--debug, --gdb-*, --harts, --console or --disasm\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Debuggers are interactive, and coverage is written to a file of its own
+    if (options.results != NULL && !options.no_results && (options.debug || gdb || options.coverage != NULL))
+    {
+        fprintf(stderr, "ERROR: --result-cache cannot be combined with --debug, --gdb-* or --coverage\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The debugger talks to the terminal on stdout
+    if (options.debug && !(options.sections & SECTION_OUTPUT))
+    {
+        fprintf(stderr, "ERROR: --debug needs the output section\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (options.expect != NULL)
+        start_expect(options.expect);
+
+    if (options.merge != NULL)
+    {
+        if (argv - optind < 1)
+        {
+            fprintf(stderr, "ERROR: --merge-coverage needs at least one coverage file\n");
+            exit(EXIT_FAILURE);
+        }
+
+        VM *vm = init_VM();
+        coverage_merge(vm, options.merge, &argc[optind], argv - optind);
+        free_VM(vm);
+        return finish_expect(EXIT_SUCCESS);
+    }
+
+    if (argv - optind != 1)
+    {
+        fprintf(stderr, "ERROR: Given %d arguments instead of 2\n", argv - optind + 1);
+        print_usage(argc[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    char *file = argc[optind];
+    FILE *f = fopen(file, "r");
     if (f == NULL)
     {
-        fprintf(stderr, "ERROR: Failed to open %s\n", argc[1]);
+        fprintf(stderr, "ERROR: Failed to open %s\n", file);
+        exit(EXIT_FAILURE);
+    }
+
+    int replayed;
+    if (options.results != NULL && !options.no_results && !options.disasm && start_results(file, &replayed))
+    {
+        fclose(f);
+        return finish_expect(replayed);
+    }
+
+    VM *vm = init_VM();
+    if (input != NULL)
+        vm_set_input(vm, input, input_len);
+    if (options.sandbox != NULL && vm_set_sandbox(vm, options.sandbox) != VM_OK)
+    {
+        fprintf(stderr, "ERROR: Failed to open sandbox %s\n", options.sandbox);
         exit(EXIT_FAILURE);
     }
+    if (options.console && vm_set_console(vm) != VM_OK)
+    {
+        fprintf(stderr, "ERROR: Failed to map the console\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (options.disasm)
+    {
+        if (is_elf(file))
+            elf_disassembler(vm, file);
+        else
+            disassembler(f, vm, file);
+        free_VM(vm);
+        fclose(f);
+        return finish_expect(EXIT_SUCCESS);
+    }
+
+    vm_set_harts(vm, options.harts, options.quantum);
+
+    // The simulators see the program as loaded, so they are attached first
+    if (options.cache)
+        vm_attach_cache(vm, options.cache_spec);
+    if (options.predict)
+        vm_attach_predictor(vm, options.predictor);
+    if (options.record)
+        vm_record(vm, options.record_spec);
+    if (options.coverage != NULL)
+        vm_attach_coverage(vm);
+    if (options.lanes != NULL)
+        init_lanes(options.lanes);
 
-    CPU *cpu = init_CPU();
+    parser(f, vm, file);
+    unmute_output();
+    if (options.sections & SECTION_REGISTERS)
+    {
+        if (lanes != NULL)
+            print_lane_registers();
+        else
+            print_registers(vm);
+    }
+    if (options.timing)
+        print_pipeline_stats(&pipeline_stats);
+    vm_print_stats(vm);
+    if (options.coverage != NULL)
+    {
+        if (vm_save_coverage(vm, options.coverage) != VM_OK)
+        {
+            fprintf(stderr, "ERROR: Failed to write %s\n", options.coverage);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (debugger != NULL)
+    {
+        free_DEBUGGER(debugger);
+        free_symbols(symbols);
+    }
 
-    parser(f, cpu, argc[1]);
-    print_registers(cpu);
+    int exit_code = lanes != NULL ? lane_exit_code() : vm_exit_code(vm);
+    finish_results(vm, exit_code);
+    if (lanes != NULL)
+        free_lanes();
 
-    free_CPU(cpu);
+    free_VM(vm);
+    free(input);
     fclose(f);
-    return EXIT_SUCCESS;
+    return finish_expect(exit_code);
 }
@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "symbols.h"
+
+#define BUFFER 4096
+
+static int compare_symbols(const void *a, const void *b)
+{
+    const SYMBOL *x = a;
+    const SYMBOL *y = b;
+    return x->index != y->index ? x->index - y->index : strcmp(x->name, y->name);
+}
+
+/**
+ * @brief Load the labels of a program from the sidecar file next to it, e.g.
+ * `prog.sym` for `prog.hex`. Each line is `ADDRESS NAME`, where ADDRESS is the
+ * byte address of the instruction in hex, as printed by `nm`.
+ *
+ * @param file Name of the program file
+ * @return SYMBOLS* Labels, empty if there is no sidecar file
+ */
+SYMBOLS *load_symbols(const char *file)
+{
+    SYMBOLS *symbols = calloc(1, sizeof(SYMBOLS));
+    char *path = malloc(strlen(file) + 5);
+    if (symbols == NULL || path == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Symbols\n");
+        exit(EXIT_FAILURE);
+    }
+
+    strcpy(path, file);
+    char *ext = strrchr(path, '.');
+    if (ext != NULL && strchr(ext, '/') == NULL)
+        *ext = '\0';
+    strcat(path, ".sym");
+
+    FILE *f = fopen(path, "r");
+    free(path);
+    if (f == NULL)
+        return symbols;
+
+    char line[BUFFER];
+    while (fgets(line, sizeof(line), f))
+    {
+        unsigned int addr;
+        char name[BUFFER];
+        if (sscanf(line, "%x %4095s", &addr, name) != 2)
+            continue;
+
+        symbol_add(symbols, name, addr / 4);
+    }
+
+    fclose(f);
+    symbols_sort(symbols);
+    return symbols;
+}
+
+/**
+ * @brief Add a label to a symbol table. Tables must be sorted with
+ * `symbols_sort` once every label is added.
+ *
+ * @param symbols Symbol table
+ * @param name Label, copied
+ * @param index Instruction index
+ */
+void symbol_add(SYMBOLS *symbols, const char *name, int index)
+{
+    if (symbols->n == symbols->capacity)
+    {
+        symbols->capacity = symbols->capacity > 0 ? symbols->capacity * 2 : 16;
+        symbols->syms = realloc(symbols->syms, symbols->capacity * sizeof(SYMBOL));
+        if (symbols->syms == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to allocate memory for Symbols\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    symbols->syms[symbols->n].name = strdup(name);
+    symbols->syms[symbols->n].index = index;
+    symbols->n++;
+}
+
+/**
+ * @brief Sort a symbol table by instruction index.
+ *
+ * @param symbols Symbol table
+ */
+void symbols_sort(SYMBOLS *symbols)
+{
+    qsort(symbols->syms, symbols->n, sizeof(SYMBOL), compare_symbols);
+}
+
+/**
+ * @brief Destroy a symbol table.
+ *
+ * @param symbols Symbol table to be destroyed
+ */
+void free_symbols(SYMBOLS *symbols)
+{
+    for (int i = 0; i < symbols->n; i++)
+        free(symbols->syms[i].name);
+    free(symbols->syms);
+    free(symbols);
+    symbols = NULL;
+}
+
+/**
+ * @brief Find the instruction a label names.
+ *
+ * @param symbols Symbol table
+ * @param name Label
+ * @param index Set to the instruction index if found
+ * @return true if the label exists
+ */
+bool symbol_lookup(SYMBOLS *symbols, const char *name, int *index)
+{
+    for (int i = 0; i < symbols->n; i++)
+    {
+        if (strcmp(symbols->syms[i].name, name) == 0)
+        {
+            *index = symbols->syms[i].index;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Find the first label on an instruction.
+ *
+ * @param symbols Symbol table
+ * @param index Instruction index
+ * @return const char* Label, or NULL if the instruction has none
+ */
+const char *symbol_at(SYMBOLS *symbols, int index)
+{
+    int lo = 0;
+    int hi = symbols->n;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (symbols->syms[mid].index < index)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo < symbols->n && symbols->syms[lo].index == index ? symbols->syms[lo].name : NULL;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "hardware.h"
+
+/**
+ * @struct SYMBOL
+ * @brief A label and the instruction it names.
+ */
+typedef struct SYMBOL
+{
+    char *name; // Label
+    int index;  // Instruction index
+} SYMBOL;
+
+/**
+ * @struct SYMBOLS
+ * @brief Labels of a program, sorted by instruction index.
+ */
+typedef struct SYMBOLS
+{
+    SYMBOL *syms; // Labels
+    int n;        // Number of labels
+    int capacity; // Allocated length of `syms`
+} SYMBOLS;
+
+SYMBOLS *load_symbols(const char *file);
+void free_symbols(SYMBOLS *symbols);
+void symbol_add(SYMBOLS *symbols, const char *name, int index);
+void symbols_sort(SYMBOLS *symbols);
+bool symbol_lookup(SYMBOLS *symbols, const char *name, int *index);
+const char *symbol_at(SYMBOLS *symbols, int index);
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm.h"
+
+/**
+ * Reads an integer, hands it to syscall 200, prints it plus one, stores that
+ * at `$gp` and exits.
+ */
+static const char PROGRAM[] =
+    "34020005\n" // ori  $v0, $0, 5
+    "0000000c\n" // syscall
+    "00404025\n" // or   $t0, $v0, $0
+    "340200c8\n" // ori  $v0, $0, 200
+    "01002025\n" // or   $a0, $t0, $0
+    "0000000c\n" // syscall
+    "21080001\n" // addi $t0, $t0, 1
+    "34020001\n" // ori  $v0, $0, 1
+    "01002025\n" // or   $a0, $t0, $0
+    "0000000c\n" // syscall
+    "af880000\n" // sw   $t0, 0($gp)
+    "3402000a\n" // ori  $v0, $0, 10
+    "0000000c\n"; // syscall
+
+/**
+ * @brief Host handler for syscall 200, which adds `$a0` to a total.
+ *
+ * @param vm VM
+ * @param ctx Total
+ */
+static void add(VM *vm, void *ctx)
+{
+    int32_t a0;
+    vm_get_reg(vm, 4, &a0);
+    *(int *)ctx += a0;
+}
+
+/**
+ * @brief Host handler for syscall 1 that prints `$a0` in brackets.
+ *
+ * @param vm VM
+ * @param ctx Unused
+ */
+static void print_bracketed(VM *vm, void *ctx)
+{
+    int32_t a0;
+    vm_get_reg(vm, 4, &a0);
+    printf("[%d]", a0);
+}
+
+/**
+ * @brief Run the VM to completion and print how it stopped.
+ *
+ * @param vm VM
+ * @param budget Instructions to run at most, or 0 for no limit
+ */
+static void run(VM *vm, uint64_t budget)
+{
+    uint64_t executed;
+    int status = vm_run(vm, budget, &executed);
+    fflush(stdout);
+    printf("\nrun: %s after %llu, pc %u\n", vm_strerror(status), (unsigned long long)executed,
+           vm_get_pc(vm));
+}
+
+int main(void)
+{
+    VM *vm = init_VM();
+    vm_set_output(vm, stdout);
+
+    int bad = -1;
+    int status = vm_load_hex(vm, PROGRAM, strlen(PROGRAM), &bad);
+    printf("load: %s\n", vm_strerror(status));
+
+    int total = 0;
+    status = vm_set_syscall(vm, 200, add, &total);
+    printf("hook: %s\n", vm_strerror(status));
+
+    vm_set_input(vm, "41\n", 3);
+    run(vm, 0);
+    printf("total %d, exit code %d\n", total, vm_exit_code(vm));
+
+    // A budgeted run stops partway and picks up where it left off
+    vm_reset(vm);
+    vm_set_input(vm, "9\n", 2);
+    run(vm, 3);
+    run(vm, 0);
+    int32_t gp;
+    uint32_t stored;
+    vm_get_reg(vm, 28, &gp);
+    vm_read_memory(vm, gp, &stored, sizeof(stored));
+    printf("total %d, stored %u\n", total, stored);
+
+    // Host handlers replace built-in syscalls until NULL restores them
+    vm_set_syscall(vm, 1, print_bracketed, NULL);
+    vm_reset(vm);
+    vm_set_input(vm, "1\n", 2);
+    run(vm, 0);
+    vm_set_syscall(vm, 1, NULL, NULL);
+    vm_reset(vm);
+    vm_set_input(vm, "2\n", 2);
+    run(vm, 0);
+
+    // Without a handler a code is unknown, and codes out of range are refused
+    vm_set_syscall(vm, 200, NULL, NULL);
+    vm_reset(vm);
+    vm_set_input(vm, "3\n", 2);
+    run(vm, 0);
+    printf("code %d: %s\n", VM_MAX_SYSCALL,
+           vm_strerror(vm_set_syscall(vm, VM_MAX_SYSCALL, add, &total)));
+    printf("code %d: %s\n", VM_MAX_SYSCALL + 1,
+           vm_strerror(vm_set_syscall(vm, VM_MAX_SYSCALL + 1, add, &total)));
+    printf("code %d: %s\n", -1, vm_strerror(vm_set_syscall(vm, -1, add, &total)));
+    printf("code %d: %s\n", 0x7fffffff, vm_strerror(vm_set_syscall(vm, 0x7fffffff, add, &total)));
+
+    // A reservation taken before a reset does not let `sc` succeed after it
+    uint32_t atomic[] = { 0xc0090000, 0xe0090000, 0x01202025, 0x34020001,
+                          0x0000000c, 0x3402000a, 0x0000000c };
+    vm_load(vm, atomic, 7, &bad);
+    run(vm, 1);
+    vm_reset(vm);
+    vm_set_pc(vm, 1);
+    run(vm, 0);
+
+    // Invalid instructions fail the load, or the run that reaches one
+    uint32_t words[] = { 0x0000000c, 0xffffffff };
+    status = vm_load(vm, words, 2, &bad);
+    printf("invalid load: %s at %d\n", vm_strerror(status), bad);
+
+    vm_reset(vm);
+    status = vm_load_elf(vm, "tests/elf.elf");
+    printf("elf: %s\n", vm_strerror(status));
+    vm_set_pc(vm, 0);
+    run(vm, 0);
+    uint32_t word;
+    vm_get_instruction(vm, vm_invalid_pc(vm), &word);
+    printf("invalid at %d of %d: 0x%08x\n", vm_invalid_pc(vm), vm_instruction_count(vm), word);
+    run(vm, 0);
+
+    vm_reset(vm);
+    vm_load_elf(vm, "tests/elf.elf");
+    run(vm, 0);
+    printf("invalid at %d\n", vm_invalid_pc(vm));
+
+    free_VM(vm);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,17 @@
+break loop
+continue
+print $t0
+step 2
+x 0x10010000
+
+delete 1
+watch 0x10010000
+continue
+watch $s1
+continue
+info
+delete
+break done
+continue
+registers
+continue
@@ -0,0 +1,3 @@
+watch 0x10010000
+continue
+continue
@@ -0,0 +1,15 @@
+break store
+continue
+continue
+x 0x10010000
+reverse-step 2
+x 0x10010000
+print $t0
+reverse-continue
+print $t0
+x 0x10010000
+reverse-continue
+info
+delete
+step 3
+continue
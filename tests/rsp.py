@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+"""Drive smips's gdb stub with a scripted remote serial protocol exchange.
+
+Usage: rsp.py SMIPS PROGRAM SCRIPT
+
+Starts SMIPS --gdb-socket on PROGRAM, sends each line of SCRIPT as a packet
+and prints it with the stub's reply, then the exit status and stdout of the
+run. `k` gets no reply, as in gdb.
+"""
+import os
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def checksum(data):
+    return "%02x" % (sum(data.encode()) & 0xFF)
+
+
+def read_packet(sock):
+    """Read one `$data#xx` packet, skipping acknowledgements before it."""
+    c = sock.recv(1)
+    while c != b"$":
+        if not c:
+            return None
+        c = sock.recv(1)
+
+    data = b""
+    while True:
+        c = sock.recv(1)
+        if not c:
+            return None
+        if c == b"#":
+            break
+        data += c
+
+    check = sock.recv(2).decode()
+    data = data.decode()
+    if check != checksum(data):
+        sys.exit("bad checksum on reply %r" % data)
+    sock.sendall(b"+")
+    return data
+
+
+def main():
+    smips, program, script = sys.argv[1:4]
+    with open(script) as f:
+        packets = [line.rstrip("\n") for line in f if line.strip()]
+
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, "gdb.sock")
+        run = subprocess.Popen([smips, "--gdb-socket", path, program],
+                               stdin=subprocess.DEVNULL, stdout=subprocess.PIPE,
+                               stderr=subprocess.DEVNULL)
+
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        for _ in range(500):
+            try:
+                sock.connect(path)
+                break
+            except OSError:
+                time.sleep(0.01)
+        else:
+            run.kill()
+            sys.exit("smips did not listen on " + path)
+        sock.settimeout(10)
+
+        for packet in packets:
+            print("$ " + packet)
+            sock.sendall(("$%s#%s" % (packet, checksum(packet))).encode())
+            if sock.recv(1) != b"+":
+                sys.exit("packet %r not acknowledged" % packet)
+            if packet == "k":
+                continue
+            reply = read_packet(sock)
+            if reply is None:
+                print("(hung up)")
+                break
+            print(reply)
+
+        sock.close()
+        out, _ = run.communicate(timeout=10)
+        print("exit status %d" % run.returncode)
+        sys.stdout.flush()
+        sys.stdout.buffer.write(out)
+
+
+if __name__ == "__main__":
+    main()
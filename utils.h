@@ -2,7 +2,8 @@
 
 #include <stdint.h>
 
-#define NUM_REGISTERS 60
+#define NUM_REGISTERS 34
+#define NUM_FP_REGISTERS 32
 
 /**
  * @def REGISTER_TABLE
@@ -48,34 +49,7 @@
     _X($30, $fa, "$30", "$fa")   \
     _X($31, $ra, "$31", "$ra")   \
     _X(LO, Lo, "Lo", "Lo")       \
-    _X(HI, Hi, "Hi", "Hi")       \
-    _X($34, $f0, "$34", "$f0")   \
-    _X($35, $f1, "$35", "$f1")   \
-    _X($36, $f2, "$36", "$f2")   \
-    _X($37, $f4, "$37", "$f4")   \
-    _X($38, $f5, "$38", "$f5")   \
-    _X($39, $f6, "$39", "$f6")   \
-    _X($40, $f7, "$40", "$f7")   \
-    _X($41, $f8, "$41", "$f8")   \
-    _X($42, $f9, "$42", "$f9")   \
-    _X($43, $f10, "$43", "$f10") \
-    _X($44, $f12, "$44", "$f12") \
-    _X($45, $f13, "$45", "$f13") \
-    _X($46, $f14, "$46", "$f14") \
-    _X($47, $f16, "$47", "$f16") \
-    _X($48, $f17, "$48", "$f17") \
-    _X($49, $f18, "$49", "$f18") \
-    _X($50, $f20, "$50", "$f20") \
-    _X($51, $f21, "$51", "$f21") \
-    _X($52, $f22, "$52", "$f22") \
-    _X($53, $f23, "$53", "$f23") \
-    _X($54, $f24, "$54", "$f24") \
-    _X($55, $f25, "$55", "$f25") \
-    _X($56, $f26, "$56", "$f26") \
-    _X($57, $f27, "$57", "$f27") \
-    _X($58, $f28, "$58", "$f28") \
-    _X($59, $f29, "$59", "$f29") \
-    _X($60, $f30, "$60", "$f30") \
+    _X(HI, Hi, "Hi", "Hi")
 
 /**
  * @def R_TYPE_TABLE
@@ -138,15 +112,21 @@
     _I(BNE, 0b000101, "bne", MIPS_bne)       \
     _I(LB, 0b100000, "lb", MIPS_lb)          \
     _I(LH, 0b100001, "lh", MIPS_lh)          \
+    _I(LL, 0b110000, "ll", MIPS_ll)          \
     _I(LUI, 0b001111, "lui", MIPS_lui)       \
     _I(LW, 0b100011, "lw", MIPS_lw)          \
     _I(ORI, 0b001101, "ori", MIPS_ori)       \
     _I(SB, 0b101000, "sb", MIPS_sb)          \
+    _I(SC, 0b111000, "sc", MIPS_sc)          \
     _I(SLTI, 0b001010, "slti", MIPS_slti)    \
     _I(SLTIU, 0b001011, "sltiu", MIPS_sltiu) \
     _I(SH, 0b101001, "sh", MIPS_sh)          \
     _I(SW, 0b101011, "sw", MIPS_sw)          \
-    _I(XORI, 0b001110, "xori", MIPS_xori)
+    _I(XORI, 0b001110, "xori", MIPS_xori)    \
+    _I(LWC1, 0b110001, "lwc1", MIPS_lwc1)    \
+    _I(LDC1, 0b110101, "ldc1", MIPS_ldc1)    \
+    _I(SWC1, 0b111001, "swc1", MIPS_swc1)    \
+    _I(SDC1, 0b111101, "sdc1", MIPS_sdc1)
 
 /**
  * @def J_TYPE_TABLE
@@ -176,13 +156,87 @@
     _P(MUL, 0b000010, "mul", MIPS_mul) \
     _P(SYSCALL, 0b001100, "syscall", MIPS_syscall)
 
-#define F_TYPE_TABLE                 \
-    _F(ADD_S, 0b000000, "add.s")     \
-    _F(CVT_S_W, 0b100000, "cvt.s.w") \
-    _F(CVT_W_S, 0b100100, "cvt.w.s") \
-    _F(DIV_S, 0b000011, "div.s")     \
-    _F(MFC1, 0b000000, "mfc1")       \
-    _F(MOVE_S, 0b000110, "move.s")
+/**
+ * @def F_TYPE_TABLE
+ * @brief X macro for CP1 (COP1) arithmetic instructions to store its enumerated
+ * name, funct code, name as string without the format suffix, function
+ * pointer. The format (`.s`, `.d`, `.w`) comes from the fmt field.
+ *
+ * @param NAME Name of instruction as enum
+ * @param FUNCT Funct value of instruction
+ * @param STR Name of instruction as string
+ * @param FUNC_PTR Function pointer to instruction
+ */
+#define F_TYPE_TABLE                          \
+    _F(ADD_F, 0b000000, "add", MIPS_add_f)    \
+    _F(SUB_F, 0b000001, "sub", MIPS_sub_f)    \
+    _F(MUL_F, 0b000010, "mul", MIPS_mul_f)    \
+    _F(DIV_F, 0b000011, "div", MIPS_div_f)    \
+    _F(SQRT_F, 0b000100, "sqrt", MIPS_sqrt_f) \
+    _F(ABS_F, 0b000101, "abs", MIPS_abs_f)    \
+    _F(MOV_F, 0b000110, "mov", MIPS_mov_f)    \
+    _F(NEG_F, 0b000111, "neg", MIPS_neg_f)    \
+    _F(CVT_S, 0b100000, "cvt.s", MIPS_cvt_s)  \
+    _F(CVT_D, 0b100001, "cvt.d", MIPS_cvt_d)  \
+    _F(CVT_W, 0b100100, "cvt.w", MIPS_cvt_w)  \
+    _F(C_EQ, 0b110010, "c.eq", MIPS_c_eq)     \
+    _F(C_LT, 0b111100, "c.lt", MIPS_c_lt)     \
+    _F(C_LE, 0b111110, "c.le", MIPS_c_le)
+
+/**
+ * @def FMT_TABLE
+ * @brief X macro for the COP1 fmt field (the rs position) to store its
+ * enumerated name, value and suffix or name as string. `MF`, `MT` and `BC`
+ * select `mfc1`, `mtc1` and `bc1f`/`bc1t` rather than a format.
+ *
+ * @param NAME Name of format as enum
+ * @param FMT Fmt value
+ * @param STR Suffix or name as string
+ */
+#define FMT_TABLE            \
+    _M(MF, 0b00000, "mfc1")  \
+    _M(MT, 0b00100, "mtc1")  \
+    _M(BC, 0b01000, "bc1")   \
+    _M(FMT_S, 0b10000, "s")  \
+    _M(FMT_D, 0b10001, "d")  \
+    _M(FMT_W, 0b10100, "w")
+
+/**
+ * @def SYSCALL_TABLE
+ * @brief X macro for built-in syscalls to store its enumerated name, `$v0`
+ * code and handler. Codes follow SPIM, with the file syscalls 13-16 taking
+ * MARS-style open flags. Codes 100-103 are smips extensions running `memcpy`
+ * (overlap-safe), `memset`, `memcmp` and `strlen` over guest memory on the
+ * host, and 110-111 start and wait for harts (see harts.h).
+ *
+ * @param NAME Name of syscall as enum
+ * @param CODE `$v0` value selecting it
+ * @param FUNC_PTR Handler
+ */
+#define SYSCALL_TABLE                             \
+    _S(SYS_PRINT_INT, 1, sys_print_int)           \
+    _S(SYS_PRINT_FLOAT, 2, sys_print_float)       \
+    _S(SYS_PRINT_DOUBLE, 3, sys_print_double)     \
+    _S(SYS_PRINT_STRING, 4, sys_print_string)     \
+    _S(SYS_READ_INT, 5, sys_read_int)             \
+    _S(SYS_READ_FLOAT, 6, sys_read_float)         \
+    _S(SYS_READ_DOUBLE, 7, sys_read_double)       \
+    _S(SYS_READ_STRING, 8, sys_read_string)       \
+    _S(SYS_SBRK, 9, sys_sbrk)                     \
+    _S(SYS_EXIT, 10, sys_exit)                    \
+    _S(SYS_PRINT_CHAR, 11, sys_print_char)        \
+    _S(SYS_READ_CHAR, 12, sys_read_char)          \
+    _S(SYS_OPEN, 13, sys_open)                    \
+    _S(SYS_READ, 14, sys_read)                    \
+    _S(SYS_WRITE, 15, sys_write)                  \
+    _S(SYS_CLOSE, 16, sys_close)                  \
+    _S(SYS_EXIT2, 17, sys_exit2)                  \
+    _S(SYS_MEMCPY, 100, sys_memcpy)               \
+    _S(SYS_MEMSET, 101, sys_memset)               \
+    _S(SYS_MEMCMP, 102, sys_memcmp)               \
+    _S(SYS_STRLEN, 103, sys_strlen)               \
+    _S(SYS_SPAWN, 110, sys_spawn)                 \
+    _S(SYS_JOIN, 111, sys_join)
 
 #define _X(REG_NUM, REG_NAME, NUM_STR, NAME_STR) REG_NUM,
 /**
@@ -251,3 +305,36 @@ typedef enum P_t
     P_TYPE_TABLE
 } P_t;
 #undef _P
+
+#define _F(NAME, FUNCT, STR, FUNC_PTR) NAME = FUNCT,
+/**
+ * @enum F_t
+ * @brief Enumerate `NAME` by its `FUNCT` value from `F_TYPE_TABLE`.
+ */
+typedef enum F_t
+{
+    F_TYPE_TABLE
+} F_t;
+#undef _F
+
+#define _M(NAME, FMT, STR) NAME = FMT,
+/**
+ * @enum fmt_t
+ * @brief Enumerate `NAME` by its `FMT` value from `FMT_TABLE`.
+ */
+typedef enum fmt_t
+{
+    FMT_TABLE
+} fmt_t;
+#undef _M
+
+#define _S(NAME, CODE, FUNC_PTR) NAME = CODE,
+/**
+ * @enum sys_t
+ * @brief Enumerate `NAME` by its `CODE` value from `SYSCALL_TABLE`.
+ */
+typedef enum sys_t
+{
+    SYSCALL_TABLE
+} sys_t;
+#undef _S
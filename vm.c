@@ -0,0 +1,635 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "console.h"
+#include "coverage.h"
+#include "cp0.h"
+#include "decode.h"
+#include "disasm.h"
+#include "functions.h"
+#include "hardware.h"
+#include "harts.h"
+#include "history.h"
+#include "io.h"
+#include "loader.h"
+#include "memory.h"
+#include "predictor.h"
+#include "vm.h"
+
+#define HEX_LINE 64
+
+static const char *STATUS_STR[] = {
+    [VM_OK] = "ok",
+    [VM_EXITED] = "program exited",
+    [VM_BUDGET] = "instruction budget ran out",
+};
+
+static const char *ERROR_STR[] = {
+    [-VM_ERR_INVALID] = "invalid instruction",
+    [-VM_ERR_TOO_LARGE] = "program too large",
+    [-VM_ERR_ARG] = "argument out of range",
+    [-VM_ERR_IO] = "host I/O failed",
+    [-VM_ERR_STATE] = "not possible in this state",
+    [-VM_ERR_FORMAT] = "not a supported executable",
+};
+
+/**
+ * @brief Create a VM with no program loaded, reading guest stdin from and
+ * writing guest stdout to the host's standard streams.
+ *
+ * @return VM*
+ */
+VM *init_VM(void)
+{
+    return init_CPU();
+}
+
+/**
+ * @brief Destroy a VM.
+ *
+ * @param vm VM to be destroyed
+ */
+void free_VM(VM *vm)
+{
+    free_CPU(vm);
+}
+
+/**
+ * @brief Load a program of encoded instructions, decode it and point the PC at
+ * its first instruction, at address 0. Guest memory and registers are left as
+ * they are.
+ *
+ * @param vm VM
+ * @param words Encoded MIPS instructions
+ * @param n Number of instructions
+ * @param bad Set to the index of the first invalid instruction, may be NULL
+ * @return int `VM_OK`, `VM_ERR_TOO_LARGE` or `VM_ERR_INVALID`
+ */
+int vm_load(VM *vm, const uint32_t *words, int n, int *bad)
+{
+    if (n < 0 || n > MAX_INSTR)
+        return VM_ERR_TOO_LARGE;
+
+    // Check the whole image before replacing the loaded program
+    for (int i = 0; i < n; i++)
+    {
+        DECODED d;
+        decode_instruction(vm, &d, words[i]);
+        if (d.format == FORMAT_INVALID)
+        {
+            if (bad != NULL)
+                *bad = i;
+            return VM_ERR_INVALID;
+        }
+    }
+
+    vm->text_base = 0;
+    load_program(vm, words, n, 0);
+    return VM_OK;
+}
+
+/**
+ * @brief Load a program from the text of a `.hex` file: one encoded
+ * instruction in hex per line.
+ *
+ * @param vm VM
+ * @param text Program text, not necessarily NUL-terminated
+ * @param len Length of the text
+ * @param bad Set to the line of the first invalid instruction, may be NULL
+ * @return int `VM_OK`, `VM_ERR_TOO_LARGE` or `VM_ERR_INVALID`
+ */
+int vm_load_hex(VM *vm, const char *text, size_t len, int *bad)
+{
+    // One instruction per line, the last perhaps without a newline
+    size_t lines = 0;
+    for (size_t pos = 0; pos < len; lines++)
+    {
+        const char *nl = memchr(text + pos, '\n', len - pos);
+        pos = nl != NULL ? (size_t)(nl - text) + 1 : len;
+    }
+    if (lines > MAX_INSTR)
+        return VM_ERR_TOO_LARGE;
+
+    uint32_t *words = malloc((lines > 0 ? lines : 1) * sizeof(uint32_t));
+    if (words == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate memory for Program\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int n = 0;
+    for (size_t pos = 0; pos < len; n++)
+    {
+        const char *nl = memchr(text + pos, '\n', len - pos);
+        size_t end = nl != NULL ? (size_t)(nl - text) : len;
+
+        char line[HEX_LINE];
+        size_t k = end - pos < sizeof(line) - 1 ? end - pos : sizeof(line) - 1;
+        memcpy(line, text + pos, k);
+        line[k] = '\0';
+
+        words[n] = strtol(line, NULL, 16);
+        pos = end + 1;
+    }
+
+    int status = vm_load(vm, words, n, bad);
+    free(words);
+    return status;
+}
+
+/**
+ * @brief Load an ELF32 little-endian MIPS executable. Its loadable segments
+ * are mapped into guest memory with copy-on-write, so only the pages the
+ * program touches are ever read from the file, and the segment holding the
+ * entry point becomes the text segment, decoded at its own address. Words in
+ * it that are not instructions, such as headers and read-only data, only fail
+ * if executed. The PC is pointed at the entry point, `$sp` at the top of the
+ * stack, `$gp` at `_gp` if the executable has it, and the program break past
+ * the highest segment. Resetting the VM clears the segments with the rest of
+ * guest memory, so load the executable again after `vm_reset`.
+ *
+ * @param vm VM
+ * @param file Name of the executable
+ * @return int `VM_OK`, `VM_ERR_IO`, `VM_ERR_FORMAT` or `VM_ERR_TOO_LARGE`
+ */
+int vm_load_elf(VM *vm, const char *file)
+{
+    ELF_IMAGE image;
+    int status = elf_open(&image, file);
+    if (status != VM_OK)
+        return status;
+
+    if (image.n > MAX_INSTR)
+    {
+        elf_close(&image);
+        return VM_ERR_TOO_LARGE;
+    }
+
+    elf_map(&image, vm->mem);
+    vm->text_base = image.text_base;
+    load_program(vm, image.text, image.n, text_index(vm, image.entry));
+
+    word_t gp;
+    if (elf_find_symbol(&image, "_gp", &gp))
+        vm->reg[$gp]->value.wd = gp;
+    vm->reg[$sp]->value.wd = STACK_TOP;
+
+    word_t brk = (image.end + PAGE_MASK) & ~PAGE_MASK;
+    if (brk > vm->mem->brk)
+        vm->mem->brk = brk;
+
+    elf_close(&image);
+    return VM_OK;
+}
+
+/**
+ * @brief Choose which fusions `vm_load` applies. Multiply/divide fusion is on
+ * by default and copy-loop fusion off. Neither is applied while caches, the
+ * branch predictor, history or coverage are attached.
+ *
+ * @param vm VM
+ * @param muldiv Fuse `mult`/`div` with the `mflo`/`mfhi` moves after them
+ * @param loops Fuse canonical `lb`/`sb` copy loops into bulk copies
+ */
+void vm_set_fusion(VM *vm, bool muldiv, bool loops)
+{
+    vm->fuse_muldiv = muldiv;
+    vm->fuse_loops = loops;
+}
+
+/**
+ * @brief Choose whether `vm_load` optimizes each basic block of the program
+ * with constant folding and propagation, strength reduction and dead-write
+ * elimination. Off by default, and not applied while caches, the branch
+ * predictor, history or coverage are attached. Registers are only guaranteed to hold
+ * the values the original program gives them when control leaves a block, so
+ * it is not meant for stepping through a program.
+ *
+ * @param vm VM
+ * @param optimize Optimize programs as they are loaded
+ */
+void vm_set_optimize(VM *vm, bool optimize)
+{
+    vm->optimize = optimize;
+}
+
+/**
+ * @brief Attach a cache simulator that every load and store goes through.
+ * Attach it before loading a program, which then leaves out fusion and
+ * optimization so that every access is seen. A malformed geometry is
+ * reported and exits, as it does on the command line.
+ *
+ * @param vm VM
+ * @param spec Cache geometry as for `--cache`, or NULL for the default
+ */
+void vm_attach_cache(VM *vm, const char *spec)
+{
+    if (vm->caches != NULL)
+        free_CACHE_SIM(vm->caches);
+    vm->caches = init_CACHE_SIM(spec);
+}
+
+/**
+ * @brief Attach a branch predictor that every branch is scored against.
+ * Attach it before loading a program, as for `vm_attach_cache`.
+ *
+ * @param vm VM
+ * @param spec Predictor kind as for `--predict`, or NULL for the default
+ */
+void vm_attach_predictor(VM *vm, const char *spec)
+{
+    if (vm->predictor != NULL)
+        free_PREDICTOR(vm->predictor);
+    vm->predictor = init_PREDICTOR(spec);
+}
+
+/**
+ * @brief Attach coverage, which marks the instructions executed and the
+ * directions each branch took. Attach it before loading a program, as for
+ * `vm_attach_cache`.
+ *
+ * @param vm VM
+ */
+void vm_attach_coverage(VM *vm)
+{
+    if (vm->coverage == NULL)
+        vm->coverage = init_COVERAGE();
+}
+
+/**
+ * @brief Start recording execution from the current state, so the debugger
+ * can run it backwards, dropping any history recorded so far. Load an
+ * executable before recording, since loading it maps new guest memory.
+ *
+ * @param vm VM
+ * @param spec Checkpoint interval and budget as for `--record`, or NULL for
+ * the default
+ */
+void vm_record(VM *vm, const char *spec)
+{
+    if (vm->history != NULL)
+        free_HISTORY(vm->history);
+    vm->history = init_HISTORY(vm, spec);
+}
+
+/**
+ * @brief Run the loaded program from the PC until it finishes or `budget`
+ * decoded records have executed. A run stopped by the budget continues where
+ * it left off when called again. Harts started by the program run alongside
+ * it, and are stopped when it finishes. An invalid instruction that the
+ * program does not take as a CP0 exception stops it with the PC on that
+ * instruction, and running on stops there again.
+ *
+ * @param vm VM
+ * @param budget Most records to execute, 0 for no limit
+ * @param executed Set to the number of records executed, may be NULL
+ * @return int `VM_EXITED`, `VM_BUDGET` or `VM_ERR_INVALID`
+ */
+int vm_run(VM *vm, uint64_t budget, uint64_t *executed)
+{
+    if (vm->harts != NULL)
+        return harts_run(vm->harts, budget, executed);
+    return hart_run(vm, budget, executed);
+}
+
+/**
+ * @brief Let the program start harts of its own with syscall 110 (see
+ * harts.h). Harts run on host threads, or in turns of `quantum` records on
+ * the thread calling `vm_run` so that every run is the same.
+ *
+ * @param vm VM
+ * @param max Most harts, the VM's own included; 1 turns harts off
+ * @param quantum Records per turn, or 0 for host threads
+ * @return int `VM_OK` or `VM_ERR_ARG`
+ */
+int vm_set_harts(VM *vm, int max, int quantum)
+{
+    if (max < 1 || max > MAX_HARTS || quantum < 0)
+        return VM_ERR_ARG;
+
+    if (vm->harts != NULL)
+        free_HARTS(vm->harts);
+    if (max > 1)
+        init_HARTS(vm, max, quantum);
+    return VM_OK;
+}
+
+/**
+ * @brief Put the VM back in the state a fresh one starts in, keeping the
+ * loaded program, syscall handlers and streams: registers, coprocessor and
+ * guest memory are cleared, an `ll` reservation is dropped, guest files
+ * closed and buffered input dropped, and a mapped console starts with empty
+ * rings. Cache and predictor statistics keep accumulating.
+ *
+ * @param vm VM
+ * @return int `VM_OK`, or `VM_ERR_STATE` while execution is recorded
+ */
+int vm_reset(VM *vm)
+{
+    // History holds write-protected pages of the memory being replaced
+    if (vm->history != NULL)
+        return VM_ERR_STATE;
+
+    if (vm->harts != NULL)
+        harts_reset(vm->harts);
+
+    for (int i = 0; i < NUM_REGISTERS; i++)
+        vm->reg[i]->value.wd = 0;
+    memset(vm->fpu, 0, sizeof(FPU));
+    cp0_reset(vm->cp0);
+
+    free_MEMORY(vm->mem);
+    vm->mem = init_MEMORY();
+
+    vm->pc = 0;
+    vm->invalid_at = -1;
+    vm->ll_valid = false;
+    vm->ll_addr = 0;
+    vm->ll_value = 0;
+    vm->exit_code = EXIT_SUCCESS;
+    io_reset(vm->io);
+    if (vm->io->console.attached)
+        console_attach(vm->mem, vm->io);
+    return VM_OK;
+}
+
+/**
+ * @brief Read a register.
+ *
+ * @param vm VM
+ * @param reg $0 - $31, `VM_REG_LO` or `VM_REG_HI`
+ * @param value Set to the value of the register
+ * @return int `VM_OK` or `VM_ERR_ARG`
+ */
+int vm_get_reg(VM *vm, int reg, int32_t *value)
+{
+    if (reg < 0 || reg >= NUM_REGISTERS)
+        return VM_ERR_ARG;
+
+    *value = vm->reg[reg]->value.wd;
+    return VM_OK;
+}
+
+/**
+ * @brief Write a register. Writes to $0 are ignored.
+ *
+ * @param vm VM
+ * @param reg $0 - $31, `VM_REG_LO` or `VM_REG_HI`
+ * @param value New value of the register
+ * @return int `VM_OK` or `VM_ERR_ARG`
+ */
+int vm_set_reg(VM *vm, int reg, int32_t value)
+{
+    if (reg < 0 || reg >= NUM_REGISTERS)
+        return VM_ERR_ARG;
+
+    if (reg != $zero)
+        vm->reg[reg]->value.wd = value;
+    return VM_OK;
+}
+
+/**
+ * @brief Get the PC, as the index of the next instruction to execute.
+ *
+ * @param vm VM
+ * @return uint32_t
+ */
+uint32_t vm_get_pc(VM *vm)
+{
+    return vm->pc;
+}
+
+/**
+ * @brief Get the number of instructions in the loaded program.
+ *
+ * @param vm VM
+ * @return int
+ */
+int vm_instruction_count(VM *vm)
+{
+    return vm->n_instr;
+}
+
+/**
+ * @brief Read the encoding of an instruction of the loaded program.
+ *
+ * @param vm VM
+ * @param pc Instruction index
+ * @param word Set to the encoded instruction
+ * @return int `VM_OK` or `VM_ERR_ARG`
+ */
+int vm_get_instruction(VM *vm, uint32_t pc, uint32_t *word)
+{
+    if (pc >= (uint32_t)vm->n_instr)
+        return VM_ERR_ARG;
+
+    *word = vm->text[pc];
+    return VM_OK;
+}
+
+/**
+ * @brief Get the invalid instruction the last run stopped at, which is where
+ * the PC is left.
+ *
+ * @param vm VM
+ * @return int Its index, or -1 if the run did not stop at one
+ */
+int vm_invalid_pc(VM *vm)
+{
+    return vm->invalid_at;
+}
+
+/**
+ * @brief Set the PC to an instruction index. The loaded program's length means
+ * it has finished.
+ *
+ * @param vm VM
+ * @param pc Index of the next instruction to execute
+ * @return int `VM_OK` or `VM_ERR_ARG`
+ */
+int vm_set_pc(VM *vm, uint32_t pc)
+{
+    if (pc > (uint32_t)vm->n_instr)
+        return VM_ERR_ARG;
+
+    vm->pc = pc;
+    return VM_OK;
+}
+
+/**
+ * @brief Copy guest memory out. Unmapped memory reads as zero.
+ *
+ * @param vm VM
+ * @param addr Guest address
+ * @param dst Host buffer
+ * @param n Number of bytes
+ */
+void vm_read_memory(VM *vm, uint32_t addr, void *dst, size_t n)
+{
+    mem_read(vm->mem, addr, dst, n);
+}
+
+/**
+ * @brief Copy into guest memory.
+ *
+ * @param vm VM
+ * @param addr Guest address
+ * @param src Host buffer
+ * @param n Number of bytes
+ */
+void vm_write_memory(VM *vm, uint32_t addr, const void *src, size_t n)
+{
+    mem_write(vm->mem, addr, src, n);
+}
+
+/**
+ * @brief Install a host handler for a syscall code in the VM's syscall table,
+ * replacing the built-in syscall or an earlier handler for it.
+ *
+ * @param vm VM
+ * @param code `$v0` value to handle, from 0 to `VM_MAX_SYSCALL`
+ * @param handler Host handler, or NULL to restore the built-in syscall
+ * @param ctx Passed to `handler`
+ * @return int `VM_OK`, or `VM_ERR_ARG` for a code out of range
+ */
+int vm_set_syscall(VM *vm, int code, vm_syscall_t handler, void *ctx)
+{
+    if (code < 0 || code > VM_MAX_SYSCALL)
+        return VM_ERR_ARG;
+
+    syscall_install(vm->syscalls, code, handler, ctx);
+    return VM_OK;
+}
+
+/**
+ * @brief Serve guest stdin from memory, or from the host's stdin again when
+ * `data` is NULL. The data is not copied and must outlive the runs reading it.
+ *
+ * @param vm VM
+ * @param data Input
+ * @param len Length of the input
+ */
+void vm_set_input(VM *vm, const char *data, size_t len)
+{
+    io_set_input(vm->io, data, len);
+}
+
+/**
+ * @brief Send guest stdout to a stream.
+ *
+ * @param vm VM
+ * @param out Stream for guest stdout
+ */
+void vm_set_output(VM *vm, FILE *out)
+{
+    vm->io->out = out;
+}
+
+/**
+ * @brief Confine guest file syscalls to a directory.
+ *
+ * @param vm VM
+ * @param dir Sandbox directory
+ * @return int `VM_OK` or `VM_ERR_IO`
+ */
+int vm_set_sandbox(VM *vm, const char *dir)
+{
+    return io_set_sandbox(vm->io, dir) < 0 ? VM_ERR_IO : VM_OK;
+}
+
+/**
+ * @brief Map the console device at `CONSOLE_BASE`, on the VM's guest stdin
+ * and stdout. It stays mapped across `vm_reset`.
+ *
+ * @param vm VM
+ * @return int `VM_OK`, or `VM_ERR_ARG` if guest memory already uses its pages
+ */
+int vm_set_console(VM *vm)
+{
+    if (vm->io->console.attached)
+        return VM_OK;
+    return console_attach(vm->mem, vm->io) ? VM_OK : VM_ERR_ARG;
+}
+
+/**
+ * @brief Get the exit status the program passed to `exit2`, or 0.
+ *
+ * @param vm VM
+ * @return int
+ */
+int vm_exit_code(VM *vm)
+{
+    return vm->exit_code;
+}
+
+/**
+ * @brief Check whether the program has tried to open a guest file since it
+ * was loaded or the VM was reset, so its runs depend on more than its input.
+ *
+ * @param vm VM
+ * @return bool
+ */
+bool vm_opened_files(VM *vm)
+{
+    return vm->io->opened_files;
+}
+
+/**
+ * @brief List the loaded program as decoded, one instruction per line.
+ *
+ * @param vm VM
+ * @param out Stream for the listing
+ */
+void vm_disassemble(VM *vm, FILE *out)
+{
+    disasm_program(out, vm->program, 0, vm->n_instr, NULL);
+}
+
+/**
+ * @brief Print the statistics of the attached cache simulator, branch
+ * predictor and coverage.
+ *
+ * @param vm VM
+ */
+void vm_print_stats(VM *vm)
+{
+    if (vm->caches != NULL)
+        print_cache_stats(vm->caches);
+    if (vm->predictor != NULL)
+        print_predictor_stats(vm->predictor);
+    if (vm->coverage != NULL)
+        print_coverage_stats(vm->coverage, vm);
+}
+
+/**
+ * @brief Write the attached coverage to a file, with the loaded program.
+ *
+ * @param vm VM
+ * @param file Name of the file, replaced if it exists
+ * @return int `VM_OK`, `VM_ERR_STATE` without coverage attached, or
+ * `VM_ERR_IO`
+ */
+int vm_save_coverage(VM *vm, const char *file)
+{
+    if (vm->coverage == NULL)
+        return VM_ERR_STATE;
+    return coverage_save(vm->coverage, vm, file) ? VM_OK : VM_ERR_IO;
+}
+
+/**
+ * @brief Describe a status code.
+ *
+ * @param status Status returned by a `vm_*` call
+ * @return const char*
+ */
+const char *vm_strerror(int status)
+{
+    if (status >= 0 && status <= VM_BUDGET)
+        return STATUS_STR[status];
+    if (status < 0 && -status <= -VM_ERR_FORMAT)
+        return ERROR_STR[-status];
+    return "unknown status";
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * libsmips: an emulator that can be embedded in a host program. A VM holds
+ * one loaded program and its guest state, and can be reset and run again, so
+ * one process can run many guest programs. Calls report failures with
+ * negative `vm_status_t` codes rather than exiting.
+ */
+typedef struct CPU VM;
+
+/**
+ * Host handler for a syscall code. It reads its arguments and writes its
+ * results through `vm_get_reg` and `vm_set_reg`.
+ */
+typedef void (*vm_syscall_t)(VM *vm, void *ctx);
+
+/**
+ * Register numbers for `vm_get_reg` and `vm_set_reg` after $0 - $31.
+ */
+#define VM_REG_LO 32
+#define VM_REG_HI 33
+
+/**
+ * Highest syscall code `vm_set_syscall` installs a handler for. The syscall
+ * table grows to reach the highest code installed.
+ */
+#define VM_MAX_SYSCALL 4096
+
+/**
+ * @enum vm_status_t
+ * @brief Result of a call: 0 or a positive reason a run stopped on success,
+ * negative on failure.
+ */
+typedef enum vm_status_t
+{
+    VM_OK = 0,              // Succeeded
+    VM_EXITED = 1,          // The program finished
+    VM_BUDGET = 2,          // The instruction budget ran out
+    VM_ERR_INVALID = -1,    // An invalid instruction was loaded or reached
+    VM_ERR_TOO_LARGE = -2,  // The image does not fit the text segment
+    VM_ERR_ARG = -3,        // A register, address or argument is out of range
+    VM_ERR_IO = -4,         // A host file or directory could not be opened
+    VM_ERR_STATE = -5,      // Not possible while recording, or with nothing attached
+    VM_ERR_FORMAT = -6,     // The file is not a supported executable
+} vm_status_t;
+
+VM *init_VM(void);
+void free_VM(VM *vm);
+int vm_load(VM *vm, const uint32_t *words, int n, int *bad);
+int vm_load_hex(VM *vm, const char *text, size_t len, int *bad);
+int vm_load_elf(VM *vm, const char *file);
+void vm_set_fusion(VM *vm, bool muldiv, bool loops);
+void vm_set_optimize(VM *vm, bool optimize);
+void vm_attach_cache(VM *vm, const char *spec);
+void vm_attach_predictor(VM *vm, const char *spec);
+void vm_attach_coverage(VM *vm);
+void vm_record(VM *vm, const char *spec);
+int vm_run(VM *vm, uint64_t budget, uint64_t *executed);
+int vm_set_harts(VM *vm, int max, int quantum);
+int vm_reset(VM *vm);
+int vm_get_reg(VM *vm, int reg, int32_t *value);
+int vm_set_reg(VM *vm, int reg, int32_t value);
+int vm_instruction_count(VM *vm);
+int vm_get_instruction(VM *vm, uint32_t pc, uint32_t *word);
+int vm_invalid_pc(VM *vm);
+uint32_t vm_get_pc(VM *vm);
+int vm_set_pc(VM *vm, uint32_t pc);
+void vm_read_memory(VM *vm, uint32_t addr, void *dst, size_t n);
+void vm_write_memory(VM *vm, uint32_t addr, const void *src, size_t n);
+int vm_set_syscall(VM *vm, int code, vm_syscall_t handler, void *ctx);
+void vm_set_input(VM *vm, const char *data, size_t len);
+void vm_set_output(VM *vm, FILE *out);
+int vm_set_sandbox(VM *vm, const char *dir);
+int vm_set_console(VM *vm);
+int vm_exit_code(VM *vm);
+bool vm_opened_files(VM *vm);
+void vm_disassemble(VM *vm, FILE *out);
+void vm_print_stats(VM *vm);
+int vm_save_coverage(VM *vm, const char *file);
+const char *vm_strerror(int status);